@@ -0,0 +1,270 @@
+/**
+ * accum.c: Lazy-carry accumulator for long sums and dot products
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "accum.h"
+#include "limb.h"
+#include "math.h"
+#include "rng.h"
+
+// Terms between folds; a carry word counts at most one carry per term
+static const size_t ACCUM_MAX_PENDING = ~(uword_t)0 - 1;
+
+// Return an empty accumulator with room for terms of words words
+accum_t accum_new(size_t words)
+{
+    accum_t acc = { .size = words + 1, .capacity = words + 1 };
+    for (int s = 0; s < 2; s++) {
+        acc.val[s] = calloc(acc.capacity, sizeof(uword_t));
+        acc.carry[s] = calloc(acc.capacity, sizeof(uword_t));
+    }
+    return acc;
+}
+
+// Free accumulator
+void accum_delete(accum_t *acc)
+{
+    for (int s = 0; s < 2; s++) {
+        free(acc->val[s]);
+        free(acc->carry[s]);
+        acc->val[s] = acc->carry[s] = NULL;
+    }
+    free(acc->scratch);
+    acc->scratch = NULL;
+    acc->size = acc->capacity = acc->pending = acc->scratch_size = 0;
+}
+
+// Reset the value to zero, keeping the storage
+void accum_clear(accum_t *acc)
+{
+    for (int s = 0; s < 2; s++) {
+        memset(acc->val[s], 0, acc->size * sizeof(uword_t));
+        memset(acc->carry[s], 0, acc->size * sizeof(uword_t));
+    }
+    acc->pending = 0;
+}
+
+// Grow the rows to size words, clearing the new ones
+static void accum_grow(accum_t *acc, size_t size)
+{
+    if (size <= acc->size)
+        return;
+    if (size > acc->capacity) {
+        acc->capacity = smax(size, 2 * acc->capacity);
+        for (int s = 0; s < 2; s++) {
+            acc->val[s] = realloc(acc->val[s], acc->capacity * sizeof(uword_t));
+            acc->carry[s] = realloc(acc->carry[s], acc->capacity * sizeof(uword_t));
+        }
+    }
+    for (int s = 0; s < 2; s++) {
+        memset(acc->val[s] + acc->size, 0, (size - acc->size) * sizeof(uword_t));
+        memset(acc->carry[s] + acc->size, 0, (size - acc->size) * sizeof(uword_t));
+    }
+    acc->size = size;
+}
+
+// Return scratch space of at least words words
+static uword_t *accum_scratch(accum_t *acc, size_t words)
+{
+    if (words > acc->scratch_size) {
+        acc->scratch_size = smax(words, 2 * acc->scratch_size);
+        acc->scratch = realloc(acc->scratch, acc->scratch_size * sizeof(uword_t));
+    }
+    return acc->scratch;
+}
+
+// Fold the carries into the sum words and cancel the two sides, leaving
+// the top word clear. Each side is below 2^(WORD_BITS * size) because its
+// top word was clear at the last fold and fewer than 2^WORD_BITS terms of
+// at most size - 1 words came in since, so the folds cannot carry out.
+static void accum_fold(accum_t *acc)
+{
+    const size_t n = acc->size;
+    for (int s = 0; s < 2; s++) {
+        limb_add_n(acc->val[s], acc->val[s], acc->carry[s], n);
+        memset(acc->carry[s], 0, n * sizeof(uword_t));
+    }
+
+    int big = limb_cmp(acc->val[0], acc->val[1], n) < 0;
+    limb_sub_n(acc->val[big], acc->val[big], acc->val[!big], n);
+    memset(acc->val[!big], 0, n * sizeof(uword_t));
+    if (acc->val[big][n - 1])
+        accum_grow(acc, n + 1);
+    acc->pending = 0;
+}
+
+// Add the n words of t to side s, leaving each word's carry-out in the
+// carry row instead of propagating it
+static void accum_absorb(accum_t *acc, int s, const uword_t *t, size_t n)
+{
+    if (n == 0)
+        return;
+    if (acc->pending == ACCUM_MAX_PENDING)
+        accum_fold(acc);
+    accum_grow(acc, n + 1);
+
+    uword_t *restrict v = acc->val[s];
+    uword_t *restrict c = acc->carry[s] + 1;
+    for (size_t i = 0; i < n; i++) {
+        uword_t x = v[i] + t[i];
+        c[i] += x < t[i];
+        v[i] = x;
+    }
+    acc->pending++;
+}
+
+// Return the magnitude of a, negated into buf (a.size words) if a is
+// negative, and set *n to its length without leading zero words
+static const uword_t *accum_abs(bigint_t a, uword_t *buf, size_t *n)
+{
+    const uword_t *mag = a.val;
+    if (is_neg(a)) {
+        for (size_t i = 0; i < a.size; i++)
+            buf[i] = ~a.val[i];
+        limb_add_1(buf, buf, a.size, 1);
+        mag = buf;
+    }
+    *n = limb_normalize(mag, a.size);
+    return mag;
+}
+
+// acc += a
+void accum_add(accum_t *acc, bigint_t a)
+{
+    size_t n;
+    const uword_t *mag = accum_abs(a, accum_scratch(acc, a.size), &n);
+    accum_absorb(acc, is_neg(a), mag, n);
+}
+
+// acc -= a
+void accum_sub(accum_t *acc, bigint_t a)
+{
+    size_t n;
+    const uword_t *mag = accum_abs(a, accum_scratch(acc, a.size), &n);
+    accum_absorb(acc, !is_neg(a), mag, n);
+}
+
+// acc += a * b
+void accum_mac(accum_t *acc, bigint_t a, bigint_t b)
+{
+    // Scratch holds |a|, |b| and their product
+    uword_t *buf = accum_scratch(acc, 2 * (a.size + b.size));
+    size_t an, bn;
+    const uword_t *ma = accum_abs(a, buf, &an);
+    const uword_t *mb = accum_abs(b, buf + a.size, &bn);
+    if (an == 0 || bn == 0)
+        return;
+
+    uword_t *prod = buf + a.size + b.size;
+    if (an >= bn)
+        limb_mul(prod, ma, an, mb, bn);
+    else
+        limb_mul(prod, mb, bn, ma, an);
+    accum_absorb(acc, is_neg(a) != is_neg(b), prod, limb_normalize(prod, an + bn));
+}
+
+// Return the value of acc
+bigint_t accum_value(accum_t *acc)
+{
+    accum_fold(acc);
+    if (limb_is_zero(acc->val[1], acc->size))
+        return bigint_from_limbs(acc->val[0], acc->size);
+
+    bigint_t mag = bigint_from_limbs(acc->val[1], acc->size);
+    bigint_t out = bigint_neg(mag);
+    bigint_delete(&mag);
+    return out;
+}
+
+// Return a random integer of up to bits bits with a random sign
+static bigint_t accum_test_term(size_t bits)
+{
+    bigint_t t = bigint_random_bits(bits);
+    uword_t coin;
+    rng_words(&coin, 1);
+    if (coin & 1) {
+        bigint_t neg = bigint_neg(t);
+        bigint_delete(&t);
+        return neg;
+    }
+    return t;
+}
+
+// Testing
+int accum_test(void)
+{
+    int total_errors = 0;
+
+    // Mixed-width signed sums, differences and products against bigint_sum,
+    // also reading the value midway and growing from an empty accumulator
+    static const size_t widths[] = { 1, 64, 200, 1000, 4096 };
+    int errors = 0;
+    accum_t acc = accum_new(0);
+    bigint_t expect = long_to_bigint(0);
+    for (int i = 0; i < 600; i++) {
+        bigint_t a = accum_test_term(widths[i % 5]);
+        bigint_t b = accum_test_term(widths[(i * 7 / 3) % 5]);
+        bigint_t next, prod;
+        switch (i % 3) {
+        case 0:
+            accum_add(&acc, a);
+            next = bigint_sum(expect, a);
+            break;
+        case 1:
+            accum_sub(&acc, a);
+            next = bigint_diff(expect, a);
+            break;
+        default:
+            accum_mac(&acc, a, b);
+            prod = bigint_prod(a, b);
+            next = bigint_sum(expect, prod);
+            bigint_delete(&prod);
+            break;
+        }
+        bigint_delete(&expect);
+        expect = next;
+        bigint_delete(&a);
+        bigint_delete(&b);
+
+        if (i % 97 == 0 || i == 599) {
+            bigint_t got = accum_value(&acc);
+            errors += !bigint_equals(got, expect);
+            bigint_delete(&got);
+        }
+    }
+    bool test = errors == 0;
+    printf("%s: accum add, sub and mac match bigint_sum over 600 terms\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+    bigint_delete(&expect);
+
+    // Carries out of every word: 1000 * (2^256 - 1), then back to zero
+    accum_clear(&acc);
+    bigint_t ones = bigint_zero(5);
+    memset(ones.val, 0xff, 4 * sizeof(uword_t));
+    for (int i = 0; i < 1000; i++)
+        accum_add(&acc, ones);
+    bigint_t k = long_to_bigint(1000);
+    expect = bigint_prod(ones, k);
+    bigint_t got = accum_value(&acc);
+    test = bigint_equals(got, expect);
+    bigint_delete(&got);
+    bigint_t minus_k = bigint_neg(k);
+    accum_mac(&acc, ones, minus_k);
+    got = accum_value(&acc);
+    test &= is_zero(got);
+    printf("%s: accum carries 1000 * (2^256 - 1) and cancels it\n", test ? "TRUE" : "FALSE");
+    total_errors += !test;
+    bigint_delete(&got);
+    bigint_delete(&expect);
+    bigint_delete(&ones);
+    bigint_delete(&k);
+    bigint_delete(&minus_k);
+    accum_delete(&acc);
+
+    return total_errors;
+}
@@ -0,0 +1,52 @@
+/**
+ * accum.h: Lazy-carry accumulator for long sums and dot products
+ *
+ * Positive and negative terms are kept apart, each in carry-save form: a
+ * row of sum words plus a row of carries into each word. Adding a term
+ * touches only its own words and records each word's carry-out beside the
+ * next one instead of rippling it through the whole number, so the words
+ * are independent and the loop vectorizes. Carries are folded in, and the
+ * two sides cancelled, only when the value is read. Storage grows in place
+ * to fit the widest term.
+ */
+
+#ifndef ACCUM_H
+#define ACCUM_H
+
+#include "bigint.h"
+
+typedef struct {
+    size_t size;        // Words per row, one more than the widest term
+    size_t capacity;    // Words allocated per row
+    size_t pending;     // Terms added since carries were last folded in
+    uword_t *val[2];    // Sum words of the positive [0] and negative [1] terms
+    uword_t *carry[2];  // carry[s][i]: carries into word i of val[s]
+    uword_t *scratch;   // Magnitudes and products of incoming terms
+    size_t scratch_size;
+} accum_t;
+
+// Return an empty accumulator with room for terms of words words
+accum_t accum_new(size_t words);
+
+// Free accumulator
+void accum_delete(accum_t *acc);
+
+// Reset the value to zero, keeping the storage
+void accum_clear(accum_t *acc);
+
+// acc += a
+void accum_add(accum_t *acc, bigint_t a);
+
+// acc -= a
+void accum_sub(accum_t *acc, bigint_t a);
+
+// acc += a * b
+void accum_mac(accum_t *acc, bigint_t a, bigint_t b);
+
+// Return the value of acc
+bigint_t accum_value(accum_t *acc);
+
+// Testing methods
+int accum_test(void);
+
+#endif // ACCUM_H
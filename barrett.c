@@ -0,0 +1,117 @@
+/**
+ * barrett.c: Barrett reduction
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "barrett.h"
+#include "limb.h"
+#include "math.h"
+
+// Return Barrett context for positive modulus n
+barrett_ctx_t barrett_new(bigint_t n)
+{
+    // A shared n is referenced rather than copied
+    size_t k = limb_normalize(n.val, n.size);
+    bigint_t modulus = bigint_share(bigint_copy(n));
+    barrett_ctx_t ctx = {
+        .size = k,
+        .modulus = modulus,
+        .n = modulus.val,
+        .mu = malloc((k + 1) * sizeof(uword_t)),
+    };
+
+    uword_t *pow = calloc(2 * k + 1, sizeof(uword_t));
+    uword_t *q = malloc((k + 2) * sizeof(uword_t));
+    pow[2 * k] = 1;
+    limb_divrem(q, NULL, pow, 2 * k + 1, ctx.n, k);
+
+    // Only n = 2^(WORD_BITS * (k - 1)) gives mu = 2^(WORD_BITS * (k + 1)); the
+    // estimate one below it costs at most one more subtraction
+    if (q[k + 1])
+        memset(ctx.mu, 0xff, (k + 1) * sizeof(uword_t));
+    else
+        memcpy(ctx.mu, q, (k + 1) * sizeof(uword_t));
+    free(pow);
+    free(q);
+
+    return ctx;
+}
+
+// Free Barrett context
+void barrett_delete(barrett_ctx_t *ctx)
+{
+    bigint_delete(&ctx->modulus);
+    ctx->n = NULL;
+    free(ctx->mu);
+    ctx->size = 0;
+}
+
+// out = a mod n for a of an <= 2 * size words (out has size words)
+// This is algorithm 14.42 of the Handbook of Applied Cryptography
+void barrett_reduce(const barrett_ctx_t *ctx, uword_t *out, const uword_t *a, size_t an)
+{
+    const size_t k = ctx->size;
+    uword_t x[2 * k];
+    memset(x, 0, sizeof(x));
+    memcpy(x, a, an * sizeof(uword_t));
+
+    // q = floor(floor(x / b^(k-1)) * mu / b^(k+1)) is at most 2 below x / n
+    uword_t q2[2 * k + 2];
+    limb_mul(q2, x + k - 1, k + 1, ctx->mu, k + 1);
+    const uword_t *q = q2 + k + 1;
+
+    // r = x - q n, computed mod b^(k+1) where it is known to fit
+    uword_t qn[2 * k + 1];
+    uword_t r[k + 1];
+    limb_mul(qn, q, k + 1, ctx->n, k);
+    limb_sub_n(r, x, qn, k + 1);
+
+    while (r[k] || limb_cmp(r, ctx->n, k) >= 0)
+        r[k] -= limb_sub_n(r, r, ctx->n, k);
+    memcpy(out, r, k * sizeof(uword_t));
+}
+
+// Testing
+int barrett_test(void)
+{
+    int errors = 0;
+    static const size_t bits[] = { 5, 64, 65, 200, 1024, 3000 };
+    for (size_t b = 0; b < sizeof(bits) / sizeof(bits[0]); b++) {
+        for (int iter = 0; iter < 10; iter++) {
+            bigint_t n = bigint_random_bits(bits[b]);
+            if (iter == 0) {
+                // Powers of the word base are the edge case for mu
+                bigint_delete(&n);
+                n = bigint_zero(bits[b] / WORD_BITS + 2);
+                n.val[bits[b] / WORD_BITS] = 1;
+            }
+            if (is_zero(n))
+                n.val[0] = 1;
+            n.val[0] |= iter == 1;
+
+            barrett_ctx_t ctx = barrett_new(n);
+            bigint_t a = bigint_random_bits(2 * ctx.size * WORD_BITS - (iter % 3));
+            bigint_t expect, rem;
+            expect = bigint_div(a, n, &rem);
+            bigint_delete(&expect);
+
+            uword_t out[ctx.size];
+            barrett_reduce(&ctx, out, a.val, smin(a.size, 2 * ctx.size));
+            bigint_t got = bigint_from_limbs(out, ctx.size);
+            errors += !bigint_equals(got, rem);
+
+            bigint_delete(&got);
+            bigint_delete(&rem);
+            bigint_delete(&a);
+            bigint_delete(&n);
+            barrett_delete(&ctx);
+        }
+    }
+
+    bool test = errors == 0;
+    printf("%s: barrett_reduce matches bigint_div remainders\n", test ? "TRUE" : "FALSE");
+    return !test;
+}
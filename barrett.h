@@ -0,0 +1,33 @@
+/**
+ * barrett.h: Barrett reduction
+ *
+ * For a modulus of k words, mu = floor(2^(2 * WORD_BITS * k) / n) turns
+ * reduction of anything below 2^(2 * WORD_BITS * k) into two products and
+ * at most two subtractions. Unlike Montgomery form it works for even moduli.
+ */
+
+#ifndef BARRETT_H
+#define BARRETT_H
+
+#include "bigint.h"
+
+typedef struct {
+    size_t size;        // Number of words in the modulus
+    bigint_t modulus;   // Shared copy of the modulus, which n points into
+    uword_t *n;         // Modulus
+    uword_t *mu;        // floor(2^(2 * WORD_BITS * size) / n), size + 1 words
+} barrett_ctx_t;
+
+// Return Barrett context for positive modulus n
+barrett_ctx_t barrett_new(bigint_t n);
+
+// Free Barrett context
+void barrett_delete(barrett_ctx_t *ctx);
+
+// out = a mod n for a of an <= 2 * size words (out has size words)
+void barrett_reduce(const barrett_ctx_t *ctx, uword_t *out, const uword_t *a, size_t an);
+
+// Testing methods
+int barrett_test(void);
+
+#endif // BARRETT_H
@@ -0,0 +1,351 @@
+/**
+ * batch.c: Batched modular arithmetic on a thread pool
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "ifma.h"
+#include "limb.h"
+#include "math.h"
+#include "mod_math.h"
+#include "mont.h"
+#include "rng.h"
+
+// Jobs sharing one modulus
+typedef struct {
+    bigint_t n;
+    bool odd;
+    pthread_mutex_t lock;
+    bool ready;             // Whether ctx has been built
+    mont_ctx_t ctx;
+} batch_group_t;
+
+// Unit of work handed to the pool: consecutive jobs of one group
+typedef struct {
+    batch_t *batch;
+    batch_group_t *group;
+    batch_job_t **jobs;
+    size_t count;
+} batch_chunk_t;
+
+// Unit of work for the IFMA engine: one job per lane
+typedef struct {
+    batch_t *batch;
+    batch_job_t **jobs;
+} batch_block_t;
+
+struct batch {
+    pool_t *pool;
+    pool_group_t tasks;
+    batch_done_t done;
+    void *ctx;
+    batch_job_t **order;    // Jobs sorted by modulus
+    batch_group_t *groups;
+    size_t n_groups;
+    batch_chunk_t *chunks;
+    batch_job_t **lanes;    // Jobs for the IFMA engine, sorted by modulus size
+    batch_block_t *blocks;
+};
+
+typedef struct {
+    uint64_t hash;
+    batch_job_t *job;
+} batch_key_t;
+
+// FNV-1a over the significant words of n
+static uint64_t batch_hash(bigint_t n)
+{
+    uint64_t h = 0xcbf29ce484222325;
+    size_t size = limb_normalize(n.val, n.size);
+    for (size_t i = 0; i < size; i++) {
+        h ^= n.val[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+// Order by hash, then by modulus, so equal moduli end up adjacent
+static int batch_key_cmp(const void *x, const void *y)
+{
+    const batch_key_t *a = x, *b = y;
+    if (a->hash != b->hash)
+        return a->hash < b->hash ? -1 : 1;
+    bigint_t na = a->job->n, nb = b->job->n;
+    size_t sa = limb_normalize(na.val, na.size);
+    size_t sb = limb_normalize(nb.val, nb.size);
+    if (sa != sb)
+        return sa < sb ? -1 : 1;
+    return limb_cmp(na.val, nb.val, sa);
+}
+
+// Return the group's Montgomery context, building it on first use
+static const mont_ctx_t *batch_group_ctx(batch_group_t *g)
+{
+    pthread_mutex_lock(&g->lock);
+    if (!g->ready) {
+        g->ctx = mont_new(g->n);
+        g->ready = true;
+    }
+    pthread_mutex_unlock(&g->lock);
+    return &g->ctx;
+}
+
+static void batch_run_job(batch_group_t *g, batch_job_t *job)
+{
+    // Even moduli and negative exponents take the generic path
+    if (!g->odd || (job->op == BATCH_MOD_EXP && is_neg(job->b))) {
+        job->result = job->op == BATCH_MOD_EXP
+            ? mod_exp(job->a, job->b, job->n)
+            : mod_prod(job->a, job->b, job->n);
+        return;
+    }
+
+    const mont_ctx_t *ctx = batch_group_ctx(g);
+    uword_t *x = pool_scratch(ctx->size * sizeof(uword_t));
+    mont_to(ctx, x, job->a);
+    if (job->op == BATCH_MOD_EXP) {
+        mont_pow(ctx, x, x, job->b.val, job->b.size);
+    } else {
+        uword_t *y = pool_scratch(ctx->size * sizeof(uword_t));
+        mont_to(ctx, y, job->b);
+        mont_mul(ctx, x, x, y);
+    }
+    job->result = mont_from(ctx, x);
+}
+
+// Return whether job can run on the IFMA engine
+static bool batch_ifma_eligible(const batch_job_t *job)
+{
+    if (job->op != BATCH_MOD_EXP || is_neg(job->b) || !is_pos(job->n) || !(job->n.val[0] & 1))
+        return false;
+    size_t bits = bigint_bits(job->n);
+    return bits >= IFMA_MIN_BITS && bits <= IFMA_MAX_BITS;
+}
+
+static int batch_bits_cmp(const void *x, const void *y)
+{
+    const batch_key_t *a = x, *b = y;
+    return (a->hash > b->hash) - (a->hash < b->hash);
+}
+
+static void batch_run_block(void *arg)
+{
+    batch_block_t *block = arg;
+    bigint_t a[IFMA_LANES], e[IFMA_LANES], n[IFMA_LANES], out[IFMA_LANES];
+    for (size_t l = 0; l < IFMA_LANES; l++) {
+        a[l] = block->jobs[l]->a;
+        e[l] = block->jobs[l]->b;
+        n[l] = block->jobs[l]->n;
+    }
+    ifma_mod_exp(out, a, e, n);
+    for (size_t l = 0; l < IFMA_LANES; l++) {
+        block->jobs[l]->result = out[l];
+        if (block->batch->done)
+            block->batch->done(block->jobs[l], block->batch->ctx);
+    }
+}
+
+static void batch_run_chunk(void *arg)
+{
+    batch_chunk_t *chunk = arg;
+    for (size_t i = 0; i < chunk->count; i++) {
+        batch_run_job(chunk->group, chunk->jobs[i]);
+        if (chunk->batch->done)
+            chunk->batch->done(chunk->jobs[i], chunk->batch->ctx);
+    }
+}
+
+// Queue count jobs on pool and return at once
+batch_t *batch_submit(pool_t *pool, batch_job_t *jobs, size_t count,
+        batch_done_t done, void *ctx)
+{
+    batch_t *batch = malloc(sizeof(batch_t));
+    batch->pool = pool ? pool : pool_default();
+    batch->done = done;
+    batch->ctx = ctx;
+    pool_group_init(&batch->tasks);
+
+    batch_key_t *keys = malloc(count * sizeof(batch_key_t));
+
+    // Full blocks of eligible exponentiations run on the IFMA engine, sorted
+    // by modulus size so that the lanes of a block need similar digit counts.
+    // The remainder takes the scalar path with everything else.
+    bool *vector = calloc(count, sizeof(bool));
+    size_t n_lanes = 0;
+    if (ifma_available()) {
+        for (size_t i = 0; i < count; i++)
+            if (batch_ifma_eligible(jobs + i))
+                keys[n_lanes++] = (batch_key_t) { .hash = bigint_bits(jobs[i].n), .job = jobs + i };
+        qsort(keys, n_lanes, sizeof(batch_key_t), batch_bits_cmp);
+        n_lanes -= n_lanes % IFMA_LANES;
+    }
+    batch->lanes = malloc((n_lanes + 1) * sizeof(batch_job_t *));
+    batch->blocks = malloc((n_lanes / IFMA_LANES + 1) * sizeof(batch_block_t));
+    for (size_t i = 0; i < n_lanes; i++) {
+        batch->lanes[i] = keys[i].job;
+        vector[keys[i].job - jobs] = true;
+    }
+    for (size_t i = 0; i < n_lanes / IFMA_LANES; i++)
+        batch->blocks[i] = (batch_block_t) { .batch = batch, .jobs = batch->lanes + i * IFMA_LANES };
+
+    size_t n_scalar = 0;
+    for (size_t i = 0; i < count; i++)
+        if (!vector[i])
+            keys[n_scalar++] = (batch_key_t) { .hash = batch_hash(jobs[i].n), .job = jobs + i };
+    free(vector);
+    count = n_scalar;
+    qsort(keys, count, sizeof(batch_key_t), batch_key_cmp);
+
+    batch->order = malloc(count * sizeof(batch_job_t *));
+    batch->groups = malloc(count * sizeof(batch_group_t));
+    batch->n_groups = 0;
+    size_t *group_start = malloc((count + 1) * sizeof(size_t));
+    for (size_t i = 0; i < count; i++) {
+        batch->order[i] = keys[i].job;
+        if (i == 0 || batch_key_cmp(keys + i - 1, keys + i) != 0) {
+            batch_group_t *g = batch->groups + batch->n_groups;
+            g->n = keys[i].job->n;
+            g->odd = is_pos(g->n) && (g->n.val[0] & 1);
+            g->ready = false;
+            pthread_mutex_init(&g->lock, NULL);
+            group_start[batch->n_groups++] = i;
+        }
+    }
+    group_start[batch->n_groups] = count;
+    free(keys);
+
+    // Split large groups so that every worker gets a few chunks
+    size_t per_chunk = count / (4 * pool_threads(batch->pool)) + 1;
+    batch->chunks = malloc(count * sizeof(batch_chunk_t));
+    size_t n_chunks = 0;
+    for (size_t g = 0; g < batch->n_groups; g++) {
+        for (size_t i = group_start[g]; i < group_start[g+1]; i += per_chunk) {
+            batch->chunks[n_chunks] = (batch_chunk_t) {
+                .batch = batch,
+                .group = batch->groups + g,
+                .jobs = batch->order + i,
+                .count = smin(per_chunk, group_start[g+1] - i),
+            };
+            n_chunks++;
+        }
+    }
+    free(group_start);
+
+    for (size_t i = 0; i < n_lanes / IFMA_LANES; i++)
+        pool_submit(batch->pool, &batch->tasks, batch_run_block, batch->blocks + i);
+    for (size_t i = 0; i < n_chunks; i++)
+        pool_submit(batch->pool, &batch->tasks, batch_run_chunk, batch->chunks + i);
+
+    return batch;
+}
+
+// Wait for every job of the batch to finish, then free the batch
+void batch_wait(batch_t *batch)
+{
+    pool_wait(batch->pool, &batch->tasks);
+
+    for (size_t i = 0; i < batch->n_groups; i++) {
+        if (batch->groups[i].ready)
+            mont_delete(&batch->groups[i].ctx);
+        pthread_mutex_destroy(&batch->groups[i].lock);
+    }
+    free(batch->groups);
+    free(batch->chunks);
+    free(batch->order);
+    free(batch->lanes);
+    free(batch->blocks);
+    free(batch);
+}
+
+static void batch_test_done(batch_job_t *job, void *ctx)
+{
+    (void)job;
+    atomic_fetch_add((atomic_size_t *)ctx, 1);
+}
+
+// Testing
+int batch_test(void)
+{
+    enum { JOBS = 48 };
+    char *moduli[] = {
+        "170141183460469231731687303715884105727",
+        "340282366920938463463374607431768211456",
+        "1000000007",
+    };
+    bigint_t n[3];
+    for (size_t i = 0; i < 3; i++)
+        n[i] = bigint_new(moduli[i]);
+
+    batch_job_t jobs[JOBS];
+    for (size_t i = 0; i < JOBS; i++) {
+        jobs[i] = (batch_job_t) {
+            .op = i % 2 ? BATCH_MOD_PROD : BATCH_MOD_EXP,
+            .a = bigint_random_bits(100 + i),
+            .b = bigint_random_bits(i % 2 ? 90 : 20),
+            .n = n[i % 3],
+        };
+    }
+
+    atomic_size_t completed;
+    atomic_init(&completed, 0);
+    pool_t *pool = pool_new(4);
+    batch_t *batch = batch_submit(pool, jobs, JOBS, batch_test_done, &completed);
+    batch_wait(batch);
+    pool_delete(pool);
+
+    size_t errors = 0;
+    for (size_t i = 0; i < JOBS; i++) {
+        bigint_t expect = jobs[i].op == BATCH_MOD_EXP
+            ? mod_exp(jobs[i].a, jobs[i].b, jobs[i].n)
+            : mod_prod(jobs[i].a, jobs[i].b, jobs[i].n);
+        errors += !bigint_equals(expect, jobs[i].result);
+        bigint_delete(&expect);
+        bigint_delete(&jobs[i].a);
+        bigint_delete(&jobs[i].b);
+        bigint_delete(&jobs[i].result);
+    }
+    for (size_t i = 0; i < 3; i++)
+        bigint_delete(n + i);
+
+    bool test = errors == 0 && atomic_load(&completed) == JOBS;
+    printf("%s: batch of %d mod_exp/mod_prod jobs matches sequential results (%zu callbacks)\n",
+        test ? "TRUE" : "FALSE", JOBS, atomic_load(&completed));
+    int total_errors = !test;
+
+    // Large odd moduli fill IFMA blocks where available, with a scalar tail
+    enum { LARGE_JOBS = 2 * IFMA_LANES + 3 };
+    batch_job_t large[LARGE_JOBS];
+    for (size_t i = 0; i < LARGE_JOBS; i++) {
+        bigint_t n = bigint_random_bits(i % 2 ? 1024 : 700);
+        n.val[0] |= 1;
+        large[i] = (batch_job_t) {
+            .op = BATCH_MOD_EXP,
+            .a = bigint_random_bits(1100),
+            .b = bigint_random_bits(i % 3 ? 1024 : 65),
+            .n = n,
+        };
+    }
+    batch = batch_submit(NULL, large, LARGE_JOBS, NULL, NULL);
+    batch_wait(batch);
+
+    errors = 0;
+    for (size_t i = 0; i < LARGE_JOBS; i++) {
+        bigint_t expect = mod_exp(large[i].a, large[i].b, large[i].n);
+        errors += !bigint_equals(expect, large[i].result);
+        bigint_delete(&expect);
+        bigint_delete(&large[i].a);
+        bigint_delete(&large[i].b);
+        bigint_delete(&large[i].n);
+        bigint_delete(&large[i].result);
+    }
+    test = errors == 0;
+    printf("%s: batch of %d large mod_exp jobs matches sequential results (IFMA %s)\n",
+        test ? "TRUE" : "FALSE", LARGE_JOBS, ifma_available() ? "on" : "off");
+    total_errors += !test;
+
+    return total_errors;
+}
@@ -0,0 +1,46 @@
+/**
+ * batch.h: Batched modular arithmetic on a thread pool
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "bigint.h"
+#include "pool.h"
+
+typedef enum {
+    BATCH_MOD_EXP,      // result = a^b mod n
+    BATCH_MOD_PROD,     // result = a * b mod n
+} batch_op_t;
+
+typedef struct {
+    batch_op_t op;
+    bigint_t a;         // Base or first factor
+    bigint_t b;         // Exponent or second factor
+    bigint_t n;         // Modulus
+    bigint_t result;    // Set when the job completes
+} batch_job_t;
+
+// Completion callback, run on a worker thread as each job finishes
+typedef void (*batch_done_t)(batch_job_t *job, void *ctx);
+
+typedef struct batch batch_t;
+
+/**
+ * Queue count jobs on pool (NULL: the default pool) and return at once.
+ * Jobs sharing a modulus are grouped so its Montgomery context is built
+ * only once. Where AVX-512 IFMA is available, mod_exp jobs with odd moduli
+ * of IFMA_MIN_BITS to IFMA_MAX_BITS bits run eight at a time on the vector
+ * engine, and the rest on the scalar path. The jobs and their operands must
+ * stay alive until batch_wait.
+ */
+batch_t *batch_submit(pool_t *pool, batch_job_t *jobs, size_t count,
+        batch_done_t done, void *ctx);
+
+// Wait for every job of the batch to finish, then free the batch
+void batch_wait(batch_t *batch);
+
+// Testing methods
+int batch_test(void);
+
+#endif // BATCH_H
@@ -0,0 +1,414 @@
+/**
+ * bench.c: Microbenchmarks for the arithmetic routines
+ *
+ * Each operation is timed over operand sizes doubling from 64 bits. A run
+ * first calibrates how many calls make up one timed batch (which doubles as
+ * warmup), then times several batches and reports the median.
+ *
+ * Usage: benchmark [-m max_bits] [-r repeats] [-o results.json] [op...]
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "accum.h"
+#include "bigint.h"
+#include "fixed_base.h"
+#include "math.h"
+#include "mod_math.h"
+#include "rns.h"
+#include "x25519.h"
+
+#ifndef BENCH_OPT
+#define BENCH_OPT ""
+#endif
+
+enum {
+    BENCH_MIN_BITS = 64,
+    BENCH_MAX_BITS = 1 << 20,
+    BENCH_REPEATS = 7,
+    BENCH_BATCH_NS = 2000000,  // Minimum length of a timed batch
+    BENCH_TERMS = 64,           // Terms per call of the running-sum ops
+};
+
+typedef struct {
+    bigint_t a;
+    bigint_t b;
+    bigint_t n;
+    char *s;
+    uint8_t key[X25519_BYTES];
+    uint8_t point[X25519_BYTES];
+    fixed_base_ctx_t fixed_base;
+    rns_ctx_t rns;
+    uword_t *ra, *rb;   // Elements of rns
+} bench_args_t;
+
+typedef struct {
+    const char *name;
+    size_t min_bits;    // 0: BENCH_MIN_BITS
+    size_t max_bits;    // Larger sizes take too long to be worth sweeping
+    size_t steps;       // Inner steps per call to report a rate for, or 0
+    void (*setup)(bench_args_t *args, size_t bits);
+    void (*run)(bench_args_t *args);
+} bench_op_t;
+
+typedef struct {
+    double ns;          // Median nanoseconds per call
+    double cycles;      // Median TSC cycles per call, 0 if unavailable
+    size_t iters;       // Calls per timed batch
+} bench_result_t;
+
+// Return wall-clock time in nanoseconds
+static uint64_t bench_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Return the time stamp counter, or 0 where there is none
+static uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Return a random integer of exactly the given number of bits
+static bigint_t bench_random(size_t bits)
+{
+    // bigint_random_bits leaves a zeroed sign word above the value
+    bigint_t out = bigint_random_bits(bits);
+    out.size = bits / WORD_BITS + 1;
+    out.val[(bits - 1) / WORD_BITS] |= (uword_t)1 << ((bits - 1) % WORD_BITS);
+    out.size = bigint_min_words(out);
+    return out;
+}
+
+static void setup_pair(bench_args_t *args, size_t bits)
+{
+    args->a = bench_random(bits);
+    args->b = bench_random(bits);
+}
+
+static void setup_div(bench_args_t *args, size_t bits)
+{
+    args->a = bench_random(2 * bits);
+    args->b = bench_random(bits);
+}
+
+static void setup_mod(bench_args_t *args, size_t bits)
+{
+    args->n = bench_random(bits);
+    args->n.val[0] |= 1;
+    args->a = bigint_random_below(args->n);
+    args->b = bench_random(bits);
+}
+
+static void setup_fixed_base(bench_args_t *args, size_t bits)
+{
+    setup_mod(args, bits);
+    args->fixed_base = fixed_base_new(args->a, args->n, bits, 0);
+}
+
+static void setup_rns(bench_args_t *args, size_t bits)
+{
+    setup_mod(args, bits);
+    args->rns = rns_new(args->n, NULL, 0);
+    args->ra = malloc(2 * args->rns.k * sizeof(uword_t));
+    args->rb = malloc(2 * args->rns.k * sizeof(uword_t));
+    rns_to(&args->rns, args->ra, args->a);
+    rns_to(&args->rns, args->rb, args->b);
+}
+
+static void setup_string(bench_args_t *args, size_t bits)
+{
+    args->a = bench_random(bits);
+    args->s = bigint_print(args->a);
+}
+
+static void setup_x25519(bench_args_t *args, size_t bits)
+{
+    (void)bits;
+    bigint_t a = bench_random(X25519_BYTES * BITS_PER_BYTE - 1);
+    memcpy(args->key, a.val, X25519_BYTES);
+    bigint_delete(&a);
+    x25519_base(args->point, args->key);
+}
+
+static void run_sum(bench_args_t *args)
+{
+    bigint_t out = bigint_sum(args->a, args->b);
+    bigint_delete(&out);
+}
+
+// Sum BENCH_TERMS terms one bigint_sum at a time
+static void run_sum_terms(bench_args_t *args)
+{
+    bigint_t acc = bigint_zero(1);
+    for (int i = 0; i < BENCH_TERMS; i++) {
+        bigint_t next = bigint_sum(acc, i & 1 ? args->b : args->a);
+        bigint_delete(&acc);
+        acc = next;
+    }
+    bigint_delete(&acc);
+}
+
+// Sum the same terms in an accumulator
+static void run_accum(bench_args_t *args)
+{
+    accum_t acc = accum_new(args->a.size);
+    for (int i = 0; i < BENCH_TERMS; i++)
+        accum_add(&acc, i & 1 ? args->b : args->a);
+    bigint_t out = accum_value(&acc);
+    bigint_delete(&out);
+    accum_delete(&acc);
+}
+
+static void run_prod(bench_args_t *args)
+{
+    bigint_t out = bigint_prod(args->a, args->b);
+    bigint_delete(&out);
+}
+
+static void run_div(bench_args_t *args)
+{
+    bigint_t rem;
+    bigint_t out = bigint_div(args->a, args->b, &rem);
+    bigint_delete(&out);
+    bigint_delete(&rem);
+}
+
+static void run_isqrt(bench_args_t *args)
+{
+    bigint_t out = bigint_isqrt(args->a);
+    bigint_delete(&out);
+}
+
+static void run_gcd(bench_args_t *args)
+{
+    bigint_t out = bigint_gcd(args->a, args->b);
+    bigint_delete(&out);
+}
+
+static void run_mod_inv(bench_args_t *args)
+{
+    bigint_t out = mod_inv(args->a, args->n);
+    bigint_delete(&out);
+}
+
+static void run_mod_prod(bench_args_t *args)
+{
+    bigint_t out = mod_prod(args->a, args->b, args->n);
+    bigint_delete(&out);
+}
+
+// Products stay below (k + 1) n, so the chain can run in place
+static void run_rns_mul(bench_args_t *args)
+{
+    rns_mul(&args->rns, args->ra, args->ra, args->rb);
+}
+
+static void run_mod_exp(bench_args_t *args)
+{
+    bigint_t out = mod_exp(args->a, args->b, args->n);
+    bigint_delete(&out);
+}
+
+static void run_fixed_base(bench_args_t *args)
+{
+    bigint_t out = fixed_base_exp(&args->fixed_base, args->b);
+    bigint_delete(&out);
+}
+
+static void run_new(bench_args_t *args)
+{
+    bigint_t out = bigint_new(args->s);
+    bigint_delete(&out);
+}
+
+static void run_print(bench_args_t *args)
+{
+    free(bigint_print(args->a));
+}
+
+static void run_x25519(bench_args_t *args)
+{
+    x25519(args->point, args->key, args->point);
+}
+
+static void run_x25519_generic(bench_args_t *args)
+{
+    x25519_generic(args->point, args->key, args->point);
+}
+
+static const bench_op_t bench_ops[] = {
+    { "sum",     0,   1 << 20, 0, setup_pair,   run_sum },
+    { "sum_terms", 0, 1 << 16, BENCH_TERMS, setup_pair, run_sum_terms },
+    { "accum",   0,   1 << 16, BENCH_TERMS, setup_pair, run_accum },
+    { "prod",    0,   1 << 20, 0, setup_pair,   run_prod },
+    { "div",     0,   1 << 20, 0, setup_div,    run_div },
+    { "isqrt",   0,   1 << 20, 0, setup_div,    run_isqrt },
+    { "gcd",     0,   1 << 14, 0, setup_pair,   run_gcd },
+    { "mod_inv", 0,   1 << 14, 0, setup_mod,    run_mod_inv },
+    { "mod_prod", 0,  1 << 14, 0, setup_mod,    run_mod_prod },
+    { "rns_mul", 0,   1 << 14, 0, setup_rns,    run_rns_mul },
+    { "mod_exp", 0,   1 << 13, 0, setup_mod,    run_mod_exp },
+    { "fixed_base", 0, 1 << 13, 0, setup_fixed_base, run_fixed_base },
+    { "new",     0,   1 << 20, 0, setup_string, run_new },
+    { "print",   0,   1 << 20, 0, setup_string, run_print },
+    { "x25519",  256, 256, X25519_LADDER_STEPS, setup_x25519, run_x25519 },
+    { "x25519_generic", 256, 256, X25519_LADDER_STEPS, setup_x25519, run_x25519_generic },
+};
+
+static int bench_cmp_double(const void *x, const void *y)
+{
+    double a = *(const double *)x, b = *(const double *)y;
+    return (a > b) - (a < b);
+}
+
+// Time op on bits-bit operands
+static bench_result_t bench_run(const bench_op_t *op, size_t bits, size_t repeats)
+{
+    bench_args_t args = { 0 };
+    op->setup(&args, bits);
+
+    // Warm up while doubling the batch until it runs long enough to time
+    size_t iters = 1;
+    for (;;) {
+        uint64_t start = bench_ns();
+        for (size_t i = 0; i < iters; i++)
+            op->run(&args);
+        if (bench_ns() - start >= BENCH_BATCH_NS)
+            break;
+        iters *= 2;
+    }
+
+    double *ns = malloc(repeats * sizeof(double));
+    double *cycles = malloc(repeats * sizeof(double));
+    for (size_t r = 0; r < repeats; r++) {
+        uint64_t start = bench_ns();
+        uint64_t start_cycles = bench_cycles();
+        for (size_t i = 0; i < iters; i++)
+            op->run(&args);
+        cycles[r] = (double)(bench_cycles() - start_cycles) / iters;
+        ns[r] = (double)(bench_ns() - start) / iters;
+    }
+    qsort(ns, repeats, sizeof(double), bench_cmp_double);
+    qsort(cycles, repeats, sizeof(double), bench_cmp_double);
+    bench_result_t result = {
+        .ns = ns[repeats / 2],
+        .cycles = cycles[repeats / 2],
+        .iters = iters,
+    };
+    free(ns);
+    free(cycles);
+
+    if (args.a.val)
+        bigint_delete(&args.a);
+    if (args.b.val)
+        bigint_delete(&args.b);
+    if (args.n.val)
+        bigint_delete(&args.n);
+    free(args.s);
+    fixed_base_delete(&args.fixed_base);
+    rns_delete(&args.rns);
+    free(args.ra);
+    free(args.rb);
+    return result;
+}
+
+// Return whether op was selected on the command line (none: all)
+static bool bench_selected(const bench_op_t *op, char **names, int count)
+{
+    for (int i = 0; i < count; i++)
+        if (strcmp(op->name, names[i]) == 0)
+            return true;
+    return count == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t max_bits = BENCH_MAX_BITS;
+    size_t repeats = BENCH_REPEATS;
+    char *json_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:r:o:")) != -1) {
+        switch (opt) {
+        case 'm':
+            max_bits = strtoull(optarg, NULL, 0);
+            break;
+        case 'r':
+            repeats = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+            json_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-m max_bits] [-r repeats] [-o results.json] [op...]\n",
+                argv[0]);
+            return 1;
+        }
+    }
+    if (repeats == 0)
+        repeats = 1;
+
+    FILE *json = NULL;
+    if (json_path) {
+        json = fopen(json_path, "w");
+        if (!json) {
+            perror(json_path);
+            return 1;
+        }
+        fprintf(json, "{\n  \"opt\": \"%s\",\n  \"repeats\": %zu,\n  \"results\": [",
+            BENCH_OPT, repeats);
+    }
+
+    bigint_init();
+
+    printf("%-14s %8s %8s %16s %14s %10s\n",
+        "op", "bits", "limbs", "ns/op", "cycles/limb", "iters");
+    const char *sep = "";
+    for (size_t i = 0; i < sizeof(bench_ops) / sizeof(bench_ops[0]); i++) {
+        const bench_op_t *op = bench_ops + i;
+        if (!bench_selected(op, argv + optind, argc - optind))
+            continue;
+
+        size_t min_bits = op->min_bits ? op->min_bits : BENCH_MIN_BITS;
+        for (size_t bits = min_bits; bits <= smin(max_bits, op->max_bits); bits *= 2) {
+            bench_result_t res = bench_run(op, bits, repeats);
+            size_t limbs = (bits + WORD_BITS - 1) / WORD_BITS;
+            double per_limb = res.cycles / limbs;
+            printf("%-14s %8zu %8zu %16.1f %14.2f %10zu",
+                op->name, bits, limbs, res.ns, per_limb, res.iters);
+            if (op->steps)
+                printf(" %14.0f steps/s", op->steps * 1e9 / res.ns);
+            printf("\n");
+            fflush(stdout);
+            if (json) {
+                fprintf(json, "%s\n    { \"op\": \"%s\", \"bits\": %zu, \"limbs\": %zu, "
+                    "\"ns_per_op\": %.1f, \"cycles_per_limb\": %.3f, \"iters\": %zu",
+                    sep, op->name, bits, limbs, res.ns, per_limb, res.iters);
+                if (op->steps)
+                    fprintf(json, ", \"steps_per_sec\": %.0f", op->steps * 1e9 / res.ns);
+                fprintf(json, " }");
+                sep = ",";
+            }
+        }
+    }
+
+    if (json) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+
+    bigint_exit();
+    return 0;
+}
@@ -2,21 +2,234 @@
  * bigint.c: Arbitrary-length integer library
  */
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
-#include "array.h"
+#include "instr.h"
+#include "limb.h"
 #include "math.h"
+#include "mod_cache.h"
+#include "pool.h"
+#include "rng.h"
+#include "tables.h"
+
+// Header in front of every limb buffer. refs is 0 for private buffers, which
+// their one owner may write, and counts the owners of shared buffers.
+typedef struct {
+    atomic_size_t refs;
+    size_t mapped;      // Length of the mapping holding the buffer (0: heap),
+                        // with BIGINT_MAPPED_FILE set for named files
+} bigint_header_t;
+
+_Static_assert(sizeof(bigint_header_t) == BIGINT_HEADER_WORDS * sizeof(uword_t),
+    "BIGINT_HEADER_WORDS does not match bigint_header_t");
+
+// Mapping lengths are page multiples, which leaves the low bits for flags
+static const size_t BIGINT_MAPPED_FILE = 1;
+
+enum { BIGINT_HUGE_PAGE_BYTES = 2 << 20 };
+
+static inline bigint_header_t *bigint_header(bigint_t n)
+{
+    return (bigint_header_t *)n.val - 1;
+}
+
+// Where large limb buffers go; see bigint_set_storage
+static atomic_size_t bigint_map_bytes = BIGINT_MAP_DEFAULT_BYTES;
+static char *bigint_map_dir = NULL;
+static pthread_mutex_t bigint_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Set where limb buffers of at least opts->map_bytes bytes are kept (NULL:
+// defaults). The directory name is copied.
+void bigint_set_storage(const bigint_storage_t *opts)
+{
+    static const bigint_storage_t defaults = { .map_bytes = BIGINT_MAP_DEFAULT_BYTES };
+    if (!opts)
+        opts = &defaults;
+
+    pthread_mutex_lock(&bigint_map_lock);
+    free(bigint_map_dir);
+    bigint_map_dir = opts->file_dir ? strdup(opts->file_dir) : NULL;
+    atomic_store(&bigint_map_bytes, opts->map_bytes);
+    pthread_mutex_unlock(&bigint_map_lock);
+}
+
+// Return the threshold above which limb buffers are mapped (0: never)
+size_t bigint_storage_map_bytes(void)
+{
+    return atomic_load(&bigint_map_bytes);
+}
+
+// Return a mapping of at least bytes bytes, NULL on failure: an unlinked file
+// in the storage directory, else anonymous memory on huge pages if possible
+static bigint_header_t *bigint_map(size_t bytes)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t len = (bytes + page - 1) / page * page;
+    void *p = MAP_FAILED;
+
+    pthread_mutex_lock(&bigint_map_lock);
+    if (bigint_map_dir) {
+        size_t path_len = strlen(bigint_map_dir) + sizeof("/lcrypt-bigint-XXXXXX");
+        char path[path_len];
+        snprintf(path, path_len, "%s/lcrypt-bigint-XXXXXX", bigint_map_dir);
+        int fd = mkstemp(path);
+        if (fd >= 0) {
+            unlink(path);
+            if (ftruncate(fd, (off_t)len) == 0)
+                p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+        }
+        if (p == MAP_FAILED)
+            fprintf(stderr, "bigint_map: WARNING: cannot map a file in %s, "
+                "using memory\n", bigint_map_dir);
+    }
+    pthread_mutex_unlock(&bigint_map_lock);
+
+    if (p == MAP_FAILED && len >= BIGINT_HUGE_PAGE_BYTES) {
+        size_t huge = (len + BIGINT_HUGE_PAGE_BYTES - 1) / BIGINT_HUGE_PAGE_BYTES
+            * BIGINT_HUGE_PAGE_BYTES;
+        p = mmap(NULL, huge, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            len = huge;
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+        // Transparent huge pages when no huge pages are reserved
+        madvise(p, len, MADV_HUGEPAGE);
+    }
+
+    bigint_header_t *h = p;
+    h->mapped = len;
+    return h;
+}
+
+// Return a private limb buffer of size words, cleared if clear is set.
+// Buffers over the storage threshold are mapped, which also clears them.
+static uword_t *bigint_alloc(size_t size, bool clear)
+{
+    size_t bytes = sizeof(bigint_header_t) + size * sizeof(uword_t);
+    size_t threshold = atomic_load_explicit(&bigint_map_bytes, memory_order_relaxed);
+    bigint_header_t *h = NULL;
+    if (threshold && bytes >= threshold)
+        h = bigint_map(bytes);
+    if (!h) {
+        h = clear ? instr_calloc(1, bytes) : instr_malloc(bytes);
+        h->mapped = 0;
+    }
+    atomic_init(&h->refs, 0);
+    return (uword_t *)(h + 1);
+}
+
+// Drop one owner of the limbs of n, freeing them with the last
+static void bigint_release(bigint_t n)
+{
+    bigint_header_t *h = bigint_header(n);
+    if (atomic_load_explicit(&h->refs, memory_order_acquire) == 0
+            || atomic_fetch_sub_explicit(&h->refs, 1, memory_order_acq_rel) == 1) {
+        if (h->mapped)
+            munmap(h, h->mapped & ~BIGINT_MAPPED_FILE);
+        else
+            instr_free(h);
+    }
+}
+
+// Return whether the limbs of n are in a mapping rather than on the heap
+bool bigint_is_mapped(bigint_t n)
+{
+    return n.val && bigint_header(n)->mapped;
+}
+
+// Return size words kept in the file at path (created or resized to hold
+// them; size 0 keeps the current length), or a zero-size bigint on failure.
+// Files hold BIGINT_HEADER_WORDS words of header, then the limbs.
+bigint_t bigint_map_file(const char *path, size_t size)
+{
+    const size_t header = sizeof(bigint_header_t);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "bigint_map_file: WARNING: cannot open %s\n", path);
+        if (fd >= 0)
+            close(fd);
+        return (bigint_t){ 0 };
+    }
+
+    if (size == 0)
+        size = (size_t)st.st_size > header ? ((size_t)st.st_size - header) / sizeof(uword_t) : 0;
+    size_t len = header + size * sizeof(uword_t);
+    void *p = MAP_FAILED;
+    if (size > 0 && ((size_t)st.st_size == len || ftruncate(fd, (off_t)len) == 0))
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "bigint_map_file: WARNING: cannot map %zu words of %s\n", size, path);
+        return (bigint_t){ 0 };
+    }
+
+    bigint_header_t *h = p;
+    atomic_init(&h->refs, 0);
+    h->mapped = len | BIGINT_MAPPED_FILE;
+    return (bigint_t){ .size = size, .val = (uword_t *)(h + 1) };
+}
+
+// Write the limbs of n back to its file, as mapped by bigint_map_file;
+// return false if n has no file or the write fails
+bool bigint_flush(bigint_t n)
+{
+    if (!n.val || !(bigint_header(n)->mapped & BIGINT_MAPPED_FILE)) {
+        fprintf(stderr, "bigint_flush: WARNING: not mapped from a file\n");
+        return false;
+    }
+    bigint_header_t *h = bigint_header(n);
+    return msync(h, h->mapped & ~BIGINT_MAPPED_FILE, MS_SYNC) == 0;
+}
+
+// Hint how words [first, first + words) of n will be used next. Only mapped
+// limbs take the hint; heap limbs are left to the hardware prefetchers.
+void bigint_advise(bigint_t n, size_t first, size_t words, bigint_access_t access)
+{
+    if (!bigint_is_mapped(n) || first >= n.size)
+        return;
+    static const int advice[] = {
+        [BIGINT_ACCESS_NORMAL] = MADV_NORMAL,
+        [BIGINT_ACCESS_SEQUENTIAL] = MADV_SEQUENTIAL,
+        [BIGINT_ACCESS_RANDOM] = MADV_RANDOM,
+        [BIGINT_ACCESS_WILLNEED] = MADV_WILLNEED,
+#ifdef MADV_COLD
+        [BIGINT_ACCESS_COLD] = MADV_COLD,
+#else
+        [BIGINT_ACCESS_COLD] = MADV_NORMAL,
+#endif
+    };
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)(n.val + first) & ~(page - 1);
+    uintptr_t end = (uintptr_t)(n.val + first + smin(words, n.size - first));
+    madvise((void *)start, end - start, advice[access]);
+}
 
 // Free bigint
 void bigint_delete(bigint_t *n)
 {
+    if (n->val)
+        bigint_release(*n);
     n->size = 0;
-    free(n->val);
+    n->val = NULL;
 }
 
 // Return zero of given size in words
@@ -24,7 +237,7 @@ bigint_t bigint_zero(size_t size)
 {
     return (bigint_t) {
         .size = size,
-        .val = calloc(size, sizeof(uword_t)),
+        .val = bigint_alloc(size, true),
     };
 }
 
@@ -33,7 +246,7 @@ bigint_t bigint_minus1(size_t size)
 {
     bigint_t out = {
         .size = size,
-        .val = malloc(size * sizeof(uword_t)),
+        .val = bigint_alloc(size, false),
     };
 
     char fill = ~(char)0;
@@ -93,7 +306,7 @@ bigint_t bigint_max(bigint_t a, bigint_t b)
 // Return the logical negation of the input
 bigint_t bigint_lneg(bigint_t n)
 {
-    bigint_t out = { .size = n.size, .val = malloc(n.size * sizeof(uword_t)) };
+    bigint_t out = { .size = n.size, .val = bigint_alloc(n.size, false) };
 
     // Take logical negation of n
     for (size_t i = 0; i < n.size; i++) {
@@ -170,6 +383,9 @@ size_t bigint_min_words(bigint_t n)
 // Resize bigint to specified number of words
 bigint_t bigint_resize(bigint_t n, size_t size)
 {
+    if (size == n.size)
+        return bigint_copy(n);
+
     bigint_t out;
     if (is_neg(n))
         out = bigint_minus1(size);
@@ -184,12 +400,17 @@ bigint_t bigint_resize(bigint_t n, size_t size)
     return out;
 }
 
-// Make copy of n
+// Make copy of n (O(1) for shared n: the copy is one more owner)
 bigint_t bigint_copy(bigint_t n)
 {
+    if (bigint_is_shared(n)) {
+        atomic_fetch_add_explicit(&bigint_header(n)->refs, 1, memory_order_relaxed);
+        return n;
+    }
+
     bigint_t out = {
         .size = n.size,
-        .val = malloc(n.size * sizeof(uword_t)),
+        .val = bigint_alloc(n.size, false),
     };
 
     for (size_t i = 0; i < out.size; i++)
@@ -198,8 +419,62 @@ bigint_t bigint_copy(bigint_t n)
     return out;
 }
 
+// Return n with its limbs marked shared, taking over the caller's ownership.
+// Copies of the result are O(1) and it must not be written before
+// bigint_detach; owners may live on different threads.
+bigint_t bigint_share(bigint_t n)
+{
+    if (n.val && !bigint_is_shared(n))
+        atomic_store_explicit(&bigint_header(n)->refs, 1, memory_order_release);
+    return n;
+}
+
+// Return whether the limbs of n are shared
+bool bigint_is_shared(bigint_t n)
+{
+    return n.val && atomic_load_explicit(&bigint_header(n)->refs, memory_order_acquire) > 0;
+}
+
+// Give n private limbs before writing them, copying only if other owners remain
+void bigint_detach(bigint_t *n)
+{
+    if (!bigint_is_shared(*n))
+        return;
+
+    bigint_header_t *h = bigint_header(*n);
+    if (atomic_load_explicit(&h->refs, memory_order_acquire) == 1) {
+        atomic_store_explicit(&h->refs, 0, memory_order_relaxed);
+        return;
+    }
+
+    uword_t *val = bigint_alloc(n->size, false);
+    memcpy(val, n->val, n->size * sizeof(uword_t));
+    bigint_release(*n);
+    n->val = val;
+}
+
+// Return a private bigint of size words whose limbs follow the header in buf
+// (BIGINT_HEADER_WORDS + size words); it must not be passed to bigint_delete
+bigint_t bigint_view(uword_t *buf, size_t size)
+{
+    bigint_header_t *h = (bigint_header_t *)buf;
+    atomic_init(&h->refs, 0);
+    h->mapped = 0;
+    return (bigint_t){ .size = size, .val = buf + BIGINT_HEADER_WORDS };
+}
+
+// Return non-negative integer whose magnitude is given by size words at val
+bigint_t bigint_from_limbs(const uword_t *val, size_t size)
+{
+    // Leave room for a cleared sign bit
+    bigint_t out = bigint_zero(size + 1);
+    memcpy(out.val, val, size * sizeof(uword_t));
+    out.size = bigint_min_words(out);
+    return out;
+}
+
 // TODO is this function even necessary?
-// n >> k (in place)
+// n >> k (in place, n must not be shared)
 // NOTE It must be the case that k <= WORD_BITS
 bigint_t ip_sr(bigint_t n, size_t k)
 {
@@ -215,7 +490,7 @@ bigint_t ip_sr(bigint_t n, size_t k)
     }
 }
 
-// n << k (in place)
+// n << k (in place, n must not be shared)
 // TODO support k > WORD_BITS
 bigint_t ip_sl(bigint_t n, size_t k)
 {
@@ -229,6 +504,40 @@ bigint_t ip_sl(bigint_t n, size_t k)
     }
 }
 
+// Return uniformly random integer in [0, 2^bits)
+bigint_t bigint_random_bits(size_t bits)
+{
+    size_t size = (bits + WORD_BITS - 1) / WORD_BITS;
+    bigint_t out = bigint_zero(size + 1);
+    rng_words(out.val, size);
+    if (bits % WORD_BITS)
+        out.val[size - 1] &= ((uword_t)1 << (bits % WORD_BITS)) - 1;
+    out.size = bigint_min_words(out);
+    return out;
+}
+
+// Return uniformly random integer in [0, n) for positive n
+bigint_t bigint_random_below(bigint_t n)
+{
+    if (!is_pos(n)) {
+        fprintf(stderr, "bigint_random_below: WARNING: bound is not positive\n");
+        return bigint_zero(1);
+    }
+
+    // Rejection sampling on bits(n)-bit values accepts with probability > 1/2
+    size_t size = limb_normalize(n.val, n.size);
+    size_t bits = limb_bits(n.val, size);
+    bigint_t out = bigint_zero(size + 1);
+    do {
+        rng_words(out.val, size);
+        if (bits % WORD_BITS)
+            out.val[size - 1] &= ((uword_t)1 << (bits % WORD_BITS)) - 1;
+    } while (limb_cmp(out.val, n.val, size) >= 0);
+
+    out.size = bigint_min_words(out);
+    return out;
+}
+
 // TODO use buffer instead
 // Print each word in hex
 void bigint_print_words(bigint_t n)
@@ -239,71 +548,117 @@ void bigint_print_words(bigint_t n)
     printf("\n");
 }
 
-array_t powers10;
+enum {
+    BIGINT_DEC_WORD_DIGITS = TABLES_POW10_DIGITS,   // Decimal digits that fit a word
+    BIGINT_DEC_BASECASE_DIGITS = 1216,              // Longer conversions divide and conquer
+    BIGINT_DEC_MAX_LEVELS = 64,                     // Bounds the powers a conversion splits by
+};
+
+// powers10[j] holds 10^(BIGINT_DEC_WORD_DIGITS * 2^j). Entries below
+// powers10_count are shared and never change until bigint_exit, so readers
+// take no lock; powers10_lock guards growth.
+static bigint_t powers10[BIGINT_DEC_MAX_LEVELS];
+static atomic_size_t powers10_count;
+static pthread_mutex_t powers10_lock = PTHREAD_MUTEX_INITIALIZER;
 
-// Return k-th power of 10
-static bigint_t bigint_power10(size_t k)
+// Return the powers 10^(BIGINT_DEC_WORD_DIGITS * 2^j) for j < levels,
+// squaring up any that are missing
+static const bigint_t *bigint_dec_powers(size_t levels)
 {
-    // Generate more powers of 10 if necessary
-    if (powers10.size == 0) {
-        bigint_t one = long_to_bigint(1);
-        array_append(&powers10, &one);
+    if (atomic_load_explicit(&powers10_count, memory_order_acquire) >= levels)
+        return powers10;
+
+    pthread_mutex_lock(&powers10_lock);
+    size_t count = atomic_load_explicit(&powers10_count, memory_order_relaxed);
+    // Powers in the generated table are copied rather than squared
+    for ( ; count < levels && count < TABLES_POW10; count++) {
+        powers10[count] = bigint_share(bigint_from_limbs(tables_pow10 + tables_pow10_start[count],
+            tables_pow10_start[count + 1] - tables_pow10_start[count]));
     }
-    if (k >= powers10.size) {
-        for (size_t i = powers10.size; i <= k; i++) {
-            bigint_t temp2 = bigint_sl( *(bigint_t*)array_get(powers10, i-1), 1);
-            bigint_t temp8 = bigint_sl( *(bigint_t*)array_get(powers10, i-1), 3);
-            bigint_t pow10 = bigint_sum(temp2, temp8);
+    for ( ; count < levels; count++)
+        powers10[count] = bigint_share(bigint_prod(powers10[count - 1], powers10[count - 1]));
+    atomic_store_explicit(&powers10_count, count, memory_order_release);
+    pthread_mutex_unlock(&powers10_lock);
+    return powers10;
+}
 
-            bigint_delete(&temp2);
-            bigint_delete(&temp8);
+// Return how many powers a conversion of digits digits splits by
+static size_t bigint_dec_levels(size_t digits)
+{
+    size_t levels = 1;
+    while (((size_t)BIGINT_DEC_WORD_DIGITS << levels) <= digits / 2)
+        levels++;
+    return levels;
+}
 
-            array_append(&powers10, &pow10);
+// Return the level of the power to split len digits at: the largest with
+// at most half the digits
+static size_t bigint_dec_level(size_t len)
+{
+    size_t j = 0;
+    while (((size_t)BIGINT_DEC_WORD_DIGITS << (j + 2)) <= len)
+        j++;
+    return j;
+}
+
+// Return the value of decimal digits s[0 .. len): a word of digits at a time
+// for short strings, else high * 10^k + low for a split from pow
+static bigint_t bigint_from_dec(const char *s, size_t len, const bigint_t *pow)
+{
+    if (len > BIGINT_DEC_BASECASE_DIGITS) {
+        size_t j = bigint_dec_level(len);
+        size_t low_len = (size_t)BIGINT_DEC_WORD_DIGITS << j;
+        bigint_t high = bigint_from_dec(s, len - low_len, pow);
+        bigint_t low = bigint_from_dec(s + len - low_len, low_len, pow);
+        bigint_t scaled = bigint_prod(high, pow[j]);
+        bigint_t out = bigint_sum(scaled, low);
+        bigint_delete(&high);
+        bigint_delete(&low);
+        bigint_delete(&scaled);
+        return out;
+    }
+
+    bigint_t out = bigint_zero(len / BIGINT_DEC_WORD_DIGITS + 2);
+    size_t n = 0;
+    for (size_t i = 0; i < len; ) {
+        // The first chunk takes the odd digits, the rest a full word each
+        size_t chunk = i ? BIGINT_DEC_WORD_DIGITS : (len - 1) % BIGINT_DEC_WORD_DIGITS + 1;
+        uword_t c = 0, scale = 1;
+        for (size_t k = 0; k < chunk; k++, i++) {
+            c = 10 * c + (uword_t)(s[i] - '0');
+            scale *= 10;
+        }
+        uword_t hi = c;
+        if (n) {
+            hi = limb_mul_1(out.val, out.val, n, scale);
+            hi += limb_add_1(out.val, out.val, n, c);
         }
+        if (hi)
+            out.val[n++] = hi;
     }
-    return *(bigint_t*)array_get(powers10, k);
+    out.size = bigint_min_words(out);
+    return out;
 }
 
 // Return integer with value specified by decimal string
 bigint_t bigint_new(char *string)
 {
-    bigint_t out = long_to_bigint(0);
-    bool neg = false;
-
+    INSTR_SCOPE(INSTR_NEW, strlen(string) / 19 + 1);
     size_t len = strlen(string);
     if (len == 0) {
         fprintf(stderr, "bigint_new: WARNING: input has length zero\n");
-        return out;
-    }
-
-    if (string[0] == '-') {
-        neg = true;
-        if (--len == 0) {
-            fprintf(stderr, "bigint_new: WARNING: negative input has length zero\n");
-            return out;
-        }
-    }
-
-    // Initialize all values from 0 to 9 for digit computations
-    bigint_t digit[10];
-    for (long i = 0; i < 10; i++) {
-        digit[i] = long_to_bigint(i);
+        return long_to_bigint(0);
     }
 
-    for (size_t i = 0; i < len; i++) {
-        // Here, read each digit and additively construct the output
-        const size_t idx = neg + i;
-        bigint_t temp_prod = bigint_prod(digit[string[idx] - '0'], bigint_power10(len - i - 1));
-        bigint_t temp_sum = bigint_sum(out, temp_prod);
-        bigint_delete(&out);
-        out = temp_sum;
-        bigint_delete(&temp_prod);
+    bool neg = string[0] == '-';
+    if (neg && --len == 0) {
+        fprintf(stderr, "bigint_new: WARNING: negative input has length zero\n");
+        return long_to_bigint(0);
     }
 
-    // Free digits
-    for (int i = 0; i < 10; i++)
-        bigint_delete(digit + i);
-
+    const bigint_t *pow = len > BIGINT_DEC_BASECASE_DIGITS
+        ? bigint_dec_powers(bigint_dec_levels(len)) : NULL;
+    bigint_t out = bigint_from_dec(string + neg, len, pow);
     if (neg) {
         bigint_t temp_neg = bigint_neg(out);
         bigint_delete(&out);
@@ -314,65 +669,73 @@ bigint_t bigint_new(char *string)
 
 const char const hex_digit[16] = {'0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f'};
 
-// Print n in base 10
-char * bigint_print(bigint_t n)
+// Write non-negative n < 10^width to out as exactly width digits, padded
+// with leading zeros: a word of digits at a time from the bottom for short
+// numbers, else as the quotient and remainder by a power from pow
+static void bigint_to_dec(bigint_t n, char *out, size_t width, const bigint_t *pow)
 {
-    bool neg = is_neg(n);
-    if (neg) {
-        n = bigint_neg(n);
-        n.size = bigint_min_words(n);
+    if (width > BIGINT_DEC_BASECASE_DIGITS) {
+        size_t j = bigint_dec_level(width);
+        size_t low_width = (size_t)BIGINT_DEC_WORD_DIGITS << j;
+        bigint_t rem;
+        bigint_t q = bigint_div(n, pow[j], &rem);
+        bigint_to_dec(q, out, width - low_width, pow);
+        bigint_to_dec(rem, out + width - low_width, low_width, pow);
+        bigint_delete(&q);
+        bigint_delete(&rem);
+        return;
     }
 
-    // Find first power of 10 greater than n
-    ssize_t i;
-    for (i = 1; true; i++) {
-        bigint_t temp_diff = bigint_diff(bigint_power10(i-1), n);
-        if (is_pos(temp_diff)) {
-            bigint_delete(&temp_diff);
-            i = ssmax(i - 2, 0);
-            break;
-        } else {
-            bigint_delete(&temp_diff);
+    const uword_t base = pow[0].val[0];
+    size_t qn = limb_normalize(n.val, n.size);
+    uword_t *q = instr_malloc((qn + 1) * sizeof(uword_t));
+    memcpy(q, n.val, qn * sizeof(uword_t));
+    for (size_t pos = width; pos > 0; ) {
+        uword_t chunk = 0;
+        if (qn) {
+            chunk = limb_divmod_1(q, q, qn, base);
+            qn = limb_normalize(q, qn);
+        }
+        for (size_t k = 0; k < BIGINT_DEC_WORD_DIGITS && pos > 0; k++) {
+            out[--pos] = hex_digit[chunk % 10];
+            chunk /= 10;
         }
     }
+    instr_free(q);
+}
 
-    ssize_t buffer_size = i + 1 + neg;
-    char *out = malloc(buffer_size + 1);
-
+// Print n in base 10
+char * bigint_print(bigint_t n)
+{
+    INSTR_SCOPE(INSTR_PRINT, n.size);
+    bool neg = is_neg(n);
     if (neg)
-        out[0] = '-';
-
-    // Compute each digit
-    bigint_t running = bigint_copy(n);
-    bigint_t rem;
-    for ( ; i >= 0; i--) {
-        bigint_t temp_digit = bigint_div(running, *(bigint_t*)array_get(powers10, i), &rem);
-        bigint_delete(&running);
-        running = rem;
-        long digit = bigint_to_long(temp_digit);
-        bigint_delete(&temp_digit);
-        // TODO
-        if (digit < 0 || digit > 10) {
-            printf("ERROR: digit offset: %d\n", digit);
-        }
-        out[buffer_size - i - 1] = hex_digit[digit];
-    }
-    out[buffer_size] = '\0';
+        n = bigint_neg(n);
 
-    bigint_delete(&running);
+    // log10(2) < 0.30103, so n < 10^width
+    size_t width = bigint_bits(n) * 30103 / 100000 + 1;
+    char *out = instr_malloc(width + neg + 1);
+    bigint_to_dec(n, out + neg, width, bigint_dec_powers(bigint_dec_levels(width)));
 
-    // Free n if necessary
-    if (neg)
+    // Drop the padding, keeping one digit for zero
+    size_t zeros = 0;
+    while (zeros + 1 < width && out[neg + zeros] == '0')
+        zeros++;
+    memmove(out + neg, out + neg + zeros, width - zeros);
+    out[neg + width - zeros] = '\0';
+    if (neg) {
+        out[0] = '-';
         bigint_delete(&n);
-
+    }
     return out;
 }
 
 // Print n in hexadecimal
 char * bigint_print_hex(bigint_t n)
 {
+    INSTR_SCOPE(INSTR_PRINT_HEX, n.size);
     const size_t buffer_size = (WORD_BITS >> 2) * n.size + 1;
-    char *buffer = malloc(buffer_size);
+    char *buffer = instr_malloc(buffer_size);
 
     for (size_t i = n.size - 1; i < n.size; i--) {
         for (size_t j = WORD_BITS - 4; j < WORD_BITS; j -= 4) {
@@ -386,18 +749,321 @@ char * bigint_print_hex(bigint_t n)
     return buffer;
 }
 
-// Initialize bigint runtime data structures
+enum { BIGINT_HEX_CHUNK_WORDS = 1024 };
+
+// Write n in hexadecimal to f, as bigint_print_hex would, a block of words
+// at a time instead of building the whole string; return false on a write error
+bool bigint_write_hex(bigint_t n, FILE *f)
+{
+    INSTR_SCOPE(INSTR_PRINT_HEX, n.size);
+    char buf[BIGINT_HEX_CHUNK_WORDS * (WORD_BITS >> 2)];
+
+    for (size_t top = n.size; top > 0; ) {
+        size_t len = smin(top, BIGINT_HEX_CHUNK_WORDS);
+        size_t next = top - len;
+        bigint_advise(n, next - smin(next, BIGINT_HEX_CHUNK_WORDS),
+            smin(next, BIGINT_HEX_CHUNK_WORDS), BIGINT_ACCESS_WILLNEED);
+
+        char *c = buf;
+        for (size_t i = top; i-- > next; )
+            for (size_t j = WORD_BITS - 4; j < WORD_BITS; j -= 4)
+                *c++ = hex_digit[(n.val[i] >> j) & 0xf];
+        if (fwrite(buf, 1, c - buf, f) != (size_t)(c - buf))
+            return false;
+        top = next;
+    }
+    return true;
+}
+
+// Initialize bigint runtime data structures and pick CPU kernels
 void bigint_init(void)
 {
-    powers10 = array_new(sizeof(bigint_t));
+    limb_dispatch(cpu_select_tier());
 }
 
 // Free bigint runtime data structures
 void bigint_exit(void)
 {
     // Free powers10
-    for (size_t i = 0; i < powers10.size; i++) {
-        bigint_delete((bigint_t*)array_get(powers10, i));
+    size_t count = atomic_load(&powers10_count);
+    for (size_t i = 0; i < count; i++)
+        bigint_delete(&powers10[i]);
+    atomic_store(&powers10_count, 0);
+
+    mod_cache_clear();
+    pool_default_exit();
+    free(bigint_map_dir);
+    bigint_map_dir = NULL;
+}
+
+enum { BIGINT_TEST_THREADS = 4, BIGINT_TEST_COPIES = 10000 };
+
+// Copy and delete a shared constant, checking it is unchanged
+static void *bigint_test_share_thread(void *arg)
+{
+    bigint_t shared = *(bigint_t *)arg;
+    uintptr_t errors = 0;
+    for (int i = 0; i < BIGINT_TEST_COPIES; i++) {
+        bigint_t c = bigint_copy(shared);
+        errors += c.val != shared.val;
+        if (i % 100 == 0) {
+            bigint_detach(&c);
+            errors += c.val == shared.val || !bigint_equals(c, shared);
+        }
+        bigint_delete(&c);
+    }
+    return (void *)errors;
+}
+
+// Testing
+int bigint_test(void)
+{
+    int total_errors = 0;
+    bool test;
+    char *p1, *p2;
+
+    // ChaCha20 with an all-zero key and nonce (RFC 8439, A.1): the first 32
+    // bytes of block 0 become the next key, so output starts at byte 32
+    static const uint8_t zero_seed[RNG_SEED_BYTES] = { 0 };
+    static const uint8_t expect[8] = { 0xda, 0x41, 0x59, 0x7c, 0x51, 0x57, 0x48, 0x8d };
+    uint8_t bytes[8];
+    rng_seed(zero_seed);
+    rng_bytes(bytes, sizeof(bytes));
+    test = memcmp(bytes, expect, sizeof(bytes)) == 0;
+    printf("%s: rng_seed(0) stream matches ChaCha20 test vector\n", test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Seeded streams are reproducible
+    rng_seed(zero_seed);
+    bigint_t r1 = bigint_random_bits(300);
+    rng_seed(zero_seed);
+    bigint_t r2 = bigint_random_bits(300);
+    test = bigint_equals(r1, r2) && !is_neg(r1);
+    printf("%s: bigint_random_bits(300) == %s after reseeding\n",
+        test ? "TRUE" : "FALSE",
+        p1 = bigint_print(r2));
+    free(p1);
+    total_errors += !test;
+    bigint_delete(&r1);
+    bigint_delete(&r2);
+    rng_seed(NULL);
+
+    // A forked child does not repeat the parent's stream
+    uint8_t parent_bytes[32], child_bytes[32];
+    int fds[2];
+    rng_bytes(parent_bytes, 1);
+    test = pipe(fds) == 0;
+    if (test) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            rng_bytes(child_bytes, sizeof(child_bytes));
+            _exit(write(fds[1], child_bytes, sizeof(child_bytes)) != sizeof(child_bytes));
+        }
+        rng_bytes(parent_bytes, sizeof(parent_bytes));
+        test = pid > 0 && read(fds[0], child_bytes, sizeof(child_bytes)) == sizeof(child_bytes)
+            && waitpid(pid, NULL, 0) == pid
+            && memcmp(parent_bytes, child_bytes, sizeof(child_bytes)) != 0;
+        close(fds[0]);
+        close(fds[1]);
+    }
+    printf("%s: rng reseeds in a forked child\n", test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Samples stay below the bound
+    bigint_t n = bigint_new("1000000000000000000000000");
+    test = true;
+    for (int i = 0; i < 100; i++) {
+        bigint_t r = bigint_random_below(n);
+        bigint_t diff = bigint_diff(r, n);
+        test &= !is_neg(r) && is_neg(diff);
+        bigint_delete(&r);
+        bigint_delete(&diff);
+    }
+    printf("%s: 0 <= bigint_random_below(%s) < n\n", test ? "TRUE" : "FALSE", p2 = bigint_print(n));
+    free(p2);
+    total_errors += !test;
+
+    // Copies of shared values share limbs until detached; writes through a
+    // detached copy leave the others alone
+    bigint_t s = bigint_share(bigint_copy(n));
+    bigint_t c1 = bigint_copy(s), c2 = bigint_resize(s, s.size);
+    bigint_t hi = bigint_max(s, n);
+    test = bigint_is_shared(s) && c1.val == s.val && c2.val == s.val && hi.val == s.val
+        && !bigint_is_shared(n);
+    bigint_detach(&c1);
+    c1.val[0] ^= 1;
+    test &= c1.val != s.val && !bigint_is_shared(c1) && bigint_equals(s, n) && !bigint_equals(c1, n);
+    bigint_delete(&c1);
+    bigint_delete(&c2);
+    bigint_delete(&hi);
+    uword_t *val = s.val;
+    bigint_detach(&s);
+    test &= s.val == val && !bigint_is_shared(s);
+    printf("%s: bigint_copy of shared values is O(1) and bigint_detach copies on write\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+    bigint_delete(&s);
+
+    // Owners of a shared constant on several threads
+    s = bigint_share(bigint_copy(n));
+    pthread_t threads[BIGINT_TEST_THREADS];
+    for (int i = 0; i < BIGINT_TEST_THREADS; i++)
+        pthread_create(&threads[i], NULL, bigint_test_share_thread, &s);
+    uintptr_t thread_errors = 0;
+    for (int i = 0; i < BIGINT_TEST_THREADS; i++) {
+        void *ret;
+        pthread_join(threads[i], &ret);
+        thread_errors += (uintptr_t)ret;
     }
-    array_delete(&powers10);
+    test = thread_errors == 0 && bigint_is_shared(s) && bigint_equals(s, n);
+    bigint_detach(&s);
+    test &= !bigint_is_shared(s);
+    printf("%s: %d threads copy and detach a shared constant\n",
+        test ? "TRUE" : "FALSE", BIGINT_TEST_THREADS);
+    total_errors += !test;
+    bigint_delete(&s);
+    bigint_delete(&n);
+
+    // Buffers above a small threshold are mapped, anonymously and from
+    // unlinked files; blocked products of mapped operands match heap ones
+    bigint_t x = bigint_random_bits(3000 * WORD_BITS);
+    bigint_t y = bigint_random_bits(2000 * WORD_BITS);
+    bigint_t xy = bigint_prod(x, y);
+    test = !bigint_is_mapped(xy);
+    const char *dir = getenv("TMPDIR");
+    bigint_storage_t storage = { .map_bytes = 4096 };
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1)
+            storage.file_dir = dir && *dir ? dir : "/tmp";
+        bigint_set_storage(&storage);
+        bigint_t mx = bigint_copy(x), my = bigint_neg(y);
+        bigint_t got = bigint_prod(mx, my);
+        bigint_t back = bigint_neg(got);
+        test &= bigint_is_mapped(mx) && bigint_is_mapped(my) && bigint_is_mapped(got)
+            && bigint_equals(back, xy);
+        bigint_delete(&mx);
+        bigint_delete(&my);
+        bigint_delete(&got);
+        bigint_delete(&back);
+    }
+    bigint_set_storage(NULL);
+    printf("%s: mapped limbs and blocked products match heap products\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // A named file survives unmapping, and hex streams match bigint_print_hex
+    char path[] = "/tmp/lcrypt-bigint-test-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    bigint_t file = bigint_map_file(path, xy.size);
+    memcpy(file.val, xy.val, xy.size * sizeof(uword_t));
+    bigint_advise(file, 0, file.size, BIGINT_ACCESS_SEQUENTIAL);
+    test = bigint_is_mapped(file) && bigint_flush(file);
+    bigint_delete(&file);
+    file = bigint_map_file(path, 0);
+    test &= file.size == xy.size && bigint_equals(file, xy);
+
+    char *stream;
+    size_t stream_len;
+    FILE *f = open_memstream(&stream, &stream_len);
+    test &= bigint_write_hex(file, f);
+    fclose(f);
+    p1 = bigint_print_hex(xy);
+    test &= strcmp(stream, p1) == 0;
+    printf("%s: bigint_map_file persists limbs and bigint_write_hex streams %zu digits\n",
+        test ? "TRUE" : "FALSE", stream_len);
+    total_errors += !test;
+    free(stream);
+    free(p1);
+    bigint_delete(&file);
+    unlink(path);
+    bigint_delete(&x);
+    bigint_delete(&y);
+    bigint_delete(&xy);
+
+    // Long numbers convert by splitting at powers of ten, including at widths
+    // around the base case and with leading zeros inside the low halves
+    test = true;
+    char *nines = malloc(5002);
+    memset(nines, '9', 5001);
+    bigint_t one = long_to_bigint(1), ten = long_to_bigint(10);
+    bigint_t pow10 = long_to_bigint(1);
+    for (size_t k = 1; k <= 5001; k++) {
+        y = bigint_prod(pow10, ten);
+        bigint_delete(&pow10);
+        pow10 = y;
+        if (k != 1215 && k != 1216 && k != 1217 && k != 2432 && k != 5001)
+            continue;
+        nines[k] = 0;
+        bigint_t below = bigint_diff(pow10, one);
+        p1 = bigint_print(below);
+        x = bigint_new(nines);
+        test &= strcmp(p1, nines) == 0 && bigint_equals(x, below);
+        free(p1);
+        bigint_delete(&x);
+        p1 = bigint_print(pow10);
+        x = bigint_new(p1);
+        test &= p1[0] == '1' && strspn(p1 + 1, "0") == k && p1[k + 1] == 0;
+        test &= bigint_equals(x, pow10);
+        free(p1);
+        bigint_delete(&x);
+        bigint_delete(&below);
+        nines[k] = '9';
+    }
+    x = bigint_random_bits(40000);
+    y = bigint_neg(x);
+    p1 = bigint_print(y);
+    bigint_t back = bigint_new(p1);
+    test &= p1[0] == '-' && bigint_equals(back, y);
+    printf("%s: numbers of up to %zu digits print and parse\n",
+        test ? "TRUE" : "FALSE", strlen(p1) - 1);
+    total_errors += !test;
+    free(p1);
+    free(nines);
+    bigint_delete(&back);
+    bigint_delete(&x);
+    bigint_delete(&y);
+    bigint_delete(&one);
+    bigint_delete(&pow10);
+
+    // The generated powers match repeated products, and numbers long enough
+    // to split past the last of them print and parse
+    enum { PAST_TABLE = BIGINT_DEC_WORD_DIGITS << (TABLES_POW10 + 1) };
+    test = true;
+    char *digits = malloc(PAST_TABLE + 2);
+    memset(digits, '9', PAST_TABLE + 1);
+    one = long_to_bigint(1);
+    pow10 = long_to_bigint(1);
+    for (size_t k = 1, j = 0; k <= PAST_TABLE + 1; k++) {
+        y = bigint_prod(pow10, ten);
+        bigint_delete(&pow10);
+        pow10 = y;
+        if (j < TABLES_POW10 && k == (size_t)BIGINT_DEC_WORD_DIGITS << j) {
+            x = bigint_from_limbs(tables_pow10 + tables_pow10_start[j],
+                tables_pow10_start[j + 1] - tables_pow10_start[j]);
+            test &= bigint_equals(x, pow10);
+            bigint_delete(&x);
+            j++;
+        }
+        if (k + 1 < PAST_TABLE)
+            continue;
+        digits[k] = 0;
+        bigint_t below = bigint_diff(pow10, one);
+        p1 = bigint_print(below);
+        x = bigint_new(digits);
+        test &= strcmp(p1, digits) == 0 && bigint_equals(x, below);
+        free(p1);
+        bigint_delete(&x);
+        bigint_delete(&below);
+        digits[k] = '9';
+    }
+    printf("%s: %d generated powers of ten match and numbers of %d digits convert\n",
+        test ? "TRUE" : "FALSE", TABLES_POW10, PAST_TABLE);
+    total_errors += !test;
+    free(digits);
+    bigint_delete(&one);
+    bigint_delete(&pow10);
+    bigint_delete(&ten);
+
+    return total_errors;
 }
@@ -7,6 +7,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
 // This is needed for uword_t
 #include "int_math.h"
@@ -15,16 +16,62 @@
 enum {
     BITS_PER_BYTE = 8,
     WORD_BITS = BITS_PER_BYTE * sizeof(uword_t),
+    BIGINT_HEADER_WORDS = 2,    // Reference count and storage in front of the limbs
 };
 
+// Limbs are private to one owner unless marked shared by bigint_share, after
+// which copies only count owners and writers must call bigint_detach first
 typedef struct {
     size_t  size;
     uword_t  *val;
 } bigint_t;
 
+// Where large limb buffers are kept
+typedef struct {
+    size_t map_bytes;       // Buffers of at least this many bytes are mapped
+                            // rather than allocated (0: never)
+    const char *file_dir;   // Back mapped buffers with unlinked files in this
+                            // directory (NULL: anonymous memory, on huge pages
+                            // when available)
+} bigint_storage_t;
+
+enum { BIGINT_MAP_DEFAULT_BYTES = 64 << 20 };
+
+// Access patterns for bigint_advise
+typedef enum {
+    BIGINT_ACCESS_NORMAL,
+    BIGINT_ACCESS_SEQUENTIAL,   // One pass in increasing order
+    BIGINT_ACCESS_RANDOM,
+    BIGINT_ACCESS_WILLNEED,     // Read ahead now
+    BIGINT_ACCESS_COLD,         // Not needed soon; reclaim first
+} bigint_access_t;
+
 // Free bigint
 void bigint_delete(bigint_t *n);
 
+// Set where limb buffers of at least opts->map_bytes bytes are kept (NULL:
+// defaults). The directory name is copied.
+void bigint_set_storage(const bigint_storage_t *opts);
+
+// Return the threshold above which limb buffers are mapped (0: never)
+size_t bigint_storage_map_bytes(void);
+
+// Return whether the limbs of n are in a mapping rather than on the heap
+bool bigint_is_mapped(bigint_t n);
+
+// Return size words kept in the file at path (created or resized to hold
+// them; size 0 keeps the current length), or a zero-size bigint on failure.
+// Files hold BIGINT_HEADER_WORDS words of header, then the limbs.
+bigint_t bigint_map_file(const char *path, size_t size);
+
+// Write the limbs of n back to its file, as mapped by bigint_map_file;
+// return false if n has no file or the write fails
+bool bigint_flush(bigint_t n);
+
+// Hint how words [first, first + words) of n will be used next. Only mapped
+// limbs take the hint; heap limbs are left to the hardware prefetchers.
+void bigint_advise(bigint_t n, size_t first, size_t words, bigint_access_t access);
+
 // Return zero of given size in words
 bigint_t bigint_zero(size_t size);
 
@@ -56,14 +103,32 @@ size_t bigint_min_words(bigint_t n);
 // Resize bigint to specified number of words
 bigint_t bigint_resize(bigint_t n, size_t size);
 
-// Make copy of n
+// Make copy of n (O(1) for shared n: the copy is one more owner)
 bigint_t bigint_copy(bigint_t n);
 
-// n >> k (in place)
+// Return n with its limbs marked shared, taking over the caller's ownership.
+// Copies of the result are O(1) and it must not be written before
+// bigint_detach; owners may live on different threads.
+bigint_t bigint_share(bigint_t n);
+
+// Return whether the limbs of n are shared
+bool bigint_is_shared(bigint_t n);
+
+// Give n private limbs before writing them, copying only if other owners remain
+void bigint_detach(bigint_t *n);
+
+// Return a private bigint of size words whose limbs follow the header in buf
+// (BIGINT_HEADER_WORDS + size words); it must not be passed to bigint_delete
+bigint_t bigint_view(uword_t *buf, size_t size);
+
+// Return non-negative integer whose magnitude is given by size words at val
+bigint_t bigint_from_limbs(const uword_t *val, size_t size);
+
+// n >> k (in place, n must not be shared)
 // NOTE It must be the case that k <= WORD_BITS
 bigint_t ip_sr(bigint_t n, size_t k);
 
-// n << k (in place)
+// n << k (in place, n must not be shared)
 // TODO support k > WORD_BITS
 bigint_t ip_sl(bigint_t n, size_t k);
 
@@ -73,6 +138,12 @@ bigint_t bigint_sl(bigint_t n, size_t k);
 // n >> k
 bigint_t bigint_sr(bigint_t n, size_t k);
 
+// Return uniformly random integer in [0, 2^bits)
+bigint_t bigint_random_bits(size_t bits);
+
+// Return uniformly random integer in [0, n) for positive n
+bigint_t bigint_random_below(bigint_t n);
+
 // Print each word in hex
 void bigint_print_words(bigint_t n);
 
@@ -85,10 +156,16 @@ char * bigint_print(bigint_t n);
 // Print n in hexadecimal
 char * bigint_print_hex(bigint_t n);
 
-// Initialize bigint runtime data structures
+// Write n in hexadecimal to f, as bigint_print_hex would, a block of words
+// at a time instead of building the whole string; return false on a write error
+bool bigint_write_hex(bigint_t n, FILE *f);
+
+// Initialize bigint runtime data structures and pick CPU kernels
 void bigint_init(void);
 // Free bigint runtime data structures
 void bigint_exit(void);
-void bigint_test(void);
+
+// Testing methods
+int bigint_test(void);
 
 #endif // BIGINT_H
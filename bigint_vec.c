@@ -0,0 +1,382 @@
+/**
+ * bigint_vec.c: Vectors of same-width unsigned integers, structure of arrays
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "bigint_vec.h"
+#include "limb.h"
+#include "math.h"
+#include "rng.h"
+
+enum { L = BIGINT_VEC_LANES };
+
+// Return zeroed vector of count elements of the given width
+bigint_vec_t bigint_vec_new(size_t count, size_t words)
+{
+    bigint_vec_t v = {
+        .count = count,
+        .words = words,
+        .stride = (count + L - 1) / L * L,
+    };
+    size_t bytes = v.words * v.stride * sizeof(uword_t);
+    v.val = aligned_alloc(64, bytes ? bytes : 64);
+    memset(v.val, 0, bytes);
+    return v;
+}
+
+// Free vector
+void bigint_vec_delete(bigint_vec_t *v)
+{
+    free(v->val);
+    v->val = NULL;
+    v->count = v->words = v->stride = 0;
+}
+
+// Copy element i into buf (BIGINT_HEADER_WORDS + v.words + 1 words) and return
+// it as a bigint using buf, so nothing is allocated; do not pass it to bigint_delete
+bigint_t bigint_vec_view(bigint_vec_t v, size_t i, uword_t *buf)
+{
+    bigint_t out = bigint_view(buf, v.words + 1);
+    for (size_t j = 0; j < v.words; j++)
+        out.val[j] = v.val[j * v.stride + i];
+    out.val[v.words] = 0;
+    return out;
+}
+
+// Store non-negative x as element i, return false if it is too wide
+bool bigint_vec_store(bigint_vec_t v, size_t i, bigint_t x)
+{
+    size_t n = limb_normalize(x.val, x.size);
+    if (is_neg(x) || n > v.words) {
+        fprintf(stderr, "bigint_vec_store: WARNING: value %s\n",
+            is_neg(x) ? "is negative" : "does not fit");
+        return false;
+    }
+    for (size_t j = 0; j < v.words; j++)
+        v.val[j * v.stride + i] = j < n ? x.val[j] : 0;
+    return true;
+}
+
+// Add rows of words words for lanes [0, stride); write the carry row and
+// zero rows up to out_words
+static void bigint_vec_add_c(uword_t *out, const uword_t *a, const uword_t *b,
+        size_t stride, size_t words, size_t out_words)
+{
+    for (size_t l = 0; l < stride; l += L) {
+        uword_t carry[L] = { 0 };
+        for (size_t j = 0; j < words; j++) {
+            const uword_t *x = a + j * stride + l, *y = b + j * stride + l;
+            uword_t *s = out + j * stride + l;
+            for (size_t k = 0; k < L; k++) {
+                uword_t t = x[k] + y[k];
+                uword_t c = t < x[k];
+                s[k] = t + carry[k];
+                carry[k] = c | (s[k] < t);
+            }
+        }
+        for (size_t j = words; j < out_words; j++)
+            for (size_t k = 0; k < L; k++)
+                out[j * stride + l + k] = j == words ? carry[k] : 0;
+    }
+}
+
+#if defined(__x86_64__)
+
+// Add rows of words words for lanes [0, stride); write the carry row and
+// zero rows up to out_words
+__attribute__((target("avx2")))
+static void bigint_vec_add_avx2(uword_t *out, const uword_t *a, const uword_t *b,
+        size_t stride, size_t words, size_t out_words)
+{
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i zero = _mm256_setzero_si256();
+    for (size_t l = 0; l < stride; l += 4) {
+        // Carries are all-ones lanes, so subtracting them adds one
+        __m256i carry = zero;
+        for (size_t j = 0; j < words; j++) {
+            __m256i x = _mm256_load_si256((const __m256i *)(a + j * stride + l));
+            __m256i y = _mm256_load_si256((const __m256i *)(b + j * stride + l));
+            __m256i s = _mm256_add_epi64(x, y);
+            __m256i g = _mm256_cmpgt_epi64(_mm256_xor_si256(x, sign), _mm256_xor_si256(s, sign));
+            s = _mm256_sub_epi64(s, carry);
+            carry = _mm256_or_si256(g, _mm256_and_si256(carry, _mm256_cmpeq_epi64(s, zero)));
+            _mm256_store_si256((__m256i *)(out + j * stride + l), s);
+        }
+        for (size_t j = words; j < out_words; j++) {
+            __m256i row = j == words ? _mm256_srli_epi64(carry, 63) : zero;
+            _mm256_store_si256((__m256i *)(out + j * stride + l), row);
+        }
+    }
+}
+
+// Add rows of words words for lanes [0, stride); write the carry row and
+// zero rows up to out_words
+__attribute__((target("avx512f")))
+static void bigint_vec_add_avx512(uword_t *out, const uword_t *a, const uword_t *b,
+        size_t stride, size_t words, size_t out_words)
+{
+    const __m512i one = _mm512_set1_epi64(1);
+    for (size_t l = 0; l < stride; l += L) {
+        __mmask8 carry = 0;
+        for (size_t j = 0; j < words; j++) {
+            __m512i x = _mm512_load_si512(a + j * stride + l);
+            __m512i y = _mm512_load_si512(b + j * stride + l);
+            __m512i s = _mm512_add_epi64(x, y);
+            __mmask8 g = _mm512_cmplt_epu64_mask(s, x);
+            s = _mm512_mask_add_epi64(s, carry, s, one);
+            carry = g | _mm512_mask_cmpeq_epi64_mask(carry, s, _mm512_setzero_si512());
+            _mm512_store_si512(out + j * stride + l, s);
+        }
+        for (size_t j = words; j < out_words; j++)
+            _mm512_store_si512(out + j * stride + l, _mm512_maskz_mov_epi64(j == words ? carry : 0, one));
+    }
+}
+
+#endif // __x86_64__
+
+// Return whether the vectors have the same number of elements, warning on
+// behalf of fn otherwise
+static bool bigint_vec_check(bigint_vec_t a, bigint_vec_t b, const char *fn)
+{
+    if (a.count == b.count)
+        return true;
+    fprintf(stderr, "%s: WARNING: vectors of %zu and %zu elements\n", fn, a.count, b.count);
+    return false;
+}
+
+// out = a + b element-wise (a and b of one width, out at least as wide; a
+// wider out keeps the carries, a same-width one wraps around)
+void bigint_vec_add(bigint_vec_t out, bigint_vec_t a, bigint_vec_t b)
+{
+    if (!bigint_vec_check(a, b, "bigint_vec_add") || !bigint_vec_check(out, a, "bigint_vec_add"))
+        return;
+    if (a.words != b.words || out.words < a.words) {
+        fprintf(stderr, "bigint_vec_add: WARNING: mismatched widths\n");
+        return;
+    }
+
+#if defined(__x86_64__)
+    if (limb_tier() >= CPU_TIER_AVX512) {
+        bigint_vec_add_avx512(out.val, a.val, b.val, a.stride, a.words, out.words);
+        return;
+    }
+    if (limb_tier() >= CPU_TIER_AVX2) {
+        bigint_vec_add_avx2(out.val, a.val, b.val, a.stride, a.words, out.words);
+        return;
+    }
+#endif
+    bigint_vec_add_c(out.val, a.val, b.val, a.stride, a.words, out.words);
+}
+
+// out = a * b element-wise (out at least a.words + b.words wide, not
+// aliasing a or b)
+void bigint_vec_mul(bigint_vec_t out, bigint_vec_t a, bigint_vec_t b)
+{
+    if (!bigint_vec_check(a, b, "bigint_vec_mul") || !bigint_vec_check(out, a, "bigint_vec_mul"))
+        return;
+    if (out.words < a.words + b.words) {
+        fprintf(stderr, "bigint_vec_mul: WARNING: output too narrow\n");
+        return;
+    }
+
+    // Schoolbook by rows, with the lanes innermost
+    const size_t s = a.stride;
+    memset(out.val, 0, out.words * s * sizeof(uword_t));
+    for (size_t l = 0; l < s; l += L) {
+        for (size_t i = 0; i < a.words; i++) {
+            const uword_t *x = a.val + i * s + l;
+            uword_t carry[L] = { 0 };
+            for (size_t j = 0; j < b.words; j++) {
+                const uword_t *y = b.val + j * s + l;
+                uword_t *z = out.val + (i + j) * s + l;
+                for (size_t k = 0; k < L; k++) {
+                    udword_t t = (udword_t)x[k] * y[k] + z[k] + carry[k];
+                    z[k] = (uword_t)t;
+                    carry[k] = (uword_t)(t >> WORD_BITS);
+                }
+            }
+            memcpy(out.val + (i + b.words) * s + l, carry, sizeof(carry));
+        }
+    }
+}
+
+// out = a * b / R mod n element-wise, for elements of ctx->size words below n
+// (out may alias a or b)
+void bigint_vec_mont_mul(const mont_ctx_t *ctx, bigint_vec_t out, bigint_vec_t a,
+        bigint_vec_t b)
+{
+    if (!bigint_vec_check(a, b, "bigint_vec_mont_mul")
+            || !bigint_vec_check(out, a, "bigint_vec_mont_mul"))
+        return;
+    const size_t n = ctx->size;
+    if (a.words != n || b.words != n || out.words != n) {
+        fprintf(stderr, "bigint_vec_mont_mul: WARNING: elements must be %zu words\n", n);
+        return;
+    }
+
+    // CIOS on L lanes at once: t has n + 2 rows of L lanes
+    const size_t s = a.stride;
+    uword_t t[(n + 2) * L];
+    for (size_t l = 0; l < s; l += L) {
+        memset(t, 0, sizeof(t));
+        for (size_t i = 0; i < n; i++) {
+            const uword_t *y = b.val + i * s + l;
+            uword_t carry[L] = { 0 };
+            for (size_t j = 0; j < n; j++) {
+                const uword_t *x = a.val + j * s + l;
+                for (size_t k = 0; k < L; k++) {
+                    udword_t p = (udword_t)x[k] * y[k] + t[j * L + k] + carry[k];
+                    t[j * L + k] = (uword_t)p;
+                    carry[k] = (uword_t)(p >> WORD_BITS);
+                }
+            }
+            for (size_t k = 0; k < L; k++) {
+                udword_t p = (udword_t)t[n * L + k] + carry[k];
+                t[n * L + k] = (uword_t)p;
+                t[(n + 1) * L + k] = (uword_t)(p >> WORD_BITS);
+            }
+
+            uword_t m[L];
+            for (size_t k = 0; k < L; k++) {
+                m[k] = t[k] * ctx->n0inv;
+                udword_t p = (udword_t)m[k] * ctx->n[0] + t[k];
+                carry[k] = (uword_t)(p >> WORD_BITS);
+            }
+            for (size_t j = 1; j < n; j++) {
+                for (size_t k = 0; k < L; k++) {
+                    udword_t p = (udword_t)m[k] * ctx->n[j] + t[j * L + k] + carry[k];
+                    t[(j - 1) * L + k] = (uword_t)p;
+                    carry[k] = (uword_t)(p >> WORD_BITS);
+                }
+            }
+            for (size_t k = 0; k < L; k++) {
+                udword_t p = (udword_t)t[n * L + k] + carry[k];
+                t[(n - 1) * L + k] = (uword_t)p;
+                t[n * L + k] = t[(n + 1) * L + k] + (uword_t)(p >> WORD_BITS);
+            }
+        }
+
+        // Subtract n from the lanes at or above it, without branching
+        uword_t borrow[L] = { 0 };
+        uword_t d[n * L];
+        for (size_t j = 0; j < n; j++) {
+            for (size_t k = 0; k < L; k++) {
+                uword_t x = t[j * L + k], y = ctx->n[j];
+                uword_t r = x - y;
+                uword_t b1 = r > x;
+                d[j * L + k] = r - borrow[k];
+                borrow[k] = b1 | (d[j * L + k] > r);
+            }
+        }
+        for (size_t k = 0; k < L; k++)
+            borrow[k] = -(borrow[k] & (t[n * L + k] == 0));
+        for (size_t j = 0; j < n; j++)
+            for (size_t k = 0; k < L; k++)
+                out.val[j * s + l + k] = (d[j * L + k] & ~borrow[k]) | (t[j * L + k] & borrow[k]);
+    }
+}
+
+// Testing
+int bigint_vec_test(void)
+{
+    int total_errors = 0;
+    static const size_t counts[] = { 1, 7, 8, 13, 64 };
+    static const size_t widths[] = { 1, 3, 16 };
+
+    // Every supported tier of the add kernel, and mul against limb_mul
+    const cpu_tier_t saved = limb_tier();
+    for (cpu_tier_t tier = CPU_TIER_PORTABLE; tier <= cpu_best_tier(); tier++) {
+        limb_dispatch(tier);
+        int errors = 0;
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+            for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+                const size_t count = counts[c], words = widths[w];
+                bigint_vec_t a = bigint_vec_new(count, words), b = bigint_vec_new(count, words);
+                bigint_vec_t sum = bigint_vec_new(count, words + 1);
+                bigint_vec_t wrap = bigint_vec_new(count, words);
+                bigint_vec_t prod = bigint_vec_new(count, 2 * words);
+                rng_words(a.val, a.words * a.stride);
+                rng_words(b.val, b.words * b.stride);
+                // Runs of all-ones words that carries must ripple through
+                for (size_t j = 0; j < words / 2; j++)
+                    for (size_t i = 0; i < count; i += 2)
+                        a.val[j * a.stride + i] = ~b.val[j * b.stride + i];
+
+                bigint_vec_add(sum, a, b);
+                bigint_vec_add(wrap, a, b);
+                bigint_vec_mul(prod, a, b);
+                for (size_t i = 0; i < count; i++) {
+                    uword_t xb[BIGINT_HEADER_WORDS + words + 1], yb[BIGINT_HEADER_WORDS + words + 1];
+                    uword_t z[BIGINT_HEADER_WORDS + 2 * words + 1], e[2 * words];
+                    const uword_t *x = bigint_vec_view(a, i, xb).val;
+                    const uword_t *y = bigint_vec_view(b, i, yb).val;
+                    e[words] = limb_add_n(e, x, y, words);
+                    bigint_t got = bigint_vec_view(sum, i, z);
+                    errors += limb_cmp(got.val, e, words + 1) != 0;
+                    got = bigint_vec_view(wrap, i, z);
+                    errors += limb_cmp(got.val, e, words) != 0;
+                    limb_mul(e, x, words, y, words);
+                    got = bigint_vec_view(prod, i, z);
+                    errors += limb_cmp(got.val, e, 2 * words) != 0;
+                }
+                bigint_vec_delete(&a);
+                bigint_vec_delete(&b);
+                bigint_vec_delete(&sum);
+                bigint_vec_delete(&wrap);
+                bigint_vec_delete(&prod);
+            }
+        }
+        bool test = errors == 0;
+        printf("%s: %s bigint_vec add and mul match limb kernels\n",
+            test ? "TRUE" : "FALSE", cpu_tier_name(tier));
+        total_errors += !test;
+    }
+    limb_dispatch(saved);
+
+    // Montgomery products against mont_mul, through store and view, also
+    // with the output aliasing an input
+    int errors = 0;
+    for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+        bigint_t n = bigint_random_bits(widths[w] * WORD_BITS - (w == 0));
+        n.val[0] |= 1;
+        mont_ctx_t ctx = mont_new(n);
+        const size_t count = 13, words = ctx.size;
+        bigint_vec_t a = bigint_vec_new(count, words), b = bigint_vec_new(count, words);
+        bigint_vec_t p = bigint_vec_new(count, words);
+        for (size_t i = 0; i < count; i++) {
+            bigint_t x = bigint_random_below(n), y = bigint_random_below(n);
+            errors += !bigint_vec_store(a, i, x) + !bigint_vec_store(b, i, y);
+            bigint_delete(&x);
+            bigint_delete(&y);
+        }
+        bigint_vec_mont_mul(&ctx, p, a, b);
+        for (size_t i = 0; i < count; i++) {
+            uword_t xb[BIGINT_HEADER_WORDS + words + 1], yb[BIGINT_HEADER_WORDS + words + 1];
+            uword_t z[BIGINT_HEADER_WORDS + words + 1], e[words];
+            const uword_t *x = bigint_vec_view(a, i, xb).val;
+            const uword_t *y = bigint_vec_view(b, i, yb).val;
+            mont_mul(&ctx, e, x, y);
+            bigint_t got = bigint_vec_view(p, i, z);
+            errors += limb_cmp(got.val, e, words) != 0;
+        }
+        bigint_vec_mont_mul(&ctx, a, a, b);
+        errors += memcmp(a.val, p.val, words * a.stride * sizeof(uword_t)) != 0;
+        bigint_vec_delete(&a);
+        bigint_vec_delete(&b);
+        bigint_vec_delete(&p);
+        mont_delete(&ctx);
+        bigint_delete(&n);
+    }
+    bool test = errors == 0;
+    printf("%s: bigint_vec_mont_mul matches mont_mul\n", test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    return total_errors;
+}
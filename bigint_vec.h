@@ -0,0 +1,58 @@
+/**
+ * bigint_vec.h: Vectors of same-width unsigned integers, structure of arrays
+ *
+ * All limbs of the vector live in one 64-byte aligned buffer, interleaved:
+ * word j of element i is at val[j * stride + i], with the stride rounded up
+ * to BIGINT_VEC_LANES. Each row of a word is then a run of whole vector
+ * registers, and the element-wise kernels process BIGINT_VEC_LANES elements
+ * per step with no carries between them. Elements are read and written
+ * through views that copy one element to or from a caller buffer.
+ */
+
+#ifndef BIGINT_VEC_H
+#define BIGINT_VEC_H
+
+#include <stdbool.h>
+
+#include "bigint.h"
+#include "mont.h"
+
+enum { BIGINT_VEC_LANES = 8 };  // Elements per 64-byte row
+
+typedef struct {
+    size_t count;       // Number of elements
+    size_t words;       // Words per element
+    size_t stride;      // Distance between consecutive words of an element
+    uword_t *val;       // words * stride words
+} bigint_vec_t;
+
+// Return zeroed vector of count elements of the given width
+bigint_vec_t bigint_vec_new(size_t count, size_t words);
+
+// Free vector
+void bigint_vec_delete(bigint_vec_t *v);
+
+// Copy element i into buf (BIGINT_HEADER_WORDS + v.words + 1 words) and return
+// it as a bigint using buf, so nothing is allocated; do not pass it to bigint_delete
+bigint_t bigint_vec_view(bigint_vec_t v, size_t i, uword_t *buf);
+
+// Store non-negative x as element i, return false if it is too wide
+bool bigint_vec_store(bigint_vec_t v, size_t i, bigint_t x);
+
+// out = a + b element-wise (a and b of one width, out at least as wide; a
+// wider out keeps the carries, a same-width one wraps around)
+void bigint_vec_add(bigint_vec_t out, bigint_vec_t a, bigint_vec_t b);
+
+// out = a * b element-wise (out at least a.words + b.words wide, not
+// aliasing a or b)
+void bigint_vec_mul(bigint_vec_t out, bigint_vec_t a, bigint_vec_t b);
+
+// out = a * b / R mod n element-wise, for elements of ctx->size words below n
+// (out may alias a or b)
+void bigint_vec_mont_mul(const mont_ctx_t *ctx, bigint_vec_t out, bigint_vec_t a,
+        bigint_vec_t b);
+
+// Testing methods
+int bigint_vec_test(void);
+
+#endif // BIGINT_VEC_H
@@ -0,0 +1,797 @@
+/**
+ * calc.c: Streaming batch calculator
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "calc.h"
+#include "int_math.h"
+#include "limb.h"
+#include "math.h"
+#include "mod_math.h"
+#include "prime.h"
+
+static const char calc_b64_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Parser state: the unread rest of the line, the first error and how many
+// parentheses and negations enclose the current operand
+typedef struct {
+    const char *p;
+    const char *err;
+    size_t depth;
+} calc_parser_t;
+
+// Return the value of base64 digit c, or -1
+static int calc_b64_value(char c)
+{
+    const char *d = c ? strchr(calc_b64_digits, c) : NULL;
+    return d ? (int)(d - calc_b64_digits) : -1;
+}
+
+// Skip whitespace
+static void calc_skip(calc_parser_t *ps)
+{
+    while (isspace((unsigned char)*ps->p))
+        ps->p++;
+}
+
+// Return the hexadecimal digits s[0 .. len) as an integer
+static bigint_t calc_from_hex(const char *s, size_t len)
+{
+    bigint_t out = bigint_zero(len / (WORD_BITS / 4) + 2);
+    for (size_t i = 0; i < len; i++) {
+        char c = tolower((unsigned char)s[len - 1 - i]);
+        uword_t d = isdigit((unsigned char)c) ? c - '0' : c - 'a' + 10;
+        out.val[i / (WORD_BITS / 4)] |= d << (4 * (i % (WORD_BITS / 4)));
+    }
+    out.size = bigint_min_words(out);
+    return out;
+}
+
+// Return the integer whose big-endian bytes are base64 digits s[0 .. len),
+// with optional '=' padding
+static bigint_t calc_from_b64(const char *s, size_t len)
+{
+    while (len && s[len - 1] == '=')
+        len--;
+    size_t bytes = len * 6 / 8;
+    bigint_t out = bigint_zero(bytes / sizeof(uword_t) + 2);
+
+    // Decode from the front, then place byte j (from the end) in its word
+    uint8_t *buf = malloc(bytes + 1);
+    uword_t acc = 0;
+    size_t bits = 0, n = 0;
+    for (size_t i = 0; i < len; i++) {
+        acc = acc << 6 | calc_b64_value(s[i]);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            buf[n++] = (uint8_t)(acc >> bits);
+        }
+    }
+    for (size_t j = 0; j < n; j++)
+        out.val[j / sizeof(uword_t)] |= (uword_t)buf[n - 1 - j] << (8 * (j % sizeof(uword_t)));
+    free(buf);
+    out.size = bigint_min_words(out);
+    return out;
+}
+
+// Parse an operand into *out; return false with ps->err set on failure
+static bool calc_operand(calc_parser_t *ps, bigint_t *out)
+{
+    calc_skip(ps);
+    const char *p = ps->p;
+    bool neg = *p == '-';
+    p += neg;
+
+    const char *start;
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        start = p += 2;
+        while (isxdigit((unsigned char)*p))
+            p++;
+        if (p == start) {
+            ps->err = "expected hexadecimal digits";
+            return false;
+        }
+        *out = calc_from_hex(start, p - start);
+    } else if (strncmp(p, "b64:", 4) == 0) {
+        start = p += 4;
+        while (calc_b64_value(*p) >= 0)
+            p++;
+        while (*p == '=')
+            p++;
+        if (p == start) {
+            ps->err = "expected base64 digits";
+            return false;
+        }
+        *out = calc_from_b64(start, p - start);
+    } else if (isdigit((unsigned char)*p)) {
+        start = p;
+        while (isdigit((unsigned char)*p))
+            p++;
+        char *digits = strndup(start, p - start);
+        *out = bigint_new(digits);
+        free(digits);
+    } else {
+        ps->err = "expected a number";
+        return false;
+    }
+
+    if (neg) {
+        bigint_t t = bigint_neg(*out);
+        bigint_delete(out);
+        *out = t;
+    }
+    ps->p = p;
+    return true;
+}
+
+// Return whether n is a valid modulus, setting *err otherwise
+static bool calc_check_mod(bigint_t n, const char **err)
+{
+    if (is_pos(n))
+        return true;
+    *err = "modulus must be positive";
+    return false;
+}
+
+// Return whether b can divide, setting *err otherwise
+static bool calc_check_div(bigint_t b, const char **err)
+{
+    if (!is_zero(b))
+        return true;
+    *err = "division by zero";
+    return false;
+}
+
+// Operations: out = f(v) for the record's operands, or false with *err set
+typedef bool (*calc_fn_t)(bigint_t *out, const bigint_t *v, const char **err);
+
+static bool calc_add(bigint_t *out, const bigint_t *v, const char **err)
+{
+    (void)err;
+    *out = bigint_sum(v[0], v[1]);
+    return true;
+}
+
+static bool calc_sub(bigint_t *out, const bigint_t *v, const char **err)
+{
+    (void)err;
+    *out = bigint_diff(v[0], v[1]);
+    return true;
+}
+
+static bool calc_mul(bigint_t *out, const bigint_t *v, const char **err)
+{
+    (void)err;
+    *out = bigint_prod(v[0], v[1]);
+    return true;
+}
+
+static bool calc_div(bigint_t *out, const bigint_t *v, const char **err)
+{
+    if (!calc_check_div(v[1], err))
+        return false;
+    bigint_t rem;
+    *out = bigint_div(v[0], v[1], &rem);
+    bigint_delete(&rem);
+    return true;
+}
+
+static bool calc_mod(bigint_t *out, const bigint_t *v, const char **err)
+{
+    if (!calc_check_mod(v[1], err))
+        return false;
+    *out = mod(v[0], v[1]);
+    return true;
+}
+
+static bool calc_neg(bigint_t *out, const bigint_t *v, const char **err)
+{
+    (void)err;
+    *out = bigint_neg(v[0]);
+    return true;
+}
+
+static bool calc_gcd(bigint_t *out, const bigint_t *v, const char **err)
+{
+    (void)err;
+    *out = bigint_gcd(v[0], v[1]);
+    return true;
+}
+
+static bool calc_addmod(bigint_t *out, const bigint_t *v, const char **err)
+{
+    if (!calc_check_mod(v[2], err))
+        return false;
+    *out = mod_sum(v[0], v[1], v[2]);
+    return true;
+}
+
+static bool calc_submod(bigint_t *out, const bigint_t *v, const char **err)
+{
+    if (!calc_check_mod(v[2], err))
+        return false;
+    *out = mod_diff(v[0], v[1], v[2]);
+    return true;
+}
+
+static bool calc_mulmod(bigint_t *out, const bigint_t *v, const char **err)
+{
+    if (!calc_check_mod(v[2], err))
+        return false;
+    *out = mod_prod(v[0], v[1], v[2]);
+    return true;
+}
+
+// Return whether a has an inverse mod n > 0, setting *err otherwise
+static bool calc_check_inv(bigint_t a, bigint_t n, const char **err)
+{
+    // Everything is a unit mod 1, where the only residue is 0
+    bigint_t g = bigint_gcd(a, n);
+    bool unit = bigint_bits(n) == 1 || (limb_normalize(g.val, g.size) == 1 && g.val[0] == 1);
+    bigint_delete(&g);
+    if (!unit)
+        *err = "not invertible";
+    return unit;
+}
+
+static bool calc_inv(bigint_t *out, const bigint_t *v, const char **err)
+{
+    if (!calc_check_mod(v[1], err) || !calc_check_inv(v[0], v[1], err))
+        return false;
+    *out = mod_inv(v[0], v[1]);
+    return true;
+}
+
+static bool calc_exp(bigint_t *out, const bigint_t *v, const char **err)
+{
+    if (!calc_check_mod(v[2], err) || (is_neg(v[1]) && !calc_check_inv(v[0], v[2], err)))
+        return false;
+    *out = mod_exp(v[0], v[1], v[2]);
+    return true;
+}
+
+static bool calc_isqrt(bigint_t *out, const bigint_t *v, const char **err)
+{
+    if (is_neg(v[0])) {
+        *err = "negative operand";
+        return false;
+    }
+    *out = bigint_isqrt(v[0]);
+    return true;
+}
+
+static bool calc_iroot(bigint_t *out, const bigint_t *v, const char **err)
+{
+    // Indices past 32 bits are refused rather than truncated
+    long k = bigint_to_long(v[1]);
+    if (!is_pos(v[1]) || bigint_bits(v[1]) > 32 || (k % 2 == 0 && is_neg(v[0]))) {
+        *err = "bad root index";
+        return false;
+    }
+    *out = bigint_iroot(v[0], k);
+    return true;
+}
+
+static bool calc_jacobi(bigint_t *out, const bigint_t *v, const char **err)
+{
+    if (!is_pos(v[1]) || !(v[1].val[0] & 1)) {
+        *err = "modulus must be odd and positive";
+        return false;
+    }
+    *out = long_to_bigint(mod_jacobi(v[0], v[1]));
+    return true;
+}
+
+static bool calc_sqrtmod(bigint_t *out, const bigint_t *v, const char **err)
+{
+    if (!calc_check_mod(v[1], err))
+        return false;
+    // mod_sqrt assumes a prime modulus and answers wrongly for composites
+    if (!bigint_is_prime(v[1], 0, true)) {
+        *err = "modulus must be prime";
+        return false;
+    }
+    if (!mod_sqrt(out, v[0], v[1])) {
+        bigint_delete(out);
+        *err = "no square root";
+        return false;
+    }
+    return true;
+}
+
+static const struct {
+    const char *name;
+    size_t args;
+    calc_fn_t fn;
+} calc_ops[] = {
+    { "add",     2, calc_add },
+    { "sub",     2, calc_sub },
+    { "mul",     2, calc_mul },
+    { "div",     2, calc_div },         // Rounds toward zero
+    { "mod",     2, calc_mod },
+    { "neg",     1, calc_neg },
+    { "gcd",     2, calc_gcd },
+    { "addmod",  3, calc_addmod },
+    { "submod",  3, calc_submod },
+    { "mulmod",  3, calc_mulmod },
+    { "exp",     3, calc_exp },         // a^e mod n
+    { "inv",     2, calc_inv },
+    { "isqrt",   1, calc_isqrt },
+    { "iroot",   2, calc_iroot },       // a k
+    { "jacobi",  2, calc_jacobi },
+    { "sqrtmod", 2, calc_sqrtmod },     // Prime modulus
+};
+
+enum {
+    CALC_MAX_ARGS = 3,
+    CALC_MAX_DEPTH = 1000,      // Nested parentheses and negations in a line
+};
+
+static bool calc_expr(calc_parser_t *ps, bigint_t *out);
+
+// unary := '-' unary | '(' expr ')' | operand
+static bool calc_unary(calc_parser_t *ps, bigint_t *out)
+{
+    calc_skip(ps);
+    bool neg = *ps->p == '-' && !isdigit((unsigned char)ps->p[1]);
+    if (!neg && *ps->p != '(')
+        return calc_operand(ps, out);
+    if (ps->depth == CALC_MAX_DEPTH) {
+        ps->err = "expression too deep";
+        return false;
+    }
+
+    ps->p++;
+    ps->depth++;
+    bool ok = neg ? calc_unary(ps, out) : calc_expr(ps, out);
+    ps->depth--;
+    if (!ok)
+        return false;
+    if (neg) {
+        bigint_t t = bigint_neg(*out);
+        bigint_delete(out);
+        *out = t;
+        return true;
+    }
+    calc_skip(ps);
+    if (*ps->p != ')') {
+        bigint_delete(out);
+        ps->err = "expected ')'";
+        return false;
+    }
+    ps->p++;
+    return true;
+}
+
+// Apply binary operator op to a and b
+static bool calc_binary(calc_parser_t *ps, char op, bigint_t *out, bigint_t a, bigint_t b)
+{
+    const bigint_t v[2] = { a, b };
+    static const char ops[] = "+-*/%";
+    static const calc_fn_t fns[] = { calc_add, calc_sub, calc_mul, calc_div, calc_mod };
+    return fns[strchr(ops, op) - ops](out, v, &ps->err);
+}
+
+// Parse a left-associative chain of unary operands joined by the operators
+// in ops, or of such chains (for + and -) when ops is "+-"
+static bool calc_chain(calc_parser_t *ps, bigint_t *out, const char *ops)
+{
+    bool sum = ops[0] == '+';
+    if (!(sum ? calc_chain(ps, out, "*/%") : calc_unary(ps, out)))
+        return false;
+    for (;;) {
+        calc_skip(ps);
+        char op = *ps->p;
+        if (!op || !strchr(ops, op))
+            return true;
+        ps->p++;
+
+        bigint_t rhs, res;
+        bool ok = sum ? calc_chain(ps, &rhs, "*/%") : calc_unary(ps, &rhs);
+        if (ok) {
+            ok = calc_binary(ps, op, &res, *out, rhs);
+            bigint_delete(&rhs);
+        }
+        bigint_delete(out);
+        if (!ok)
+            return false;
+        *out = res;
+    }
+}
+
+// expr := term (('+' | '-') term)*, term := unary (('*' | '/' | '%') unary)*
+static bool calc_expr(calc_parser_t *ps, bigint_t *out)
+{
+    return calc_chain(ps, out, "+-");
+}
+
+// Parse and evaluate a record or expression
+static bool calc_parse(calc_parser_t *ps, bigint_t *out)
+{
+    calc_skip(ps);
+    if (!isalpha((unsigned char)*ps->p) || strncmp(ps->p, "b64:", 4) == 0) {
+        if (!calc_expr(ps, out))
+            return false;
+        calc_skip(ps);
+        if (*ps->p) {
+            bigint_delete(out);
+            ps->err = "unexpected input after expression";
+            return false;
+        }
+        return true;
+    }
+
+    const char *name = ps->p;
+    while (isalnum((unsigned char)*ps->p))
+        ps->p++;
+    size_t len = ps->p - name;
+    size_t op = 0;
+    const size_t num_ops = sizeof(calc_ops) / sizeof(calc_ops[0]);
+    while (op < num_ops && (strlen(calc_ops[op].name) != len
+            || strncmp(calc_ops[op].name, name, len)))
+        op++;
+    if (op == num_ops) {
+        ps->err = "unknown operation";
+        return false;
+    }
+
+    // Operands separated by whitespace
+    bigint_t v[CALC_MAX_ARGS];
+    size_t n = 0;
+    bool ok = true;
+    while (ok && n < calc_ops[op].args) {
+        if (!isspace((unsigned char)*ps->p)) {
+            ps->err = *ps->p ? "expected whitespace" : "too few operands";
+            ok = false;
+        } else if ((ok = calc_operand(ps, &v[n])))
+            n++;
+    }
+    if (ok) {
+        calc_skip(ps);
+        if (*ps->p) {
+            ps->err = "too many operands";
+            ok = false;
+        }
+    }
+    ok = ok && calc_ops[op].fn(out, v, &ps->err);
+    for (size_t i = 0; i < n; i++)
+        bigint_delete(&v[i]);
+    return ok;
+}
+
+// Write n to out in the given format
+static void calc_write(FILE *out, bigint_t n, calc_format_t format)
+{
+    bool neg = is_neg(n);
+    bigint_t mag = neg ? bigint_neg(n) : n;
+    size_t words = limb_normalize(mag.val, mag.size);
+    if (neg)
+        fputc('-', out);
+    if (format == CALC_DEC) {
+        char *digits = bigint_print(mag);
+        fputs(digits, out);
+        free(digits);
+    } else if (format == CALC_HEX) {
+        fputs("0x", out);
+        if (words == 0)
+            fputc('0', out);
+        for (size_t i = words; i-- > 0; )
+            fprintf(out, i + 1 == words ? "%llx" : "%016llx", (unsigned long long)mag.val[i]);
+    } else {
+        // Big-endian bytes without leading zeros, at least one
+        size_t bytes = words ? (limb_bits(mag.val, words) + 7) / 8 : 1;
+        fputs("b64:", out);
+        for (size_t i = 0; i < bytes; i += 3) {
+            uword_t group = 0;
+            for (size_t j = 0; j < 3; j++) {
+                size_t b = bytes - 1 - (i + j);
+                uword_t byte = i + j < bytes ? mag.val[b / sizeof(uword_t)]
+                    >> (8 * (b % sizeof(uword_t))) & 0xff : 0;
+                group = group << 8 | byte;
+            }
+            for (size_t j = 0; j < 4; j++)
+                fputc(j <= (bytes - i) ? calc_b64_digits[group >> (18 - 6 * j) & 0x3f] : '=', out);
+        }
+    }
+    if (neg)
+        bigint_delete(&mag);
+}
+
+// Evaluate one record or expression and write its result, or an error line,
+// to out without a newline; return false on error
+bool calc_eval(const char *line, calc_format_t format, FILE *out)
+{
+    calc_parser_t ps = { .p = line };
+    bigint_t result;
+    if (!calc_parse(&ps, &result)) {
+        fprintf(out, "error: %s", ps.err);
+        return false;
+    }
+    calc_write(out, result, format);
+    bigint_delete(&result);
+    return true;
+}
+
+// Lines read together and evaluated as one pool task
+typedef struct {
+    char *in;               // Lines, each ending in '\n'
+    size_t in_len;
+    size_t in_cap;
+    size_t lines;
+    char *out;              // Result lines, once the task is done
+    size_t out_len;
+    size_t records;
+    size_t errors;
+    calc_format_t format;
+    pool_group_t group;
+} calc_batch_t;
+
+// Evaluate the lines of a batch (a pool task)
+static void calc_batch_run(void *arg)
+{
+    calc_batch_t *b = arg;
+    FILE *out = open_memstream(&b->out, &b->out_len);
+    char *end = b->in + b->in_len;
+    for (char *line = b->in, *nl; line < end; line = nl + 1) {
+        nl = memchr(line, '\n', end - line);
+        *nl = 0;
+        if (nl > line && nl[-1] == '\r')
+            nl[-1] = 0;
+
+        const char *p = line;
+        while (isspace((unsigned char)*p))
+            p++;
+        if (!*p || *p == '#')
+            continue;
+        b->records++;
+        b->errors += !calc_eval(p, b->format, out);
+        fputc('\n', out);
+    }
+    fclose(out);
+}
+
+// Wait for batch b, write its results and reset it; return false on a write error
+static bool calc_batch_flush(pool_t *pool, calc_batch_t *b, FILE *out, calc_stats_t *stats)
+{
+    pool_wait(pool, &b->group);
+    bool ok = fwrite(b->out, 1, b->out_len, out) == b->out_len;
+    stats->records += b->records;
+    stats->errors += b->errors;
+    stats->bytes_out += b->out_len;
+    free(b->out);
+    b->out = NULL;
+    b->out_len = b->in_len = b->lines = b->records = b->errors = 0;
+    return ok;
+}
+
+// Return monotonic time in seconds
+static double calc_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Evaluate every line of in, writing results to out in order. Adds to *stats
+// (which may be NULL); opts may be NULL for defaults. Return false on an I/O
+// error.
+bool calc_run(FILE *in, FILE *out, const calc_opts_t *opts, calc_stats_t *stats)
+{
+    static const calc_opts_t defaults = { 0 };
+    if (!opts)
+        opts = &defaults;
+    pool_t *pool = opts->pool ? opts->pool : pool_default();
+    const size_t batch_lines = opts->batch_lines ? opts->batch_lines : CALC_BATCH_LINES;
+    const size_t max_batches = opts->max_batches ? opts->max_batches : 4 * pool_threads(pool);
+    calc_stats_t total = { 0 };
+    double start = calc_now();
+
+    // Ring of batches: head is the oldest in flight, the one after the last
+    // in flight is being filled
+    calc_batch_t *ring = calloc(max_batches + 1, sizeof(calc_batch_t));
+    size_t head = 0, flight = 0;
+    bool ok = true;
+    char *line = NULL;
+    size_t line_cap = 0;
+    for (;;) {
+        ssize_t len = getline(&line, &line_cap, in);
+        calc_batch_t *b = &ring[(head + flight) % (max_batches + 1)];
+        if (len > 0) {
+            total.bytes_in += len;
+            if (b->in_len + len + 1 > b->in_cap) {
+                b->in_cap = smax(b->in_len + len + 1, 2 * b->in_cap);
+                b->in = realloc(b->in, b->in_cap);
+            }
+            memcpy(b->in + b->in_len, line, len);
+            b->in_len += len;
+            if (line[len - 1] != '\n')
+                b->in[b->in_len++] = '\n';
+            if (++b->lines < batch_lines)
+                continue;
+        }
+        if (b->in_len) {
+            // Make room, then hand the batch to the pool
+            if (flight == max_batches) {
+                ok &= calc_batch_flush(pool, &ring[head], out, &total);
+                head = (head + 1) % (max_batches + 1);
+                flight--;
+            }
+            b->format = opts->format;
+            pool_group_init(&b->group);
+            pool_submit(pool, &b->group, calc_batch_run, b);
+            flight++;
+        }
+        if (len <= 0)
+            break;
+    }
+    ok &= !ferror(in);
+
+    for (; flight; flight--, head = (head + 1) % (max_batches + 1))
+        ok &= calc_batch_flush(pool, &ring[head], out, &total);
+    ok &= fflush(out) == 0;
+
+    for (size_t i = 0; i <= max_batches; i++)
+        free(ring[i].in);
+    free(ring);
+    free(line);
+
+    if (stats) {
+        stats->records += total.records;
+        stats->errors += total.errors;
+        stats->bytes_in += total.bytes_in;
+        stats->bytes_out += total.bytes_out;
+        stats->seconds += calc_now() - start;
+    }
+    return ok;
+}
+
+// Return the output of calc_run on input with the given options
+static char *calc_test_run(const char *input, const calc_opts_t *opts, calc_stats_t *stats)
+{
+    char *text;
+    size_t len;
+    FILE *in = fmemopen((void *)input, strlen(input), "r");
+    FILE *out = open_memstream(&text, &len);
+    calc_run(in, out, opts, stats);
+    fclose(in);
+    fclose(out);
+    return text;
+}
+
+// Testing
+int calc_test(void)
+{
+    int total_errors = 0;
+
+    // Records, expressions, operand formats and errors, one line each
+    static const char script[] =
+        "mulmod 123456789 987654321 1000000007\n"
+        "exp 2 0xf b64:AQE=\n"
+        "# comment\n"
+        "\n"
+        "(0x10 + -3) * 5 % 7 - 2 * 3\n"
+        "inv 3 0x7\n"
+        "exp 3 -1 7\n"
+        "isqrt 1000000000000000000000000000000\n"
+        "mul 123456789012345678901234567890 -98765432109876543210\n"
+        "iroot -1000000000000 3\n"
+        "jacobi -1 7\n"
+        "sqrtmod 2 7\n"
+        "div 7 0\n"
+        "inv 2 4\n"
+        "inv 0 7\n"
+        "inv 14 7\n"
+        "exp 7 -1 7\n"
+        "exp 0 -2 13\n"
+        "inv 5 1\n"
+        "exp 0 -1 1\n"
+        "mulmod 1 2\n"
+        "frobnicate 1\n"
+        "(1 + 2\r\n"
+        "sqrtmod 4 15\n"
+        "sqrtmod 3 7";
+    static const char expect[] =
+        "259106859\n"
+        "129\n"
+        "-4\n"
+        "5\n"
+        "5\n"
+        "1000000000000000\n"
+        "-12193263113702179522496570642237463801111263526900\n"
+        "-10000\n"
+        "-1\n"
+        "3\n"
+        "error: division by zero\n"
+        "error: not invertible\n"
+        "error: not invertible\n"
+        "error: not invertible\n"
+        "error: not invertible\n"
+        "error: not invertible\n"
+        "0\n"
+        "0\n"
+        "error: too few operands\n"
+        "error: unknown operation\n"
+        "error: expected ')'\n"
+        "error: modulus must be prime\n"
+        "error: no square root\n";
+    calc_stats_t stats = { 0 };
+    char *got = calc_test_run(script, NULL, &stats);
+    bool test = strcmp(got, expect) == 0 && stats.records == 23 && stats.errors == 11
+        && stats.bytes_in == sizeof(script) - 1 && stats.bytes_out == strlen(expect);
+    printf("%s: calc evaluates records and expressions, one line per record\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+    free(got);
+
+    // Nesting up to the limit evaluates; deeper lines fail alone
+    enum { DEEP = 200000 };
+    char *deep = malloc(4 * DEEP + 64), *d = deep;
+    memset(d, '(', CALC_MAX_DEPTH);
+    d += CALC_MAX_DEPTH;
+    d += sprintf(d, "2");
+    memset(d, ')', CALC_MAX_DEPTH);
+    d += CALC_MAX_DEPTH;
+    *d++ = '\n';
+    memset(d, '-', CALC_MAX_DEPTH + 1);
+    d += CALC_MAX_DEPTH + 1;
+    d += sprintf(d, "(2)\n");
+    memset(d, '(', DEEP);
+    d += DEEP;
+    sprintf(d, "1\nadd 1 2\n");
+    got = calc_test_run(deep, NULL, &stats);
+    test = strcmp(got, "2\nerror: expression too deep\nerror: expression too deep\n3\n") == 0;
+    printf("%s: calc rejects expressions nested over %d deep\n",
+        test ? "TRUE" : "FALSE", CALC_MAX_DEPTH);
+    total_errors += !test;
+    free(got);
+    free(deep);
+
+    // Output formats, negative values included
+    static const char *const formats[][3] = {
+        { "-0x12345678901234567890", "-0x12345678901234567890", "-b64:EjRWeJASNFZ4kA==" },
+        { "mul 0x100 0x1000000000000000", "0x100000000000000000", "b64:EAAAAAAAAAAA" },
+        { "sub 0 b64:/w==", "-0xff", "-b64:/w==" },
+        { "b64:AAAB", "0x1", "b64:AQ==" },
+        { "neg 0", "0x0", "b64:AA==" },
+    };
+    test = true;
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        for (calc_format_t f = CALC_HEX; f <= CALC_BASE64; f++) {
+            char *text;
+            size_t len;
+            FILE *out = open_memstream(&text, &len);
+            calc_eval(formats[i][0], f, out);
+            fclose(out);
+            test &= strcmp(text, formats[i][f]) == 0;
+            free(text);
+        }
+    }
+    printf("%s: calc writes hexadecimal and base64 results\n", test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Many small batches in flight keep their order
+    enum { LINES = 3000 };
+    char *input = malloc(LINES * 64), *p = input;
+    char *expected = malloc(LINES * 32), *e = expected;
+    for (long i = 0; i < LINES; i++) {
+        p += sprintf(p, "%s %ld %ld 1000003\n", i % 2 ? "mulmod" : "addmod", i * i, i + 7);
+        e += sprintf(e, "%ld\n", (i % 2 ? (i * i % 1000003) * (i + 7) : i * i + i + 7) % 1000003);
+    }
+    calc_opts_t opts = { .batch_lines = 7, .max_batches = 3 };
+    got = calc_test_run(input, &opts, NULL);
+    test = strcmp(got, expected) == 0;
+    printf("%s: calc keeps %d records in order across batches\n", test ? "TRUE" : "FALSE", LINES);
+    total_errors += !test;
+    free(got);
+    free(input);
+    free(expected);
+
+    return total_errors;
+}
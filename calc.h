@@ -0,0 +1,67 @@
+/**
+ * calc.h: Streaming batch calculator
+ *
+ * Each input line is a record, i.e. an operation name and its operands
+ * ("mulmod a b n", "exp a e n"), or an infix expression over + - * / %
+ * and parentheses, nested at most 1000 deep. Operands are decimal,
+ * hexadecimal after 0x, or base64 of their big-endian bytes after b64:, each
+ * optionally negated by a leading '-'; base64 operands in expressions end at
+ * whitespace, since + and / are base64 digits. Every record gets one output
+ * line, "error: ..." if it does not parse or evaluate, so results line up
+ * with the input. Blank lines and lines starting with '#' are skipped.
+ *
+ * calc_run reads lines into batches that are parsed and evaluated on a
+ * thread pool while more input is read. Finished batches are written in
+ * input order, and only a bounded number are in flight, so memory stays
+ * flat however long the stream.
+ */
+
+#ifndef CALC_H
+#define CALC_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bigint.h"
+#include "pool.h"
+
+enum {
+    CALC_BATCH_LINES = 256,     // Default lines per batch
+    CALC_IO_BUFFER = 1 << 20,   // Bytes of stdio buffering on each stream
+};
+
+// Output radix
+typedef enum {
+    CALC_DEC,
+    CALC_HEX,       // 0x prefix
+    CALC_BASE64,    // b64: prefix, big-endian bytes of the magnitude
+} calc_format_t;
+
+typedef struct {
+    pool_t *pool;           // Pool for evaluation (NULL: the default pool)
+    calc_format_t format;
+    size_t batch_lines;     // Lines per batch (0: CALC_BATCH_LINES)
+    size_t max_batches;     // Batches in flight (0: four per pool thread)
+} calc_opts_t;
+
+typedef struct {
+    size_t records;         // Records evaluated
+    size_t errors;          // Records answered with an error line
+    size_t bytes_in;
+    size_t bytes_out;
+    double seconds;         // Wall-clock time in calc_run
+} calc_stats_t;
+
+// Evaluate one record or expression and write its result, or an error line,
+// to out without a newline; return false on error
+bool calc_eval(const char *line, calc_format_t format, FILE *out);
+
+// Evaluate every line of in, writing results to out in order. Adds to *stats
+// (which may be NULL); opts may be NULL for defaults. Return false on an I/O
+// error.
+bool calc_run(FILE *in, FILE *out, const calc_opts_t *opts, calc_stats_t *stats);
+
+// Testing methods
+int calc_test(void);
+
+#endif // CALC_H
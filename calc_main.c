@@ -0,0 +1,99 @@
+/**
+ * calc_main.c: Command-line front end for the streaming calculator
+ *
+ * Reads records or expressions (see calc.h) from each file in turn, or from
+ * stdin, writes one result line per record to stdout and reports throughput
+ * on stderr at exit.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bigint.h"
+#include "calc.h"
+#include "pool.h"
+
+int main(int argc, char *argv[])
+{
+    calc_opts_t opts = { 0 };
+    size_t threads = 0;
+    bool quiet = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:f:b:q")) != -1) {
+        switch (opt) {
+        case 'j':
+            threads = strtoull(optarg, NULL, 0);
+            break;
+        case 'f':
+            if (strcmp(optarg, "dec") == 0)
+                opts.format = CALC_DEC;
+            else if (strcmp(optarg, "hex") == 0)
+                opts.format = CALC_HEX;
+            else if (strcmp(optarg, "b64") == 0)
+                opts.format = CALC_BASE64;
+            else
+                goto usage;
+            break;
+        case 'b':
+            opts.batch_lines = strtoull(optarg, NULL, 0);
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    bigint_init();
+    if (threads)
+        opts.pool = pool_new(threads);
+
+    static char out_buf[CALC_IO_BUFFER], stdin_buf[CALC_IO_BUFFER], file_buf[CALC_IO_BUFFER];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+    setvbuf(stdin, stdin_buf, _IOFBF, sizeof(stdin_buf));
+
+    calc_stats_t stats = { 0 };
+    int status = 0;
+    if (optind == argc && !calc_run(stdin, stdout, &opts, &stats)) {
+        perror("calc: stdin");
+        status = 1;
+    }
+    for (int i = optind; i < argc; i++) {
+        FILE *in = strcmp(argv[i], "-") ? fopen(argv[i], "r") : stdin;
+        if (!in) {
+            perror(argv[i]);
+            status = 1;
+            continue;
+        }
+        if (in != stdin)
+            setvbuf(in, file_buf, _IOFBF, sizeof(file_buf));
+        if (!calc_run(in, stdout, &opts, &stats)) {
+            perror(argv[i]);
+            status = 1;
+        }
+        if (in != stdin)
+            fclose(in);
+    }
+
+    if (!quiet) {
+        double secs = stats.seconds > 0 ? stats.seconds : 1e-9;
+        fprintf(stderr, "calc: %zu records, %zu errors in %.3f s: "
+            "%.0f records/s, %.1f MB/s in, %.1f MB/s out\n",
+            stats.records, stats.errors, stats.seconds, stats.records / secs,
+            stats.bytes_in / secs / 1e6, stats.bytes_out / secs / 1e6);
+    }
+
+    if (opts.pool)
+        pool_delete(opts.pool);
+    bigint_exit();
+    return status;
+
+usage:
+    fprintf(stderr, "usage: %s [-j threads] [-f dec|hex|b64] [-b batch_lines] [-q] [file...]\n",
+        argv[0]);
+    return 1;
+}
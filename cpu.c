@@ -0,0 +1,109 @@
+/**
+ * cpu.c: CPU feature detection
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include "cpu.h"
+
+static const char *cpu_tier_names[CPU_TIERS] = {
+    [CPU_TIER_PORTABLE] = "portable",
+    [CPU_TIER_ADX] = "adx",
+    [CPU_TIER_AVX2] = "avx2",
+    [CPU_TIER_AVX512] = "avx512",
+};
+
+static cpu_features_t features;
+static pthread_once_t features_once = PTHREAD_ONCE_INIT;
+
+#if defined(__x86_64__)
+// Return the OS-enabled state components (XCR0)
+static uint64_t cpu_xcr0(void)
+{
+    uint32_t lo, hi;
+    __asm__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+    return ((uint64_t)hi << 32) | lo;
+}
+#endif
+
+static void cpu_detect(void)
+{
+#if defined(__x86_64__)
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return;
+
+    // Vector registers are only usable if the OS saves them on context switch
+    bool osxsave = ecx & bit_OSXSAVE;
+    uint64_t xcr0 = osxsave ? cpu_xcr0() : 0;
+    bool ymm = (xcr0 & 0x06) == 0x06;
+    bool zmm = (xcr0 & 0xe6) == 0xe6;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return;
+    features.bmi2 = ebx & bit_BMI2;
+    features.adx = ebx & bit_ADX;
+    features.avx2 = ymm && (ebx & bit_AVX2);
+    features.avx512f = zmm && (ebx & bit_AVX512F);
+    features.avx512vl = zmm && (ebx & bit_AVX512VL);
+    features.avx512ifma = zmm && (ebx & bit_AVX512IFMA);
+#endif
+}
+
+// Return the features of the running CPU (and OS, for vector state)
+const cpu_features_t *cpu_features(void)
+{
+    pthread_once(&features_once, cpu_detect);
+    return &features;
+}
+
+// Return the best tier the CPU supports
+cpu_tier_t cpu_best_tier(void)
+{
+    const cpu_features_t *f = cpu_features();
+    if (!f->bmi2 || !f->adx)
+        return CPU_TIER_PORTABLE;
+    if (f->avx512f)
+        return CPU_TIER_AVX512;
+    if (f->avx2)
+        return CPU_TIER_AVX2;
+    return CPU_TIER_ADX;
+}
+
+// Return the best tier, lowered to LCRYPT_CPU if set
+cpu_tier_t cpu_select_tier(void)
+{
+    cpu_tier_t best = cpu_best_tier();
+    const char *name = getenv("LCRYPT_CPU");
+    if (!name || !*name)
+        return best;
+
+    for (cpu_tier_t tier = 0; tier < CPU_TIERS; tier++) {
+        if (strcmp(name, cpu_tier_names[tier]) != 0)
+            continue;
+        if (tier > best) {
+            fprintf(stderr, "cpu_select_tier: WARNING: %s not supported, using %s\n",
+                name, cpu_tier_names[best]);
+            return best;
+        }
+        return tier;
+    }
+
+    fprintf(stderr, "cpu_select_tier: WARNING: unknown LCRYPT_CPU=%s, using %s\n",
+        name, cpu_tier_names[best]);
+    return best;
+}
+
+// Return the name of tier, e.g. "avx2"
+const char *cpu_tier_name(cpu_tier_t tier)
+{
+    return tier < CPU_TIERS ? cpu_tier_names[tier] : "unknown";
+}
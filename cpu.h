@@ -0,0 +1,44 @@
+/**
+ * cpu.h: CPU feature detection
+ *
+ * Kernels come in tiers, each requiring the features of the ones below it.
+ * The tier in use is the best one the CPU supports, unless the LCRYPT_CPU
+ * environment variable names a lower one ("portable", "adx", "avx2" or
+ * "avx512"), which is mainly useful for testing the fallbacks.
+ */
+
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdbool.h>
+
+typedef enum {
+    CPU_TIER_PORTABLE,  // Plain C
+    CPU_TIER_ADX,       // BMI2 mulx with ADX adcx/adox carry chains
+    CPU_TIER_AVX2,      // ADX plus AVX2 vector add/sub
+    CPU_TIER_AVX512,    // ADX plus AVX-512F vector add/sub
+    CPU_TIERS,
+} cpu_tier_t;
+
+typedef struct {
+    bool bmi2;
+    bool adx;
+    bool avx2;
+    bool avx512f;
+    bool avx512vl;
+    bool avx512ifma;
+} cpu_features_t;
+
+// Return the features of the running CPU (and OS, for vector state)
+const cpu_features_t *cpu_features(void);
+
+// Return the best tier the CPU supports
+cpu_tier_t cpu_best_tier(void);
+
+// Return the best tier, lowered to LCRYPT_CPU if set
+cpu_tier_t cpu_select_tier(void);
+
+// Return the name of tier, e.g. "avx2"
+const char *cpu_tier_name(cpu_tier_t tier);
+
+#endif // CPU_H
@@ -0,0 +1,130 @@
+/**
+ * fixed.c: Fixed-width unsigned integers for common key sizes
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fixed.h"
+#include "limb.h"
+#include "math.h"
+
+// r2 = 2^(2 * WORD_BITS * words) mod n (n nonzero, both words words)
+void fixed_r2(uword_t *r2, const uword_t *n, size_t words)
+{
+    size_t size = limb_normalize(n, words);
+    uword_t pow[2 * words + 1];
+    memset(pow, 0, sizeof(pow));
+    pow[2 * words] = 1;
+    memset(r2, 0, words * sizeof(uword_t));
+    limb_divrem(NULL, r2, pow, 2 * words + 1, n, size);
+}
+
+// Return whether a equals the value of the given words
+static bool fixed_test_equals(bigint_t a, const uword_t *val, size_t size)
+{
+    bigint_t b = bigint_from_limbs(val, size);
+    bool equal = bigint_equals(a, b);
+    bigint_delete(&b);
+    return equal;
+}
+
+// Check every operation of one width against the bigint results on random
+// operands of BITS bits, and Montgomery products under a random odd modulus
+#define FIXED_TEST(BITS)                                                       \
+static int fixed##BITS##_test(void)                                            \
+{                                                                              \
+    enum { WORDS = sizeof(fixed##BITS##_t) / sizeof(uword_t) };                \
+    int errors = 0;                                                            \
+    for (int iter = 0; iter < 20; iter++) {                                    \
+        bigint_t a = bigint_random_bits(BITS);                                 \
+        bigint_t b = bigint_random_bits(BITS);                                 \
+        fixed##BITS##_t fa, fb, f;                                             \
+        fixed##BITS##_wide_t wide;                                             \
+        uword_t w[WORDS + 1];                                                  \
+        errors += !fixed_from_bigint(&fa, a);                                  \
+        errors += !fixed_from_bigint(&fb, b);                                  \
+                                                                               \
+        bigint_t expect = bigint_sum(a, b);                                    \
+        w[WORDS] = fixed_add(&f, &fa, &fb);                                    \
+        memcpy(w, f.w, sizeof(f.w));                                           \
+        errors += !fixed_test_equals(expect, w, WORDS + 1);                    \
+        bigint_delete(&expect);                                                \
+                                                                               \
+        /* (a - b) + b must give back a, with the borrow as the carry */       \
+        fixed##BITS##_t back;                                                  \
+        uword_t borrow = fixed_sub(&f, &fa, &fb);                              \
+        errors += fixed_add(&back, &f, &fb) != borrow;                         \
+        errors += fixed_cmp(&back, &fa) != 0;                                  \
+        errors += borrow != (fixed_cmp(&fa, &fb) < 0);                         \
+                                                                               \
+        expect = bigint_prod(a, b);                                            \
+        fixed_mul(&wide, &fa, &fb);                                            \
+        errors += !fixed_test_equals(expect, wide.w, 2 * WORDS);               \
+        bigint_delete(&expect);                                                \
+                                                                               \
+        expect = bigint_prod(a, a);                                            \
+        fixed_sqr(&wide, &fa);                                                 \
+        errors += !fixed_test_equals(expect, wide.w, 2 * WORDS);               \
+        bigint_delete(&expect);                                                \
+                                                                               \
+        bigint_t n = bigint_random_bits(BITS);                                 \
+        n.val[0] |= 1;                                                         \
+        fixed##BITS##_mont_t ctx;                                              \
+        errors += !fixed_mont_init(&ctx, n);                                   \
+        bigint_t q, ra, rb, rem;                                               \
+        q = bigint_div(a, n, &ra);                                             \
+        bigint_delete(&q);                                                     \
+        q = bigint_div(b, n, &rb);                                             \
+        bigint_delete(&q);                                                     \
+        fixed_from_bigint(&fa, ra);                                            \
+        fixed_from_bigint(&fb, rb);                                            \
+        fixed_mont_to(&ctx, &fa, &fa);                                         \
+        fixed_mont_to(&ctx, &fb, &fb);                                         \
+        fixed_mont_mul(&ctx, &f, &fa, &fb);                                    \
+        fixed_mont_from(&ctx, &f, &f);                                         \
+        bigint_t p = bigint_prod(ra, rb);                                      \
+        q = bigint_div(p, n, &rem);                                            \
+        bigint_delete(&q);                                                     \
+        errors += !fixed_test_equals(rem, f.w, WORDS);                         \
+                                                                               \
+        bigint_t round = fixed_to_bigint(&f);                                  \
+        errors += !bigint_equals(round, rem);                                  \
+                                                                               \
+        bigint_delete(&round);                                                 \
+        bigint_delete(&p);                                                     \
+        bigint_delete(&rem);                                                   \
+        bigint_delete(&ra);                                                    \
+        bigint_delete(&rb);                                                    \
+        bigint_delete(&n);                                                     \
+        bigint_delete(&a);                                                     \
+        bigint_delete(&b);                                                     \
+    }                                                                          \
+                                                                               \
+    /* Values wider than the type or negative must be rejected */              \
+    fixed##BITS##_t f;                                                         \
+    bigint_t big = bigint_zero(WORDS + 2);                                     \
+    big.val[WORDS] = 1;                                                        \
+    bigint_t neg = long_to_bigint(-1);                                         \
+    errors += fixed_from_bigint(&f, big) || fixed_from_bigint(&f, neg);        \
+    bigint_delete(&big);                                                       \
+    bigint_delete(&neg);                                                       \
+                                                                               \
+    bool test = errors == 0;                                                   \
+    printf("%s: fixed%d add/sub/mul/sqr/mont_mul match bigint results\n",     \
+        test ? "TRUE" : "FALSE", BITS);                                        \
+    return !test;                                                              \
+}
+
+FIXED_TEST(256)
+FIXED_TEST(384)
+FIXED_TEST(521)
+FIXED_TEST(2048)
+FIXED_TEST(4096)
+
+int fixed_test(void)
+{
+    return fixed256_test() + fixed384_test() + fixed521_test()
+        + fixed2048_test() + fixed4096_test();
+}
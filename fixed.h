@@ -0,0 +1,257 @@
+/**
+ * fixed.h: Fixed-width unsigned integers for common key sizes
+ *
+ * fixedN_t holds an N-bit (rounded up to whole words) unsigned value in a
+ * plain array, so values live on the stack and nothing here allocates except
+ * the conversions to bigint_t and fixedN_mont_init. Each width gets its own
+ * functions from FIXED_DEFINE, with loop bounds fixed at compile time so the
+ * compiler unrolls them; the type-generic macros at the bottom pick the
+ * function for the width of their first pointer argument.
+ */
+
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "bigint.h"
+#include "int_math.h"
+#include "mont.h"
+
+#define FIXED_PRAGMA(x) _Pragma(#x)
+#define FIXED_UNROLL_N(n) FIXED_PRAGMA(GCC unroll n)
+#define FIXED_UNROLL FIXED_UNROLL_N(64)
+
+// Types and arithmetic for one width. Linear loops and the inner loops of the
+// quadratic ones are unrolled completely; OUTER is the unroll factor of the
+// outer loops, 1 where full unrolling would only thrash the instruction cache
+#define FIXED_DEFINE(BITS, WORDS, OUTER)                                       \
+                                                                               \
+typedef struct { uword_t w[WORDS]; } fixed##BITS##_t;                          \
+typedef struct { uword_t w[2 * (WORDS)]; } fixed##BITS##_wide_t;               \
+                                                                               \
+/* Montgomery context for an odd modulus of at most BITS bits in WORDS words */\
+typedef struct {                                                               \
+    fixed##BITS##_t n;                                                         \
+    fixed##BITS##_t r2;         /* R^2 mod n, R = 2^(WORD_BITS * WORDS) */     \
+    uword_t n0inv;              /* -n^-1 mod 2^WORD_BITS */                    \
+} fixed##BITS##_mont_t;                                                        \
+                                                                               \
+/* out = a + b, return carry */                                                \
+static inline uword_t fixed##BITS##_add(fixed##BITS##_t *out,                  \
+        const fixed##BITS##_t *a, const fixed##BITS##_t *b)                    \
+{                                                                              \
+    uword_t carry = 0;                                                         \
+    FIXED_UNROLL                                                               \
+    for (size_t i = 0; i < (WORDS); i++) {                                     \
+        udword_t t = (udword_t)a->w[i] + b->w[i] + carry;                      \
+        out->w[i] = (uword_t)t;                                                \
+        carry = (uword_t)(t >> WORD_BITS);                                     \
+    }                                                                          \
+    return carry;                                                              \
+}                                                                              \
+                                                                               \
+/* out = a - b, return borrow */                                               \
+static inline uword_t fixed##BITS##_sub(fixed##BITS##_t *out,                  \
+        const fixed##BITS##_t *a, const fixed##BITS##_t *b)                    \
+{                                                                              \
+    uword_t borrow = 0;                                                        \
+    FIXED_UNROLL                                                               \
+    for (size_t i = 0; i < (WORDS); i++) {                                     \
+        udword_t t = (udword_t)a->w[i] - b->w[i] - borrow;                     \
+        out->w[i] = (uword_t)t;                                                \
+        borrow = (uword_t)(t >> WORD_BITS) & 1;                                \
+    }                                                                          \
+    return borrow;                                                             \
+}                                                                              \
+                                                                               \
+/* Compare a and b: return -1, 0 or 1 */                                       \
+static inline int fixed##BITS##_cmp(const fixed##BITS##_t *a,                  \
+        const fixed##BITS##_t *b)                                              \
+{                                                                              \
+    for (size_t i = (WORDS) - 1; i < (WORDS); i--)                             \
+        if (a->w[i] != b->w[i])                                                \
+            return a->w[i] < b->w[i] ? -1 : 1;                                 \
+    return 0;                                                                  \
+}                                                                              \
+                                                                               \
+/* out = a * b (full double-width product) */                                  \
+static inline void fixed##BITS##_mul(fixed##BITS##_wide_t *out,                \
+        const fixed##BITS##_t *a, const fixed##BITS##_t *b)                    \
+{                                                                              \
+    uword_t t[2 * (WORDS)] = { 0 };                                            \
+    FIXED_UNROLL_N(OUTER)                                                      \
+    for (size_t i = 0; i < (WORDS); i++) {                                     \
+        uword_t carry = 0;                                                     \
+        FIXED_UNROLL                                                           \
+        for (size_t j = 0; j < (WORDS); j++) {                                 \
+            udword_t x = (udword_t)a->w[j] * b->w[i] + t[i+j] + carry;         \
+            t[i+j] = (uword_t)x;                                               \
+            carry = (uword_t)(x >> WORD_BITS);                                 \
+        }                                                                      \
+        t[i + (WORDS)] = carry;                                                \
+    }                                                                          \
+    memcpy(out->w, t, sizeof(t));                                              \
+}                                                                              \
+                                                                               \
+/* out = a^2, computing each cross product once */                             \
+static inline void fixed##BITS##_sqr(fixed##BITS##_wide_t *out,                \
+        const fixed##BITS##_t *a)                                              \
+{                                                                              \
+    uword_t t[2 * (WORDS)] = { 0 };                                            \
+    FIXED_UNROLL_N(OUTER)                                                      \
+    for (size_t i = 0; i < (WORDS); i++) {                                     \
+        uword_t carry = 0;                                                     \
+        FIXED_UNROLL                                                           \
+        for (size_t j = i + 1; j < (WORDS); j++) {                             \
+            udword_t x = (udword_t)a->w[j] * a->w[i] + t[i+j] + carry;         \
+            t[i+j] = (uword_t)x;                                               \
+            carry = (uword_t)(x >> WORD_BITS);                                 \
+        }                                                                      \
+        t[i + (WORDS)] = carry;                                                \
+    }                                                                          \
+    /* Double the cross products and add the squares on the diagonal */        \
+    uword_t top = 0, carry = 0;                                                \
+    FIXED_UNROLL                                                               \
+    for (size_t i = 0; i < 2 * (WORDS); i++) {                                 \
+        uword_t x = t[i];                                                      \
+        t[i] = (x << 1) | top;                                                 \
+        top = x >> (WORD_BITS - 1);                                            \
+    }                                                                          \
+    FIXED_UNROLL                                                               \
+    for (size_t i = 0; i < (WORDS); i++) {                                     \
+        udword_t sq = (udword_t)a->w[i] * a->w[i];                             \
+        udword_t x = (udword_t)t[2*i] + (uword_t)sq + carry;                   \
+        t[2*i] = (uword_t)x;                                                   \
+        x = (udword_t)t[2*i+1] + (uword_t)(sq >> WORD_BITS)                    \
+            + (uword_t)(x >> WORD_BITS);                                       \
+        t[2*i+1] = (uword_t)x;                                                 \
+        carry = (uword_t)(x >> WORD_BITS);                                     \
+    }                                                                          \
+    memcpy(out->w, t, sizeof(t));                                              \
+}                                                                              \
+                                                                               \
+/* out = a * b / R mod n with a, b < n (out may alias a or b), using CIOS */   \
+static inline void fixed##BITS##_mont_mul(const fixed##BITS##_mont_t *ctx,     \
+        fixed##BITS##_t *out, const fixed##BITS##_t *a,                        \
+        const fixed##BITS##_t *b)                                              \
+{                                                                              \
+    uword_t t[(WORDS) + 2] = { 0 };                                            \
+    FIXED_UNROLL_N(OUTER)                                                      \
+    for (size_t i = 0; i < (WORDS); i++) {                                     \
+        uword_t carry = 0;                                                     \
+        FIXED_UNROLL                                                           \
+        for (size_t j = 0; j < (WORDS); j++) {                                 \
+            udword_t x = (udword_t)a->w[j] * b->w[i] + t[j] + carry;           \
+            t[j] = (uword_t)x;                                                 \
+            carry = (uword_t)(x >> WORD_BITS);                                 \
+        }                                                                      \
+        udword_t x = (udword_t)t[(WORDS)] + carry;                             \
+        t[(WORDS)] = (uword_t)x;                                               \
+        t[(WORDS) + 1] = (uword_t)(x >> WORD_BITS);                            \
+                                                                               \
+        uword_t m = t[0] * ctx->n0inv;                                         \
+        x = (udword_t)m * ctx->n.w[0] + t[0];                                  \
+        carry = (uword_t)(x >> WORD_BITS);                                     \
+        FIXED_UNROLL                                                           \
+        for (size_t j = 1; j < (WORDS); j++) {                                 \
+            x = (udword_t)m * ctx->n.w[j] + t[j] + carry;                      \
+            t[j-1] = (uword_t)x;                                               \
+            carry = (uword_t)(x >> WORD_BITS);                                 \
+        }                                                                      \
+        x = (udword_t)t[(WORDS)] + carry;                                      \
+        t[(WORDS) - 1] = (uword_t)x;                                           \
+        t[(WORDS)] = t[(WORDS) + 1] + (uword_t)(x >> WORD_BITS);               \
+    }                                                                          \
+    fixed##BITS##_t r;                                                         \
+    memcpy(r.w, t, sizeof(r.w));                                               \
+    fixed##BITS##_t d;                                                         \
+    uword_t borrow = fixed##BITS##_sub(&d, &r, &ctx->n);                       \
+    *out = (t[(WORDS)] || !borrow) ? d : r;                                    \
+}                                                                              \
+                                                                               \
+/* Set out to a if 0 <= a < 2^(WORD_BITS * WORDS), return whether it fits */   \
+static inline bool fixed##BITS##_from_bigint(fixed##BITS##_t *out, bigint_t a) \
+{                                                                              \
+    memset(out, 0, sizeof(*out));                                              \
+    size_t size = bigint_min_words(a);                                         \
+    if (is_neg(a) || (size > (WORDS) && !(size == (WORDS) + 1                  \
+            && a.val[(WORDS)] == 0)))                                          \
+        return false;                                                          \
+    memcpy(out->w, a.val, smin(size, (WORDS)) * sizeof(uword_t));              \
+    return true;                                                               \
+}                                                                              \
+                                                                               \
+/* Return a as a bigint */                                                     \
+static inline bigint_t fixed##BITS##_to_bigint(const fixed##BITS##_t *a)       \
+{                                                                              \
+    return bigint_from_limbs(a->w, (WORDS));                                   \
+}                                                                              \
+                                                                               \
+/* Set up ctx for odd n; return false if n is even or too wide */              \
+static inline bool fixed##BITS##_mont_init(fixed##BITS##_mont_t *ctx,          \
+        bigint_t n)                                                            \
+{                                                                              \
+    if (!fixed##BITS##_from_bigint(&ctx->n, n) || !(ctx->n.w[0] & 1))          \
+        return false;                                                          \
+    ctx->n0inv = mont_n0inv(ctx->n.w[0]);                                      \
+    fixed_r2(ctx->r2.w, ctx->n.w, (WORDS));                                    \
+    return true;                                                               \
+}                                                                              \
+                                                                               \
+/* out = a * R mod n for a < n */                                              \
+static inline void fixed##BITS##_mont_to(const fixed##BITS##_mont_t *ctx,      \
+        fixed##BITS##_t *out, const fixed##BITS##_t *a)                        \
+{                                                                              \
+    fixed##BITS##_mont_mul(ctx, out, a, &ctx->r2);                             \
+}                                                                              \
+                                                                               \
+/* out = a / R mod n */                                                        \
+static inline void fixed##BITS##_mont_from(const fixed##BITS##_mont_t *ctx,    \
+        fixed##BITS##_t *out, const fixed##BITS##_t *a)                        \
+{                                                                              \
+    fixed##BITS##_t one = { { 1 } };                                           \
+    fixed##BITS##_mont_mul(ctx, out, a, &one);                                 \
+}
+
+// r2 = 2^(2 * WORD_BITS * words) mod n (n nonzero, both words words)
+void fixed_r2(uword_t *r2, const uword_t *n, size_t words);
+
+FIXED_DEFINE(256, 4, 4)
+FIXED_DEFINE(384, 6, 6)
+FIXED_DEFINE(521, 9, 9)
+FIXED_DEFINE(2048, 32, 1)
+FIXED_DEFINE(4096, 64, 1)
+
+// Dispatch on the width of the first pointer argument
+#define FIXED_GENERIC(x, op) _Generic((x),                                     \
+    fixed256_t *: fixed256_##op, const fixed256_t *: fixed256_##op,            \
+    fixed384_t *: fixed384_##op, const fixed384_t *: fixed384_##op,            \
+    fixed521_t *: fixed521_##op, const fixed521_t *: fixed521_##op,            \
+    fixed2048_t *: fixed2048_##op, const fixed2048_t *: fixed2048_##op,        \
+    fixed4096_t *: fixed4096_##op, const fixed4096_t *: fixed4096_##op)
+
+#define FIXED_GENERIC_MONT(ctx, op) _Generic((ctx),                            \
+    fixed256_mont_t *: fixed256_##op, const fixed256_mont_t *: fixed256_##op,  \
+    fixed384_mont_t *: fixed384_##op, const fixed384_mont_t *: fixed384_##op,  \
+    fixed521_mont_t *: fixed521_##op, const fixed521_mont_t *: fixed521_##op,  \
+    fixed2048_mont_t *: fixed2048_##op, const fixed2048_mont_t *: fixed2048_##op, \
+    fixed4096_mont_t *: fixed4096_##op, const fixed4096_mont_t *: fixed4096_##op)
+
+#define fixed_add(out, a, b) FIXED_GENERIC(a, add)(out, a, b)
+#define fixed_sub(out, a, b) FIXED_GENERIC(a, sub)(out, a, b)
+#define fixed_cmp(a, b) FIXED_GENERIC(a, cmp)(a, b)
+#define fixed_mul(out, a, b) FIXED_GENERIC(a, mul)(out, a, b)
+#define fixed_sqr(out, a) FIXED_GENERIC(a, sqr)(out, a)
+#define fixed_from_bigint(out, a) FIXED_GENERIC(out, from_bigint)(out, a)
+#define fixed_to_bigint(a) FIXED_GENERIC(a, to_bigint)(a)
+#define fixed_mont_init(ctx, n) FIXED_GENERIC_MONT(ctx, mont_init)(ctx, n)
+#define fixed_mont_mul(ctx, out, a, b) FIXED_GENERIC_MONT(ctx, mont_mul)(ctx, out, a, b)
+#define fixed_mont_to(ctx, out, a) FIXED_GENERIC_MONT(ctx, mont_to)(ctx, out, a)
+#define fixed_mont_from(ctx, out, a) FIXED_GENERIC_MONT(ctx, mont_from)(ctx, out, a)
+
+// Testing methods
+int fixed_test(void);
+
+#endif // FIXED_H
@@ -0,0 +1,194 @@
+/**
+ * fixed_base.c: Exponentiation of a fixed base with precomputed comb tables
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fixed_base.h"
+#include "limb.h"
+#include "math.h"
+#include "mod_math.h"
+
+// Return the expected number of products for an exponentiation
+static double fixed_base_cost(size_t max_bits, size_t teeth, size_t tables)
+{
+    size_t span = (max_bits + teeth * tables - 1) / (teeth * tables);
+    double hit = 1.0 - 1.0 / (double)((size_t)1 << teeth);
+    return span + tables * span * hit;
+}
+
+// Return context for g^e mod n with 0 <= e < 2^max_bits, n odd and positive.
+// table_bytes bounds the table memory (0: FIXED_BASE_DEFAULT_TEETH teeth); a
+// budget under one table of FIXED_BASE_MIN_ENTRIES entries gets that table.
+fixed_base_ctx_t fixed_base_new(bigint_t g, bigint_t n, size_t max_bits, size_t table_bytes)
+{
+    fixed_base_ctx_t ctx = { 0 };
+    if (!is_pos(n) || !(n.val[0] & 1)) {
+        fprintf(stderr, "fixed_base_new: WARNING: modulus must be odd and positive\n");
+        return ctx;
+    }
+
+    ctx.mont = mont_new(n);
+    const size_t s = ctx.mont.size;
+    const size_t entry_bytes = s * sizeof(uword_t);
+    ctx.max_bits = max_bits ? max_bits : 1;
+
+    // Pick the teeth and table count with the fewest products within budget
+    ctx.teeth = smin(FIXED_BASE_DEFAULT_TEETH, ctx.max_bits);
+    ctx.tables = 1;
+    if (table_bytes) {
+        if (table_bytes < FIXED_BASE_MIN_ENTRIES * entry_bytes)
+            fprintf(stderr, "fixed_base_new: WARNING: table_bytes %zu is below the minimum "
+                "of %zu, using the minimum\n", table_bytes, FIXED_BASE_MIN_ENTRIES * entry_bytes);
+        ctx.teeth = 1;
+        double best = fixed_base_cost(ctx.max_bits, 1, 1);
+        for (size_t t = 1; t <= FIXED_BASE_MAX_TEETH && t <= ctx.max_bits; t++) {
+            size_t v = table_bytes / (((size_t)1 << t) * entry_bytes);
+            v = smin(v, ctx.max_bits / t);
+            if (v == 0)
+                break;
+            double cost = fixed_base_cost(ctx.max_bits, t, v);
+            if (cost < best) {
+                best = cost;
+                ctx.teeth = t;
+                ctx.tables = v;
+            }
+        }
+    }
+    ctx.span = (ctx.max_bits + ctx.teeth * ctx.tables - 1) / (ctx.teeth * ctx.tables);
+
+    ctx.g = malloc(entry_bytes);
+    mont_to(&ctx.mont, ctx.g, g);
+
+    // Block bases g^(2^(m * span)) for every block m
+    const size_t blocks = ctx.teeth * ctx.tables;
+    uword_t *base = malloc(blocks * entry_bytes);
+    memcpy(base, ctx.g, entry_bytes);
+    for (size_t m = 1; m < blocks; m++) {
+        memcpy(base + m * s, base + (m - 1) * s, entry_bytes);
+        for (size_t i = 0; i < ctx.span; i++)
+            mont_mul(&ctx.mont, base + m * s, base + m * s, base + m * s);
+    }
+
+    // Entry i of table k: product of the bases of blocks j * tables + k over
+    // the set bits j of i, built from the entry without its top bit
+    const size_t entries = (size_t)1 << ctx.teeth;
+    ctx.table = malloc(ctx.tables * entries * entry_bytes);
+    for (size_t k = 0; k < ctx.tables; k++) {
+        uword_t *t = ctx.table + k * entries * s;
+        memcpy(t, ctx.mont.one, entry_bytes);
+        for (size_t i = 1; i < entries; i++) {
+            size_t j = WORD_BITS - 1 - __builtin_clzll(i);
+            size_t rest = i & ~((size_t)1 << j);
+            mont_mul(&ctx.mont, t + i * s, t + rest * s, base + (j * ctx.tables + k) * s);
+        }
+    }
+    free(base);
+
+    return ctx;
+}
+
+// Free context
+void fixed_base_delete(fixed_base_ctx_t *ctx)
+{
+    if (!ctx->table)
+        return;
+    mont_delete(&ctx->mont);
+    free(ctx->g);
+    free(ctx->table);
+    ctx->g = ctx->table = NULL;
+}
+
+// Return the number of bytes used by the tables
+size_t fixed_base_table_bytes(const fixed_base_ctx_t *ctx)
+{
+    return ctx->tables * ((size_t)1 << ctx->teeth) * ctx->mont.size * sizeof(uword_t);
+}
+
+// Return bit i of exp (words words), 0 past the end
+static inline unsigned fixed_base_bit(const uword_t *exp, size_t words, size_t i)
+{
+    return i / WORD_BITS < words ? (exp[i / WORD_BITS] >> (i % WORD_BITS)) & 1 : 0;
+}
+
+// Return g^exp mod n for non-negative exp (longer exponents than max_bits
+// fall back to mont_pow)
+bigint_t fixed_base_exp(const fixed_base_ctx_t *ctx, bigint_t exp)
+{
+    if (!ctx->table || is_neg(exp)) {
+        fprintf(stderr, "fixed_base_exp: WARNING: %s\n",
+            ctx->table ? "negative exponent" : "invalid context");
+        return bigint_zero(1);
+    }
+
+    const size_t s = ctx->mont.size;
+    uword_t acc[s];
+    size_t words = limb_normalize(exp.val, exp.size);
+    if (limb_bits(exp.val, words) > ctx->max_bits) {
+        mont_pow(&ctx->mont, acc, ctx->g, exp.val, words);
+        return mont_from(&ctx->mont, acc);
+    }
+
+    // Column c takes bit c of every block: one squaring, then one product
+    // per table indexed by that table's teeth
+    const size_t entries = (size_t)1 << ctx->teeth;
+    memcpy(acc, ctx->mont.one, sizeof(acc));
+    for (size_t c = ctx->span; c-- > 0; ) {
+        if (c + 1 < ctx->span)
+            mont_mul(&ctx->mont, acc, acc, acc);
+        for (size_t k = 0; k < ctx->tables; k++) {
+            size_t idx = 0;
+            for (size_t j = 0; j < ctx->teeth; j++) {
+                size_t bit = (j * ctx->tables + k) * ctx->span + c;
+                idx |= (size_t)fixed_base_bit(exp.val, words, bit) << j;
+            }
+            if (idx)
+                mont_mul(&ctx->mont, acc, acc, ctx->table + (k * entries + idx) * s);
+        }
+    }
+    return mont_from(&ctx->mont, acc);
+}
+
+// Testing
+int fixed_base_test(void)
+{
+    int total_errors = 0;
+    static const size_t budgets[] = { 0, 1, 4096, 1 << 16 };
+    static const size_t bits[] = { 64, 521, 1024 };
+
+    for (size_t b = 0; b < sizeof(bits) / sizeof(bits[0]); b++) {
+        bigint_t n = bigint_random_bits(bits[b]);
+        n.val[0] |= 1;
+        bigint_t g = bigint_random_below(n);
+        int errors = 0;
+        for (size_t m = 0; m < sizeof(budgets) / sizeof(budgets[0]); m++) {
+            fixed_base_ctx_t ctx = fixed_base_new(g, n, bits[b], budgets[m]);
+            size_t floor = FIXED_BASE_MIN_ENTRIES * ctx.mont.size * sizeof(uword_t);
+            errors += budgets[m] > 0 && fixed_base_table_bytes(&ctx) > smax(budgets[m], floor);
+
+            // Short, full-length and too-long exponents, and zero
+            size_t exp_bits[] = { 0, 5, bits[b] / 2, bits[b], bits[b] + 70 };
+            for (size_t e = 0; e < sizeof(exp_bits) / sizeof(exp_bits[0]); e++) {
+                bigint_t exp = bigint_random_bits(exp_bits[e]);
+                bigint_t got = fixed_base_exp(&ctx, exp);
+                bigint_t expect = mod_exp(g, exp, n);
+                errors += !bigint_equals(got, expect);
+                bigint_delete(&exp);
+                bigint_delete(&got);
+                bigint_delete(&expect);
+            }
+            fixed_base_delete(&ctx);
+        }
+
+        bool test = errors == 0;
+        printf("%s: fixed_base_exp matches mod_exp for %zu-bit moduli\n",
+            test ? "TRUE" : "FALSE", bits[b]);
+        total_errors += !test;
+        bigint_delete(&n);
+        bigint_delete(&g);
+    }
+
+    return total_errors;
+}
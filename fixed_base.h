@@ -0,0 +1,52 @@
+/**
+ * fixed_base.h: Exponentiation of a fixed base with precomputed comb tables
+ *
+ * The exponent is cut into teeth * tables blocks of `span` bits. Table k
+ * holds, for every teeth-bit index i, the product of g^(2^(m * span)) over
+ * the blocks m = j * tables + k picked by the bits j of i. An exponentiation
+ * then walks the span columns once: one squaring per column and one product
+ * per table, about max_bits / (teeth * tables) squarings in all. Contexts
+ * are not modified after fixed_base_new, so threads may share one.
+ */
+
+#ifndef FIXED_BASE_H
+#define FIXED_BASE_H
+
+#include "bigint.h"
+#include "mont.h"
+
+enum {
+    FIXED_BASE_DEFAULT_TEETH = 4,   // One 16-entry table: a quarter of the squarings
+    FIXED_BASE_MAX_TEETH = 12,
+    FIXED_BASE_MIN_ENTRIES = 2,     // Smallest table: one tooth
+};
+
+typedef struct {
+    mont_ctx_t mont;
+    size_t max_bits;    // Longest exponent covered by the tables
+    size_t teeth;       // Table index bits
+    size_t tables;
+    size_t span;        // Bits per block, i.e. squarings per exponentiation
+    uword_t *g;         // Base in Montgomery form, for longer exponents
+    uword_t *table;     // tables * 2^teeth entries of mont.size words
+} fixed_base_ctx_t;
+
+// Return context for g^e mod n with 0 <= e < 2^max_bits, n odd and positive.
+// table_bytes bounds the table memory (0: FIXED_BASE_DEFAULT_TEETH teeth); a
+// budget under one table of FIXED_BASE_MIN_ENTRIES entries gets that table.
+fixed_base_ctx_t fixed_base_new(bigint_t g, bigint_t n, size_t max_bits, size_t table_bytes);
+
+// Free context
+void fixed_base_delete(fixed_base_ctx_t *ctx);
+
+// Return the number of bytes used by the tables
+size_t fixed_base_table_bytes(const fixed_base_ctx_t *ctx);
+
+// Return g^exp mod n for non-negative exp (longer exponents than max_bits
+// fall back to mont_pow)
+bigint_t fixed_base_exp(const fixed_base_ctx_t *ctx, bigint_t exp);
+
+// Testing methods
+int fixed_base_test(void);
+
+#endif // FIXED_BASE_H
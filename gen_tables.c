@@ -0,0 +1,341 @@
+/**
+ * gen_tables.c: Build-time generator for the constant tables in tables.h
+ *
+ * Writes tables.c to stdout. Nothing is typed in by hand: the small primes
+ * come from a sieve, the powers of ten from repeated products, and the
+ * RFC 3526 and RFC 7919 group primes from their definitions in terms of pi
+ * and e, which are computed here in fixed point. The generator links no
+ * library code, so it can run before the library is built.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prime.h"
+#include "tables.h"
+
+enum {
+    GEN_MAX_WORDS = 8192 / WORD_BITS + 1,   // Largest modulus, plus a carry word
+    GEN_FRAC_WORDS = 8192 / WORD_BITS + 2,  // Fraction words of pi and e
+    GEN_SIEVE = 2048,                       // Sieve bound for the small primes
+    // Words of the largest power of ten: log2(10) < 3.33
+    GEN_POW10_WORDS = (TABLES_POW10_DIGITS << (TABLES_POW10 - 1)) * 333 / 100 / WORD_BITS + 2,
+};
+
+// Fixed-point values: GEN_FRAC_WORDS fraction words, then one integer word
+typedef uword_t gen_fixed_t[GEN_FRAC_WORDS + 1];
+
+// a += b (n words), return the carry
+static uword_t gen_add(uword_t *a, const uword_t *b, size_t n)
+{
+    uword_t carry = 0;
+    for (size_t i = 0; i < n; i++) {
+        udword_t t = (udword_t)a[i] + b[i] + carry;
+        a[i] = (uword_t)t;
+        carry = (uword_t)(t >> WORD_BITS);
+    }
+    return carry;
+}
+
+// a -= b (n words), return the borrow
+static uword_t gen_sub(uword_t *a, const uword_t *b, size_t n)
+{
+    uword_t borrow = 0;
+    for (size_t i = 0; i < n; i++) {
+        uword_t t = a[i] - b[i] - borrow;
+        borrow = a[i] < b[i] || (a[i] == b[i] && borrow);
+        a[i] = t;
+    }
+    return borrow;
+}
+
+// a += k (n words)
+static void gen_add_1(uword_t *a, size_t n, uword_t k)
+{
+    for (size_t i = 0; i < n && k; i++) {
+        a[i] += k;
+        k = a[i] < k;
+    }
+}
+
+// a *= k (n words), return the carry word
+static uword_t gen_mul_1(uword_t *a, size_t n, uword_t k)
+{
+    uword_t carry = 0;
+    for (size_t i = 0; i < n; i++) {
+        udword_t t = (udword_t)a[i] * k + carry;
+        a[i] = (uword_t)t;
+        carry = (uword_t)(t >> WORD_BITS);
+    }
+    return carry;
+}
+
+// a /= d (n words), truncating
+static void gen_div_1(uword_t *a, size_t n, uword_t d)
+{
+    uword_t rem = 0;
+    for (size_t i = n; i-- > 0; ) {
+        udword_t t = ((udword_t)rem << WORD_BITS) | a[i];
+        a[i] = (uword_t)(t / d);
+        rem = (uword_t)(t % d);
+    }
+}
+
+// Return whether all n words of a are zero
+static bool gen_is_zero(const uword_t *a, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        if (a[i])
+            return false;
+    return true;
+}
+
+// Return a <=> b (n words)
+static int gen_cmp(const uword_t *a, const uword_t *b, size_t n)
+{
+    for (size_t i = n; i-- > 0; )
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    return 0;
+}
+
+// out = e = sum 1 / k!
+static void gen_e(uword_t *out)
+{
+    gen_fixed_t term = { 0 };
+    term[GEN_FRAC_WORDS] = 1;
+    memcpy(out, term, sizeof(gen_fixed_t));
+    for (uword_t k = 1; !gen_is_zero(term, GEN_FRAC_WORDS + 1); k++) {
+        gen_div_1(term, GEN_FRAC_WORDS + 1, k);
+        gen_add(out, term, GEN_FRAC_WORDS + 1);
+    }
+}
+
+// out = atan(1 / x) = sum (-1)^k / ((2k + 1) x^(2k + 1))
+static void gen_atan_inv(uword_t *out, uword_t x)
+{
+    gen_fixed_t pow = { 0 }, term;
+    pow[GEN_FRAC_WORDS] = 1;
+    gen_div_1(pow, GEN_FRAC_WORDS + 1, x);
+    memcpy(out, pow, sizeof(gen_fixed_t));
+    for (uword_t k = 1; !gen_is_zero(pow, GEN_FRAC_WORDS + 1); k++) {
+        gen_div_1(pow, GEN_FRAC_WORDS + 1, x * x);
+        memcpy(term, pow, sizeof(term));
+        gen_div_1(term, GEN_FRAC_WORDS + 1, 2 * k + 1);
+        if (k & 1)
+            gen_sub(out, term, GEN_FRAC_WORDS + 1);
+        else
+            gen_add(out, term, GEN_FRAC_WORDS + 1);
+    }
+}
+
+// out = pi = 16 atan(1/5) - 4 atan(1/239) (Machin)
+static void gen_pi(uword_t *out)
+{
+    gen_fixed_t t;
+    gen_atan_inv(out, 5);
+    gen_mul_1(out, GEN_FRAC_WORDS + 1, 16);
+    gen_atan_inv(t, 239);
+    gen_mul_1(t, GEN_FRAC_WORDS + 1, 4);
+    gen_sub(out, t, GEN_FRAC_WORDS + 1);
+}
+
+// out = 2^bits - 2^(bits - 64) - 1 + 2^64 (floor(2^(bits - 130) c) + k), the
+// form of the RFC 3526 and RFC 7919 primes, as bits / WORD_BITS words
+static void gen_group_prime(uword_t *out, size_t bits, const uword_t *c, uword_t k)
+{
+    const size_t s = bits / WORD_BITS;
+    uword_t t[GEN_MAX_WORDS + 1] = { 0 };
+
+    // floor(2^(bits - 130) c): c carries WORD_BITS * GEN_FRAC_WORDS fraction bits
+    size_t shift = WORD_BITS * GEN_FRAC_WORDS - (bits - 130);
+    for (size_t i = 0; i < s; i++) {
+        size_t bit = shift + i * WORD_BITS, w = bit / WORD_BITS, b = bit % WORD_BITS;
+        uword_t lo = w <= GEN_FRAC_WORDS ? c[w] >> b : 0;
+        uword_t hi = b && w + 1 <= GEN_FRAC_WORDS ? c[w + 1] << (WORD_BITS - b) : 0;
+        t[i + 1] = lo | hi;
+    }
+    gen_add_1(t + 1, s, k);
+
+    // 2^bits - 2^(bits - 64) - 1 is all ones but bit bits - 64
+    memset(out, 0xff, s * sizeof(uword_t));
+    out[s - 1] ^= 1;
+    if (gen_add(out, t, s) || t[s]) {
+        fprintf(stderr, "gen_tables: ERROR: %zu-bit group prime out of range\n", bits);
+        abort();
+    }
+}
+
+// out = 2^bits + sum of sign * 2^e over the terms, as words words
+static void gen_sparse(uword_t *out, size_t words, size_t bits, const int *terms, size_t count)
+{
+    uword_t p[GEN_MAX_WORDS] = { 0 };
+    memset(out, 0, words * sizeof(uword_t));
+    if (bits < words * WORD_BITS)
+        out[bits / WORD_BITS] = (uword_t)1 << (bits % WORD_BITS);
+    for (size_t i = 0; i < count; i++) {
+        int e = abs(terms[i]) - 1;
+        memset(p, 0, words * sizeof(uword_t));
+        p[e / WORD_BITS] = (uword_t)1 << (e % WORD_BITS);
+        if (terms[i] > 0)
+            gen_add(out, p, words);
+        else
+            gen_sub(out, p, words);
+    }
+}
+
+// Write a as a static array named name_suffix
+static void gen_print_words(const char *name, const char *suffix, const uword_t *a, size_t n)
+{
+    printf("static const uword_t %s_%s[%zu] = {", name, suffix, n);
+    for (size_t i = 0; i < n; i++)
+        printf("%s0x%016llx,", i % 4 ? " " : "\n    ", (unsigned long long)a[i]);
+    printf("\n};\n");
+}
+
+typedef struct {
+    const char *name;
+    size_t bits;
+    uword_t n[GEN_MAX_WORDS];
+} gen_modulus_t;
+
+// Write the Montgomery constants of m, by doubling R mod n up from 1
+static void gen_mont(const gen_modulus_t *m)
+{
+    const size_t s = (m->bits + WORD_BITS - 1) / WORD_BITS;
+    uword_t x[GEN_MAX_WORDS + 1] = { 1 }, one[GEN_MAX_WORDS];
+    for (size_t i = 0; i < 2 * s * WORD_BITS; i++) {
+        x[s] = gen_mul_1(x, s, 2);
+        if (x[s] || gen_cmp(x, m->n, s) >= 0)
+            x[s] -= gen_sub(x, m->n, s);
+        if (i + 1 == s * WORD_BITS)
+            memcpy(one, x, s * sizeof(uword_t));
+    }
+    gen_print_words(m->name, "n", m->n, s);
+    gen_print_words(m->name, "r2", x, s);
+    gen_print_words(m->name, "one", one, s);
+}
+
+int main(void)
+{
+    printf("/**\n * tables.c: Constant tables, generated by gen_tables; do not edit\n */\n\n");
+    printf("#include \"prime.h\"\n#include \"tables.h\"\n\n");
+
+    // Odd primes by a sieve
+    static bool composite[GEN_SIEVE];
+    size_t count = 0;
+    printf("// Odd primes for trial division\nconst uint16_t small_primes[SMALL_PRIMES] = {");
+    for (size_t p = 3; p < GEN_SIEVE && count < SMALL_PRIMES; p += 2) {
+        if (composite[p])
+            continue;
+        for (size_t q = p * p; q < GEN_SIEVE; q += 2 * p)
+            composite[q] = true;
+        printf("%s%4zu,", count++ % 12 ? " " : "\n    ", p);
+    }
+    printf("\n};\n\n");
+    if (count < SMALL_PRIMES) {
+        fprintf(stderr, "gen_tables: ERROR: sieve bound too small\n");
+        return 1;
+    }
+
+    // Powers of ten that decimal conversion splits at, each without leading
+    // zero words
+    static uword_t pow[GEN_POW10_WORDS] = { 1 };
+    size_t words = 1, start = 0, k = 0;
+    printf("const uword_t tables_pow10[] = {");
+    char offsets[TABLES_POW10 + 1][8];
+    for (size_t j = 0; j < TABLES_POW10; j++) {
+        for ( ; k < (size_t)TABLES_POW10_DIGITS << j; k++) {
+            uword_t carry = gen_mul_1(pow, words, 10);
+            if (carry)
+                pow[words++] = carry;
+        }
+        snprintf(offsets[j], sizeof(offsets[j]), "%zu", start);
+        for (size_t i = 0; i < words; i++)
+            printf("%s0x%016llx,", (start + i) % 4 ? " " : "\n    ", (unsigned long long)pow[i]);
+        start += words;
+    }
+    snprintf(offsets[TABLES_POW10], sizeof(offsets[0]), "%zu", start);
+    printf("\n};\n\nconst uint16_t tables_pow10_start[TABLES_POW10 + 1] = {");
+    for (size_t j = 0; j <= TABLES_POW10; j++)
+        printf("%s%s,", j % 12 ? " " : "\n    ", offsets[j]);
+    printf("\n};\n\n");
+
+    // Field primes, terms given as +-(e + 1) for +-2^e
+    static const struct {
+        const char *name;
+        size_t bits;
+        int terms[8];
+    } sparse[] = {
+        { "p192", 192, { -65, -1 } },
+        { "p224", 224, { -97, 1 } },
+        { "p256", 256, { -225, 193, 97, -1 } },
+        { "p384", 384, { -129, -97, 33, -1 } },
+        { "p521", 521, { -1 } },
+        { "curve25519", 255, { -5, -2, -1 } },                  // - 19
+        { "secp256k1", 256, { -33, -10, -9, -8, -7, -5, -1 } }, // - 2^32 - 977
+    };
+    // RFC 3526 (pi) and RFC 7919 (e) groups
+    static const struct {
+        const char *name;
+        size_t bits;
+        bool e;
+        uword_t k;
+    } groups[] = {
+        { "modp1536", 1536, false, 741804 },
+        { "modp2048", 2048, false, 124476 },
+        { "modp3072", 3072, false, 1690314 },
+        { "modp4096", 4096, false, 240904 },
+        { "modp6144", 6144, false, 929484 },
+        { "modp8192", 8192, false, 4743158 },
+        { "ffdhe2048", 2048, true, 560316 },
+        { "ffdhe3072", 3072, true, 2625351 },
+        { "ffdhe4096", 4096, true, 5736041 },
+        { "ffdhe6144", 6144, true, 15705020 },
+        { "ffdhe8192", 8192, true, 10965728 },
+    };
+    const size_t num_sparse = sizeof(sparse) / sizeof(sparse[0]);
+    const size_t num_groups = sizeof(groups) / sizeof(groups[0]);
+    if (num_sparse + num_groups != TABLES_MONT) {
+        fprintf(stderr, "gen_tables: ERROR: TABLES_MONT is not %zu\n", num_sparse + num_groups);
+        return 1;
+    }
+
+    static gen_modulus_t mods[TABLES_MONT];
+    static gen_fixed_t pi, e;
+    gen_pi(pi);
+    gen_e(e);
+    for (size_t i = 0; i < num_sparse; i++) {
+        mods[i].name = sparse[i].name;
+        mods[i].bits = sparse[i].bits;
+        size_t terms = 0;
+        while (terms < 8 && sparse[i].terms[terms])
+            terms++;
+        gen_sparse(mods[i].n, (sparse[i].bits + WORD_BITS - 1) / WORD_BITS, sparse[i].bits,
+            sparse[i].terms, terms);
+    }
+    for (size_t i = 0; i < num_groups; i++) {
+        gen_modulus_t *m = &mods[num_sparse + i];
+        m->name = groups[i].name;
+        m->bits = groups[i].bits;
+        gen_group_prime(m->n, groups[i].bits, groups[i].e ? e : pi, groups[i].k);
+    }
+
+    for (size_t i = 0; i < TABLES_MONT; i++)
+        gen_mont(&mods[i]);
+    printf("\nconst tables_mont_t tables_mont[TABLES_MONT] = {\n");
+    for (size_t i = 0; i < TABLES_MONT; i++) {
+        // -n^-1 mod 2^WORD_BITS by Newton iteration, as mont_n0inv
+        uword_t n0 = mods[i].n[0], inv = n0;
+        for (int j = 0; j < 6; j++)
+            inv *= 2 - n0 * inv;
+        const char *name = mods[i].name;
+        printf("    { \"%s\", %zu, 0x%016llx, %s_n, %s_r2, %s_one },\n", name,
+            (mods[i].bits + WORD_BITS - 1) / WORD_BITS, (unsigned long long)-inv,
+            name, name, name);
+    }
+    printf("};\n");
+    return 0;
+}
@@ -0,0 +1,454 @@
+/**
+ * ifma.c: AVX-512 IFMA Montgomery arithmetic on eight lanes
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "cpu.h"
+#include "ifma.h"
+#include "limb.h"
+#include "math.h"
+#include "mont.h"
+
+#define IFMA_MASK (((uint64_t)1 << IFMA_DIGIT_BITS) - 1)
+
+// Return whether the CPU has AVX-512 IFMA and the avx512 tier is in use
+bool ifma_available(void)
+{
+#if defined(__x86_64__)
+    return cpu_features()->avx512ifma && limb_tier() >= CPU_TIER_AVX512;
+#else
+    return false;
+#endif
+}
+
+// Return a zeroed vector of ctx->digits interleaved digits, freed with free()
+uint64_t *ifma_vec_new(const ifma_ctx_t *ctx)
+{
+    size_t bytes = ctx->digits * IFMA_LANES * sizeof(uint64_t);
+    uint64_t *v = aligned_alloc(64, bytes);
+    memset(v, 0, bytes);
+    return v;
+}
+
+// Store the value of words (n words) as the digits of one lane of v
+static void ifma_split(const ifma_ctx_t *ctx, uint64_t *v, size_t lane,
+        const uword_t *words, size_t n)
+{
+    for (size_t j = 0; j < ctx->digits; j++) {
+        size_t bit = j * IFMA_DIGIT_BITS;
+        size_t w = bit / WORD_BITS;
+        unsigned off = bit % WORD_BITS;
+        uint64_t d = 0;
+        if (w < n)
+            d = words[w] >> off;
+        if (off > WORD_BITS - IFMA_DIGIT_BITS && w + 1 < n)
+            d |= words[w + 1] << (WORD_BITS - off);
+        v[j * IFMA_LANES + lane] = d & IFMA_MASK;
+    }
+}
+
+// Return words needed to hold the digits of one lane, plus one spare
+static size_t ifma_words(const ifma_ctx_t *ctx)
+{
+    return (ctx->digits * IFMA_DIGIT_BITS + WORD_BITS - 1) / WORD_BITS + 1;
+}
+
+// Store the normalized digits of one lane of v into words (ifma_words long)
+static void ifma_join(const ifma_ctx_t *ctx, uword_t *words, const uint64_t *v, size_t lane)
+{
+    memset(words, 0, ifma_words(ctx) * sizeof(uword_t));
+    for (size_t j = 0; j < ctx->digits; j++) {
+        uint64_t d = v[j * IFMA_LANES + lane];
+        size_t bit = j * IFMA_DIGIT_BITS;
+        size_t w = bit / WORD_BITS;
+        unsigned off = bit % WORD_BITS;
+        words[w] |= d << off;
+        if (off > WORD_BITS - IFMA_DIGIT_BITS)
+            words[w + 1] |= d >> (WORD_BITS - off);
+    }
+}
+
+// Return -n^-1 mod 2^52 for odd n
+static uint64_t ifma_n0inv(uint64_t n)
+{
+    uint64_t inv = n;
+    for (int i = 0; i < 5; i++)
+        inv *= 2 - n * inv;
+    return -inv & IFMA_MASK;
+}
+
+// Return context for IFMA_LANES odd positive moduli of at most IFMA_MAX_BITS bits
+ifma_ctx_t ifma_new(const bigint_t n[IFMA_LANES])
+{
+    ifma_ctx_t ctx = { 0 };
+    size_t bits = 0;
+    for (size_t l = 0; l < IFMA_LANES; l++) {
+        size_t lane_bits = bigint_bits(n[l]);
+        if (!is_pos(n[l]) || !(n[l].val[0] & 1) || lane_bits > IFMA_MAX_BITS) {
+            fprintf(stderr, "ifma_new: WARNING: moduli must be odd, positive and "
+                "at most %d bits\n", IFMA_MAX_BITS);
+            return (ifma_ctx_t) { 0 };
+        }
+        bits = smax(bits, lane_bits);
+        ctx.lane_size[l] = limb_normalize(n[l].val, n[l].size);
+        ctx.size = smax(ctx.size, ctx.lane_size[l]);
+    }
+
+    // R > 4n keeps almost-reduced results below 2n
+    ctx.digits = (bits + 2 + IFMA_DIGIT_BITS - 1) / IFMA_DIGIT_BITS;
+    ctx.limbs = calloc(IFMA_LANES * ctx.size, sizeof(uword_t));
+    ctx.n = ifma_vec_new(&ctx);
+    for (size_t l = 0; l < IFMA_LANES; l++) {
+        uword_t *limbs = ctx.limbs + l * ctx.size;
+        memcpy(limbs, n[l].val, ctx.lane_size[l] * sizeof(uword_t));
+        ifma_split(&ctx, ctx.n, l, limbs, ctx.lane_size[l]);
+        ctx.n0inv[l] = ifma_n0inv(limbs[0]);
+    }
+
+    bigint_t one[IFMA_LANES];
+    for (size_t l = 0; l < IFMA_LANES; l++)
+        one[l] = long_to_bigint(1);
+    ctx.one = ifma_vec_new(&ctx);
+    ifma_to(&ctx, ctx.one, one);
+    for (size_t l = 0; l < IFMA_LANES; l++)
+        bigint_delete(one + l);
+
+    return ctx;
+}
+
+// Free context
+void ifma_delete(ifma_ctx_t *ctx)
+{
+    free(ctx->n);
+    free(ctx->one);
+    free(ctx->limbs);
+    ctx->digits = 0;
+}
+
+#if defined(__x86_64__)
+
+/**
+ * Both kernels accumulate 52x52-bit partial products into 64-bit columns
+ * without propagating carries. A column takes at most 4 (digits + 1) terms
+ * below 2^52 plus carries, which fits for moduli up to IFMA_MAX_BITS bits.
+ * Inputs must have normalized digits; outputs are normalized.
+ */
+
+// Reduce the column sums t (2 * digits + 1 columns) by n and normalize the
+// upper half into out
+__attribute__((target("avx512f,avx512ifma")))
+static void ifma_redc(const ifma_ctx_t *ctx, uint64_t *out, __m512i *t)
+{
+    const size_t L = ctx->digits;
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i mask = _mm512_set1_epi64(IFMA_MASK);
+    const __m512i n0inv = _mm512_loadu_si512(ctx->n0inv);
+
+    for (size_t i = 0; i < L; i++) {
+        // The low 52 bits of m * n cancel column i
+        __m512i m = _mm512_madd52lo_epu64(zero, t[i], n0inv);
+        for (size_t j = 0; j < L; j++) {
+            __m512i nj = _mm512_load_si512(ctx->n + j * IFMA_LANES);
+            t[i+j] = _mm512_madd52lo_epu64(t[i+j], nj, m);
+            t[i+j+1] = _mm512_madd52hi_epu64(t[i+j+1], nj, m);
+        }
+        t[i+1] = _mm512_add_epi64(t[i+1], _mm512_srli_epi64(t[i], IFMA_DIGIT_BITS));
+    }
+
+    // The result is below 2n < R, so the carry out of the top digit is zero
+    __m512i carry = zero;
+    for (size_t j = 0; j < L; j++) {
+        __m512i x = _mm512_add_epi64(t[L+j], carry);
+        carry = _mm512_srli_epi64(x, IFMA_DIGIT_BITS);
+        _mm512_store_si512(out + j * IFMA_LANES, _mm512_and_si512(x, mask));
+    }
+}
+
+// out = a * b / R mod n in every lane (out may alias a or b)
+__attribute__((target("avx512f,avx512ifma")))
+void ifma_mul(const ifma_ctx_t *ctx, uint64_t *out, const uint64_t *a, const uint64_t *b)
+{
+    const size_t L = ctx->digits;
+    __m512i t[2 * L + 1];
+    for (size_t k = 0; k <= 2 * L; k++)
+        t[k] = _mm512_setzero_si512();
+
+    for (size_t i = 0; i < L; i++) {
+        __m512i bi = _mm512_load_si512(b + i * IFMA_LANES);
+        for (size_t j = 0; j < L; j++) {
+            __m512i aj = _mm512_load_si512(a + j * IFMA_LANES);
+            t[i+j] = _mm512_madd52lo_epu64(t[i+j], aj, bi);
+            t[i+j+1] = _mm512_madd52hi_epu64(t[i+j+1], aj, bi);
+        }
+    }
+    ifma_redc(ctx, out, t);
+}
+
+// out = a^2 / R mod n in every lane (out may alias a)
+__attribute__((target("avx512f,avx512ifma")))
+void ifma_sqr(const ifma_ctx_t *ctx, uint64_t *out, const uint64_t *a)
+{
+    const size_t L = ctx->digits;
+    __m512i t[2 * L + 1];
+    for (size_t k = 0; k <= 2 * L; k++)
+        t[k] = _mm512_setzero_si512();
+
+    // Cross products once, doubled, then the squares on the diagonal
+    for (size_t i = 0; i < L; i++) {
+        __m512i ai = _mm512_load_si512(a + i * IFMA_LANES);
+        for (size_t j = i + 1; j < L; j++) {
+            __m512i aj = _mm512_load_si512(a + j * IFMA_LANES);
+            t[i+j] = _mm512_madd52lo_epu64(t[i+j], ai, aj);
+            t[i+j+1] = _mm512_madd52hi_epu64(t[i+j+1], ai, aj);
+        }
+    }
+    for (size_t k = 0; k <= 2 * L; k++)
+        t[k] = _mm512_add_epi64(t[k], t[k]);
+    for (size_t i = 0; i < L; i++) {
+        __m512i ai = _mm512_load_si512(a + i * IFMA_LANES);
+        t[2*i] = _mm512_madd52lo_epu64(t[2*i], ai, ai);
+        t[2*i+1] = _mm512_madd52hi_epu64(t[2*i+1], ai, ai);
+    }
+    ifma_redc(ctx, out, t);
+}
+
+// out = table[win[lane]] in every lane
+__attribute__((target("avx512f")))
+static void ifma_select(const ifma_ctx_t *ctx, uint64_t *out, const uint64_t *table,
+        const uint64_t win[IFMA_LANES])
+{
+    const size_t stride = ctx->digits * IFMA_LANES;
+    uint64_t start[IFMA_LANES];
+    for (size_t l = 0; l < IFMA_LANES; l++)
+        start[l] = win[l] * stride + l;
+    __m512i idx = _mm512_loadu_si512(start);
+    for (size_t j = 0; j < ctx->digits; j++) {
+        __m512i d = _mm512_i64gather_epi64(idx, (const void *)table, sizeof(uint64_t));
+        _mm512_store_si512(out + j * IFMA_LANES, d);
+        idx = _mm512_add_epi64(idx, _mm512_set1_epi64(IFMA_LANES));
+    }
+}
+
+#else
+
+void ifma_mul(const ifma_ctx_t *ctx, uint64_t *out, const uint64_t *a, const uint64_t *b)
+{
+    (void)ctx; (void)out; (void)a; (void)b;
+    fprintf(stderr, "ifma_mul: WARNING: not supported on this architecture\n");
+}
+
+void ifma_sqr(const ifma_ctx_t *ctx, uint64_t *out, const uint64_t *a)
+{
+    (void)ctx; (void)out; (void)a;
+    fprintf(stderr, "ifma_sqr: WARNING: not supported on this architecture\n");
+}
+
+static void ifma_select(const ifma_ctx_t *ctx, uint64_t *out, const uint64_t *table,
+        const uint64_t win[IFMA_LANES])
+{
+    const size_t stride = ctx->digits * IFMA_LANES;
+    for (size_t j = 0; j < ctx->digits; j++)
+        for (size_t l = 0; l < IFMA_LANES; l++)
+            out[j * IFMA_LANES + l] = table[win[l] * stride + j * IFMA_LANES + l];
+}
+
+#endif // __x86_64__
+
+// Convert a[lane] (any sign or size) into Montgomery form
+void ifma_to(const ifma_ctx_t *ctx, uint64_t *out, const bigint_t a[IFMA_LANES])
+{
+    // R = 2^shift
+    const size_t shift = ctx->digits * IFMA_DIGIT_BITS;
+    const size_t s = ctx->size;
+    for (size_t l = 0; l < IFMA_LANES; l++) {
+        const uword_t *n = ctx->limbs + l * s;
+        const size_t ns = ctx->lane_size[l];
+        bool neg = is_neg(a[l]);
+        bigint_t mag = neg ? bigint_neg(a[l]) : a[l];
+        size_t an = limb_normalize(mag.val, mag.size);
+
+        // Reduce the magnitude mod n, then fix the sign
+        uword_t red[ns];
+        memset(red, 0, sizeof(red));
+        if (an >= ns)
+            limb_divrem(NULL, red, mag.val, an, n, ns);
+        else
+            memcpy(red, mag.val, an * sizeof(uword_t));
+        if (neg && !limb_is_zero(red, ns))
+            limb_sub_n(red, n, red, ns);
+        if (neg)
+            bigint_delete(&mag);
+
+        // a * R mod n
+        size_t size = ns + shift / WORD_BITS + 1;
+        uword_t *t = calloc(size, sizeof(uword_t));
+        t[size - 1] = limb_shl(t + shift / WORD_BITS, red, ns, shift % WORD_BITS);
+        limb_divrem(NULL, red, t, size, n, ns);
+        free(t);
+
+        ifma_split(ctx, out, l, red, ns);
+    }
+}
+
+// Convert every lane of a out of Montgomery form
+void ifma_from(const ifma_ctx_t *ctx, bigint_t out[IFMA_LANES], const uint64_t *a)
+{
+    uint64_t *unit = ifma_vec_new(ctx);
+    for (size_t l = 0; l < IFMA_LANES; l++)
+        unit[l] = 1;
+    uint64_t *x = ifma_vec_new(ctx);
+    ifma_mul(ctx, x, a, unit);
+
+    // Each lane is below 2n, so one subtraction finishes the reduction
+    uword_t words[ifma_words(ctx)];
+    for (size_t l = 0; l < IFMA_LANES; l++) {
+        const uword_t *n = ctx->limbs + l * ctx->size;
+        const size_t ns = ctx->lane_size[l];
+        ifma_join(ctx, words, x, l);
+        if (words[ns] || limb_cmp(words, n, ns) >= 0)
+            words[ns] -= limb_sub_n(words, words, n, ns);
+        out[l] = bigint_from_limbs(words, ns);
+    }
+
+    free(unit);
+    free(x);
+}
+
+// Return fixed window size for an exponent of the given length
+static unsigned ifma_window(size_t bits)
+{
+    if (bits > 768) return 6;
+    if (bits > 256) return 5;
+    if (bits > 64) return 4;
+    if (bits > 16) return 3;
+    return 1;
+}
+
+// out = base^exp[lane] in every lane, exponents non-negative
+void ifma_pow(const ifma_ctx_t *ctx, uint64_t *out, const uint64_t *base,
+        const bigint_t exp[IFMA_LANES])
+{
+    const size_t stride = ctx->digits * IFMA_LANES;
+    size_t bits = 0;
+    for (size_t l = 0; l < IFMA_LANES; l++)
+        bits = smax(bits, bigint_bits(exp[l]));
+    if (bits == 0) {
+        memcpy(out, ctx->one, stride * sizeof(uint64_t));
+        return;
+    }
+
+    // Table of base^0 .. base^(2^w - 1), shared by the lanes
+    unsigned w = ifma_window(bits);
+    size_t entries = (size_t)1 << w;
+    uint64_t *table = aligned_alloc(64, entries * stride * sizeof(uint64_t));
+    memcpy(table, ctx->one, stride * sizeof(uint64_t));
+    memcpy(table + stride, base, stride * sizeof(uint64_t));
+    for (size_t i = 2; i < entries; i++)
+        ifma_mul(ctx, table + i * stride, table + (i - 1) * stride, base);
+
+    // Left-to-right fixed window; shorter exponents see leading zero windows
+    uint64_t *acc = ifma_vec_new(ctx);
+    uint64_t *sel = ifma_vec_new(ctx);
+    size_t pos = (bits + w - 1) / w * w;
+    bool first = true;
+    while (pos > 0) {
+        pos -= w;
+        uint64_t win[IFMA_LANES] = { 0 };
+        for (size_t l = 0; l < IFMA_LANES; l++) {
+            for (unsigned j = 0; j < w; j++) {
+                size_t bit = pos + j;
+                if (bit / WORD_BITS < exp[l].size
+                        && (exp[l].val[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1)
+                    win[l] |= (uint64_t)1 << j;
+            }
+        }
+        if (first) {
+            ifma_select(ctx, acc, table, win);
+            first = false;
+            continue;
+        }
+        for (unsigned j = 0; j < w; j++)
+            ifma_sqr(ctx, acc, acc);
+        ifma_select(ctx, sel, table, win);
+        ifma_mul(ctx, acc, acc, sel);
+    }
+
+    memcpy(out, acc, stride * sizeof(uint64_t));
+    free(acc);
+    free(sel);
+    free(table);
+}
+
+// out[lane] = a[lane]^exp[lane] mod n[lane], exponents non-negative
+void ifma_mod_exp(bigint_t out[IFMA_LANES], const bigint_t a[IFMA_LANES],
+        const bigint_t exp[IFMA_LANES], const bigint_t n[IFMA_LANES])
+{
+    ifma_ctx_t ctx = ifma_new(n);
+    if (ctx.digits == 0) {
+        for (size_t l = 0; l < IFMA_LANES; l++)
+            out[l] = bigint_zero(1);
+        return;
+    }
+
+    uint64_t *x = ifma_vec_new(&ctx);
+    ifma_to(&ctx, x, a);
+    ifma_pow(&ctx, x, x, exp);
+    ifma_from(&ctx, out, x);
+    free(x);
+    ifma_delete(&ctx);
+}
+
+// Return a random odd modulus of exactly the given number of bits
+static bigint_t ifma_test_modulus(size_t bits)
+{
+    bigint_t n = bigint_random_bits(bits);
+    n.size = bits / WORD_BITS + 1;
+    n.val[(bits - 1) / WORD_BITS] |= (uword_t)1 << ((bits - 1) % WORD_BITS);
+    n.val[0] |= 1;
+    n.size = bigint_min_words(n);
+    return n;
+}
+
+// Testing
+int ifma_test(void)
+{
+    if (!ifma_available()) {
+        printf("TRUE: AVX-512 IFMA not available, engine skipped\n");
+        return 0;
+    }
+
+    // Lanes mix sizes, and lanes 2 and 3 share a modulus
+    static const size_t bits[IFMA_LANES] = { 1024, 521, 768, 768, 1000, 640, 1024, 900 };
+    bigint_t n[IFMA_LANES], a[IFMA_LANES], e[IFMA_LANES], out[IFMA_LANES];
+    for (size_t l = 0; l < IFMA_LANES; l++) {
+        n[l] = l == 3 ? bigint_copy(n[2]) : ifma_test_modulus(bits[l]);
+        a[l] = bigint_random_bits(bits[l] + 40);
+        e[l] = bigint_random_bits(l == 5 ? 17 : bits[l]);
+    }
+    ifma_mod_exp(out, a, e, n);
+
+    int errors = 0;
+    for (size_t l = 0; l < IFMA_LANES; l++) {
+        mont_ctx_t ctx = mont_new(n[l]);
+        bigint_t expect = mont_exp(&ctx, a[l], e[l]);
+        mont_delete(&ctx);
+        errors += !bigint_equals(expect, out[l]);
+        bigint_delete(&expect);
+        bigint_delete(n + l);
+        bigint_delete(a + l);
+        bigint_delete(e + l);
+        bigint_delete(out + l);
+    }
+
+    bool test = errors == 0;
+    printf("%s: IFMA mod_exp on %d lanes matches scalar Montgomery results\n",
+        test ? "TRUE" : "FALSE", IFMA_LANES);
+    return !test;
+}
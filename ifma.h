@@ -0,0 +1,72 @@
+/**
+ * ifma.h: AVX-512 IFMA Montgomery arithmetic on eight lanes
+ *
+ * Each of the IFMA_LANES lanes holds its own residue under its own odd
+ * modulus (lanes may share one). Residues are stored in radix 2^52, digit
+ * interleaved: digit j of lane l is at v[j * IFMA_LANES + l], so one 512-bit
+ * load fetches a digit of every lane. Montgomery form uses R = 2^(52 * digits)
+ * with R > 4n for every lane, which lets results stay in [0, 2n) until they
+ * are converted back.
+ */
+
+#ifndef IFMA_H
+#define IFMA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bigint.h"
+
+enum {
+    IFMA_LANES = 8,
+    IFMA_DIGIT_BITS = 52,
+    IFMA_MIN_BITS = 512,        // Smaller moduli are faster on the scalar path
+    IFMA_MAX_BITS = 8192,       // Keeps the column sums within 64 bits
+};
+
+typedef struct {
+    size_t digits;                  // Digits per lane
+    size_t size;                    // Words of the largest modulus
+    uint64_t *n;                    // Moduli, interleaved
+    uint64_t *one;                  // R mod n, interleaved
+    uint64_t n0inv[IFMA_LANES];     // -n^-1 mod 2^52 for each lane
+    uword_t *limbs;                 // Moduli as words, size per lane
+    size_t lane_size[IFMA_LANES];   // Significant words of each modulus
+} ifma_ctx_t;
+
+// Return whether the CPU has AVX-512 IFMA and the avx512 tier is in use
+bool ifma_available(void);
+
+// Return context for IFMA_LANES odd positive moduli of at most IFMA_MAX_BITS bits
+ifma_ctx_t ifma_new(const bigint_t n[IFMA_LANES]);
+
+// Free context
+void ifma_delete(ifma_ctx_t *ctx);
+
+// Return a zeroed vector of ctx->digits interleaved digits, freed with free()
+uint64_t *ifma_vec_new(const ifma_ctx_t *ctx);
+
+// out = a * b / R mod n in every lane (out may alias a or b)
+void ifma_mul(const ifma_ctx_t *ctx, uint64_t *out, const uint64_t *a, const uint64_t *b);
+
+// out = a^2 / R mod n in every lane (out may alias a)
+void ifma_sqr(const ifma_ctx_t *ctx, uint64_t *out, const uint64_t *a);
+
+// Convert a[lane] (any sign or size) into Montgomery form
+void ifma_to(const ifma_ctx_t *ctx, uint64_t *out, const bigint_t a[IFMA_LANES]);
+
+// Convert every lane of a out of Montgomery form
+void ifma_from(const ifma_ctx_t *ctx, bigint_t out[IFMA_LANES], const uint64_t *a);
+
+// out = base^exp[lane] in every lane, exponents non-negative
+void ifma_pow(const ifma_ctx_t *ctx, uint64_t *out, const uint64_t *base,
+        const bigint_t exp[IFMA_LANES]);
+
+// out[lane] = a[lane]^exp[lane] mod n[lane], exponents non-negative
+void ifma_mod_exp(bigint_t out[IFMA_LANES], const bigint_t a[IFMA_LANES],
+        const bigint_t exp[IFMA_LANES], const bigint_t n[IFMA_LANES]);
+
+// Testing methods
+int ifma_test(void);
+
+#endif // IFMA_H
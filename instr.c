@@ -0,0 +1,215 @@
+/**
+ * instr.c: Optional runtime instrumentation
+ */
+
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "instr.h"
+#include "math.h"
+
+static const char *instr_names[INSTR_OPS] = {
+    [INSTR_NEW] = "new",
+    [INSTR_PRINT] = "print",
+    [INSTR_PRINT_HEX] = "print_hex",
+    [INSTR_NEG] = "neg",
+    [INSTR_SUM] = "sum",
+    [INSTR_DIFF] = "diff",
+    [INSTR_PROD] = "prod",
+    [INSTR_DIV] = "div",
+    [INSTR_SL] = "sl",
+    [INSTR_SR] = "sr",
+    [INSTR_GCD] = "gcd",
+    [INSTR_XGCD] = "xgcd",
+    [INSTR_ISQRT] = "isqrt",
+    [INSTR_IROOT] = "iroot",
+    [INSTR_MOD] = "mod",
+    [INSTR_MOD_SUM] = "mod_sum",
+    [INSTR_MOD_DIFF] = "mod_diff",
+    [INSTR_MOD_PROD] = "mod_prod",
+    [INSTR_MOD_EXP] = "mod_exp",
+    [INSTR_MOD_INV] = "mod_inv",
+    [INSTR_MOD_NEG] = "mod_neg",
+    [INSTR_MOD_JACOBI] = "mod_jacobi",
+    [INSTR_MOD_SQRT] = "mod_sqrt",
+};
+
+// Return whether instrumentation was compiled in
+bool instr_enabled(void)
+{
+#ifdef INSTRUMENT
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Return the name of op, e.g. "mod_exp"
+const char *instr_op_name(instr_op_t op)
+{
+    return op < INSTR_OPS ? instr_names[op] : "unknown";
+}
+
+// Return ceil(log2(n)) clamped to [0, bins)
+static size_t instr_log2_bin(uint64_t n, size_t bins)
+{
+    size_t bin = n <= 1 ? 0 : 64 - __builtin_clzll(n - 1);
+    return bin < bins ? bin : bins - 1;
+}
+
+// Return the size bucket for an operand of the given number of limbs
+size_t instr_size_bucket(size_t limbs)
+{
+    return instr_log2_bin(limbs, INSTR_SIZE_BUCKETS);
+}
+
+#ifdef INSTRUMENT
+
+// Relaxed counters: a snapshot need not be consistent across fields
+static _Atomic uint64_t instr_calls[INSTR_OPS];
+static _Atomic uint64_t instr_cycles[INSTR_OPS];
+static _Atomic uint64_t instr_hist[INSTR_OPS][INSTR_SIZE_BUCKETS][INSTR_CYCLE_BINS];
+static _Atomic uint64_t instr_alloc_calls;
+static _Atomic uint64_t instr_alloc_bytes;
+static _Atomic uint64_t instr_free_calls;
+static _Atomic uint64_t instr_free_bytes;
+
+// Return the time stamp counter, or 0 where there is none
+static inline uint64_t instr_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Count a call to op and start its timer
+instr_scope_t instr_scope_begin(instr_op_t op, size_t limbs)
+{
+    atomic_fetch_add_explicit(instr_calls + op, 1, memory_order_relaxed);
+    return (instr_scope_t) { .op = op, .limbs = limbs, .start = instr_tsc() };
+}
+
+// Record the latency of the call started by instr_scope_begin
+void instr_scope_end(instr_scope_t *scope)
+{
+    uint64_t cycles = instr_tsc() - scope->start;
+    size_t bucket = instr_size_bucket(scope->limbs);
+    size_t bin = instr_log2_bin(cycles, INSTR_CYCLE_BINS);
+    atomic_fetch_add_explicit(instr_cycles + scope->op, cycles, memory_order_relaxed);
+    atomic_fetch_add_explicit(&instr_hist[scope->op][bucket][bin], 1, memory_order_relaxed);
+}
+
+static void instr_count_alloc(void *p)
+{
+    if (!p)
+        return;
+    atomic_fetch_add_explicit(&instr_alloc_calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&instr_alloc_bytes, malloc_usable_size(p), memory_order_relaxed);
+}
+
+void *instr_malloc(size_t bytes)
+{
+    void *p = malloc(bytes);
+    instr_count_alloc(p);
+    return p;
+}
+
+void *instr_calloc(size_t count, size_t bytes)
+{
+    void *p = calloc(count, bytes);
+    instr_count_alloc(p);
+    return p;
+}
+
+void instr_free(void *p)
+{
+    if (p) {
+        atomic_fetch_add_explicit(&instr_free_calls, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&instr_free_bytes, malloc_usable_size(p), memory_order_relaxed);
+    }
+    free(p);
+}
+
+// Read counter c, clearing it if reset
+static inline uint64_t instr_take(_Atomic uint64_t *c, bool reset)
+{
+    return reset
+        ? atomic_exchange_explicit(c, 0, memory_order_relaxed)
+        : atomic_load_explicit(c, memory_order_relaxed);
+}
+
+// Copy the counters into out; if reset, clear them in the same pass
+void instr_snapshot(instr_snapshot_t *out, bool reset)
+{
+    for (size_t op = 0; op < INSTR_OPS; op++) {
+        out->calls[op] = instr_take(instr_calls + op, reset);
+        out->cycles[op] = instr_take(instr_cycles + op, reset);
+        for (size_t i = 0; i < INSTR_SIZE_BUCKETS; i++)
+            for (size_t j = 0; j < INSTR_CYCLE_BINS; j++)
+                out->hist[op][i][j] = instr_take(&instr_hist[op][i][j], reset);
+    }
+    out->alloc_calls = instr_take(&instr_alloc_calls, reset);
+    out->alloc_bytes = instr_take(&instr_alloc_bytes, reset);
+    out->free_calls = instr_take(&instr_free_calls, reset);
+    out->free_bytes = instr_take(&instr_free_bytes, reset);
+}
+
+#else
+
+// Copy the counters into out; if reset, clear them in the same pass
+void instr_snapshot(instr_snapshot_t *out, bool reset)
+{
+    (void)reset;
+    memset(out, 0, sizeof(instr_snapshot_t));
+}
+
+#endif // INSTRUMENT
+
+// Clear all counters
+void instr_reset(void)
+{
+    instr_snapshot_t *discard = malloc(sizeof(instr_snapshot_t));
+    instr_snapshot(discard, true);
+    free(discard);
+}
+
+// Testing
+int instr_test(void)
+{
+    instr_snapshot_t *snap = malloc(sizeof(instr_snapshot_t));
+    bool test;
+
+    if (!instr_enabled()) {
+        instr_snapshot(snap, false);
+        test = snap->calls[INSTR_PROD] == 0 && snap->alloc_calls == 0;
+        printf("%s: instrumentation compiled out\n", test ? "TRUE" : "FALSE");
+        free(snap);
+        return !test;
+    }
+
+    bigint_t a = bigint_new("340282366920938463463374607431768211457");
+    bigint_t b = bigint_new("18446744073709551629");
+    instr_reset();
+    bigint_t c = bigint_prod(a, b);
+    bigint_delete(&c);
+    instr_snapshot(snap, true);
+
+    uint64_t timed = 0;
+    for (size_t j = 0; j < INSTR_CYCLE_BINS; j++)
+        timed += snap->hist[INSTR_PROD][instr_size_bucket(a.size)][j];
+    test = snap->calls[INSTR_PROD] == 1 && timed == 1 && snap->calls[INSTR_SUM] == 0
+        && snap->alloc_calls > 0 && snap->alloc_calls == snap->free_calls
+        && snap->alloc_bytes == snap->free_bytes;
+    printf("%s: bigint_prod counted once, %" PRIu64 " allocations and %" PRIu64 " frees\n",
+        test ? "TRUE" : "FALSE", snap->alloc_calls, snap->free_calls);
+
+    bigint_delete(&a);
+    bigint_delete(&b);
+    free(snap);
+    return !test;
+}
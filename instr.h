@@ -0,0 +1,115 @@
+/**
+ * instr.h: Optional runtime instrumentation
+ *
+ * Built with -DINSTRUMENT (`make INSTR=1`), the library counts calls to its
+ * public arithmetic functions, tracks allocations made in bigint.c and
+ * math.c, and keeps per-operation latency histograms in TSC cycles, bucketed
+ * by operand size. Without it the hooks below compile to nothing and
+ * instr_snapshot reports zeros.
+ *
+ * Strings returned by bigint_print and bigint_print_hex count as allocations
+ * but are released by the caller with plain free().
+ */
+
+#ifndef INSTR_H
+#define INSTR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef enum {
+    INSTR_NEW,
+    INSTR_PRINT,
+    INSTR_PRINT_HEX,
+    INSTR_NEG,
+    INSTR_SUM,
+    INSTR_DIFF,
+    INSTR_PROD,
+    INSTR_DIV,
+    INSTR_SL,
+    INSTR_SR,
+    INSTR_GCD,
+    INSTR_XGCD,
+    INSTR_ISQRT,
+    INSTR_IROOT,
+    INSTR_MOD,
+    INSTR_MOD_SUM,
+    INSTR_MOD_DIFF,
+    INSTR_MOD_PROD,
+    INSTR_MOD_EXP,
+    INSTR_MOD_INV,
+    INSTR_MOD_NEG,
+    INSTR_MOD_JACOBI,
+    INSTR_MOD_SQRT,
+    INSTR_OPS,
+} instr_op_t;
+
+enum {
+    INSTR_SIZE_BUCKETS = 16,    // Bucket i holds operands of 2^(i-1) < limbs <= 2^i
+    INSTR_CYCLE_BINS = 40,      // Bin i holds latencies of 2^(i-1) < cycles <= 2^i
+};
+
+typedef struct {
+    uint64_t calls[INSTR_OPS];
+    uint64_t cycles[INSTR_OPS];             // Total cycles spent, nested calls included
+    uint64_t hist[INSTR_OPS][INSTR_SIZE_BUCKETS][INSTR_CYCLE_BINS];
+    uint64_t alloc_calls;
+    uint64_t alloc_bytes;                   // Usable sizes of the blocks
+    uint64_t free_calls;
+    uint64_t free_bytes;
+} instr_snapshot_t;
+
+// Return whether instrumentation was compiled in
+bool instr_enabled(void);
+
+// Return the name of op, e.g. "mod_exp"
+const char *instr_op_name(instr_op_t op);
+
+// Copy the counters into out; if reset, clear them in the same pass
+void instr_snapshot(instr_snapshot_t *out, bool reset);
+
+// Clear all counters
+void instr_reset(void);
+
+// Return the size bucket for an operand of the given number of limbs
+size_t instr_size_bucket(size_t limbs);
+
+#ifdef INSTRUMENT
+
+typedef struct {
+    instr_op_t op;
+    size_t limbs;
+    uint64_t start;
+} instr_scope_t;
+
+// Count a call to op and start its timer
+instr_scope_t instr_scope_begin(instr_op_t op, size_t limbs);
+
+// Record the latency of the call started by instr_scope_begin
+void instr_scope_end(instr_scope_t *scope);
+
+// Tracked replacements for the C allocator
+void *instr_malloc(size_t bytes);
+void *instr_calloc(size_t count, size_t bytes);
+void instr_free(void *p);
+
+// Count this call and time it until the enclosing scope exits
+#define INSTR_SCOPE(op, limbs) \
+    instr_scope_t instr_scope __attribute__((cleanup(instr_scope_end))) \
+        = instr_scope_begin((op), (limbs))
+
+#else
+
+#define INSTR_SCOPE(op, limbs) do { } while (0)
+#define instr_malloc(bytes) malloc(bytes)
+#define instr_calloc(count, bytes) calloc((count), (bytes))
+#define instr_free(p) free(p)
+
+#endif // INSTRUMENT
+
+// Testing methods
+int instr_test(void);
+
+#endif // INSTR_H
@@ -13,6 +13,9 @@
 typedef  int64_t word_t;
 typedef uint64_t uword_t;
 
+// Double-word type for widening multiplication and division
+__extension__ typedef unsigned __int128 udword_t;
+
 // Word operations
 static inline word_t wmin(word_t a, word_t b)
 {
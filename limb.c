@@ -0,0 +1,969 @@
+/**
+ * limb.c: Unsigned limb-array kernels
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "bigint.h"
+#include "cpu.h"
+#include "limb.h"
+#include "pool.h"
+#include "rng.h"
+
+// out = a + b (n words each), return carry
+static uword_t limb_add_n_c(uword_t *out, const uword_t *a, const uword_t *b, size_t n)
+{
+    uword_t carry = 0;
+    for (size_t i = 0; i < n; i++) {
+        udword_t t = (udword_t)a[i] + b[i] + carry;
+        out[i] = (uword_t)t;
+        carry = (uword_t)(t >> WORD_BITS);
+    }
+    return carry;
+}
+
+// out = a - b (n words each), return borrow
+static uword_t limb_sub_n_c(uword_t *out, const uword_t *a, const uword_t *b, size_t n)
+{
+    uword_t borrow = 0;
+    for (size_t i = 0; i < n; i++) {
+        udword_t t = (udword_t)a[i] - b[i] - borrow;
+        out[i] = (uword_t)t;
+        borrow = (uword_t)(t >> WORD_BITS) & 1;
+    }
+    return borrow;
+}
+
+// out = a * k (n words), return high word
+static uword_t limb_mul_1_c(uword_t *out, const uword_t *a, size_t n, uword_t k)
+{
+    uword_t carry = 0;
+    for (size_t i = 0; i < n; i++) {
+        udword_t t = (udword_t)a[i] * k + carry;
+        out[i] = (uword_t)t;
+        carry = (uword_t)(t >> WORD_BITS);
+    }
+    return carry;
+}
+
+// out += a * k (n words), return carry word
+static uword_t limb_addmul_1_c(uword_t *out, const uword_t *a, size_t n, uword_t k)
+{
+    uword_t carry = 0;
+    for (size_t i = 0; i < n; i++) {
+        udword_t t = (udword_t)a[i] * k + out[i] + carry;
+        out[i] = (uword_t)t;
+        carry = (uword_t)(t >> WORD_BITS);
+    }
+    return carry;
+}
+
+// out -= a * k (n words), return borrow word
+static uword_t limb_submul_1_c(uword_t *out, const uword_t *a, size_t n, uword_t k)
+{
+    uword_t borrow = 0;
+    for (size_t i = 0; i < n; i++) {
+        udword_t t = (udword_t)a[i] * k + borrow;
+        uword_t lo = (uword_t)t;
+        borrow = (uword_t)(t >> WORD_BITS) + (out[i] < lo);
+        out[i] -= lo;
+    }
+    return borrow;
+}
+
+#if defined(__x86_64__)
+
+typedef unsigned long long ull_t;
+
+// out = a + b (n words each), return carry
+__attribute__((target("adx")))
+static uword_t limb_add_n_adx(uword_t *out, const uword_t *a, const uword_t *b, size_t n)
+{
+    unsigned char carry = 0;
+    for (size_t i = 0; i < n; i++) {
+        ull_t t;
+        carry = _addcarryx_u64(carry, a[i], b[i], &t);
+        out[i] = t;
+    }
+    return carry;
+}
+
+// out = a - b (n words each), return borrow
+__attribute__((target("adx")))
+static uword_t limb_sub_n_adx(uword_t *out, const uword_t *a, const uword_t *b, size_t n)
+{
+    unsigned char borrow = 0;
+    for (size_t i = 0; i < n; i++) {
+        ull_t t;
+        borrow = _subborrow_u64(borrow, a[i], b[i], &t);
+        out[i] = t;
+    }
+    return borrow;
+}
+
+// out = a * k (n words), return high word
+__attribute__((target("bmi2,adx")))
+static uword_t limb_mul_1_adx(uword_t *out, const uword_t *a, size_t n, uword_t k)
+{
+    unsigned char carry = 0;
+    ull_t hi = 0;
+    for (size_t i = 0; i < n; i++) {
+        ull_t prev = hi, t;
+        ull_t lo = _mulx_u64(a[i], k, &hi);
+        carry = _addcarryx_u64(carry, lo, prev, &t);
+        out[i] = t;
+    }
+    return hi + carry;
+}
+
+// out += a * k (n words), return carry word. The low product words and the
+// high words of the previous step are added on two independent carry chains
+__attribute__((target("bmi2,adx")))
+static uword_t limb_addmul_1_adx(uword_t *out, const uword_t *a, size_t n, uword_t k)
+{
+    unsigned char c1 = 0, c2 = 0;
+    ull_t hi = 0;
+    for (size_t i = 0; i < n; i++) {
+        ull_t prev = hi, t;
+        ull_t lo = _mulx_u64(a[i], k, &hi);
+        c1 = _addcarryx_u64(c1, lo, out[i], &t);
+        c2 = _addcarryx_u64(c2, t, prev, &t);
+        out[i] = t;
+    }
+    return hi + c1 + c2;
+}
+
+// out -= a * k (n words), return borrow word
+__attribute__((target("bmi2,adx")))
+static uword_t limb_submul_1_adx(uword_t *out, const uword_t *a, size_t n, uword_t k)
+{
+    unsigned char c1 = 0, c2 = 0;
+    ull_t hi = 0;
+    for (size_t i = 0; i < n; i++) {
+        ull_t prev = hi, t;
+        ull_t lo = _mulx_u64(a[i], k, &hi);
+        c1 = _addcarryx_u64(c1, lo, prev, &t);
+        c2 = _subborrow_u64(c2, out[i], t, &t);
+        out[i] = t;
+    }
+    return hi + c1 + c2;
+}
+
+/**
+ * The vector add and sub compute all lanes at once, then resolve carries
+ * from the generate mask g (the lane wrapped) and the propagate mask p (the
+ * lane is all ones for add, zero for sub, so an incoming carry passes on).
+ * With x = g + (g | p) + carry_in as an integer, bit i of x ^ p is the carry
+ * into lane i and bit `lanes` of x is the carry out of the block.
+ */
+
+// Return the lanes of a 4-bit mask as a vector of all-ones or zero words
+__attribute__((target("avx2")))
+static inline __m256i limb_mask4(unsigned mask)
+{
+    const __m256i bits = _mm256_setr_epi64x(1, 2, 4, 8);
+    __m256i m = _mm256_and_si256(_mm256_set1_epi64x(mask), bits);
+    return _mm256_cmpeq_epi64(m, bits);
+}
+
+// Return the lanes of x < y (unsigned) as a 4-bit mask
+__attribute__((target("avx2")))
+static inline unsigned limb_lt4(__m256i x, __m256i y)
+{
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    __m256i lt = _mm256_cmpgt_epi64(_mm256_xor_si256(y, sign), _mm256_xor_si256(x, sign));
+    return _mm256_movemask_pd(_mm256_castsi256_pd(lt));
+}
+
+// out = a + b (n words each), return carry
+__attribute__((target("avx2,adx")))
+static uword_t limb_add_n_avx2(uword_t *out, const uword_t *a, const uword_t *b, size_t n)
+{
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    unsigned carry = 0;
+    size_t i = 0;
+    for ( ; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i s = _mm256_add_epi64(x, y);
+        unsigned g = limb_lt4(s, x);
+        unsigned p = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(s, ones)));
+        unsigned c = g + (g | p) + carry;
+        s = _mm256_sub_epi64(s, limb_mask4((c ^ p) & 0xf));
+        _mm256_storeu_si256((__m256i *)(out + i), s);
+        carry = (c >> 4) & 1;
+    }
+
+    unsigned char c = carry;
+    for ( ; i < n; i++) {
+        ull_t t;
+        c = _addcarryx_u64(c, a[i], b[i], &t);
+        out[i] = t;
+    }
+    return c;
+}
+
+// out = a - b (n words each), return borrow
+__attribute__((target("avx2,adx")))
+static uword_t limb_sub_n_avx2(uword_t *out, const uword_t *a, const uword_t *b, size_t n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    unsigned borrow = 0;
+    size_t i = 0;
+    for ( ; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i d = _mm256_sub_epi64(x, y);
+        unsigned g = limb_lt4(x, y);
+        unsigned p = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(d, zero)));
+        unsigned c = g + (g | p) + borrow;
+        d = _mm256_add_epi64(d, limb_mask4((c ^ p) & 0xf));
+        _mm256_storeu_si256((__m256i *)(out + i), d);
+        borrow = (c >> 4) & 1;
+    }
+
+    unsigned char c = borrow;
+    for ( ; i < n; i++) {
+        ull_t t;
+        c = _subborrow_u64(c, a[i], b[i], &t);
+        out[i] = t;
+    }
+    return c;
+}
+
+// out = a + b (n words each), return carry
+__attribute__((target("avx512f,adx")))
+static uword_t limb_add_n_avx512(uword_t *out, const uword_t *a, const uword_t *b, size_t n)
+{
+    const __m512i ones = _mm512_set1_epi64(-1);
+    const __m512i one = _mm512_set1_epi64(1);
+    unsigned carry = 0;
+    size_t i = 0;
+    for ( ; i + 8 <= n; i += 8) {
+        __m512i x = _mm512_loadu_si512(a + i);
+        __m512i y = _mm512_loadu_si512(b + i);
+        __m512i s = _mm512_add_epi64(x, y);
+        unsigned g = _mm512_cmplt_epu64_mask(s, x);
+        unsigned p = _mm512_cmpeq_epu64_mask(s, ones);
+        unsigned c = g + (g | p) + carry;
+        s = _mm512_mask_add_epi64(s, (__mmask8)(c ^ p), s, one);
+        _mm512_storeu_si512(out + i, s);
+        carry = (c >> 8) & 1;
+    }
+
+    unsigned char c = carry;
+    for ( ; i < n; i++) {
+        ull_t t;
+        c = _addcarryx_u64(c, a[i], b[i], &t);
+        out[i] = t;
+    }
+    return c;
+}
+
+// out = a - b (n words each), return borrow
+__attribute__((target("avx512f,adx")))
+static uword_t limb_sub_n_avx512(uword_t *out, const uword_t *a, const uword_t *b, size_t n)
+{
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi64(1);
+    unsigned borrow = 0;
+    size_t i = 0;
+    for ( ; i + 8 <= n; i += 8) {
+        __m512i x = _mm512_loadu_si512(a + i);
+        __m512i y = _mm512_loadu_si512(b + i);
+        __m512i d = _mm512_sub_epi64(x, y);
+        unsigned g = _mm512_cmplt_epu64_mask(x, y);
+        unsigned p = _mm512_cmpeq_epu64_mask(d, zero);
+        unsigned c = g + (g | p) + borrow;
+        d = _mm512_mask_sub_epi64(d, (__mmask8)(c ^ p), d, one);
+        _mm512_storeu_si512(out + i, d);
+        borrow = (c >> 8) & 1;
+    }
+
+    unsigned char c = borrow;
+    for ( ; i < n; i++) {
+        ull_t t;
+        c = _subborrow_u64(c, a[i], b[i], &t);
+        out[i] = t;
+    }
+    return c;
+}
+
+#endif // __x86_64__
+
+typedef struct {
+    uword_t (*add_n)(uword_t *out, const uword_t *a, const uword_t *b, size_t n);
+    uword_t (*sub_n)(uword_t *out, const uword_t *a, const uword_t *b, size_t n);
+    uword_t (*mul_1)(uword_t *out, const uword_t *a, size_t n, uword_t k);
+    uword_t (*addmul_1)(uword_t *out, const uword_t *a, size_t n, uword_t k);
+    uword_t (*submul_1)(uword_t *out, const uword_t *a, size_t n, uword_t k);
+} limb_kernels_t;
+
+static const limb_kernels_t limb_kernels_portable = {
+    limb_add_n_c, limb_sub_n_c, limb_mul_1_c, limb_addmul_1_c, limb_submul_1_c,
+};
+
+// Kernels in use, set once by limb_dispatch
+static limb_kernels_t limb_kernels = limb_kernels_portable;
+static cpu_tier_t limb_kernels_tier = CPU_TIER_PORTABLE;
+
+// Use the kernels of the given tier, which the CPU must support
+void limb_dispatch(cpu_tier_t tier)
+{
+    limb_kernels_t k = limb_kernels_portable;
+#if defined(__x86_64__)
+    if (tier >= CPU_TIER_ADX) {
+        k = (limb_kernels_t) {
+            limb_add_n_adx, limb_sub_n_adx, limb_mul_1_adx, limb_addmul_1_adx, limb_submul_1_adx,
+        };
+    }
+    if (tier == CPU_TIER_AVX2) {
+        k.add_n = limb_add_n_avx2;
+        k.sub_n = limb_sub_n_avx2;
+    }
+    if (tier == CPU_TIER_AVX512) {
+        k.add_n = limb_add_n_avx512;
+        k.sub_n = limb_sub_n_avx512;
+    }
+#else
+    tier = CPU_TIER_PORTABLE;
+#endif
+    limb_kernels = k;
+    limb_kernels_tier = tier;
+}
+
+// Return the tier of the kernels in use
+cpu_tier_t limb_tier(void)
+{
+    return limb_kernels_tier;
+}
+
+// out = a + b (n words each), return carry
+uword_t limb_add_n(uword_t *out, const uword_t *a, const uword_t *b, size_t n)
+{
+    return limb_kernels.add_n(out, a, b, n);
+}
+
+// out = a - b (n words each), return borrow
+uword_t limb_sub_n(uword_t *out, const uword_t *a, const uword_t *b, size_t n)
+{
+    return limb_kernels.sub_n(out, a, b, n);
+}
+
+// out = a * k (n words), return high word
+uword_t limb_mul_1(uword_t *out, const uword_t *a, size_t n, uword_t k)
+{
+    return limb_kernels.mul_1(out, a, n, k);
+}
+
+// out += a * k (n words), return carry word
+uword_t limb_addmul_1(uword_t *out, const uword_t *a, size_t n, uword_t k)
+{
+    return limb_kernels.addmul_1(out, a, n, k);
+}
+
+// out -= a * k (n words), return borrow word
+uword_t limb_submul_1(uword_t *out, const uword_t *a, size_t n, uword_t k)
+{
+    return limb_kernels.submul_1(out, a, n, k);
+}
+
+// out = a + k (n words), return carry
+uword_t limb_add_1(uword_t *out, const uword_t *a, size_t n, uword_t k)
+{
+    for (size_t i = 0; i < n; i++) {
+        uword_t t = a[i] + k;
+        k = t < k;
+        out[i] = t;
+    }
+    return k;
+}
+
+// out = a - k (n words), return borrow
+uword_t limb_sub_1(uword_t *out, const uword_t *a, size_t n, uword_t k)
+{
+    for (size_t i = 0; i < n; i++) {
+        uword_t t = a[i] - k;
+        k = t > a[i];
+        out[i] = t;
+    }
+    return k;
+}
+
+// out = a + b mod m (n words, a and b below m), without branching on values
+void limb_add_mod(uword_t *out, const uword_t *a, const uword_t *b, const uword_t *m, size_t n)
+{
+    uword_t sum[n];
+    uword_t carry = limb_add_n(sum, a, b, n);
+    uword_t borrow = limb_sub_n(out, sum, m, n);
+
+    // Keep the sum when it was already below m
+    uword_t keep = -(borrow & (carry ^ 1));
+    for (size_t i = 0; i < n; i++)
+        out[i] ^= (out[i] ^ sum[i]) & keep;
+}
+
+// out = a - b mod m (n words, a and b below m), without branching on values
+void limb_sub_mod(uword_t *out, const uword_t *a, const uword_t *b, const uword_t *m, size_t n)
+{
+    uword_t mask = -limb_sub_n(out, a, b, n);
+    uword_t add[n];
+    for (size_t i = 0; i < n; i++)
+        add[i] = m[i] & mask;
+    limb_add_n(out, out, add, n);
+}
+
+// out = a << k (n words, k < WORD_BITS), return bits shifted out
+uword_t limb_shl(uword_t *out, const uword_t *a, size_t n, unsigned k)
+{
+    if (k == 0) {
+        memmove(out, a, n * sizeof(uword_t));
+        return 0;
+    }
+    uword_t spill = 0;
+    // Walk downwards so that out == a is allowed
+    for (size_t i = n - 1; i < n; i--) {
+        if (i == n - 1)
+            spill = a[i] >> (WORD_BITS - k);
+        out[i] = (a[i] << k) | (i > 0 ? a[i-1] >> (WORD_BITS - k) : 0);
+    }
+    return spill;
+}
+
+// out = a >> k (n words, k < WORD_BITS), return bits shifted out (high end)
+uword_t limb_shr(uword_t *out, const uword_t *a, size_t n, unsigned k)
+{
+    if (k == 0) {
+        memmove(out, a, n * sizeof(uword_t));
+        return 0;
+    }
+    uword_t spill = n ? a[0] << (WORD_BITS - k) : 0;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (a[i] >> k) | (i + 1 < n ? a[i+1] << (WORD_BITS - k) : 0);
+    }
+    return spill;
+}
+
+// Compare a and b (n words each): return -1, 0 or 1
+int limb_cmp(const uword_t *a, const uword_t *b, size_t n)
+{
+    for (size_t i = n - 1; i < n; i--) {
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// Return whether all n words of a are zero
+bool limb_is_zero(const uword_t *a, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        if (a[i]) return false;
+    return true;
+}
+
+// Return number of words of a without leading zero words
+size_t limb_normalize(const uword_t *a, size_t n)
+{
+    while (n > 0 && a[n-1] == 0)
+        n--;
+    return n;
+}
+
+// Return number of significant bits of a
+size_t limb_bits(const uword_t *a, size_t n)
+{
+    n = limb_normalize(a, n);
+    if (n == 0)
+        return 0;
+    return n * WORD_BITS - __builtin_clzll(a[n-1]);
+}
+
+// Return a mod d for a single word d != 0
+uword_t limb_mod_1(const uword_t *a, size_t n, uword_t d)
+{
+    uword_t rem = 0;
+    for (size_t i = n - 1; i < n; i--) {
+        udword_t t = ((udword_t)rem << WORD_BITS) | a[i];
+        rem = (uword_t)(t % d);
+    }
+    return rem;
+}
+
+// q = a / d (n words), return a mod d for a single word d != 0
+uword_t limb_divmod_1(uword_t *q, const uword_t *a, size_t n, uword_t d)
+{
+    uword_t rem = 0;
+    for (size_t i = n - 1; i < n; i--) {
+        udword_t t = ((udword_t)rem << WORD_BITS) | a[i];
+        q[i] = (uword_t)(t / d);
+        rem = (uword_t)(t % d);
+    }
+    return rem;
+}
+
+// Return the Jacobi symbol (a/n) for odd n, by the binary algorithm with no
+// divisions. Allocates scratch space.
+int limb_jacobi(const uword_t *a, size_t an, const uword_t *n, size_t nn)
+{
+    const size_t size = smax(an, nn);
+    uword_t *buf = malloc(2 * size * sizeof(uword_t));
+    uword_t *x = buf, *y = buf + size;
+    memcpy(x, a, an * sizeof(uword_t));
+    memcpy(y, n, nn * sizeof(uword_t));
+    size_t xn = limb_normalize(x, an), yn = limb_normalize(y, nn);
+
+    // (x/y) for odd y: strip twos from x, then subtract the smaller of the
+    // two odd values from the larger
+    int j = 1;
+    while (xn) {
+        size_t zw = 0;
+        while (!x[zw])
+            zw++;
+        unsigned zb = __builtin_ctzll(x[zw]);
+        if (zw || zb) {
+            memmove(x, x + zw, (xn - zw) * sizeof(uword_t));
+            xn = limb_normalize(x, xn - zw);
+            limb_shr(x, x, xn, zb);
+            xn = limb_normalize(x, xn);
+            // (2/y) = -1 for y = 3 or 5 mod 8
+            if ((zw * WORD_BITS + zb) & 1 && ((y[0] & 7) == 3 || (y[0] & 7) == 5))
+                j = -j;
+        }
+
+        // Reciprocity: (x/y) = -(y/x) when both are 3 mod 4
+        if (xn < yn || (xn == yn && limb_cmp(x, y, xn) < 0)) {
+            uword_t *t = x; x = y; y = t;
+            size_t tn = xn; xn = yn; yn = tn;
+            if ((x[0] & 3) == 3 && (y[0] & 3) == 3)
+                j = -j;
+        }
+        uword_t borrow = limb_sub_n(x, x, y, yn);
+        limb_sub_1(x + yn, x + yn, xn - yn, borrow);
+        xn = limb_normalize(x, xn);
+    }
+
+    int out = yn == 1 && y[0] == 1 ? j : 0;
+    free(buf);
+    return out;
+}
+
+// Schoolbook multiplication, out = a * b (an + bn words)
+static void limb_mul_basecase(uword_t *out, const uword_t *a, size_t an,
+        const uword_t *b, size_t bn)
+{
+    memset(out, 0, (an + bn) * sizeof(uword_t));
+    for (size_t i = 0; i < bn; i++) {
+        out[an + i] = limb_addmul_1(out + i, a, an, b[i]);
+    }
+}
+
+// Divide a (an words) by d (dn words, top word nonzero, an >= dn)
+// This is Knuth's Algorithm D (TAOCP vol. 2, 4.3.1)
+static void limb_divrem_basecase(uword_t *q, uword_t *r, const uword_t *a, size_t an,
+        const uword_t *d, size_t dn)
+{
+    if (dn == 1) {
+        uword_t *quot = q ? q : malloc(an * sizeof(uword_t));
+        uword_t rem = limb_divmod_1(quot, a, an, d[0]);
+        if (r)
+            r[0] = rem;
+        if (!q)
+            free(quot);
+        return;
+    }
+
+    // Normalize so the top bit of the divisor is set
+    unsigned shift = __builtin_clzll(d[dn-1]);
+    uword_t *vn = malloc(dn * sizeof(uword_t));
+    uword_t *un = malloc((an + 1) * sizeof(uword_t));
+    limb_shl(vn, d, dn, shift);
+    un[an] = limb_shl(un, a, an, shift);
+
+    const uword_t v1 = vn[dn-1];
+    const uword_t v2 = vn[dn-2];
+
+    for (size_t j = an - dn; j < an; j--) {
+        // Estimate the quotient word from the top two words of the remainder
+        udword_t num = ((udword_t)un[j+dn] << WORD_BITS) | un[j+dn-1];
+        udword_t qhat = num / v1;
+        udword_t rhat = num % v1;
+
+        while (qhat >> WORD_BITS
+                || qhat * v2 > ((rhat << WORD_BITS) | un[j+dn-2])) {
+            qhat--;
+            rhat += v1;
+            if (rhat >> WORD_BITS)
+                break;
+        }
+
+        // Multiply and subtract, adding back if the estimate was one too big
+        uword_t borrow = limb_submul_1(un + j, vn, dn, (uword_t)qhat);
+        uword_t top = un[j+dn];
+        un[j+dn] = top - borrow;
+        if (top < borrow) {
+            qhat--;
+            un[j+dn] += limb_add_n(un + j, un + j, vn, dn);
+        }
+
+        if (q)
+            q[j] = (uword_t)qhat;
+    }
+
+    if (r)
+        limb_shr(r, un, dn, shift);
+
+    free(vn);
+    free(un);
+}
+
+/**
+ * Multiplication switches from schoolbook to Karatsuba at KARATSUBA_THRESHOLD
+ * words, and division from Algorithm D to Burnikel-Ziegler recursion at
+ * BZ_THRESHOLD divisor words. At limb_parallel_words and above, the
+ * independent subproducts are handed to a thread pool.
+ */
+enum {
+    KARATSUBA_THRESHOLD = 32,
+    BZ_THRESHOLD = 64,
+};
+
+static pool_t *_Atomic limb_pool = NULL;
+static atomic_size_t limb_parallel_words = LIMB_PARALLEL_DEFAULT_WORDS;
+
+// Split multiplications and divisions of at least `words` words across pool
+void limb_set_parallel(pool_t *pool, size_t words)
+{
+    atomic_store(&limb_pool, pool);
+    atomic_store(&limb_parallel_words, words);
+}
+
+// Return pool to split an n-word operation across, or NULL to stay serial
+static pool_t *limb_parallel(size_t n)
+{
+    size_t words = atomic_load(&limb_parallel_words);
+    if (words == 0 || n < words)
+        return NULL;
+
+    pool_t *pool = atomic_load(&limb_pool);
+    if (!pool)
+        pool = pool_default();
+
+    // Nothing to gain on one worker, or when queued work (for example from
+    // batch jobs) already keeps every worker busy
+    if (pool_threads(pool) < 2 || pool_queued(pool) >= pool_threads(pool))
+        return NULL;
+    return pool;
+}
+
+static void limb_kara(uword_t *out, const uword_t *a, const uword_t *b, size_t n);
+
+typedef struct {
+    uword_t *out;
+    const uword_t *a;
+    const uword_t *b;
+    size_t n;
+} limb_kara_arg_t;
+
+static void limb_kara_task(void *arg)
+{
+    limb_kara_arg_t *k = arg;
+    limb_kara(k->out, k->a, k->b, k->n);
+}
+
+// Karatsuba multiplication, out = a * b (2n words)
+static void limb_kara(uword_t *out, const uword_t *a, const uword_t *b, size_t n)
+{
+    if (n < KARATSUBA_THRESHOLD) {
+        limb_mul_basecase(out, a, n, b, n);
+        return;
+    }
+
+    // a = a1 * B^m + a0 with m low words and h >= m high words
+    const size_t m = n / 2;
+    const size_t h = n - m;
+
+    // z0 = a0 * b0 and z2 = a1 * b1 go straight into out
+    pool_t *pool = limb_parallel(n);
+    pool_group_t group;
+    limb_kara_arg_t z0 = { .out = out, .a = a, .b = b, .n = m };
+    limb_kara_arg_t z2 = { .out = out + 2 * m, .a = a + m, .b = b + m, .n = h };
+    if (pool) {
+        pool_group_init(&group);
+        pool_submit(pool, &group, limb_kara_task, &z0);
+        pool_submit(pool, &group, limb_kara_task, &z2);
+    } else {
+        limb_kara_task(&z0);
+        limb_kara_task(&z2);
+    }
+
+    // z1 = (a0 + a1)(b0 + b1) - z0 - z2
+    uword_t *sa = malloc((4 * h + 4) * sizeof(uword_t));
+    uword_t *sb = sa + h + 1;
+    uword_t *z1 = sb + h + 1;
+    memcpy(sa, a + m, h * sizeof(uword_t));
+    memcpy(sb, b + m, h * sizeof(uword_t));
+    uword_t carry = limb_add_n(sa, sa, a, m);
+    sa[h] = limb_add_1(sa + m, sa + m, h - m, carry);
+    carry = limb_add_n(sb, sb, b, m);
+    sb[h] = limb_add_1(sb + m, sb + m, h - m, carry);
+    limb_kara(z1, sa, sb, h + 1);
+
+    if (pool)
+        pool_wait(pool, &group);
+
+    uword_t borrow = limb_sub_n(z1, z1, out, 2 * m);
+    limb_sub_1(z1 + 2 * m, z1 + 2 * m, 2 * h + 2 - 2 * m, borrow);
+    borrow = limb_sub_n(z1, z1, out + 2 * m, 2 * h);
+    limb_sub_1(z1 + 2 * h, z1 + 2 * h, 2, borrow);
+
+    // z1 < B^(2h + 1), and out + m has 2h + m words of room
+    size_t len = smin(2 * h + 2, 2 * n - m);
+    carry = limb_add_n(out + m, out + m, z1, len);
+    limb_add_1(out + m + len, out + m + len, 2 * n - m - len, carry);
+
+    free(sa);
+}
+
+// out = a * b (an + bn words), out must not overlap a or b
+void limb_mul(uword_t *out, const uword_t *a, size_t an, const uword_t *b, size_t bn)
+{
+    if (an < bn) {
+        const uword_t *t = a; a = b; b = t;
+        size_t tn = an; an = bn; bn = tn;
+    }
+    if (bn < KARATSUBA_THRESHOLD) {
+        limb_mul_basecase(out, a, an, b, bn);
+        return;
+    }
+    if (an == bn) {
+        limb_kara(out, a, b, an);
+        return;
+    }
+
+    // Unbalanced: multiply bn-word slices of a by b and accumulate
+    memset(out, 0, (an + bn) * sizeof(uword_t));
+    uword_t *t = malloc(2 * bn * sizeof(uword_t));
+    for (size_t i = 0; i < an; i += bn) {
+        size_t len = smin(bn, an - i);
+        limb_mul(t, b, bn, a + i, len);
+        uword_t carry = limb_add_n(out + i, out + i, t, len + bn);
+        limb_add_1(out + i + len + bn, out + i + len + bn, an - i - len, carry);
+    }
+    free(t);
+}
+
+static void bz_div_2n_1n(uword_t *q, uword_t *r, const uword_t *a, const uword_t *b, size_t n);
+
+// Divide a (3h words) by normalized b (2h words) with a < B^h * b:
+// q gets h words, r gets 2h words
+static void bz_div_3h_2h(uword_t *q, uword_t *r, const uword_t *a, const uword_t *b, size_t h)
+{
+    const uword_t *a2 = a + h, *a1 = a + 2 * h;
+    const uword_t *b2 = b, *b1 = b + h;
+
+    // t = r1 * B^h + a3 - q * b2, kept in 2h + 1 words with a sign word
+    uword_t *t = malloc((4 * h + 1) * sizeof(uword_t));
+    uword_t *d = t + 2 * h + 1;
+    if (limb_cmp(a1, b1, h) < 0) {
+        bz_div_2n_1n(q, t + h, a + h, b1, h);
+        t[2 * h] = 0;
+    } else {
+        // a1 == b1: q = B^h - 1 and r1 = a1a2 - q * b1 = a2 + b1
+        memset(q, 0xff, h * sizeof(uword_t));
+        t[2 * h] = limb_add_n(t + h, a2, b1, h);
+    }
+    memcpy(t, a, h * sizeof(uword_t));
+
+    limb_mul(d, q, h, b2, h);
+    t[2 * h] -= limb_sub_n(t, t, d, 2 * h);
+
+    // At most two corrections since b is normalized
+    while (t[2 * h] >> (WORD_BITS - 1)) {
+        limb_sub_1(q, q, h, 1);
+        t[2 * h] += limb_add_n(t, t, b, 2 * h);
+    }
+
+    memcpy(r, t, 2 * h * sizeof(uword_t));
+    free(t);
+}
+
+// Divide a (2n words) by normalized b (n words) with a < B^n * b:
+// q and r get n words each
+static void bz_div_2n_1n(uword_t *q, uword_t *r, const uword_t *a, const uword_t *b, size_t n)
+{
+    if (n % 2 || n < BZ_THRESHOLD) {
+        uword_t *qt = malloc((n + 1) * sizeof(uword_t));
+        limb_divrem_basecase(qt, r, a, 2 * n, b, n);
+        memcpy(q, qt, n * sizeof(uword_t));
+        free(qt);
+        return;
+    }
+
+    // Two 3h/2h steps on the halves: first the top three quarters of a,
+    // then the remainder joined with the last quarter
+    const size_t h = n / 2;
+    uword_t *t = malloc(3 * h * sizeof(uword_t));
+    bz_div_3h_2h(q + h, t + h, a + h, b, h);
+    memcpy(t, a, h * sizeof(uword_t));
+    bz_div_3h_2h(q, r, t, b, h);
+    free(t);
+}
+
+// Burnikel-Ziegler division, see limb_divrem
+static void limb_divrem_bz(uword_t *q, uword_t *r, const uword_t *a, size_t an,
+        const uword_t *d, size_t dn)
+{
+    // Block size n = j * 2^k >= dn so that halving ends below BZ_THRESHOLD
+    size_t m = 1;
+    while (m * BZ_THRESHOLD <= dn)
+        m <<= 1;
+    const size_t n = (dn + m - 1) / m * m;
+
+    // Scale both operands so that the divisor fills n words with its top
+    // bit set; this leaves the quotient unchanged
+    const size_t word_shift = n - dn;
+    const unsigned bit_shift = __builtin_clzll(d[dn-1]);
+    uword_t *b = calloc(n, sizeof(uword_t));
+    limb_shl(b + word_shift, d, dn, bit_shift);
+
+    // Number of n-word blocks t >= 2 with the scaled a below B^(tn) / 2
+    size_t bits = limb_bits(a, an) + word_shift * WORD_BITS + bit_shift;
+    size_t t = smax(2, (bits + 1 + n * WORD_BITS - 1) / (n * WORD_BITS));
+    size_t sn = smax(t * n, an + word_shift + 1);
+    uword_t *as = calloc(sn, sizeof(uword_t));
+    as[word_shift + an] = limb_shl(as + word_shift, a, an, bit_shift);
+
+    // Schoolbook division on n-word digits, each step a 2n/1n division
+    uword_t *qs = malloc((t - 1) * n * sizeof(uword_t));
+    uword_t *z = malloc(2 * n * sizeof(uword_t));
+    memcpy(z, as + (t - 2) * n, 2 * n * sizeof(uword_t));
+    for (size_t i = t - 2; i < t; i--) {
+        bz_div_2n_1n(qs + i * n, z + n, z, b, n);
+        if (i > 0)
+            memcpy(z, as + (i - 1) * n, n * sizeof(uword_t));
+    }
+
+    if (q) {
+        size_t qn = an - dn + 1;
+        memset(q, 0, qn * sizeof(uword_t));
+        memcpy(q, qs, smin(qn, (t - 1) * n) * sizeof(uword_t));
+    }
+    if (r) {
+        limb_shr(z + n, z + n, n, bit_shift);
+        memcpy(r, z + n + word_shift, dn * sizeof(uword_t));
+    }
+
+    free(b);
+    free(as);
+    free(qs);
+    free(z);
+}
+
+// Divide a (an words) by d (dn words, top word nonzero, an >= dn)
+void limb_divrem(uword_t *q, uword_t *r, const uword_t *a, size_t an,
+        const uword_t *d, size_t dn)
+{
+    if (dn < BZ_THRESHOLD || an - dn < BZ_THRESHOLD)
+        limb_divrem_basecase(q, r, a, an, d, dn);
+    else
+        limb_divrem_bz(q, r, a, an, d, dn);
+}
+
+// Testing
+int limb_test(void)
+{
+    static const struct {
+        size_t an;
+        size_t bn;
+    } muls[] = { { 31, 31 }, { 100, 100 }, { 257, 257 }, { 600, 130 }, { 1000, 999 } };
+    static const struct {
+        size_t an;
+        size_t dn;
+    } divs[] = { { 200, 70 }, { 400, 200 }, { 1000, 129 }, { 1500, 700 } };
+    int total_errors = 0;
+
+    // Every supported kernel tier agrees with the portable one, including on
+    // runs of all-ones and zero words that carries must ripple through
+    const cpu_tier_t saved = limb_tier();
+    for (cpu_tier_t tier = CPU_TIER_ADX; tier <= cpu_best_tier(); tier++) {
+        limb_dispatch(tier);
+        const limb_kernels_t *c = &limb_kernels_portable;
+        size_t errors = 0;
+        for (size_t n = 1; n <= 40; n++) {
+            uword_t a[40], b[40], x[40], y[40];
+            rng_words(a, n);
+            rng_words(b, n);
+            for (size_t i = n / 3; i < 2 * n / 3; i++) {
+                a[i] = n % 2 ? ~(uword_t)0 : 0;
+                b[i] = 0;
+            }
+            uword_t k = a[0] | 1;
+
+            errors += limb_add_n(x, a, b, n) != c->add_n(y, a, b, n) || limb_cmp(x, y, n);
+            errors += limb_sub_n(x, a, b, n) != c->sub_n(y, a, b, n) || limb_cmp(x, y, n);
+            errors += limb_sub_n(x, b, a, n) != c->sub_n(y, b, a, n) || limb_cmp(x, y, n);
+            errors += limb_mul_1(x, a, n, k) != c->mul_1(y, a, n, k) || limb_cmp(x, y, n);
+            memcpy(x, b, n * sizeof(uword_t));
+            memcpy(y, b, n * sizeof(uword_t));
+            errors += limb_addmul_1(x, a, n, k) != c->addmul_1(y, a, n, k) || limb_cmp(x, y, n);
+            errors += limb_submul_1(x, a, n, k) != c->submul_1(y, a, n, k) || limb_cmp(x, y, n);
+        }
+        printf("%s: %s limb kernels match portable ones\n",
+            errors == 0 ? "TRUE" : "FALSE", cpu_tier_name(tier));
+        total_errors += errors != 0;
+    }
+    limb_dispatch(saved);
+
+    // Split even small products across a private pool
+    pool_t *pool = pool_new(4);
+    limb_set_parallel(pool, 64);
+
+    for (size_t i = 0; i < sizeof(muls) / sizeof(muls[0]); i++) {
+        size_t an = muls[i].an, bn = muls[i].bn;
+        uword_t *a = malloc(an * sizeof(uword_t));
+        uword_t *b = malloc(bn * sizeof(uword_t));
+        uword_t *x = malloc((an + bn) * sizeof(uword_t));
+        uword_t *y = malloc((an + bn) * sizeof(uword_t));
+        rng_words(a, an);
+        rng_words(b, bn);
+        limb_mul(x, a, an, b, bn);
+        limb_mul_basecase(y, a, an, b, bn);
+        bool test = limb_cmp(x, y, an + bn) == 0;
+        printf("%s: limb_mul (%zu x %zu words) matches schoolbook\n",
+            test ? "TRUE" : "FALSE", an, bn);
+        total_errors += !test;
+        free(a); free(b); free(x); free(y);
+    }
+
+    for (size_t i = 0; i < sizeof(divs) / sizeof(divs[0]); i++) {
+        size_t an = divs[i].an, dn = divs[i].dn;
+        uword_t *a = malloc(an * sizeof(uword_t));
+        uword_t *d = malloc(dn * sizeof(uword_t));
+        uword_t *q = malloc(2 * (an - dn + 1) * sizeof(uword_t));
+        uword_t *r = malloc(2 * dn * sizeof(uword_t));
+        rng_words(a, an);
+        rng_words(d, dn);
+        d[dn-1] |= 1;
+        limb_divrem(q, r, a, an, d, dn);
+        limb_divrem_basecase(q + an - dn + 1, r + dn, a, an, d, dn);
+        bool test = limb_cmp(q, q + an - dn + 1, an - dn + 1) == 0
+            && limb_cmp(r, r + dn, dn) == 0;
+        printf("%s: limb_divrem (%zu / %zu words) matches Algorithm D\n",
+            test ? "TRUE" : "FALSE", an, dn);
+        total_errors += !test;
+        free(a); free(d); free(q); free(r);
+    }
+
+    limb_set_parallel(NULL, LIMB_PARALLEL_DEFAULT_WORDS);
+    pool_delete(pool);
+
+    return total_errors;
+}
@@ -0,0 +1,100 @@
+/**
+ * limb.h: Unsigned limb-array kernels
+ *
+ * These routines operate on little-endian arrays of uword_t holding unsigned
+ * magnitudes. They perform no allocation unless noted and are the building
+ * blocks for the faster arithmetic layered on top of bigint_t.
+ */
+
+#ifndef LIMB_H
+#define LIMB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cpu.h"
+#include "int_math.h"
+#include "pool.h"
+
+// Default operand size in words at which work is split across threads
+enum { LIMB_PARALLEL_DEFAULT_WORDS = 2048 };
+
+// out = a + b (n words each), return carry
+uword_t limb_add_n(uword_t *out, const uword_t *a, const uword_t *b, size_t n);
+
+// out = a - b (n words each), return borrow
+uword_t limb_sub_n(uword_t *out, const uword_t *a, const uword_t *b, size_t n);
+
+// out = a + k (n words), return carry
+uword_t limb_add_1(uword_t *out, const uword_t *a, size_t n, uword_t k);
+
+// out = a - k (n words), return borrow
+uword_t limb_sub_1(uword_t *out, const uword_t *a, size_t n, uword_t k);
+
+// out = a + b mod m (n words, a and b below m), without branching on values
+void limb_add_mod(uword_t *out, const uword_t *a, const uword_t *b, const uword_t *m, size_t n);
+
+// out = a - b mod m (n words, a and b below m), without branching on values
+void limb_sub_mod(uword_t *out, const uword_t *a, const uword_t *b, const uword_t *m, size_t n);
+
+// out = a * k (n words), return high word
+uword_t limb_mul_1(uword_t *out, const uword_t *a, size_t n, uword_t k);
+
+// out += a * k (n words), return carry word
+uword_t limb_addmul_1(uword_t *out, const uword_t *a, size_t n, uword_t k);
+
+// out -= a * k (n words), return borrow word
+uword_t limb_submul_1(uword_t *out, const uword_t *a, size_t n, uword_t k);
+
+// out = a << k (n words, k < WORD_BITS), return bits shifted out
+uword_t limb_shl(uword_t *out, const uword_t *a, size_t n, unsigned k);
+
+// out = a >> k (n words, k < WORD_BITS), return bits shifted out (high end)
+uword_t limb_shr(uword_t *out, const uword_t *a, size_t n, unsigned k);
+
+// Compare a and b (n words each): return -1, 0 or 1
+int limb_cmp(const uword_t *a, const uword_t *b, size_t n);
+
+// Return whether all n words of a are zero
+bool limb_is_zero(const uword_t *a, size_t n);
+
+// Return number of words of a without leading zero words
+size_t limb_normalize(const uword_t *a, size_t n);
+
+// Return number of significant bits of a
+size_t limb_bits(const uword_t *a, size_t n);
+
+// Return a mod d for a single word d != 0
+uword_t limb_mod_1(const uword_t *a, size_t n, uword_t d);
+
+// q = a / d (n words), return a mod d for a single word d != 0
+uword_t limb_divmod_1(uword_t *q, const uword_t *a, size_t n, uword_t d);
+
+// Return the Jacobi symbol (a/n) for odd n, by the binary algorithm with no
+// divisions. Allocates scratch space.
+int limb_jacobi(const uword_t *a, size_t an, const uword_t *n, size_t nn);
+
+// out = a * b (an + bn words), out must not overlap a or b
+void limb_mul(uword_t *out, const uword_t *a, size_t an, const uword_t *b, size_t bn);
+
+// Divide a (an words) by d (dn words, top word nonzero, an >= dn); store the
+// quotient in q (an - dn + 1 words) and the remainder in r (dn words).
+// Either output may be NULL. Allocates scratch space.
+void limb_divrem(uword_t *q, uword_t *r, const uword_t *a, size_t an,
+        const uword_t *d, size_t dn);
+
+// Split multiplications and divisions of at least `words` words across pool
+// (NULL: the default pool); 0 words keeps everything on the calling thread
+void limb_set_parallel(pool_t *pool, size_t words);
+
+// Use the add/sub/mul kernels of the given tier, which the CPU must support.
+// Called once by bigint_init; until then the portable kernels are used.
+void limb_dispatch(cpu_tier_t tier);
+
+// Return the tier of the kernels in use
+cpu_tier_t limb_tier(void);
+
+// Testing methods
+int limb_test(void);
+
+#endif // LIMB_H
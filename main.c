@@ -5,7 +5,25 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "accum.h"
+#include "barrett.h"
+#include "batch.h"
+#include "bigint_vec.h"
+#include "calc.h"
+#include "fixed.h"
+#include "fixed_base.h"
+#include "ifma.h"
+#include "instr.h"
+#include "limb.h"
 #include "math.h"
+#include "mod_cache.h"
+#include "mod_math.h"
+#include "p256.h"
+#include "prime.h"
+#include "primegen.h"
+#include "rns.h"
+#include "tree.h"
+#include "x25519.h"
 
 // TODO place all test code into file-specific testing methods
 static int main_test(void)
@@ -138,7 +156,26 @@ static int main_test(void)
     bigint_delete(&y);
     bigint_delete(&z);
 
+    bigint_test();
+    math_test();
+    limb_test();
+    bigint_vec_test();
+    accum_test();
+    fixed_test();
+    fixed_base_test();
+    barrett_test();
     mod_test();
+    mod_cache_test();
+    rns_test();
+    prime_test();
+    primegen_test();
+    ifma_test();
+    batch_test();
+    tree_test();
+    instr_test();
+    x25519_test();
+    p256_test();
+    calc_test();
 }
 
 static void main_init(void)
@@ -2,18 +2,17 @@
  * math.c: Mathematical operations
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "instr.h"
+#include "limb.h"
 #include "math.h"
 
 // Add two words with overflow
 static inline uword_t add_word(uword_t a, uword_t b, bool *overflow)
 {
-    asm (
-        "add %2, %0\n\t"
-        "setc %1\n\t"
-        : "+r" (a), "=ro" (*overflow)
-        : "ro" (b)
-        : // No clobbers
-    );
+    *overflow = __builtin_add_overflow(a, b, &a);
     return a;
 }
 
@@ -21,6 +20,8 @@ static inline uword_t add_word(uword_t a, uword_t b, bool *overflow)
 static inline void ip_inc(bigint_t n, uword_t k)
 {
     bool overflow = 0;
+    if (n.size == 0)
+        return;
 
     n.val[0] = add_word(n.val[0], k, &overflow);
 
@@ -32,13 +33,8 @@ static inline void ip_inc(bigint_t n, uword_t k)
 // Return the negative of the input
 bigint_t bigint_neg(bigint_t n)
 {
-    bigint_t out = { .size = n.size, .val = malloc(n.size * sizeof(uword_t)) };
-
-    // Take logical negation of n
-    for (size_t i = 0; i < n.size; i++) {
-        out.val[i] = ~n.val[i];
-    }
-
+    INSTR_SCOPE(INSTR_NEG, n.size);
+    bigint_t out = bigint_lneg(n);
     ip_inc(out, 1);
 
     // Shrink number
@@ -50,6 +46,7 @@ bigint_t bigint_neg(bigint_t n)
 // Sum of a and b
 bigint_t bigint_sum(bigint_t a, bigint_t b)
 {
+    INSTR_SCOPE(INSTR_SUM, smax(a.size, b.size));
     bigint_t sum;
     bigint_t term;
 
@@ -94,6 +91,7 @@ bigint_t bigint_sum(bigint_t a, bigint_t b)
 // Return the difference a - b
 bigint_t bigint_diff(bigint_t a, bigint_t b)
 {
+    INSTR_SCOPE(INSTR_DIFF, smax(a.size, b.size));
     bigint_t temp_neg;
     bigint_t out = bigint_sum(a, temp_neg = bigint_neg(b));
     bigint_delete(&temp_neg);
@@ -111,7 +109,7 @@ bool bigint_equals(bigint_t a, bigint_t b)
 }
 
 // Number of bits needed for number
-static size_t bigint_bits(bigint_t n)
+size_t bigint_bits(bigint_t n)
 {
     // Calculate max shift
     for (ssize_t i = n.size * WORD_BITS - 1; i >= 0; i--) {
@@ -123,6 +121,7 @@ static size_t bigint_bits(bigint_t n)
 
 bigint_t bigint_sl(bigint_t n, size_t k)
 {
+    INSTR_SCOPE(INSTR_SL, n.size);
     if (k == 0)
         return bigint_copy(n);
 
@@ -180,51 +179,94 @@ bigint_t bigint_sl(bigint_t n, size_t k)
     return out;
 }
 
-// TODO
-// n >> k
+// n >> k, rounding toward negative infinity
 bigint_t bigint_sr(bigint_t n, size_t k)
 {
-    //bigint_t out;
+    INSTR_SCOPE(INSTR_SR, n.size);
+    bool neg = is_neg(n);
+    if (k / WORD_BITS >= n.size)
+        return neg ? bigint_minus1(1) : bigint_zero(1);
 
-    //return out;
+    bigint_t out = bigint_zero(n.size - k / WORD_BITS);
+    limb_shr(out.val, n.val + k / WORD_BITS, out.size, k % WORD_BITS);
+    if (neg && k % WORD_BITS)
+        out.val[out.size - 1] |= ~(~(uword_t)0 >> (k % WORD_BITS));
+    out.size = bigint_min_words(out);
+    return out;
+}
+
+// out = a * b for magnitudes of an and bn words into cleared out, in square
+// blocks of a quarter of the storage threshold so the scratch space stays
+// bounded however large the operands. Each block of a meets b in one pass,
+// while the next block of b is read ahead.
+static void bigint_prod_blocked(bigint_t out, bigint_t a, size_t an, bigint_t b, size_t bn)
+{
+    const size_t block = smax(bigint_storage_map_bytes() / (4 * sizeof(uword_t)), 1);
+    uword_t *t = instr_malloc(2 * block * sizeof(uword_t));
+    for (size_t i = 0; i < an; i += block) {
+        size_t al = smin(block, an - i);
+        for (size_t j = 0; j < bn; j += block) {
+            size_t bl = smin(block, bn - j);
+            if (j + bl < bn)
+                bigint_advise(b, j + bl, block, BIGINT_ACCESS_WILLNEED);
+            limb_mul(t, a.val + i, al, b.val + j, bl);
+            uword_t *o = out.val + i + j;
+            uword_t carry = limb_add_n(o, o, t, al + bl);
+            for (o += al + bl; carry; o++)
+                carry = ++*o == 0;
+        }
+        // Done with this block of a
+        bigint_advise(a, i, al, BIGINT_ACCESS_COLD);
+    }
+    instr_free(t);
 }
 
-// TODO Make this more efficient (use asm multiplication instructions)
 // Integer multiplication a * b
-// NOTE: best efficiency is achieved when bits(a) < bits(b)
 bigint_t bigint_prod(bigint_t a, bigint_t b)
 {
-    bigint_t out = bigint_zero(1);
-
-    // Resize numbers
-    size_t bits = bigint_bits(a) + bigint_bits(b);
-    size_t size = bits / WORD_BITS + (bits % WORD_BITS > 0);
-    a = bigint_resize(a, size);
-    b = bigint_resize(b, size);
-
-    for (size_t i = 0; i < size * WORD_BITS; i++) {
-        if (a.val[i / WORD_BITS] & ((uword_t)1 << (i % WORD_BITS))) {
-            bigint_t shift = bigint_sl(b, i);
-            bigint_t temp_sum = bigint_sum(out, shift);
-            bigint_delete(&out);
-            out = temp_sum;
+    INSTR_SCOPE(INSTR_PROD, smax(a.size, b.size));
+    bool neg_a = is_neg(a);
+    bool neg_b = is_neg(b);
 
-            bigint_delete(&shift);
-        }
+    // Multiply magnitudes
+    if (neg_a)
+        a = bigint_neg(a);
+    if (neg_b)
+        b = bigint_neg(b);
+
+    size_t an = limb_normalize(a.val, a.size);
+    size_t bn = limb_normalize(b.val, b.size);
+    bigint_t out;
+    if (an == 0 || bn == 0) {
+        out = bigint_zero(1);
+    } else {
+        // One extra word keeps the sign bit clear for positive products
+        out = bigint_zero(an + bn + 1);
+        if (bigint_is_mapped(out))
+            bigint_prod_blocked(out, a, an, b, bn);
+        else
+            limb_mul(out.val, a.val, an, b.val, bn);
+        out.size = bigint_min_words(out);
     }
 
-    bigint_delete(&a);
-    bigint_delete(&b);
+    // Take care of sign
+    if (neg_a)
+        bigint_delete(&a);
+    if (neg_b)
+        bigint_delete(&b);
+    if (neg_a != neg_b) {
+        bigint_t temp = bigint_neg(out);
+        bigint_delete(&out);
+        out = temp;
+    }
 
-    out.size = size;
-    out.size = bigint_min_words(out);
     return out;
 }
 
-// Integer division a/b
+// Integer division a/b, rounding toward zero; rem gets |a| mod |b|
 bigint_t bigint_div(bigint_t a, bigint_t b, bigint_t *rem)
 {
-    //bigint_t temp_diff;
+    INSTR_SCOPE(INSTR_DIV, smax(a.size, b.size));
     bool neg_a = is_neg(a);
     bool neg_b = is_neg(b);
     bool neg_out = neg_a != neg_b;
@@ -234,48 +276,27 @@ bigint_t bigint_div(bigint_t a, bigint_t b, bigint_t *rem)
     if (neg_b)
         b = bigint_neg(b);
 
-    *rem = bigint_copy(a);
-
-    // TODO is this necessary?
-    bigint_t temp_diff = bigint_diff(b, a);
-    if (is_pos(temp_diff)) {
-        bigint_delete(&temp_diff);
-        return bigint_zero(1);
-    }
-    bigint_delete(&temp_diff);
-
-    // Calculate the max left shift i so that (b << i) <= a
-    size_t i;
-    temp_diff = bigint_zero(1);
-    for (i = 0; ! is_neg(temp_diff); i++) {
-        bigint_delete(&temp_diff);
-        bigint_t temp_shift;
-        temp_diff = bigint_diff(a, temp_shift = bigint_sl(b, i));
-
-        bigint_delete(&temp_shift);
-    }
-    bigint_delete(&temp_diff);
-    bigint_t out = bigint_zero(i / WORD_BITS + (i % WORD_BITS > 0));
-
-    i -= 2;
-
-    // Perform long division algorithm
-    for ( ; i < SIZE_MAX; i--) {
-        bigint_t temp_shift = bigint_sl(b, i);
-        temp_diff = bigint_diff(*rem, temp_shift);
-
-        bigint_delete(&temp_shift);
-        if (! is_neg(temp_diff)) {
-            out.val[i / WORD_BITS] |= (uword_t)1 << (i % WORD_BITS);
-            bigint_delete(rem);
-            *rem = temp_diff;
-        } else {
-            bigint_delete(&temp_diff);
-        }
+    size_t an = limb_normalize(a.val, a.size);
+    size_t bn = limb_normalize(b.val, b.size);
+    bigint_t out;
+    if (bn == 0) {
+        fprintf(stderr, "bigint_div: WARNING: division by zero\n");
+        out = bigint_zero(1);
+        *rem = bigint_zero(1);
+    } else if (an < bn) {
+        out = bigint_zero(1);
+        // Shared a makes the remainder O(1)
+        *rem = neg_a ? bigint_from_limbs(a.val, an) : bigint_copy(a);
+    } else {
+        // Extra words keep the sign bits clear
+        out = bigint_zero(an - bn + 2);
+        *rem = bigint_zero(bn + 1);
+        limb_divrem(out.val, rem->val, a.val, an, b.val, bn);
+        out.size = bigint_min_words(out);
+        rem->size = bigint_min_words(*rem);
     }
 
     // Take care of sign
-    // TODO adjust `rem` based on sign?
     if (neg_a)
         bigint_delete(&a);
     if (neg_b)
@@ -292,6 +313,7 @@ bigint_t bigint_div(bigint_t a, bigint_t b, bigint_t *rem)
 // Greatest Common Divisor
 bigint_t bigint_gcd(bigint_t a, bigint_t b)
 {
+    INSTR_SCOPE(INSTR_GCD, smax(a.size, b.size));
     bigint_t M = bigint_copy(a);
     bigint_t m = bigint_copy(b);
     bigint_t rem;
@@ -313,6 +335,7 @@ bigint_t bigint_gcd(bigint_t a, bigint_t b)
 // Perform the extended euclidean algorithm
 bigint_t bigint_xgcd(bigint_t a, bigint_t b, bigint_t *x, bigint_t *y)
 {
+    INSTR_SCOPE(INSTR_XGCD, smax(a.size, b.size));
     bigint_t r_2;
     bigint_t r_1 = bigint_max(a, b);
     bigint_t r = bigint_min(a, b);
@@ -371,3 +394,309 @@ bigint_t bigint_xgcd(bigint_t a, bigint_t b, bigint_t *x, bigint_t *y)
 
     return r_1;
 }
+
+// Return x^k for k >= 1, by left-to-right squaring
+static bigint_t bigint_pow(bigint_t x, size_t k)
+{
+    bigint_t out = bigint_copy(x), t;
+    int top = WORD_BITS - 1 - __builtin_clzll(k);
+    for (int i = top - 1; i >= 0; i--) {
+        t = bigint_prod(out, out);
+        bigint_delete(&out);
+        out = t;
+        if ((k >> i) & 1) {
+            t = bigint_prod(out, x);
+            bigint_delete(&out);
+            out = t;
+        }
+    }
+    return out;
+}
+
+// Return one integer Newton step toward the k-th root of n from x, given
+// q = x^(k - 1): floor(((k - 1) x + floor(n / q)) / k). The result is never
+// below the floor of the root, and is below x whenever x^k > n.
+static bigint_t bigint_root_step(bigint_t n, bigint_t x, bigint_t q, size_t k)
+{
+    bigint_t rem, kb = long_to_bigint(k), km1 = long_to_bigint(k - 1);
+    bigint_t quot = bigint_div(n, q, &rem);
+    bigint_delete(&rem);
+    bigint_t t = bigint_prod(x, km1);
+    bigint_t sum = bigint_sum(t, quot);
+    bigint_t out = bigint_div(sum, kb, &rem);
+    bigint_delete(&rem); bigint_delete(&sum); bigint_delete(&t);
+    bigint_delete(&quot); bigint_delete(&kb); bigint_delete(&km1);
+    return out;
+}
+
+// Return floor(n^(1/k)) for a single word n > 0 and 2 <= k < WORD_BITS, by
+// integer Newton steps down from 2^ceil(bits / k)
+static uword_t word_root(uword_t n, size_t k)
+{
+    const size_t bits = WORD_BITS - __builtin_clzll(n);
+    uword_t x = (uword_t)1 << ((bits + k - 1) / k);
+    for (;;) {
+        // x^(k - 1), saturating once it passes n
+        udword_t q = 1;
+        for (size_t i = 1; i < k && q <= n; i++)
+            q *= x;
+        uword_t y = ((k - 1) * x + (q > n ? 0 : n / (uword_t)q)) / k;
+        if (y >= x)
+            return x;
+        x = y;
+    }
+}
+
+// Return floor(n^(1/k)) for n > 0 and k >= 2. The root of the top half of
+// n's bits, shifted back up, is right in about half its bits, so a single
+// Newton step at full precision nearly finishes the job; the recursion
+// works at half, quarter, ... precision below, for a total cost of a few
+// full-size products and divisions.
+static bigint_t bigint_root(bigint_t n, size_t k)
+{
+    const size_t bits = bigint_bits(n);
+    if (bits <= k)
+        return long_to_bigint(1);
+    if (bits <= WORD_BITS) {
+        uword_t r = word_root(n.val[0], k);
+        return bigint_from_limbs(&r, 1);
+    }
+
+    // Slack for the (k - 1) / 2 factor in the Newton error
+    const size_t margin = 2 + (WORD_BITS - __builtin_clzll(k));
+    const size_t j = bits / (2 * k) > margin ? bits / (2 * k) - margin : 0;
+    bigint_t x, q, p, t;
+    if (j == 0) {
+        // Few root bits: start from 2^ceil(bits / k), above the root
+        t = long_to_bigint(1);
+        x = bigint_sl(t, (bits + k - 1) / k);
+        bigint_delete(&t);
+    } else {
+        bigint_t top = bigint_sr(n, j * k);
+        bigint_t r = bigint_root(top, k);
+        t = bigint_sl(r, j);
+        q = bigint_pow(t, k - 1);
+        x = bigint_root_step(n, t, q, k);
+        bigint_delete(&top); bigint_delete(&r); bigint_delete(&t); bigint_delete(&q);
+    }
+
+    // x is at least the root now; step down until x^k <= n
+    for (;;) {
+        q = k > 2 ? bigint_pow(x, k - 1) : bigint_copy(x);
+        p = bigint_prod(q, x);
+        t = bigint_diff(n, p);
+        bool done = !is_neg(t);
+        bigint_delete(&t);
+        bigint_delete(&p);
+        if (done) {
+            bigint_delete(&q);
+            return x;
+        }
+        t = bigint_root_step(n, x, q, k);
+        bigint_delete(&q);
+        bigint_delete(&x);
+        x = t;
+    }
+}
+
+// Return floor(sqrt(n)) for n >= 0
+bigint_t bigint_isqrt(bigint_t n)
+{
+    INSTR_SCOPE(INSTR_ISQRT, n.size);
+    if (is_neg(n)) {
+        fprintf(stderr, "bigint_isqrt: WARNING: negative input\n");
+        return bigint_zero(1);
+    }
+    if (is_zero(n))
+        return bigint_zero(1);
+    return bigint_root(n, 2);
+}
+
+// Return the k-th root of n rounded toward zero, for k >= 1 and n >= 0 or k odd
+bigint_t bigint_iroot(bigint_t n, size_t k)
+{
+    INSTR_SCOPE(INSTR_IROOT, n.size);
+    if (k == 0 || (is_neg(n) && k % 2 == 0)) {
+        fprintf(stderr, "bigint_iroot: WARNING: %s\n",
+            k == 0 ? "zeroth root" : "even root of a negative input");
+        return bigint_zero(1);
+    }
+    if (k == 1 || is_zero(n))
+        return bigint_copy(n);
+    if (!is_neg(n))
+        return bigint_root(n, k);
+
+    bigint_t abs_n = bigint_neg(n);
+    bigint_t r = bigint_root(abs_n, k);
+    bigint_t out = bigint_neg(r);
+    bigint_delete(&abs_n);
+    bigint_delete(&r);
+    return out;
+}
+
+// Return whether n = r^k for some |r| >= 2 and k >= 2; if so, set *root and *k
+// (either may be NULL) to the r of least magnitude and its exponent
+bool bigint_is_perfect_power(bigint_t n, bigint_t *root, size_t *k)
+{
+    // Peel prime exponents off |n| while it stays a power; negative n only
+    // has odd ones
+    bool neg = is_neg(n);
+    bigint_t m = neg ? bigint_neg(n) : bigint_copy(n);
+    size_t exp = 1;
+    for (size_t p = neg ? 3 : 2; p < bigint_bits(m); p++) {
+        bool prime = true;
+        for (size_t d = 2; d * d <= p && prime; d++)
+            prime = p % d != 0;
+        if (!prime)
+            continue;
+
+        bigint_t r = bigint_root(m, p);
+        bigint_t rp = bigint_pow(r, p);
+        bool exact = bigint_equals(rp, m);
+        bigint_delete(&rp);
+        if (!exact) {
+            bigint_delete(&r);
+            continue;
+        }
+        bigint_delete(&m);
+        m = r;
+        exp *= p;
+        p--;    // Try p again on the root
+    }
+
+    bool found = exp > 1;
+    if (found && neg) {
+        bigint_t t = bigint_neg(m);
+        bigint_delete(&m);
+        m = t;
+    }
+    if (k && found)
+        *k = exp;
+    if (root && found)
+        *root = m;
+    else
+        bigint_delete(&m);
+    return found;
+}
+
+// Return whether r is the k-th root of n rounded toward zero, i.e.
+// |r|^k <= |n| < (|r| + 1)^k with the sign of n
+static bool math_test_root(bigint_t n, bigint_t r, size_t k)
+{
+    bool neg = is_neg(n);
+    if (neg != is_neg(r) && !is_zero(r))
+        return false;
+    bigint_t abs_n = neg ? bigint_neg(n) : bigint_copy(n);
+    bigint_t abs_r = neg ? bigint_neg(r) : bigint_copy(r);
+    bigint_t one = long_to_bigint(1);
+    bigint_t next = bigint_sum(abs_r, one);
+    bigint_t lo = k == 1 ? bigint_copy(abs_r) : bigint_pow(abs_r, k);
+    bigint_t hi = k == 1 ? bigint_copy(next) : bigint_pow(next, k);
+    bigint_t d1 = bigint_diff(abs_n, lo), d2 = bigint_diff(hi, abs_n);
+    bool out = !is_neg(d1) && is_pos(d2);
+    bigint_delete(&d1); bigint_delete(&d2); bigint_delete(&lo); bigint_delete(&hi);
+    bigint_delete(&next); bigint_delete(&one); bigint_delete(&abs_r); bigint_delete(&abs_n);
+    return out;
+}
+
+// Testing
+int math_test(void)
+{
+    int total_errors = 0;
+
+    // Right shifts against division by 2^k, rounding down for negative n
+    int errors = 0;
+    for (size_t iter = 0; iter < 40; iter++) {
+        bigint_t n = bigint_random_bits(1 + 37 * iter);
+        if (iter & 1) {
+            bigint_t t = bigint_neg(n);
+            bigint_delete(&n);
+            n = t;
+        }
+        size_t k = (iter * 29) % 300;
+        bigint_t one = long_to_bigint(1), rem;
+        bigint_t pow2 = bigint_sl(one, k);
+        bigint_t q = bigint_div(n, pow2, &rem);
+        if (is_neg(n) && !is_zero(rem)) {
+            bigint_t t = bigint_diff(q, one);
+            bigint_delete(&q);
+            q = t;
+        }
+        bigint_t got = bigint_sr(n, k);
+        errors += !bigint_equals(got, q);
+        bigint_delete(&got); bigint_delete(&q); bigint_delete(&rem);
+        bigint_delete(&pow2); bigint_delete(&one); bigint_delete(&n);
+    }
+    bool test = errors == 0;
+    printf("%s: bigint_sr matches floor division by 2^k\n", test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Square and k-th roots bracket n, from one word to a few thousand bits
+    static const size_t roots[] = { 2, 3, 5, 7, 17, 64 };
+    errors = 0;
+    for (size_t iter = 0; iter < 30; iter++) {
+        bigint_t n = bigint_random_bits(1 + 101 * iter);
+        bigint_t r = bigint_isqrt(n);
+        errors += !math_test_root(n, r, 2);
+        bigint_delete(&r);
+        for (size_t i = 0; i < sizeof(roots) / sizeof(roots[0]); i++) {
+            r = bigint_iroot(n, roots[i]);
+            errors += !math_test_root(n, r, roots[i]);
+            bigint_delete(&r);
+        }
+
+        // Odd roots of negative n round toward zero
+        bigint_t neg_n = bigint_neg(n);
+        r = bigint_iroot(neg_n, 3);
+        errors += !math_test_root(neg_n, r, 3);
+        bigint_delete(&r);
+        bigint_delete(&neg_n);
+        bigint_delete(&n);
+    }
+    test = errors == 0;
+    printf("%s: bigint_isqrt and bigint_iroot bracket n up to 2930 bits\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Exact powers are found with the largest exponent, their neighbours
+    // are not, and negative n only has odd exponents
+    errors = 0;
+    static const size_t exps[] = { 2, 3, 6, 9, 10, 35 };
+    for (size_t i = 0; i < sizeof(exps) / sizeof(exps[0]); i++) {
+        bigint_t r = bigint_random_bits(40 + 30 * i);
+        bigint_t n = bigint_pow(r, exps[i]);
+        bigint_t root;
+        size_t k = 0;
+        errors += !bigint_is_perfect_power(n, &root, &k) || k != exps[i]
+            || !bigint_equals(root, r);
+        bigint_delete(&root);
+
+        bigint_t one = long_to_bigint(1);
+        bigint_t near = bigint_sum(n, one);
+        errors += bigint_is_perfect_power(near, NULL, NULL);
+        bigint_delete(&near);
+        bigint_delete(&one);
+
+        bigint_t neg_n = bigint_neg(n);
+        bool found = bigint_is_perfect_power(neg_n, &root, &k);
+        if (exps[i] % 2) {
+            bigint_t neg_r = bigint_neg(r);
+            errors += !found || k != exps[i] || !bigint_equals(root, neg_r);
+            bigint_delete(&neg_r);
+            bigint_delete(&root);
+        } else {
+            errors += found && k % 2 == 0;
+            if (found)
+                bigint_delete(&root);
+        }
+        bigint_delete(&neg_n);
+        bigint_delete(&n);
+        bigint_delete(&r);
+    }
+    test = errors == 0;
+    printf("%s: bigint_is_perfect_power finds r^k with the largest k\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    return total_errors;
+}
@@ -20,6 +20,9 @@ bigint_t bigint_diff(bigint_t a, bigint_t b);
 // Return whether a == b, i.e. whether a - b == 0
 bool bigint_equals(bigint_t a, bigint_t b);
 
+// Number of bits needed for the unsigned value of n
+size_t bigint_bits(bigint_t n);
+
 // Integer multiplication a * b
 bigint_t bigint_prod(bigint_t a, bigint_t b);
 
@@ -32,7 +35,17 @@ bigint_t bigint_gcd(bigint_t a, bigint_t b);
 // Extended euclidean algorithm
 bigint_t bigint_xgcd(bigint_t a, bigint_t b, bigint_t *x, bigint_t *y);
 
+// Return floor(sqrt(n)) for n >= 0
+bigint_t bigint_isqrt(bigint_t n);
+
+// Return the k-th root of n rounded toward zero, for k >= 1 and n >= 0 or k odd
+bigint_t bigint_iroot(bigint_t n, size_t k);
+
+// Return whether n = r^k for some |r| >= 2 and k >= 2; if so, set *root and *k
+// (either may be NULL) to the r of least magnitude and its exponent
+bool bigint_is_perfect_power(bigint_t n, bigint_t *root, size_t *k);
+
 // Testing methods
-int mod_test(void);
+int math_test(void);
 
 #endif // MATH_H
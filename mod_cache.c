@@ -0,0 +1,452 @@
+/**
+ * mod_cache.c: Cache of reduction contexts keyed by modulus
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "limb.h"
+#include "math.h"
+#include "mod_cache.h"
+
+typedef struct mod_cache_entry {
+    mod_ctx_t ctx;                  // First, so a mod_ctx_t * is the entry
+    uint64_t hash;
+    atomic_size_t refs;             // Contexts handed out and not yet put
+    atomic_bool cached;             // Freed on the last put once evicted
+    struct mod_cache_entry *prev;   // LRU list, most recently used first
+    struct mod_cache_entry *next;
+    struct mod_cache_entry *chain;  // Next entry in the hash bucket
+} mod_cache_entry_t;
+
+static struct {
+    pthread_mutex_t lock;
+    mod_cache_entry_t **buckets;
+    size_t bucket_mask;             // Bucket count minus one, a power of two
+    mod_cache_entry_t *head;
+    mod_cache_entry_t *tail;
+    size_t entries;
+    size_t capacity;
+    atomic_size_t hits;             // Also counted outside the lock
+    size_t misses;
+    size_t evictions;
+} cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .capacity = MOD_CACHE_DEFAULT_SIZE,
+};
+
+/**
+ * Each thread keeps a reference to the entry it used last. Lookups of that
+ * modulus, the common case for batches and repeated mod_exp calls, take
+ * another reference without the lock. Since the slot holds a reference,
+ * refs only moves between zero and one under the lock, and the
+ * key destructor drops the slot's reference when the thread exits.
+ */
+static _Thread_local mod_cache_entry_t *mod_cache_last;
+static pthread_key_t mod_cache_last_key;
+static pthread_once_t mod_cache_last_once = PTHREAD_ONCE_INIT;
+
+static void mod_cache_last_exit(void *e)
+{
+    mod_cache_last = NULL;
+    mod_cache_put(e);
+}
+
+static void mod_cache_last_init(void)
+{
+    pthread_key_create(&mod_cache_last_key, mod_cache_last_exit);
+}
+
+// Return FNV-1a hash of the limbs, with a final mix for the bucket bits
+static uint64_t mod_cache_hash(const uword_t *n, size_t size)
+{
+    uint64_t h = 0xcbf29ce484222325;
+    for (size_t i = 0; i < size; i++) {
+        h ^= n[i];
+        h *= 0x100000001b3;
+    }
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93;
+    return h ^ (h >> 32);
+}
+
+// Free an entry and its context
+static void mod_cache_free(mod_cache_entry_t *e)
+{
+    if (e->ctx.odd)
+        mont_delete(&e->ctx.mont);
+    else
+        barrett_delete(&e->ctx.barrett);
+    free(e);
+}
+
+// Return the cached entry for n, or NULL (lock held)
+static mod_cache_entry_t *mod_cache_find(const uword_t *n, size_t size, uint64_t hash)
+{
+    if (!cache.buckets)
+        return NULL;
+    for (mod_cache_entry_t *e = cache.buckets[hash & cache.bucket_mask]; e; e = e->chain)
+        if (e->hash == hash && e->ctx.size == size && !limb_cmp(mod_ctx_n(&e->ctx), n, size))
+            return e;
+    return NULL;
+}
+
+// Move an entry to the front of the LRU list (lock held)
+static void mod_cache_touch(mod_cache_entry_t *e)
+{
+    if (cache.head == e)
+        return;
+    e->prev->next = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        cache.tail = e->prev;
+    e->prev = NULL;
+    e->next = cache.head;
+    cache.head->prev = e;
+    cache.head = e;
+}
+
+// Unlink an entry from the list and its bucket, freeing it if unused (lock held)
+static void mod_cache_remove(mod_cache_entry_t *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        cache.head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        cache.tail = e->prev;
+
+    mod_cache_entry_t **p = &cache.buckets[e->hash & cache.bucket_mask];
+    while (*p != e)
+        p = &(*p)->chain;
+    *p = e->chain;
+
+    cache.entries--;
+    atomic_store(&e->cached, false);
+    if (!atomic_load(&e->refs))
+        mod_cache_free(e);
+}
+
+// Evict least recently used entries down to the capacity (lock held)
+static void mod_cache_trim(void)
+{
+    while (cache.entries > cache.capacity) {
+        mod_cache_remove(cache.tail);
+        cache.evictions++;
+    }
+}
+
+// Size the bucket array for the capacity, rehashing the entries (lock held)
+static void mod_cache_rehash(void)
+{
+    size_t count = 16;
+    while (count < 2 * cache.capacity)
+        count *= 2;
+    if (cache.buckets && count == cache.bucket_mask + 1)
+        return;
+
+    free(cache.buckets);
+    cache.buckets = calloc(count, sizeof(*cache.buckets));
+    cache.bucket_mask = count - 1;
+    for (mod_cache_entry_t *e = cache.head; e; e = e->next) {
+        e->chain = cache.buckets[e->hash & cache.bucket_mask];
+        cache.buckets[e->hash & cache.bucket_mask] = e;
+    }
+}
+
+// Make e the calling thread's last entry, holding a reference to it in the
+// slot, and return its context
+static const mod_ctx_t *mod_cache_remember(mod_cache_entry_t *e)
+{
+    mod_cache_entry_t *old = mod_cache_last;
+    if (old == e)
+        return &e->ctx;
+    pthread_once(&mod_cache_last_once, mod_cache_last_init);
+    atomic_fetch_add(&e->refs, 1);
+    mod_cache_last = e;
+    pthread_setspecific(mod_cache_last_key, e);
+    if (old)
+        mod_cache_put(&old->ctx);
+    return &e->ctx;
+}
+
+// Return the context for positive modulus n; release it with mod_cache_put
+const mod_ctx_t *mod_cache_get(bigint_t n)
+{
+    if (!is_pos(n)) {
+        fprintf(stderr, "mod_cache_get: WARNING: modulus must be positive\n");
+        return NULL;
+    }
+    const size_t size = limb_normalize(n.val, n.size);
+
+    // The same modulus as last time on this thread skips the lock
+    mod_cache_entry_t *e = mod_cache_last;
+    if (e && atomic_load(&e->cached) && e->ctx.size == size
+            && !limb_cmp(mod_ctx_n(&e->ctx), n.val, size)) {
+        atomic_fetch_add(&cache.hits, 1);
+        atomic_fetch_add(&e->refs, 1);
+        return &e->ctx;
+    }
+
+    const uint64_t hash = mod_cache_hash(n.val, size);
+    pthread_mutex_lock(&cache.lock);
+    e = mod_cache_find(n.val, size, hash);
+    if (e) {
+        atomic_fetch_add(&cache.hits, 1);
+        atomic_fetch_add(&e->refs, 1);
+        mod_cache_touch(e);
+        pthread_mutex_unlock(&cache.lock);
+        return mod_cache_remember(e);
+    }
+    cache.misses++;
+    pthread_mutex_unlock(&cache.lock);
+
+    // Precompute without the lock, so other moduli are not held up
+    mod_cache_entry_t *fresh = calloc(1, sizeof(*fresh));
+    fresh->ctx.odd = n.val[0] & 1;
+    fresh->ctx.size = size;
+    if (fresh->ctx.odd)
+        fresh->ctx.mont = mont_new(n);
+    else
+        fresh->ctx.barrett = barrett_new(n);
+    fresh->hash = hash;
+    atomic_init(&fresh->refs, 1);
+    atomic_init(&fresh->cached, true);
+
+    // Another thread may have added the same modulus in the meantime
+    pthread_mutex_lock(&cache.lock);
+    e = mod_cache_find(n.val, size, hash);
+    if (e) {
+        atomic_fetch_add(&e->refs, 1);
+        mod_cache_touch(e);
+        pthread_mutex_unlock(&cache.lock);
+        mod_cache_free(fresh);
+        return mod_cache_remember(e);
+    }
+    if (!cache.buckets)
+        mod_cache_rehash();
+    fresh->chain = cache.buckets[hash & cache.bucket_mask];
+    cache.buckets[hash & cache.bucket_mask] = fresh;
+    fresh->next = cache.head;
+    if (cache.head)
+        cache.head->prev = fresh;
+    else
+        cache.tail = fresh;
+    cache.head = fresh;
+    cache.entries++;
+    mod_cache_trim();
+    pthread_mutex_unlock(&cache.lock);
+    return mod_cache_remember(fresh);
+}
+
+// Take another reference to a context, released with mod_cache_put
+const mod_ctx_t *mod_cache_ref(const mod_ctx_t *ctx)
+{
+    // The caller holds a reference, so refs cannot be zero here
+    mod_cache_entry_t *e = (mod_cache_entry_t *)ctx;
+    atomic_fetch_add(&e->refs, 1);
+    return ctx;
+}
+
+// Release a context returned by mod_cache_get or mod_cache_ref
+void mod_cache_put(const mod_ctx_t *ctx)
+{
+    if (!ctx)
+        return;
+    mod_cache_entry_t *e = (mod_cache_entry_t *)ctx;
+    if (e == mod_cache_last) {
+        // The thread's slot keeps another reference
+        atomic_fetch_sub(&e->refs, 1);
+        return;
+    }
+    pthread_mutex_lock(&cache.lock);
+    bool unused = atomic_fetch_sub(&e->refs, 1) == 1 && !atomic_load(&e->cached);
+    pthread_mutex_unlock(&cache.lock);
+    if (unused)
+        mod_cache_free(e);
+}
+
+// out = a mod n (an words, out has ctx->size words)
+void mod_cache_reduce(const mod_ctx_t *ctx, uword_t *out, const uword_t *a, size_t an)
+{
+    // Values already below n are only copied
+    const size_t k = ctx->size;
+    an = limb_normalize(a, an);
+    if (an < k || (an == k && limb_cmp(a, mod_ctx_n(ctx), k) < 0)) {
+        memmove(out, a, an * sizeof(uword_t));
+        memset(out + an, 0, (k - an) * sizeof(uword_t));
+        return;
+    }
+
+    if (ctx->odd)
+        mont_reduce(&ctx->mont, out, a, an);
+    else if (an <= 2 * k)
+        barrett_reduce(&ctx->barrett, out, a, an);
+    else
+        limb_divrem(NULL, out, a, an, ctx->barrett.n, k);
+}
+
+// Keep at most entries contexts (0 disables caching), evicting the oldest
+void mod_cache_resize(size_t entries)
+{
+    pthread_mutex_lock(&cache.lock);
+    cache.capacity = entries;
+    mod_cache_trim();
+    mod_cache_rehash();
+    pthread_mutex_unlock(&cache.lock);
+}
+
+// Copy the counters into out, then zero them if reset is set
+void mod_cache_stats(mod_cache_stats_t *out, bool reset)
+{
+    pthread_mutex_lock(&cache.lock);
+    *out = (mod_cache_stats_t){
+        .hits = reset ? atomic_exchange(&cache.hits, 0) : atomic_load(&cache.hits),
+        .misses = cache.misses,
+        .evictions = cache.evictions,
+        .entries = cache.entries,
+        .capacity = cache.capacity,
+    };
+    if (reset)
+        cache.misses = cache.evictions = 0;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+// Drop every cached context
+void mod_cache_clear(void)
+{
+    // Other threads' slots keep their entries alive until they move on
+    mod_cache_entry_t *last = mod_cache_last;
+    mod_cache_last = NULL;
+    if (last) {
+        pthread_setspecific(mod_cache_last_key, NULL);
+        mod_cache_put(&last->ctx);
+    }
+
+    pthread_mutex_lock(&cache.lock);
+    while (cache.head)
+        mod_cache_remove(cache.head);
+    free(cache.buckets);
+    cache.buckets = NULL;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+// Hammer a few moduli from several threads through a tiny cache
+static void *mod_cache_test_thread(void *arg)
+{
+    const bigint_t *moduli = arg;
+    size_t errors = 0;
+    for (int iter = 0; iter < 200; iter++) {
+        bigint_t n = moduli[iter % 5];
+        const mod_ctx_t *ctx = mod_cache_get(n);
+        bigint_t a = bigint_random_bits(2 * ctx->size * WORD_BITS - 1);
+        bigint_t expect, rem;
+        expect = bigint_div(a, n, &rem);
+        uword_t out[ctx->size];
+        mod_cache_reduce(ctx, out, a.val, a.size);
+        bigint_t got = bigint_from_limbs(out, ctx->size);
+        errors += !bigint_equals(got, rem);
+        mod_cache_put(ctx);
+        bigint_delete(&got);
+        bigint_delete(&rem);
+        bigint_delete(&expect);
+        bigint_delete(&a);
+    }
+    return (void *)errors;
+}
+
+// Look one modulus up repeatedly, then exit with it in the thread's slot
+static void *mod_cache_test_repeat(void *arg)
+{
+    for (int iter = 0; iter < 100; iter++)
+        mod_cache_put(mod_cache_get(*(bigint_t *)arg));
+    return NULL;
+}
+
+// Testing
+int mod_cache_test(void)
+{
+    int total_errors = 0;
+    bool test;
+    mod_cache_stats_t before, after;
+
+    mod_cache_clear();
+    mod_cache_stats(&before, true);
+
+    // Hits and misses, and contexts outliving their eviction
+    bigint_t moduli[5];
+    for (int i = 0; i < 5; i++) {
+        moduli[i] = bigint_random_bits(100 + 300 * i);
+        moduli[i].val[0] = (moduli[i].val[0] & ~(uword_t)1) | (i & 1);
+    }
+    mod_cache_resize(2);
+    const mod_ctx_t *held = mod_cache_get(moduli[0]);
+    for (int i = 0; i < 5; i++)
+        mod_cache_put(mod_cache_get(moduli[i]));
+    mod_cache_put(mod_cache_get(moduli[4]));
+    mod_cache_stats(&after, true);
+    test = after.hits == 2 && after.misses == 5 && after.evictions == 3
+        && after.entries == 2 && after.capacity == 2
+        && !held->odd && limb_cmp(held->barrett.n, moduli[0].val, held->size) == 0;
+    mod_cache_put(held);
+    printf("%s: mod_cache counts hits, misses and evictions\n", test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Concurrent lookups with constant eviction
+    pthread_t threads[4];
+    size_t errors = 0;
+    for (int i = 0; i < 4; i++)
+        pthread_create(&threads[i], NULL, mod_cache_test_thread, moduli);
+    for (int i = 0; i < 4; i++) {
+        void *ret;
+        pthread_join(threads[i], &ret);
+        errors += (size_t)ret;
+    }
+    mod_cache_stats(&after, true);
+    test = errors == 0 && after.hits + after.misses == 800 && after.entries <= 2;
+    printf("%s: mod_cache_reduce is correct under concurrent eviction\n", test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Runs of one modulus hit, and the slot is released when the thread exits
+    mod_cache_clear();
+    mod_cache_resize(MOD_CACHE_DEFAULT_SIZE);
+    pthread_create(&threads[0], NULL, mod_cache_test_repeat, &moduli[1]);
+    pthread_join(threads[0], NULL);
+    const mod_ctx_t *ctx = mod_cache_get(moduli[1]);
+    mod_cache_stats(&after, true);
+    test = after.hits == 100 && after.misses == 1 && after.entries == 1
+        && atomic_load(&((mod_cache_entry_t *)ctx)->refs) == 2;
+    mod_cache_put(ctx);
+    printf("%s: mod_cache serves repeated lookups from the thread's last entry\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Contexts for a shared modulus reference its limbs and outlive it
+    test = true;
+    for (uword_t odd = 0; odd < 2; odd++) {
+        bigint_t n = bigint_random_bits(777);
+        n.val[0] = (n.val[0] & ~(uword_t)1) | odd;
+        bigint_t shared = bigint_share(bigint_copy(n));
+        ctx = mod_cache_get(shared);
+        test &= mod_ctx_n(ctx) == shared.val;
+        bigint_delete(&shared);
+        test &= !limb_cmp(mod_ctx_n(ctx), n.val, ctx->size);
+        mod_cache_put(ctx);
+        bigint_delete(&n);
+    }
+    printf("%s: mod_cache contexts take the limbs of a shared modulus without copying\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    for (int i = 0; i < 5; i++)
+        bigint_delete(&moduli[i]);
+    mod_cache_clear();
+    return total_errors;
+}
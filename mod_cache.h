@@ -0,0 +1,71 @@
+/**
+ * mod_cache.h: Cache of reduction contexts keyed by modulus
+ *
+ * Contexts are looked up by a hash of the modulus limbs and kept in least
+ * recently used order, so a working set of moduli that fits the cache pays
+ * for its precomputation once. Odd moduli get Montgomery contexts, even ones
+ * Barrett contexts. A context stays valid until it is released, even if the
+ * cache evicts it in the meantime; all functions are thread-safe. Each
+ * thread also remembers the context it used last, so runs of lookups for
+ * one modulus do not contend on the cache lock.
+ */
+
+#ifndef MOD_CACHE_H
+#define MOD_CACHE_H
+
+#include <stdbool.h>
+
+#include "barrett.h"
+#include "bigint.h"
+#include "mont.h"
+
+enum {
+    MOD_CACHE_DEFAULT_SIZE = 512,   // Contexts kept when nothing uses them
+};
+
+typedef struct {
+    bool odd;               // Montgomery context if set, Barrett otherwise
+    size_t size;            // Words in the modulus
+    mont_ctx_t mont;
+    barrett_ctx_t barrett;
+} mod_ctx_t;
+
+// Return the modulus limbs of a context
+static inline const uword_t *mod_ctx_n(const mod_ctx_t *ctx)
+{
+    return ctx->odd ? ctx->mont.n : ctx->barrett.n;
+}
+
+typedef struct {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t entries;         // Contexts currently cached
+    size_t capacity;
+} mod_cache_stats_t;
+
+// Return the context for positive modulus n; release it with mod_cache_put
+const mod_ctx_t *mod_cache_get(bigint_t n);
+
+// Take another reference to a context, released with mod_cache_put
+const mod_ctx_t *mod_cache_ref(const mod_ctx_t *ctx);
+
+// Release a context returned by mod_cache_get or mod_cache_ref
+void mod_cache_put(const mod_ctx_t *ctx);
+
+// out = a mod n (an words, out has ctx->size words)
+void mod_cache_reduce(const mod_ctx_t *ctx, uword_t *out, const uword_t *a, size_t an);
+
+// Keep at most entries contexts (0 disables caching), evicting the oldest
+void mod_cache_resize(size_t entries);
+
+// Copy the counters into out, then zero them if reset is set
+void mod_cache_stats(mod_cache_stats_t *out, bool reset);
+
+// Drop every cached context
+void mod_cache_clear(void);
+
+// Testing methods
+int mod_cache_test(void);
+
+#endif // MOD_CACHE_H
@@ -2,82 +2,171 @@
  * mod_math.c: Modular arithmetic
  */
 
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "instr.h"
+#include "limb.h"
 #include "math.h"
+#include "mod_math.h"
+#include "mont.h"
+#include "tables.h"
 
-// TODO move to a header file
-bigint_t mod(bigint_t a, bigint_t n);
-bigint_t mod_sum(bigint_t a, bigint_t b, bigint_t n);
-bigint_t mod_diff(bigint_t a, bigint_t b, bigint_t n);
-bigint_t mod_prod(bigint_t a, bigint_t b, bigint_t n);
-bigint_t mod_exp(bigint_t a, bigint_t exp, bigint_t n);
-bigint_t mod_inv(bigint_t a, bigint_t n);
-bigint_t mod_neg(bigint_t a, bigint_t n);
+// Return whether n is a valid modulus, warning on behalf of fn otherwise
+static bool mod_check(bigint_t n, const char *fn)
+{
+    if (is_pos(n))
+        return true;
+    fprintf(stderr, "%s: WARNING: modulus must be positive\n", fn);
+    return false;
+}
+
+// out = a mod n (ctx->size words) for the context of n, any sign of a
+static void mod_to_limbs(const mod_ctx_t *ctx, uword_t *out, bigint_t a)
+{
+    if (!is_neg(a)) {
+        mod_cache_reduce(ctx, out, a.val, a.size);
+        return;
+    }
 
+    // Otherwise a mod n = n - (-a mod n), or 0
+    bigint_t neg_a = bigint_neg(a);
+    mod_cache_reduce(ctx, out, neg_a.val, neg_a.size);
+    bigint_delete(&neg_a);
+    if (!limb_is_zero(out, ctx->size))
+        limb_sub_n(out, mod_ctx_n(ctx), out, ctx->size);
+}
+
+// out = a * b mod n for reduced a and b of ctx->size words
+static void mod_mul_limbs(const mod_ctx_t *ctx, uword_t *out, const uword_t *a, const uword_t *b)
+{
+    uword_t prod[2 * ctx->size];
+    limb_mul(prod, a, ctx->size, b, ctx->size);
+    mod_cache_reduce(ctx, out, prod, 2 * ctx->size);
+}
+
+// Calculate a mod n
 bigint_t mod(bigint_t a, bigint_t n)
 {
-    bigint_t out;
-    bigint_t div = div = bigint_div(a, n, &out);
-    bigint_delete(&div);
-    return out;
+    INSTR_SCOPE(INSTR_MOD, n.size);
+    if (!mod_check(n, "mod"))
+        return bigint_zero(1);
+
+    // Sizes are read up front: the context may be freed once it is put
+    const mod_ctx_t *ctx = mod_cache_get(n);
+    const size_t s = ctx->size;
+    uword_t r[s];
+    mod_to_limbs(ctx, r, a);
+    mod_cache_put(ctx);
+    return bigint_from_limbs(r, s);
 }
 
-// TODO test
+// Calculate a + b mod n
 bigint_t mod_sum(bigint_t a, bigint_t b, bigint_t n)
 {
-    bigint_t sum;
-    a = mod(a, n);
-    b = mod(b, n);
-    bigint_t tmp_sum = bigint_sum(a, b);
-    bigint_delete(&a);
-    bigint_delete(&b);
-    sum = mod(tmp_sum, n);
-    bigint_delete(&tmp_sum);
-    return sum;
+    INSTR_SCOPE(INSTR_MOD_SUM, n.size);
+    if (!mod_check(n, "mod_sum"))
+        return bigint_zero(1);
+
+    const mod_ctx_t *ctx = mod_cache_get(n);
+    const size_t s = ctx->size;
+    uword_t x[s], y[s];
+    mod_to_limbs(ctx, x, a);
+    mod_to_limbs(ctx, y, b);
+    limb_add_mod(x, x, y, mod_ctx_n(ctx), ctx->size);
+    mod_cache_put(ctx);
+    return bigint_from_limbs(x, s);
 }
 
-// TODO test
+// Calculate a - b mod n
 bigint_t mod_diff(bigint_t a, bigint_t b, bigint_t n)
 {
-    a = mod(a, n);
-    b = mod(b, n);
-    bigint_t neg_b = bigint_neg(b);
-    bigint_delete(&b);
-    bigint_t diff_ab = bigint_sum(a, neg_b);
-    bigint_delete(&a);
-    bigint_delete(&neg_b);
-    bigint_t diff = mod(diff_ab, n);
-    bigint_delete(&diff_ab);
-    return diff;
+    INSTR_SCOPE(INSTR_MOD_DIFF, n.size);
+    if (!mod_check(n, "mod_diff"))
+        return bigint_zero(1);
+
+    const mod_ctx_t *ctx = mod_cache_get(n);
+    const size_t s = ctx->size;
+    uword_t x[s], y[s];
+    mod_to_limbs(ctx, x, a);
+    mod_to_limbs(ctx, y, b);
+    limb_sub_mod(x, x, y, mod_ctx_n(ctx), ctx->size);
+    mod_cache_put(ctx);
+    return bigint_from_limbs(x, s);
 }
 
-// TODO re-implement bigint_prod and take mods after each iteration
-// TODO test
+// Calculate a * b mod n
 bigint_t mod_prod(bigint_t a, bigint_t b, bigint_t n)
 {
-    a = mod(a, n);
-    b = mod(b, n);
-    bigint_t prod_ab = bigint_prod(a, b);
-    bigint_delete(&a);
-    bigint_delete(&b);
-    bigint_t prod = mod(prod_ab, n);
-    bigint_delete(&prod_ab);
-    return prod;
+    INSTR_SCOPE(INSTR_MOD_PROD, n.size);
+    if (!mod_check(n, "mod_prod"))
+        return bigint_zero(1);
+
+    const mod_ctx_t *ctx = mod_cache_get(n);
+    const size_t s = ctx->size;
+    uword_t x[s], y[s];
+    mod_to_limbs(ctx, x, a);
+    mod_to_limbs(ctx, y, b);
+    mod_mul_limbs(ctx, x, x, y);
+    mod_cache_put(ctx);
+    return bigint_from_limbs(x, s);
 }
 
-// TODO
-// TODO test
-// Calculate a^exp mod n
+// Calculate a^exp mod n. A negative exp raises the inverse of a, and gives 0
+// with a warning if a has none.
 bigint_t mod_exp(bigint_t a, bigint_t exp, bigint_t n)
 {
+    INSTR_SCOPE(INSTR_MOD_EXP, n.size);
+    if (!mod_check(n, "mod_exp"))
+        return bigint_zero(1);
 
+    // Negative exponents use the inverse of a; mod 1 everything is 0
+    if (is_neg(exp)) {
+        bigint_t inv = mod_inv(a, n);
+        if (is_zero(inv) && bigint_bits(n) != 1) {
+            fprintf(stderr, "mod_exp: WARNING: negative exponent of a base with no inverse\n");
+            return inv;
+        }
+        bigint_t neg_exp = bigint_neg(exp);
+        bigint_t out = mod_exp(inv, neg_exp, n);
+        bigint_delete(&inv);
+        bigint_delete(&neg_exp);
+        return out;
+    }
+
+    // Odd moduli use Montgomery multiplication
+    const mod_ctx_t *ctx = mod_cache_get(n);
+    if (ctx->odd) {
+        bigint_t out = mont_exp(&ctx->mont, a, exp);
+        mod_cache_put(ctx);
+        return out;
+    }
+
+    // Even moduli: left-to-right square and multiply with Barrett reduction
+    const size_t s = ctx->size;
+    uword_t out[s], base[s];
+    bigint_t one = long_to_bigint(1);
+    mod_to_limbs(ctx, out, one);
+    mod_to_limbs(ctx, base, a);
+    bigint_delete(&one);
+    for (size_t i = bigint_bits(exp) - 1; i < SIZE_MAX; i--) {
+        mod_mul_limbs(ctx, out, out, out);
+        if (exp.val[i / WORD_BITS] & ((uword_t)1 << (i % WORD_BITS)))
+            mod_mul_limbs(ctx, out, out, base);
+    }
+    mod_cache_put(ctx);
+    return bigint_from_limbs(out, s);
 }
 
-// TODO test
 // Calculate multiplicative inverse of a mod n, return 0 if it doesn't exist
 bigint_t mod_inv(bigint_t a, bigint_t n)
 {
+    INSTR_SCOPE(INSTR_MOD_INV, n.size);
+    if (!mod_check(n, "mod_inv"))
+        return bigint_zero(1);
+
     a = mod(a, n);
     bigint_t inv_a, y;
     bigint_t gcd = bigint_xgcd(a, n, &inv_a, &y);
@@ -86,27 +175,247 @@ bigint_t mod_inv(bigint_t a, bigint_t n)
     bigint_t one = bigint_new("1");
     bigint_t inv;
     if (bigint_equals(gcd, one)) {
-        bigint_delete(&one);
         inv = mod(inv_a, n);
-        bigint_delete(&inv_a);
     } else {
-        bigint_delete(&one);
-        bigint_delete(&inv_a);
         inv = bigint_new("0");
     }
+    bigint_delete(&one);
+    bigint_delete(&inv_a);
+    bigint_delete(&gcd);
     return inv;
 }
 
-// TODO test
 // Calculate the additive inverse of a mod n
 bigint_t mod_neg(bigint_t a, bigint_t n)
 {
-    a = mod(a, n);
+    INSTR_SCOPE(INSTR_MOD_NEG, n.size);
+    if (!mod_check(n, "mod_neg"))
+        return bigint_zero(1);
+
+    const mod_ctx_t *ctx = mod_cache_get(n);
+    const size_t s = ctx->size;
+    uword_t x[s], zero[s];
+    mod_to_limbs(ctx, x, a);
+    memset(zero, 0, sizeof(zero));
+    limb_sub_mod(x, zero, x, mod_ctx_n(ctx), ctx->size);
+    mod_cache_put(ctx);
+    return bigint_from_limbs(x, s);
+}
+
+// Return the Jacobi symbol (a/n) for odd positive n, or 0 with a warning otherwise
+int mod_jacobi(bigint_t a, bigint_t n)
+{
+    INSTR_SCOPE(INSTR_MOD_JACOBI, n.size);
+    if (!is_pos(n) || !(n.val[0] & 1)) {
+        fprintf(stderr, "mod_jacobi: WARNING: modulus must be odd and positive\n");
+        return 0;
+    }
+    if (!is_neg(a))
+        return limb_jacobi(a.val, a.size, n.val, n.size);
+
+    // (-1/n) = -1 for n = 3 mod 4
     bigint_t neg_a = bigint_neg(a);
-    bigint_delete(&a);
-    bigint_t neg = mod(neg_a, n);
+    int j = limb_jacobi(neg_a.val, neg_a.size, n.val, n.size);
     bigint_delete(&neg_a);
-    return neg;
+    return (n.val[0] & 3) == 3 ? -j : j;
+}
+
+// Set *root to the smaller square root of a mod prime p and return true, or
+// set it to 0 and return false if a is a non-residue
+bool mod_sqrt(bigint_t *root, bigint_t a, bigint_t p)
+{
+    INSTR_SCOPE(INSTR_MOD_SQRT, p.size);
+    *root = bigint_zero(1);
+    if (!mod_check(p, "mod_sqrt"))
+        return false;
+
+    // The only even prime: every residue is its own root
+    const mod_ctx_t *ctx = mod_cache_get(p);
+    if (!ctx->odd) {
+        bool two = p.val[0] == 2 && limb_normalize(p.val, p.size) == 1;
+        mod_cache_put(ctx);
+        if (!two) {
+            fprintf(stderr, "mod_sqrt: WARNING: modulus must be prime\n");
+            return false;
+        }
+        bigint_delete(root);
+        *root = mod(a, p);
+        return true;
+    }
+
+    const size_t s = ctx->size;
+    uword_t x[s], y[s];
+    mont_to(&ctx->mont, x, a);
+    bool found = mont_sqrt(&ctx->mont, x, x);
+    if (found) {
+        // Out of Montgomery form, then pick the smaller of x and p - x
+        memset(y, 0, sizeof(y));
+        y[0] = 1;
+        mont_mul(&ctx->mont, x, x, y);
+        limb_sub_n(y, ctx->mont.n, x, s);
+        bigint_delete(root);
+        bool neg = !limb_is_zero(x, s) && limb_cmp(y, x, s) < 0;
+        *root = bigint_from_limbs(neg ? y : x, s);
+    }
+    mod_cache_put(ctx);
+    return found;
+}
+
+// Return an unreduced residue of n words for the context ctx
+static residue_t residue_alloc(const mod_ctx_t *ctx)
+{
+    return (residue_t){
+        .ctx = mod_cache_ref(ctx),
+        .val = malloc(ctx->size * sizeof(uword_t)),
+    };
+}
+
+// Return whether a has a modulus, i.e. did not come from a failed
+// residue_new, warning on behalf of fn otherwise
+static bool residue_valid(residue_t a, const char *fn)
+{
+    if (a.ctx)
+        return true;
+    fprintf(stderr, "%s: WARNING: empty residue\n", fn);
+    return false;
+}
+
+// Return whether a and b have the same modulus, warning on behalf of fn otherwise
+static bool residue_check(residue_t a, residue_t b, const char *fn)
+{
+    if (a.ctx == b.ctx || (a.ctx->size == b.ctx->size
+            && !limb_cmp(mod_ctx_n(a.ctx), mod_ctx_n(b.ctx), a.ctx->size)))
+        return true;
+    fprintf(stderr, "%s: WARNING: residues of different moduli\n", fn);
+    return false;
+}
+
+// Return residue of a mod n, or an empty residue (NULL ctx) if n is not
+// positive; operations on an empty residue warn and return another
+residue_t residue_new(bigint_t a, bigint_t n)
+{
+    if (!mod_check(n, "residue_new"))
+        return (residue_t){ 0 };
+
+    const mod_ctx_t *ctx = mod_cache_get(n);
+    residue_t r = { .ctx = ctx, .val = malloc(ctx->size * sizeof(uword_t)) };
+    mod_to_limbs(ctx, r.val, a);
+    return r;
+}
+
+// Free residue
+void residue_delete(residue_t *r)
+{
+    mod_cache_put(r->ctx);
+    free(r->val);
+    r->ctx = NULL;
+    r->val = NULL;
+}
+
+// Return a + b for residues of the same modulus
+residue_t residue_sum(residue_t a, residue_t b)
+{
+    if (!residue_valid(a, "residue_sum") || !residue_valid(b, "residue_sum"))
+        return (residue_t){ 0 };
+    residue_t r = residue_alloc(a.ctx);
+    if (residue_check(a, b, "residue_sum"))
+        limb_add_mod(r.val, a.val, b.val, mod_ctx_n(a.ctx), a.ctx->size);
+    else
+        memset(r.val, 0, a.ctx->size * sizeof(uword_t));
+    return r;
+}
+
+// Return a - b for residues of the same modulus
+residue_t residue_diff(residue_t a, residue_t b)
+{
+    if (!residue_valid(a, "residue_diff") || !residue_valid(b, "residue_diff"))
+        return (residue_t){ 0 };
+    residue_t r = residue_alloc(a.ctx);
+    if (residue_check(a, b, "residue_diff"))
+        limb_sub_mod(r.val, a.val, b.val, mod_ctx_n(a.ctx), a.ctx->size);
+    else
+        memset(r.val, 0, a.ctx->size * sizeof(uword_t));
+    return r;
+}
+
+// Return a * b for residues of the same modulus
+residue_t residue_prod(residue_t a, residue_t b)
+{
+    if (!residue_valid(a, "residue_prod") || !residue_valid(b, "residue_prod"))
+        return (residue_t){ 0 };
+    residue_t r = residue_alloc(a.ctx);
+    if (residue_check(a, b, "residue_prod"))
+        mod_mul_limbs(a.ctx, r.val, a.val, b.val);
+    else
+        memset(r.val, 0, a.ctx->size * sizeof(uword_t));
+    return r;
+}
+
+// Return -a
+residue_t residue_neg(residue_t a)
+{
+    if (!residue_valid(a, "residue_neg"))
+        return (residue_t){ 0 };
+    residue_t r = residue_alloc(a.ctx);
+    memset(r.val, 0, a.ctx->size * sizeof(uword_t));
+    limb_sub_mod(r.val, r.val, a.val, mod_ctx_n(a.ctx), a.ctx->size);
+    return r;
+}
+
+// Return the value of a residue, in [0, n)
+bigint_t residue_to_bigint(residue_t a)
+{
+    if (!residue_valid(a, "residue_to_bigint"))
+        return bigint_zero(1);
+    return bigint_from_limbs(a.val, a.ctx->size);
+}
+
+// Return a mod n in [0, n) by plain division, for testing. Negative a is
+// first made positive by adding a multiple of n.
+static bigint_t mod_test_ref(bigint_t a, bigint_t n)
+{
+    bigint_t rem;
+    bigint_t t = bigint_copy(a);
+    if (is_neg(a)) {
+        bigint_t abs_a = bigint_neg(a);
+        bigint_t q = bigint_div(abs_a, n, &rem);
+        bigint_t shift = bigint_prod(q, n);
+        bigint_t tmp = bigint_sum(t, shift);
+        bigint_delete(&t);
+        t = bigint_sum(tmp, n);
+        bigint_delete(&tmp); bigint_delete(&shift); bigint_delete(&q);
+        bigint_delete(&rem); bigint_delete(&abs_a);
+    }
+    bigint_t q = bigint_div(t, n, &rem);
+    bigint_delete(&q);
+    bigint_delete(&t);
+    return rem;
+}
+
+// Run mod_prod and mod_sum on fresh moduli from several threads, so entries
+// are evicted while other threads are between get and put
+static void *mod_test_thread(void *arg)
+{
+    (void)arg;
+    size_t errors = 0;
+    for (int iter = 0; iter < 300; iter++) {
+        bigint_t n = bigint_random_bits(64 + iter % 5 * 64);
+        n.val[0] |= iter & 1;
+        bigint_t a = bigint_random_bits(300), b = bigint_random_bits(200);
+        bigint_t got = mod_prod(a, b, n);
+        bigint_t ab = bigint_prod(a, b);
+        bigint_t expect = mod_test_ref(ab, n);
+        errors += !bigint_equals(got, expect);
+        bigint_delete(&got); bigint_delete(&expect); bigint_delete(&ab);
+
+        got = mod_sum(a, b, n);
+        ab = bigint_sum(a, b);
+        expect = mod_test_ref(ab, n);
+        errors += !bigint_equals(got, expect);
+        bigint_delete(&got); bigint_delete(&expect); bigint_delete(&ab);
+        bigint_delete(&a); bigint_delete(&b); bigint_delete(&n);
+    }
+    return (void *)errors;
 }
 
 // Testing
@@ -138,5 +447,262 @@ int mod_test(void)
 
     total_errors += !test;
 
+    // Cached contexts against plain division, odd and even moduli
+    int errors = 0;
+    for (int iter = 0; iter < 20; iter++) {
+        n = bigint_random_bits(64 + 97 * iter);
+        n.val[0] = (n.val[0] & ~(uword_t)1) | (iter & 1);
+        bigint_t x = bigint_random_bits(70 + 150 * iter);
+        bigint_t y = bigint_random_bits(64 + 97 * iter);
+        bigint_t e = long_to_bigint(3);
+
+        bigint_t xy = bigint_prod(x, y);
+        bigint_t xxx = bigint_prod(tmp1 = bigint_prod(x, x), x);
+        bigint_delete(&tmp1);
+        bigint_t q, r_xy, r_xxx;
+        q = bigint_div(xy, n, &r_xy);
+        bigint_delete(&q);
+        q = bigint_div(xxx, n, &r_xxx);
+        bigint_delete(&q);
+
+        tmp1 = mod_prod(x, y, n);
+        tmp2 = mod_exp(x, e, n);
+        errors += !bigint_equals(tmp1, r_xy) + !bigint_equals(tmp2, r_xxx);
+
+        bigint_delete(&tmp1); bigint_delete(&tmp2);
+        bigint_delete(&xy); bigint_delete(&xxx);
+        bigint_delete(&r_xy); bigint_delete(&r_xxx);
+        bigint_delete(&x); bigint_delete(&y); bigint_delete(&e);
+        bigint_delete(&n);
+    }
+    test = errors == 0;
+    printf("%s: mod_prod and mod_exp match bigint_div for odd and even moduli\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Signed inputs, and residues against the bigint functions
+    errors = 0;
+    for (int iter = 0; iter < 40; iter++) {
+        n = bigint_random_bits(3 + 41 * iter);
+        n.val[0] = (n.val[0] & ~(uword_t)1) | (iter & 1);
+        if (is_zero(n))
+            n.val[0] = 2 + (iter & 1);
+        bigint_t x = bigint_random_bits(1 + 53 * iter);
+        bigint_t y = bigint_random_bits(3 + 41 * iter);
+        if (iter & 2) {
+            tmp1 = bigint_neg(x);
+            bigint_delete(&x);
+            x = tmp1;
+        }
+        if (iter & 4) {
+            tmp1 = bigint_neg(y);
+            bigint_delete(&y);
+            y = tmp1;
+        }
+
+        bigint_t sum = bigint_sum(x, y), diff = bigint_diff(x, y), neg = bigint_neg(x);
+        bigint_t expect[] = {
+            mod_test_ref(x, n), mod_test_ref(sum, n),
+            mod_test_ref(diff, n), mod_test_ref(neg, n),
+        };
+        bigint_t got[] = { mod(x, n), mod_sum(x, y, n), mod_diff(x, y, n), mod_neg(x, n) };
+        residue_t rx = residue_new(x, n), ry = residue_new(y, n);
+        residue_t rs[] = { residue_sum(rx, ry), residue_diff(rx, ry), residue_neg(rx) };
+        for (size_t i = 0; i < 4; i++) {
+            errors += !bigint_equals(got[i], expect[i]);
+            tmp1 = i ? residue_to_bigint(rs[i - 1]) : residue_to_bigint(rx);
+            errors += !bigint_equals(tmp1, expect[i]);
+            bigint_delete(&tmp1);
+        }
+
+        // x * x^-1 == 1 whenever the inverse exists
+        bigint_t inv = mod_inv(x, n);
+        tmp1 = mod_prod(x, inv, n);
+        tmp2 = bigint_gcd(x, n);
+        errors += !is_zero(inv) && !(tmp1.size == 1 && tmp1.val[0] == 1);
+        errors += is_zero(inv) && tmp2.size == 1 && tmp2.val[0] == 1 && !bigint_equals(n, tmp2);
+        bigint_delete(&tmp1); bigint_delete(&tmp2); bigint_delete(&inv);
+
+        for (size_t i = 0; i < 4; i++) {
+            bigint_delete(&expect[i]);
+            bigint_delete(&got[i]);
+        }
+        for (size_t i = 0; i < 3; i++)
+            residue_delete(&rs[i]);
+        residue_delete(&rx); residue_delete(&ry);
+        bigint_delete(&sum); bigint_delete(&diff); bigint_delete(&neg);
+        bigint_delete(&x); bigint_delete(&y); bigint_delete(&n);
+    }
+    test = errors == 0;
+    printf("%s: mod_sum, mod_diff, mod_neg, mod_inv and residues agree for signed inputs\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Operations on the empty residue of a bad modulus give empty residues
+    bigint_t zero = bigint_zero(1), seven = long_to_bigint(7);
+    residue_t bad = residue_new(seven, zero), good = residue_new(seven, seven);
+    residue_t empty[] = {
+        residue_sum(bad, good), residue_diff(good, bad), residue_prod(bad, bad), residue_neg(bad),
+    };
+    tmp1 = residue_to_bigint(bad);
+    test = is_zero(tmp1);
+    for (size_t i = 0; i < 4; i++) {
+        test &= empty[i].ctx == NULL && empty[i].val == NULL;
+        residue_delete(&empty[i]);
+    }
+    printf("%s: residue operations on an empty residue return empty residues\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+    bigint_delete(&tmp1);
+    residue_delete(&bad); residue_delete(&good);
+    bigint_delete(&zero); bigint_delete(&seven);
+
+    // Negative exponents raise the inverse, or warn and give 0 without one
+    static const long neg_exp[][4] = {
+        // a, exp, n, a^exp mod n
+        { 3, -1, 7, 5 }, { 3, -2, 7, 4 }, { -2, -3, 9, 1 }, { 5, -1, 1, 0 },
+        { 14, -1, 7, 0 }, { 0, -2, 13, 0 }, { 6, -1, 4, 0 },
+    };
+    test = true;
+    for (size_t i = 0; i < sizeof(neg_exp) / sizeof(neg_exp[0]); i++) {
+        bigint_t a = long_to_bigint(neg_exp[i][0]), e = long_to_bigint(neg_exp[i][1]);
+        bigint_t n = long_to_bigint(neg_exp[i][2]);
+        tmp1 = mod_exp(a, e, n);
+        test &= bigint_to_long(tmp1) == neg_exp[i][3];
+        bigint_delete(&tmp1);
+        bigint_delete(&a); bigint_delete(&e); bigint_delete(&n);
+    }
+    printf("%s: mod_exp with a negative exponent raises the inverse of the base\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Jacobi symbols against Euler's criterion for small primes, and against
+    // the product of the two Legendre symbols for n = p q
+    static const long small_primes[] = { 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 97 };
+    const size_t num_small = sizeof(small_primes) / sizeof(small_primes[0]);
+    int legendre[num_small][101];
+    errors = 0;
+    for (size_t i = 0; i < num_small; i++) {
+        n = long_to_bigint(small_primes[i]);
+        bigint_t e = long_to_bigint((small_primes[i] - 1) / 2);
+        for (long v = -50; v <= 50; v++) {
+            a = long_to_bigint(v);
+            tmp1 = mod_exp(a, e, n);
+            int euler = is_zero(tmp1) ? 0 : tmp1.val[0] == 1 ? 1 : -1;
+            legendre[i][v + 50] = mod_jacobi(a, n);
+            errors += legendre[i][v + 50] != euler;
+            bigint_delete(&tmp1);
+            bigint_delete(&a);
+        }
+        bigint_delete(&e);
+        bigint_delete(&n);
+    }
+    for (size_t i = 0; i < num_small; i++)
+        for (size_t j = i; j < num_small; j++) {
+            n = long_to_bigint(small_primes[i] * small_primes[j]);
+            for (long v = -50; v <= 50; v++) {
+                a = long_to_bigint(v);
+                errors += mod_jacobi(a, n) != legendre[i][v + 50] * legendre[j][v + 50];
+                bigint_delete(&a);
+            }
+            bigint_delete(&n);
+        }
+    test = errors == 0;
+    printf("%s: mod_jacobi matches Euler's criterion and Legendre products\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Square roots modulo primes of each class: P-256's p = 3 mod 4,
+    // 2^255 - 19 = 5 mod 8, P-224's p = 1 mod 2^96, and 2 and 17
+    static const uword_t p256[] = {
+        0xffffffffffffffff, 0x00000000ffffffff, 0, 0xffffffff00000001 };
+    static const uword_t p25519[] = {
+        0xffffffffffffffed, 0xffffffffffffffff, 0xffffffffffffffff, 0x7fffffffffffffff };
+    static const uword_t p224[] = { 1, 0xffffffff00000000, 0xffffffffffffffff, 0xffffffff };
+    bigint_t primes[] = {
+        bigint_from_limbs(p256, 4), bigint_from_limbs(p25519, 4),
+        bigint_from_limbs(p224, 4), long_to_bigint(2), long_to_bigint(17),
+    };
+    errors = 0;
+    for (size_t i = 0; i < sizeof(primes) / sizeof(primes[0]); i++) {
+        bigint_t p = primes[i];
+        bigint_t half = bigint_div(p, tmp1 = long_to_bigint(2), &tmp2);
+        bigint_delete(&tmp1); bigint_delete(&tmp2);
+        for (int iter = 0; iter < 20; iter++) {
+            // Roots of squares, and the smaller of the two
+            bigint_t x = bigint_random_bits(bigint_bits(p) + 8);
+            bigint_t sq = mod_prod(x, x, p);
+            bigint_t root;
+            bool found = mod_sqrt(&root, sq, p);
+            tmp1 = mod_prod(root, root, p);
+            tmp2 = bigint_diff(half, root);
+            errors += !found || !bigint_equals(tmp1, sq) || is_neg(tmp2);
+            bigint_delete(&tmp1); bigint_delete(&tmp2); bigint_delete(&root);
+
+            // x is a non-residue exactly when mod_sqrt finds no root
+            found = mod_sqrt(&root, x, p);
+            bool residue = p.val[0] == 2 || mod_jacobi(x, p) != -1;
+            errors += found != residue || (!found && !is_zero(root));
+            bigint_delete(&root);
+            bigint_delete(&sq);
+            bigint_delete(&x);
+        }
+        bigint_delete(&half);
+        bigint_delete(&primes[i]);
+    }
+    test = errors == 0;
+    printf("%s: mod_sqrt roots square back for p = 3 mod 4, 5 mod 8 and 1 mod 2^96\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Generated Montgomery constants of standard moduli match division, and
+    // the smallest group primes pass a base 2 Fermat test
+    errors = 0;
+    for (size_t i = 0; i < TABLES_MONT; i++) {
+        const tables_mont_t *t = &tables_mont[i];
+        const size_t s = t->size;
+        uword_t pow[2 * s + 1], r[s];
+        memset(pow, 0, sizeof(pow));
+        pow[2 * s] = 1;
+        limb_divrem(NULL, r, pow, 2 * s + 1, t->n, s);
+        errors += memcmp(r, t->r2, sizeof(r)) != 0;
+        pow[2 * s] = 0;
+        pow[s] = 1;
+        limb_divrem(NULL, r, pow, s + 1, t->n, s);
+        errors += memcmp(r, t->one, sizeof(r)) != 0;
+        errors += t->n0inv != mont_n0inv(t->n[0]);
+
+        if (s <= 24 || !strcmp(t->name, "ffdhe2048")) {
+            n = bigint_from_limbs(t->n, s);
+            bigint_t one = long_to_bigint(1), two = long_to_bigint(2);
+            bigint_t e = bigint_diff(n, one);
+            tmp1 = mod_exp(two, e, n);
+            errors += !bigint_equals(tmp1, one);
+            bigint_delete(&tmp1); bigint_delete(&e); bigint_delete(&two);
+            bigint_delete(&one); bigint_delete(&n);
+        }
+    }
+    test = errors == 0;
+    printf("%s: generated Montgomery constants of %d standard moduli match division\n",
+        test ? "TRUE" : "FALSE", TABLES_MONT);
+    total_errors += !test;
+
+    // Results stay correct while a one-entry cache evicts under other threads
+    mod_cache_resize(1);
+    pthread_t threads[4];
+    errors = 0;
+    for (int i = 0; i < 4; i++)
+        pthread_create(&threads[i], NULL, mod_test_thread, NULL);
+    for (int i = 0; i < 4; i++) {
+        void *ret;
+        pthread_join(threads[i], &ret);
+        errors += (size_t)ret;
+    }
+    mod_cache_resize(MOD_CACHE_DEFAULT_SIZE);
+    test = errors == 0;
+    printf("%s: mod_prod and mod_sum are correct under concurrent eviction\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
     return total_errors;
 }
@@ -0,0 +1,76 @@
+/**
+ * mod_math.h: Modular arithmetic
+ *
+ * Every function takes a positive modulus n and returns a value in [0, n),
+ * whatever the signs of its other arguments. Reduction contexts come from
+ * mod_cache, so repeated calls with one modulus skip their precomputation.
+ * residue_t keeps a value reduced between operations, so sums, differences
+ * and negations need one conditional correction instead of a division.
+ */
+
+#ifndef MOD_MATH_H
+#define MOD_MATH_H
+
+#include "bigint.h"
+#include "mod_cache.h"
+
+typedef struct {
+    const mod_ctx_t *ctx;   // Context of the modulus, holding a cache reference
+    uword_t *val;           // Value in [0, n), ctx->size words
+} residue_t;
+
+// Calculate a mod n
+bigint_t mod(bigint_t a, bigint_t n);
+
+// Calculate a + b mod n
+bigint_t mod_sum(bigint_t a, bigint_t b, bigint_t n);
+
+// Calculate a - b mod n
+bigint_t mod_diff(bigint_t a, bigint_t b, bigint_t n);
+
+// Calculate a * b mod n
+bigint_t mod_prod(bigint_t a, bigint_t b, bigint_t n);
+
+// Calculate a^exp mod n. A negative exp raises the inverse of a, and gives 0
+// with a warning if a has none.
+bigint_t mod_exp(bigint_t a, bigint_t exp, bigint_t n);
+
+// Calculate multiplicative inverse of a mod n, return 0 if it doesn't exist
+bigint_t mod_inv(bigint_t a, bigint_t n);
+
+// Calculate the additive inverse of a mod n
+bigint_t mod_neg(bigint_t a, bigint_t n);
+
+// Return the Jacobi symbol (a/n) for odd positive n, or 0 with a warning otherwise
+int mod_jacobi(bigint_t a, bigint_t n);
+
+// Set *root to the smaller square root of a mod prime p and return true, or
+// set it to 0 and return false if a is a non-residue
+bool mod_sqrt(bigint_t *root, bigint_t a, bigint_t p);
+
+// Return residue of a mod n, or an empty residue (NULL ctx) if n is not
+// positive; operations on an empty residue warn and return another
+residue_t residue_new(bigint_t a, bigint_t n);
+
+// Free residue
+void residue_delete(residue_t *r);
+
+// Return a + b for residues of the same modulus
+residue_t residue_sum(residue_t a, residue_t b);
+
+// Return a - b for residues of the same modulus
+residue_t residue_diff(residue_t a, residue_t b);
+
+// Return a * b for residues of the same modulus
+residue_t residue_prod(residue_t a, residue_t b);
+
+// Return -a
+residue_t residue_neg(residue_t a);
+
+// Return the value of a residue, in [0, n)
+bigint_t residue_to_bigint(residue_t a);
+
+// Testing methods
+int mod_test(void);
+
+#endif // MOD_MATH_H
@@ -0,0 +1,348 @@
+/**
+ * mont.c: Montgomery modular arithmetic
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "limb.h"
+#include "math.h"
+#include "mont.h"
+#include "tables.h"
+
+// Return -n^-1 mod 2^WORD_BITS for odd n
+uword_t mont_n0inv(uword_t n)
+{
+    // Newton iteration doubles the number of correct bits each step
+    uword_t inv = n;
+    for (int i = 0; i < 5; i++)
+        inv *= 2 - n * inv;
+    return -inv;
+}
+
+// Return the generated constants for modulus n of size words, or NULL
+static const tables_mont_t *mont_table(const uword_t *n, size_t size)
+{
+    for (size_t i = 0; i < TABLES_MONT; i++) {
+        const tables_mont_t *t = &tables_mont[i];
+        if (t->size == size && t->n[0] == n[0] && !memcmp(t->n, n, size * sizeof(uword_t)))
+            return t;
+    }
+    return NULL;
+}
+
+// Return Montgomery context for odd positive modulus n
+mont_ctx_t mont_new(bigint_t n)
+{
+    // A shared n is referenced rather than copied
+    size_t size = limb_normalize(n.val, n.size);
+    bigint_t modulus = bigint_share(bigint_copy(n));
+    mont_ctx_t ctx = {
+        .size = size,
+        .n0inv = mont_n0inv(n.val[0]),
+        .modulus = modulus,
+        .n = modulus.val,
+        .r2 = malloc(size * sizeof(uword_t)),
+        .one = malloc(size * sizeof(uword_t)),
+    };
+
+    // Standard moduli come with their constants from the build
+    const tables_mont_t *t = mont_table(ctx.n, size);
+    if (t) {
+        memcpy(ctx.one, t->one, size * sizeof(uword_t));
+        memcpy(ctx.r2, t->r2, size * sizeof(uword_t));
+        return ctx;
+    }
+
+    // R mod n and R^2 mod n via a single division each
+    uword_t *pow = calloc(2 * size + 1, sizeof(uword_t));
+    pow[size] = 1;
+    limb_divrem(NULL, ctx.one, pow, size + 1, ctx.n, size);
+    pow[size] = 0;
+    pow[2 * size] = 1;
+    limb_divrem(NULL, ctx.r2, pow, 2 * size + 1, ctx.n, size);
+    free(pow);
+
+    return ctx;
+}
+
+// Free Montgomery context
+void mont_delete(mont_ctx_t *ctx)
+{
+    bigint_delete(&ctx->modulus);
+    ctx->n = NULL;
+    free(ctx->r2);
+    free(ctx->one);
+    ctx->size = 0;
+}
+
+// out = a * b / R mod n (out may alias a or b)
+// This is the coarsely integrated operand scanning (CIOS) method
+void mont_mul(const mont_ctx_t *ctx, uword_t *out, const uword_t *a, const uword_t *b)
+{
+    const size_t s = ctx->size;
+    uword_t t[s + 2];
+    memset(t, 0, sizeof(t));
+
+    for (size_t i = 0; i < s; i++) {
+        udword_t x = (udword_t)t[s] + limb_addmul_1(t, a, s, b[i]);
+        t[s] = (uword_t)x;
+        t[s+1] = (uword_t)(x >> WORD_BITS);
+
+        uword_t m = t[0] * ctx->n0inv;
+        x = (udword_t)t[s] + limb_addmul_1(t, ctx->n, s, m);
+        t[s] = (uword_t)x;
+        t[s+1] += (uword_t)(x >> WORD_BITS);
+
+        // t[0] is now zero: divide by the word base
+        memmove(t, t + 1, (s + 1) * sizeof(uword_t));
+        t[s+1] = 0;
+    }
+
+    if (t[s] || limb_cmp(t, ctx->n, s) >= 0)
+        limb_sub_n(t, t, ctx->n, s);
+    memcpy(out, t, s * sizeof(uword_t));
+}
+
+// out = a + b mod n
+void mont_add(const mont_ctx_t *ctx, uword_t *out, const uword_t *a, const uword_t *b)
+{
+    uword_t carry = limb_add_n(out, a, b, ctx->size);
+    if (carry || limb_cmp(out, ctx->n, ctx->size) >= 0)
+        limb_sub_n(out, out, ctx->n, ctx->size);
+}
+
+// out = a - b mod n
+void mont_sub(const mont_ctx_t *ctx, uword_t *out, const uword_t *a, const uword_t *b)
+{
+    if (limb_sub_n(out, a, b, ctx->size))
+        limb_add_n(out, out, ctx->n, ctx->size);
+}
+
+// out = a / 2 mod n
+void mont_half(const mont_ctx_t *ctx, uword_t *out, const uword_t *a)
+{
+    uword_t carry = 0;
+    if (a[0] & 1)
+        carry = limb_add_n(out, a, ctx->n, ctx->size);
+    else
+        memmove(out, a, ctx->size * sizeof(uword_t));
+    limb_shr(out, out, ctx->size, 1);
+    out[ctx->size - 1] |= carry << (WORD_BITS - 1);
+}
+
+// out = a mod n (an words), by REDC and a product with R^2 when a < n R
+void mont_reduce(const mont_ctx_t *ctx, uword_t *out, const uword_t *a, size_t an)
+{
+    const size_t s = ctx->size;
+    an = limb_normalize(a, an);
+    if (an > 2 * s || (an == 2 * s && limb_cmp(a + s, ctx->n, s) >= 0)) {
+        limb_divrem(NULL, out, a, an, ctx->n, s);
+        return;
+    }
+
+    // t = a / R mod n, below 2n
+    uword_t t[2 * s + 1];
+    memset(t, 0, sizeof(t));
+    memcpy(t, a, an * sizeof(uword_t));
+    for (size_t i = 0; i < s; i++) {
+        uword_t carry = limb_addmul_1(t + i, ctx->n, s, t[i] * ctx->n0inv);
+        limb_add_1(t + i + s, t + i + s, s + 1 - i, carry);
+    }
+    if (t[2 * s] || limb_cmp(t + s, ctx->n, s) >= 0)
+        limb_sub_n(t + s, t + s, ctx->n, s);
+
+    mont_mul(ctx, out, t + s, ctx->r2);
+}
+
+// Convert a (any sign or size) into Montgomery form
+void mont_to(const mont_ctx_t *ctx, uword_t *out, bigint_t a)
+{
+    const size_t s = ctx->size;
+    bool neg = is_neg(a);
+    bigint_t mag = neg ? bigint_neg(a) : a;
+    size_t an = limb_normalize(mag.val, mag.size);
+
+    // Reduce the magnitude mod n
+    uword_t red[s];
+    if (an > s || (an == s && limb_cmp(mag.val, ctx->n, s) >= 0)) {
+        limb_divrem(NULL, red, mag.val, an, ctx->n, s);
+    } else {
+        memset(red, 0, sizeof(red));
+        memcpy(red, mag.val, an * sizeof(uword_t));
+    }
+    if (neg && !limb_is_zero(red, s))
+        limb_sub_n(red, ctx->n, red, s);
+    if (neg)
+        bigint_delete(&mag);
+
+    mont_mul(ctx, out, red, ctx->r2);
+}
+
+// Convert a out of Montgomery form
+bigint_t mont_from(const mont_ctx_t *ctx, const uword_t *a)
+{
+    uword_t unit[ctx->size];
+    uword_t out[ctx->size];
+    memset(unit, 0, sizeof(unit));
+    unit[0] = 1;
+    mont_mul(ctx, out, a, unit);
+    return bigint_from_limbs(out, ctx->size);
+}
+
+// Return fixed window size for an exponent of the given length
+static unsigned mont_window(size_t bits)
+{
+    if (bits > 768) return 6;
+    if (bits > 256) return 5;
+    if (bits > 64) return 4;
+    if (bits > 16) return 3;
+    return 1;
+}
+
+// out = base^exp, base and out in Montgomery form, exp given as exp_size words
+void mont_pow(const mont_ctx_t *ctx, uword_t *out, const uword_t *base,
+        const uword_t *exp, size_t exp_size)
+{
+    const size_t s = ctx->size;
+    size_t bits = limb_bits(exp, exp_size);
+    if (bits == 0) {
+        memcpy(out, ctx->one, s * sizeof(uword_t));
+        return;
+    }
+
+    // Table of base^0 .. base^(2^w - 1)
+    unsigned w = mont_window(bits);
+    size_t entries = (size_t)1 << w;
+    uword_t *table = malloc(entries * s * sizeof(uword_t));
+    memcpy(table, ctx->one, s * sizeof(uword_t));
+    memcpy(table + s, base, s * sizeof(uword_t));
+    for (size_t i = 2; i < entries; i++)
+        mont_mul(ctx, table + i * s, table + (i - 1) * s, base);
+
+    // Left-to-right fixed window, starting from the top partial window
+    uword_t acc[s];
+    size_t pos = (bits + w - 1) / w * w;
+    bool first = true;
+    while (pos > 0) {
+        pos -= w;
+        uword_t win = 0;
+        for (unsigned j = 0; j < w; j++) {
+            size_t bit = pos + j;
+            if (bit < bits && (exp[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1)
+                win |= (uword_t)1 << j;
+        }
+        if (first) {
+            memcpy(acc, table + win * s, sizeof(acc));
+            first = false;
+            continue;
+        }
+        for (unsigned j = 0; j < w; j++)
+            mont_mul(ctx, acc, acc, acc);
+        if (win)
+            mont_mul(ctx, acc, acc, table + win * s);
+    }
+
+    memcpy(out, acc, sizeof(acc));
+    free(table);
+}
+
+// Return a^exp mod n for non-negative exp
+bigint_t mont_exp(const mont_ctx_t *ctx, bigint_t a, bigint_t exp)
+{
+    uword_t base[ctx->size];
+    mont_to(ctx, base, a);
+    mont_pow(ctx, base, base, exp.val, exp.size);
+    return mont_from(ctx, base);
+}
+
+// out = a square root of a mod prime n, both in Montgomery form; return false,
+// leaving out unset, if a is a non-residue or n is found not to be prime
+bool mont_sqrt(const mont_ctx_t *ctx, uword_t *out, const uword_t *a)
+{
+    const size_t s = ctx->size;
+    uword_t buf[5 * s];
+    uword_t *plain = buf, *e = buf + s, *x = buf + 2 * s, *t = buf + 3 * s, *c = buf + 4 * s;
+
+    // Residues only: (a/n) must be 1, or a must be 0
+    memset(e, 0, s * sizeof(uword_t));
+    e[0] = 1;
+    mont_mul(ctx, plain, a, e);
+    if (limb_is_zero(plain, s)) {
+        memset(out, 0, s * sizeof(uword_t));
+        return true;
+    }
+    if (limb_jacobi(plain, s, ctx->n, s) != 1)
+        return false;
+
+    if ((ctx->n[0] & 3) == 3) {
+        // x = a^((n + 1) / 4)
+        limb_shr(e, ctx->n, s, 2);
+        limb_add_1(e, e, s, 1);
+        mont_pow(ctx, x, a, e, s);
+    } else if ((ctx->n[0] & 7) == 5) {
+        // Atkin: v = (2a)^((n - 5) / 8), i = 2a v^2, x = a v (i - 1)
+        limb_shr(e, ctx->n, s, 3);
+        mont_add(ctx, t, a, a);
+        mont_pow(ctx, c, t, e, s);
+        mont_mul(ctx, x, c, c);
+        mont_mul(ctx, x, x, t);
+        mont_sub(ctx, x, x, ctx->one);
+        mont_mul(ctx, x, x, c);
+        mont_mul(ctx, x, x, a);
+    } else {
+        // Tonelli-Shanks: n - 1 = q 2^r with q odd
+        limb_sub_1(e, ctx->n, s, 1);
+        size_t r = 0;
+        while (!e[r / WORD_BITS])
+            r += WORD_BITS;
+        r += __builtin_ctzll(e[r / WORD_BITS]);
+        size_t words = r / WORD_BITS;
+        memmove(e, e + words, (s - words) * sizeof(uword_t));
+        memset(e + s - words, 0, words * sizeof(uword_t));
+        limb_shr(e, e, s, r % WORD_BITS);
+
+        // c = z^q for the first non-residue z
+        uword_t z = 2;
+        while (limb_jacobi(&z, 1, ctx->n, s) != -1)
+            if (++z > 1000)
+                return false;
+        memset(c, 0, s * sizeof(uword_t));
+        c[0] = z;
+        mont_mul(ctx, c, c, ctx->r2);
+        mont_pow(ctx, c, c, e, s);
+
+        // t = a^q, x = a^((q + 1) / 2)
+        mont_pow(ctx, t, a, e, s);
+        limb_shr(e, e, s, 1);
+        limb_add_1(e, e, s, 1);
+        mont_pow(ctx, x, a, e, s);
+
+        // While t != 1, find the least i with t^(2^i) = 1, and fold
+        // b = c^(2^(r - i - 1)) into x, c = b^2 and t = t b^2
+        uword_t *sq = plain;
+        while (limb_cmp(t, ctx->one, s)) {
+            size_t i = 0;
+            memcpy(sq, t, s * sizeof(uword_t));
+            while (i < r && limb_cmp(sq, ctx->one, s)) {
+                mont_mul(ctx, sq, sq, sq);
+                i++;
+            }
+            if (i == r)
+                return false;
+            for (size_t j = i + 1; j < r; j++)
+                mont_mul(ctx, c, c, c);
+            mont_mul(ctx, x, x, c);
+            mont_mul(ctx, c, c, c);
+            mont_mul(ctx, t, t, c);
+            r = i;
+        }
+    }
+
+    // Composite n can pass the symbol and still have no root here
+    mont_mul(ctx, t, x, x);
+    if (limb_cmp(t, a, s))
+        return false;
+    memcpy(out, x, s * sizeof(uword_t));
+    return true;
+}
@@ -0,0 +1,63 @@
+/**
+ * mont.h: Montgomery modular arithmetic
+ *
+ * Residues are stored in Montgomery form, i.e. a * R mod n with
+ * R = 2^(WORD_BITS * size), as arrays of exactly `size` words.
+ */
+
+#ifndef MONT_H
+#define MONT_H
+
+#include "bigint.h"
+
+typedef struct {
+    size_t size;        // Number of words in the modulus
+    uword_t n0inv;      // -n^-1 mod 2^WORD_BITS
+    bigint_t modulus;   // Shared copy of the modulus, which n points into
+    uword_t *n;         // Modulus (odd)
+    uword_t *r2;        // R^2 mod n
+    uword_t *one;       // R mod n, i.e. 1 in Montgomery form
+} mont_ctx_t;
+
+// Return -n^-1 mod 2^WORD_BITS for odd n
+uword_t mont_n0inv(uword_t n);
+
+// Return Montgomery context for odd positive modulus n
+mont_ctx_t mont_new(bigint_t n);
+
+// Free Montgomery context
+void mont_delete(mont_ctx_t *ctx);
+
+// out = a * b / R mod n (out may alias a or b)
+void mont_mul(const mont_ctx_t *ctx, uword_t *out, const uword_t *a, const uword_t *b);
+
+// out = a + b mod n
+void mont_add(const mont_ctx_t *ctx, uword_t *out, const uword_t *a, const uword_t *b);
+
+// out = a - b mod n
+void mont_sub(const mont_ctx_t *ctx, uword_t *out, const uword_t *a, const uword_t *b);
+
+// out = a / 2 mod n
+void mont_half(const mont_ctx_t *ctx, uword_t *out, const uword_t *a);
+
+// out = a mod n (an words), by REDC and a product with R^2 when a < n R
+void mont_reduce(const mont_ctx_t *ctx, uword_t *out, const uword_t *a, size_t an);
+
+// Convert a (any sign or size) into Montgomery form
+void mont_to(const mont_ctx_t *ctx, uword_t *out, bigint_t a);
+
+// Convert a out of Montgomery form
+bigint_t mont_from(const mont_ctx_t *ctx, const uword_t *a);
+
+// out = base^exp, base and out in Montgomery form, exp given as exp_size words
+void mont_pow(const mont_ctx_t *ctx, uword_t *out, const uword_t *base,
+        const uword_t *exp, size_t exp_size);
+
+// Return a^exp mod n for non-negative exp
+bigint_t mont_exp(const mont_ctx_t *ctx, bigint_t a, bigint_t exp);
+
+// out = a square root of a mod prime n, both in Montgomery form; return false,
+// leaving out unset, if a is a non-residue or n is found not to be prime
+bool mont_sqrt(const mont_ctx_t *ctx, uword_t *out, const uword_t *a);
+
+#endif // MONT_H
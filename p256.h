@@ -0,0 +1,28 @@
+/**
+ * p256.h: NIST P-256 curve arithmetic and ECDSA verification
+ *
+ * Field elements are fixed256_t values below p, reduced with the Solinas
+ * identities for p = 2^256 - 2^224 + 2^192 + 2^96 - 1. Points are kept in
+ * Jacobian coordinates, so the only field inversion is the conversion of the
+ * final point back to affine. None of this is constant time: it is meant for
+ * verification, where every input is public.
+ */
+
+#ifndef P256_H
+#define P256_H
+
+#include <stdbool.h>
+
+#include "bigint.h"
+
+// Set (x, y) = k * G for 0 < k < n, return false for other k
+bool p256_mul_base(bigint_t *x, bigint_t *y, bigint_t k);
+
+// Return whether (r, s) is an ECDSA signature of e under public key (qx, qy).
+// e is the hash as an integer, already truncated to 256 bits by the caller.
+bool p256_verify(bigint_t e, bigint_t r, bigint_t s, bigint_t qx, bigint_t qy);
+
+// Testing methods
+int p256_test(void);
+
+#endif // P256_H
@@ -0,0 +1,373 @@
+/**
+ * pool.c: Work-stealing thread pool
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "int_math.h"
+#include "pool.h"
+
+enum {
+    POOL_DEQUE_CAPACITY = 64,
+    POOL_ARENA_BLOCK = 64 * 1024,
+    POOL_ARENA_ALIGN = 64,
+};
+
+typedef struct {
+    void (*fn)(void *);
+    void *arg;
+    pool_group_t *group;
+} pool_task_t;
+
+// Ring buffer of tasks: thieves take from head, the owner from tail
+typedef struct {
+    pthread_mutex_t lock;
+    pool_task_t *tasks;
+    size_t capacity;
+    size_t head;
+    size_t size;
+} pool_deque_t;
+
+struct pool {
+    size_t threads;             // Worker slots, each with a deque
+    size_t started;             // Workers running in slots 0 .. started - 1
+    pthread_t *workers;
+    pool_deque_t *deques;       // One per worker, then the injection queue
+    atomic_size_t queued;       // Tasks sitting in any deque
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake;
+    bool stop;
+};
+
+// Scratch arena: a stack of blocks, released in task order
+typedef struct arena_block {
+    struct arena_block *prev;
+    size_t size;
+    size_t used;
+    _Alignas(POOL_ARENA_ALIGN) unsigned char data[];
+} arena_block_t;
+
+static _Thread_local pool_t *pool_self;     // Pool the calling worker belongs to
+static _Thread_local size_t pool_index;     // Deque of the calling worker
+static _Thread_local size_t pool_depth;     // Nesting of running tasks
+static _Thread_local arena_block_t *pool_arena;
+
+static pthread_once_t pool_default_once = PTHREAD_ONCE_INIT;
+static pool_t *pool_default_pool;
+
+static void deque_init(pool_deque_t *dq)
+{
+    pthread_mutex_init(&dq->lock, NULL);
+    dq->capacity = POOL_DEQUE_CAPACITY;
+    dq->tasks = malloc(dq->capacity * sizeof(pool_task_t));
+    dq->head = 0;
+    dq->size = 0;
+}
+
+static void deque_delete(pool_deque_t *dq)
+{
+    pthread_mutex_destroy(&dq->lock);
+    free(dq->tasks);
+}
+
+static void deque_push(pool_deque_t *dq, pool_task_t task)
+{
+    pthread_mutex_lock(&dq->lock);
+    // Double the capacity if necessary, unwrapping the ring
+    if (dq->size == dq->capacity) {
+        pool_task_t *tasks = malloc(2 * dq->capacity * sizeof(pool_task_t));
+        for (size_t i = 0; i < dq->size; i++)
+            tasks[i] = dq->tasks[(dq->head + i) % dq->capacity];
+        free(dq->tasks);
+        dq->tasks = tasks;
+        dq->capacity <<= 1;
+        dq->head = 0;
+    }
+    dq->tasks[(dq->head + dq->size) % dq->capacity] = task;
+    dq->size++;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+static bool deque_pop(pool_deque_t *dq, pool_task_t *task, bool back)
+{
+    bool out = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->size > 0) {
+        if (back) {
+            *task = dq->tasks[(dq->head + dq->size - 1) % dq->capacity];
+        } else {
+            *task = dq->tasks[dq->head];
+            dq->head = (dq->head + 1) % dq->capacity;
+        }
+        dq->size--;
+        out = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return out;
+}
+
+// Take a task: own deque first, then the injection queue, then steal
+static bool pool_take(pool_t *pool, pool_task_t *task)
+{
+    bool worker = pool_self == pool;
+    if (worker && deque_pop(&pool->deques[pool_index], task, true))
+        goto found;
+    if (deque_pop(&pool->deques[pool->threads], task, false))
+        goto found;
+    size_t start = worker ? pool_index + 1 : 0;
+    for (size_t i = 0; i < pool->threads; i++) {
+        if (deque_pop(&pool->deques[(start + i) % pool->threads], task, false))
+            goto found;
+    }
+    return false;
+
+found:
+    atomic_fetch_sub(&pool->queued, 1);
+    return true;
+}
+
+// Return arena position to restore after a task
+static void pool_arena_mark(arena_block_t **block, size_t *used)
+{
+    *block = pool_arena;
+    *used = pool_arena ? pool_arena->used : 0;
+}
+
+// Release everything allocated since the mark, keeping the bottom block
+static void pool_arena_release(arena_block_t *block, size_t used)
+{
+    while (pool_arena != block && pool_arena->prev) {
+        arena_block_t *prev = pool_arena->prev;
+        free(pool_arena);
+        pool_arena = prev;
+    }
+    if (pool_arena)
+        pool_arena->used = pool_arena == block ? used : 0;
+}
+
+// Free the whole arena of the calling thread
+static void pool_arena_free(void)
+{
+    while (pool_arena) {
+        arena_block_t *prev = pool_arena->prev;
+        free(pool_arena);
+        pool_arena = prev;
+    }
+}
+
+static void pool_run(pool_t *pool, pool_task_t task)
+{
+    arena_block_t *block;
+    size_t used;
+    pool_arena_mark(&block, &used);
+
+    pool_depth++;
+    task.fn(task.arg);
+    pool_depth--;
+
+    pool_arena_release(block, used);
+
+    if (task.group && atomic_fetch_sub(&task.group->pending, 1) == 1) {
+        // Waiters sleep on the same condition as idle workers
+        pthread_mutex_lock(&pool->sleep_lock);
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->sleep_lock);
+    }
+}
+
+typedef struct {
+    pool_t *pool;
+    size_t index;
+} pool_worker_arg_t;
+
+static void *pool_worker(void *arg)
+{
+    pool_worker_arg_t *w = arg;
+    pool_self = w->pool;
+    pool_index = w->index;
+    pool_t *pool = w->pool;
+    free(w);
+
+    for (;;) {
+        pool_task_t task;
+        if (pool_take(pool, &task)) {
+            pool_run(pool, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->sleep_lock);
+        while (atomic_load(&pool->queued) == 0 && !pool->stop)
+            pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+        bool done = pool->stop && atomic_load(&pool->queued) == 0;
+        pthread_mutex_unlock(&pool->sleep_lock);
+        if (done)
+            break;
+    }
+
+    pool_arena_free();
+    return NULL;
+}
+
+// Return new pool with the given number of workers
+pool_t *pool_new(size_t threads)
+{
+    if (threads == 0)
+        threads = smax(sysconf(_SC_NPROCESSORS_ONLN), 1);
+
+    pool_t *pool = malloc(sizeof(pool_t));
+    pool->threads = threads;
+    pool->workers = malloc(threads * sizeof(pthread_t));
+    pool->deques = malloc((threads + 1) * sizeof(pool_deque_t));
+    for (size_t i = 0; i <= threads; i++)
+        deque_init(pool->deques + i);
+    atomic_init(&pool->queued, 0);
+    pthread_mutex_init(&pool->sleep_lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pool->stop = false;
+
+    // Slots whose worker fails to start keep an empty deque, and their share
+    // of the work is stolen by the others or run by pool_wait
+    for (pool->started = 0; pool->started < threads; pool->started++) {
+        pool_worker_arg_t *w = malloc(sizeof(pool_worker_arg_t));
+        *w = (pool_worker_arg_t) { .pool = pool, .index = pool->started };
+        int err = pthread_create(pool->workers + pool->started, NULL, pool_worker, w);
+        if (err) {
+            fprintf(stderr, "pool_new: WARNING: started %zu of %zu workers: %s\n",
+                pool->started, threads, strerror(err));
+            free(w);
+            break;
+        }
+    }
+    return pool;
+}
+
+// Finish queued tasks, then stop and free the pool
+void pool_delete(pool_t *pool)
+{
+    pthread_mutex_lock(&pool->sleep_lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->sleep_lock);
+
+    for (size_t i = 0; i < pool->started; i++)
+        pthread_join(pool->workers[i], NULL);
+    for (size_t i = 0; i <= pool->threads; i++)
+        deque_delete(pool->deques + i);
+    pthread_mutex_destroy(&pool->sleep_lock);
+    pthread_cond_destroy(&pool->wake);
+    free(pool->deques);
+    free(pool->workers);
+    free(pool);
+}
+
+static void pool_default_init(void)
+{
+    pool_default_pool = pool_new(0);
+}
+
+// Return the process-wide pool, creating it on first use
+pool_t *pool_default(void)
+{
+    pthread_once(&pool_default_once, pool_default_init);
+    return pool_default_pool;
+}
+
+// Free the process-wide pool, if it was created
+void pool_default_exit(void)
+{
+    if (pool_default_pool) {
+        pool_delete(pool_default_pool);
+        pool_default_pool = NULL;
+    }
+}
+
+// Return number of workers in the pool, at least one since a pool without
+// any runs its tasks in pool_wait
+size_t pool_threads(const pool_t *pool)
+{
+    return smax(pool->started, 1);
+}
+
+// Return number of tasks waiting to be picked up
+size_t pool_queued(const pool_t *pool)
+{
+    return atomic_load(&pool->queued);
+}
+
+// Return whether the calling thread is running a pool task
+bool pool_in_task(void)
+{
+    return pool_depth > 0;
+}
+
+// Initialize an empty group
+void pool_group_init(pool_group_t *group)
+{
+    atomic_init(&group->pending, 0);
+}
+
+// Queue fn(arg) as part of group
+void pool_submit(pool_t *pool, pool_group_t *group, void (*fn)(void *), void *arg)
+{
+    if (group)
+        atomic_fetch_add(&group->pending, 1);
+
+    // Count the task before publishing it, so a thief that takes it at once
+    // cannot decrement queued below zero
+    atomic_fetch_add(&pool->queued, 1);
+
+    // Workers keep their own tasks local; everyone else injects
+    size_t idx = pool_self == pool ? pool_index : pool->threads;
+    deque_push(&pool->deques[idx], (pool_task_t) { .fn = fn, .arg = arg, .group = group });
+
+    pthread_mutex_lock(&pool->sleep_lock);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->sleep_lock);
+}
+
+// Run queued tasks until every task in group has finished
+void pool_wait(pool_t *pool, pool_group_t *group)
+{
+    while (atomic_load(&group->pending) > 0) {
+        pool_task_t task;
+        if (pool_take(pool, &task)) {
+            pool_run(pool, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->sleep_lock);
+        while (atomic_load(&group->pending) > 0 && atomic_load(&pool->queued) == 0)
+            pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+        pthread_mutex_unlock(&pool->sleep_lock);
+    }
+}
+
+// Return scratch memory from the calling thread's arena
+void *pool_scratch(size_t bytes)
+{
+    if (pool_depth == 0) {
+        fprintf(stderr, "pool_scratch: ERROR: called outside of a task\n");
+        abort();
+    }
+
+    bytes = (bytes + POOL_ARENA_ALIGN - 1) / POOL_ARENA_ALIGN * POOL_ARENA_ALIGN;
+    if (!pool_arena || pool_arena->size - pool_arena->used < bytes) {
+        size_t size = smax(POOL_ARENA_BLOCK, bytes);
+        if (pool_arena)
+            size = smax(size, 2 * pool_arena->size);
+        arena_block_t *block = aligned_alloc(POOL_ARENA_ALIGN, sizeof(arena_block_t) + size);
+        block->prev = pool_arena;
+        block->size = size;
+        block->used = 0;
+        pool_arena = block;
+    }
+
+    void *out = pool_arena->data + pool_arena->used;
+    pool_arena->used += bytes;
+    return out;
+}
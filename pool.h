@@ -0,0 +1,59 @@
+/**
+ * pool.h: Work-stealing thread pool
+ *
+ * Each worker owns a deque of tasks: it pushes and pops at the back, while
+ * idle workers steal from the front. Tasks submitted from outside the pool
+ * go through a shared injection queue. Threads waiting on a group run queued
+ * tasks instead of blocking, so tasks may submit and wait on nested work.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct pool pool_t;
+
+// Set of tasks that can be waited on together
+typedef struct {
+    atomic_size_t pending;
+} pool_group_t;
+
+// Return new pool with the given number of workers (0: one per online CPU)
+pool_t *pool_new(size_t threads);
+
+// Finish queued tasks, then stop and free the pool
+void pool_delete(pool_t *pool);
+
+// Return the process-wide pool, creating it on first use
+pool_t *pool_default(void);
+
+// Free the process-wide pool, if it was created
+void pool_default_exit(void);
+
+// Return number of workers in the pool, at least one since a pool without
+// any runs its tasks in pool_wait
+size_t pool_threads(const pool_t *pool);
+
+// Return number of tasks waiting to be picked up
+size_t pool_queued(const pool_t *pool);
+
+// Return whether the calling thread is running a pool task
+bool pool_in_task(void);
+
+// Initialize an empty group
+void pool_group_init(pool_group_t *group);
+
+// Queue fn(arg) as part of group (which may be NULL)
+void pool_submit(pool_t *pool, pool_group_t *group, void (*fn)(void *), void *arg);
+
+// Run queued tasks until every task in group has finished
+void pool_wait(pool_t *pool, pool_group_t *group);
+
+// Return scratch memory from the calling thread's arena, released when the
+// current task returns. Must be called from inside a task.
+void *pool_scratch(size_t bytes);
+
+#endif // POOL_H
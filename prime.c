@@ -0,0 +1,362 @@
+/**
+ * prime.c: Probable prime testing
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "limb.h"
+#include "math.h"
+#include "prime.h"
+
+// Largest value for which trial division by small_primes is a proof
+static const uword_t SMALL_PRIME_BOUND = (uword_t)1621 * 1621;
+
+/**
+ * Minimum Miller-Rabin rounds from FIPS 186-5, Table B.1, indexed by the
+ * candidate size. Smaller candidates, which the table does not cover, get
+ * enough rounds for an error probability of 2^-100 on adversarial input.
+ */
+static const struct {
+    size_t bits;
+    size_t mr;          // Miller-Rabin only
+    size_t mr_lucas;    // Miller-Rabin followed by a Lucas test
+} mr_rounds[] = {
+    { 2048,  4,  2 },
+    { 1536,  4,  3 },
+    { 1024,  5,  4 },
+    {  512,  7,  5 },
+    {    0, 50, 25 },
+};
+
+// Return Miller-Rabin round count for a candidate of the given size
+size_t prime_mr_rounds(size_t bits, bool lucas)
+{
+    size_t i = 0;
+    while (bits < mr_rounds[i].bits)
+        i++;
+    return lucas ? mr_rounds[i].mr_lucas : mr_rounds[i].mr;
+}
+
+// Store n mod small_primes[i] in res[i] for every small prime
+void prime_small_residues(bigint_t n, uint16_t *res)
+{
+    size_t size = limb_normalize(n.val, n.size);
+
+    // Take one multi-word remainder per group of primes whose product fits
+    // in a word, then finish each prime on that single word
+    size_t i = 0;
+    while (i < SMALL_PRIMES) {
+        size_t j = i;
+        uword_t prod = 1;
+        while (j < SMALL_PRIMES && (udword_t)prod * small_primes[j] >> WORD_BITS == 0)
+            prod *= small_primes[j++];
+
+        uword_t rem = limb_mod_1(n.val, size, prod);
+        for ( ; i < j; i++)
+            res[i] = rem % small_primes[i];
+    }
+}
+
+// Return whether n has a factor in small_primes other than n itself
+bool prime_has_small_factor(bigint_t n)
+{
+    size_t size = limb_normalize(n.val, n.size);
+    bool small = size == 1 && n.val[0] <= small_primes[SMALL_PRIMES - 1];
+
+    uint16_t res[SMALL_PRIMES];
+    prime_small_residues(n, res);
+    for (size_t i = 0; i < SMALL_PRIMES; i++) {
+        if (res[i] == 0 && !(small && n.val[0] == small_primes[i]))
+            return true;
+    }
+    return false;
+}
+
+// Return whether the context modulus passes `rounds` Miller-Rabin rounds
+bool prime_miller_rabin(const mont_ctx_t *ctx, size_t rounds)
+{
+    const size_t s = ctx->size;
+
+    // n - 1 = d * 2^k
+    uword_t d[s];
+    limb_sub_1(d, ctx->n, s, 1);
+    size_t k = 0;
+    while (!(d[k / WORD_BITS] >> (k % WORD_BITS) & 1))
+        k++;
+    for (size_t i = 0; i < k / WORD_BITS; i++) {
+        memmove(d, d + 1, (s - 1) * sizeof(uword_t));
+        d[s-1] = 0;
+    }
+    limb_shr(d, d, s, k % WORD_BITS);
+
+    // -1 in Montgomery form
+    uword_t minus1[s];
+    limb_sub_n(minus1, ctx->n, ctx->one, s);
+
+    // Bases are drawn uniformly from [2, n - 2]
+    uword_t x[s];
+    limb_sub_1(x, ctx->n, s, 3);
+    bigint_t range = bigint_from_limbs(x, s);
+    bigint_t two = long_to_bigint(2);
+
+    size_t r;
+    for (r = 0; r < rounds; r++) {
+        bigint_t rand = bigint_random_below(range);
+        bigint_t base = bigint_sum(rand, two);
+        mont_to(ctx, x, base);
+        bigint_delete(&rand);
+        bigint_delete(&base);
+
+        mont_pow(ctx, x, x, d, s);
+        if (limb_cmp(x, ctx->one, s) == 0 || limb_cmp(x, minus1, s) == 0)
+            continue;
+
+        bool witness = true;
+        for (size_t i = 1; i < k; i++) {
+            mont_mul(ctx, x, x, x);
+            if (limb_cmp(x, minus1, s) == 0) {
+                witness = false;
+                break;
+            }
+            if (limb_cmp(x, ctx->one, s) == 0)
+                break;
+        }
+        if (witness)
+            break;
+    }
+
+    bigint_delete(&range);
+    bigint_delete(&two);
+    return r == rounds;
+}
+
+// Jacobi symbol (a/n) for words, n odd
+static int word_jacobi(uword_t a, uword_t n)
+{
+    int j = 1;
+    a %= n;
+    while (a) {
+        while (!(a & 1)) {
+            a >>= 1;
+            if ((n & 7) == 3 || (n & 7) == 5)
+                j = -j;
+        }
+        uword_t t = a;
+        a = n;
+        n = t;
+        if ((a & 3) == 3 && (n & 3) == 3)
+            j = -j;
+        a %= n;
+    }
+    return n == 1 ? j : 0;
+}
+
+// Jacobi symbol (a/n) for a small a and an odd multi-word n
+static int jacobi_small(word_t a, const uword_t *n, size_t size)
+{
+    int j = 1;
+    if (a < 0) {
+        a = -a;
+        if ((n[0] & 3) == 3)
+            j = -j;
+    }
+    uword_t ua = a;
+    while (!(ua & 1)) {
+        ua >>= 1;
+        if ((n[0] & 7) == 3 || (n[0] & 7) == 5)
+            j = -j;
+    }
+    if (ua == 1)
+        return j;
+
+    // Quadratic reciprocity reduces n modulo the small value
+    if ((ua & 3) == 3 && (n[0] & 3) == 3)
+        j = -j;
+    return j * word_jacobi(limb_mod_1(n, size, ua), ua);
+}
+
+// Return whether n (size words) is a perfect square
+static bool limb_is_square(const uword_t *n, size_t size)
+{
+    // Newton iteration from above: x <- (x + n / x) / 2
+    size_t bits = limb_bits(n, size);
+    uword_t *x = calloc(size + 1, sizeof(uword_t));
+    uword_t *y = calloc(size + 1, sizeof(uword_t));
+    uword_t *q = calloc(size + 1, sizeof(uword_t));
+    size_t half = (bits + 1) / 2;
+    x[half / WORD_BITS] = (uword_t)1 << (half % WORD_BITS);
+
+    for (;;) {
+        size_t xn = limb_normalize(x, size + 1);
+        memset(q, 0, (size + 1) * sizeof(uword_t));
+        limb_divrem(q, NULL, n, size, x, xn);
+        uword_t carry = limb_add_n(y, x, q, size + 1);
+        limb_shr(y, y, size + 1, 1);
+        y[size] |= carry << (WORD_BITS - 1);
+        if (limb_cmp(y, x, size + 1) >= 0)
+            break;
+        memcpy(x, y, (size + 1) * sizeof(uword_t));
+    }
+
+    size_t xn = limb_normalize(x, size + 1);
+    uword_t *sq = calloc(2 * xn, sizeof(uword_t));
+    limb_mul(sq, x, xn, x, xn);
+    bool out = limb_normalize(sq, 2 * xn) == size && limb_cmp(sq, n, size) == 0;
+
+    free(x);
+    free(y);
+    free(q);
+    free(sq);
+    return out;
+}
+
+// Return whether the context modulus is a strong Lucas probable prime
+// Parameters follow Selfridge's method A: P = 1, Q = (1 - D) / 4
+bool prime_strong_lucas(const mont_ctx_t *ctx)
+{
+    const size_t s = ctx->size;
+
+    // Find the first D in 5, -7, 9, -11, ... with (D/n) == -1
+    word_t D = 5;
+    for (int tries = 0; ; tries++) {
+        int j = jacobi_small(D, ctx->n, s);
+        if (j == -1)
+            break;
+        if (j == 0)
+            return false;
+        // Squares never give -1, so rule them out once the search drags on
+        if (tries == 10 && limb_is_square(ctx->n, s))
+            return false;
+        D = D > 0 ? -(D + 2) : -D + 2;
+    }
+
+    uword_t Um[s], Vm[s], Qk[s], Qm[s], Dm[s], t[s];
+    bigint_t temp = long_to_bigint(D);
+    mont_to(ctx, Dm, temp);
+    bigint_delete(&temp);
+    temp = long_to_bigint((1 - D) / 4);
+    mont_to(ctx, Qm, temp);
+    bigint_delete(&temp);
+
+    // n + 1 = d * 2^k
+    uword_t d[s + 1];
+    d[s] = limb_add_1(d, ctx->n, s, 1);
+    size_t k = 0;
+    while (!(d[k / WORD_BITS] >> (k % WORD_BITS) & 1))
+        k++;
+
+    // Binary ladder over the bits of d = (n + 1) >> k, from U_1 = V_1 = 1
+    memcpy(Um, ctx->one, sizeof(Um));
+    memcpy(Vm, ctx->one, sizeof(Vm));
+    memcpy(Qk, Qm, sizeof(Qk));
+    size_t bits = limb_bits(d, s + 1);
+    for (size_t i = bits - 2; i >= k && i < bits; i--) {
+        // U_2m = U_m V_m, V_2m = V_m^2 - 2 Q^m
+        mont_mul(ctx, Um, Um, Vm);
+        mont_mul(ctx, Vm, Vm, Vm);
+        mont_sub(ctx, Vm, Vm, Qk);
+        mont_sub(ctx, Vm, Vm, Qk);
+        mont_mul(ctx, Qk, Qk, Qk);
+
+        if (d[i / WORD_BITS] >> (i % WORD_BITS) & 1) {
+            // U_m+1 = (U_m + V_m) / 2, V_m+1 = (D U_m + V_m) / 2
+            mont_mul(ctx, t, Dm, Um);
+            mont_add(ctx, Um, Um, Vm);
+            mont_half(ctx, Um, Um);
+            mont_add(ctx, Vm, Vm, t);
+            mont_half(ctx, Vm, Vm);
+            mont_mul(ctx, Qk, Qk, Qm);
+        }
+    }
+
+    if (limb_is_zero(Um, s) || limb_is_zero(Vm, s))
+        return true;
+    for (size_t r = 1; r < k; r++) {
+        mont_mul(ctx, Vm, Vm, Vm);
+        mont_sub(ctx, Vm, Vm, Qk);
+        mont_sub(ctx, Vm, Vm, Qk);
+        if (limb_is_zero(Vm, s))
+            return true;
+        mont_mul(ctx, Qk, Qk, Qk);
+    }
+    return false;
+}
+
+// Return whether n is a probable prime
+bool bigint_is_prime(bigint_t n, size_t rounds, bool lucas)
+{
+    if (!is_pos(n))
+        return false;
+
+    size_t size = limb_normalize(n.val, n.size);
+    if (size == 1 && n.val[0] < 3)
+        return n.val[0] == 2;
+    if (!(n.val[0] & 1))
+        return false;
+    if (prime_has_small_factor(n))
+        return false;
+    if (size == 1 && n.val[0] < SMALL_PRIME_BOUND)
+        return true;
+
+    if (rounds == 0)
+        rounds = prime_mr_rounds(bigint_bits(n), lucas);
+
+    mont_ctx_t ctx = mont_new(n);
+    bool out = prime_miller_rabin(&ctx, rounds);
+    if (out && lucas)
+        out = prime_strong_lucas(&ctx);
+    mont_delete(&ctx);
+
+    return out;
+}
+
+// Testing
+int prime_test(void)
+{
+    static const struct {
+        char *n;
+        size_t rounds;
+        bool lucas;
+        bool prime;
+    } cases[] = {
+        { "561", 0, false, false },
+        { "1621", 0, false, true },
+        { "2627657", 0, true, true },
+        // Strong pseudoprime to bases 2, 3, 5 and 7
+        { "3215031751", 1, true, false },
+        { "1000006000009", 1, true, false },
+        { "170141183460469231731687303715884105727", 0, true, true },
+        // (2^61 - 1) * (2^127 - 1)
+        { "392318858461667547569595655490009919272404068553904357377", 0, true, false },
+        // 2^521 - 1
+        { "6864797660130609714981900799081393217269435300143305409394463459185543183397656052122559640661454554977296311391480858037121987999716643812574028291115057151", 0, true, true },
+    };
+    int total_errors = 0;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        bigint_t n = bigint_new(cases[i].n);
+        bool prime = bigint_is_prime(n, cases[i].rounds, cases[i].lucas);
+        bool test = prime == cases[i].prime;
+        printf("%s: is_prime(%s) == %d\n", test ? "TRUE" : "FALSE", cases[i].n, prime);
+        bigint_delete(&n);
+        total_errors += !test;
+    }
+
+    // Fermat test of modular exponentiation: 2^(p-1) == 1 mod p
+    bigint_t p = bigint_new("170141183460469231731687303715884105727");
+    bigint_t two = long_to_bigint(2);
+    bigint_t one = long_to_bigint(1);
+    bigint_t pm1 = bigint_diff(p, one);
+    mont_ctx_t ctx = mont_new(p);
+    bigint_t pow = mont_exp(&ctx, two, pm1);
+    mont_delete(&ctx);
+    bool test = bigint_equals(pow, one);
+    printf("%s: 2^(p-1) mod p == 1\n", test ? "TRUE" : "FALSE");
+    total_errors += !test;
+    bigint_delete(&p); bigint_delete(&two); bigint_delete(&one);
+    bigint_delete(&pm1); bigint_delete(&pow);
+
+    return total_errors;
+}
@@ -0,0 +1,41 @@
+/**
+ * prime.h: Probable prime testing
+ */
+
+#ifndef PRIME_H
+#define PRIME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bigint.h"
+#include "mont.h"
+
+enum { SMALL_PRIMES = 256 };
+
+// Odd primes 3 .. 1621 used for trial division, generated into tables.c
+extern const uint16_t small_primes[SMALL_PRIMES];
+
+// Return Miller-Rabin round count for a candidate of the given size
+size_t prime_mr_rounds(size_t bits, bool lucas);
+
+// Store n mod small_primes[i] in res[i] for every small prime
+void prime_small_residues(bigint_t n, uint16_t *res);
+
+// Return whether n has a factor in small_primes other than n itself
+bool prime_has_small_factor(bigint_t n);
+
+// Return whether the context modulus passes `rounds` Miller-Rabin rounds
+bool prime_miller_rabin(const mont_ctx_t *ctx, size_t rounds);
+
+// Return whether the context modulus is a strong Lucas probable prime
+bool prime_strong_lucas(const mont_ctx_t *ctx);
+
+// Return whether n is a probable prime. rounds == 0 chooses the round count
+// from the bit size; lucas adds the strong Lucas test (Baillie-PSW).
+bool bigint_is_prime(bigint_t n, size_t rounds, bool lucas);
+
+// Testing methods
+int prime_test(void);
+
+#endif // PRIME_H
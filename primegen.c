@@ -0,0 +1,292 @@
+/**
+ * primegen.c: Multithreaded prime search
+ *
+ * The candidates start + step * i are split into windows of opts->window
+ * offsets. A worker claims the next window, sieves it against small_primes
+ * using residues derived from those of start (so no candidate is divided
+ * from scratch), then runs the probable prime tests on the survivors.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "limb.h"
+#include "math.h"
+#include "prime.h"
+#include "primegen.h"
+
+typedef struct {
+    bigint_t start;                     // First candidate
+    size_t step;                        // Distance between candidates
+    size_t window;
+    size_t rounds;
+    bool lucas;
+    bool safe;
+    uint16_t res[SMALL_PRIMES];         // start mod small_primes[i]
+    uint16_t inv_step[SMALL_PRIMES];    // step^-1 mod small_primes[i]
+
+    atomic_size_t next_window;
+    atomic_bool found;
+    atomic_size_t sieved;
+    atomic_size_t tested;
+
+    pthread_mutex_t lock;
+    bigint_t result;
+} search_t;
+
+// Return whether c passes `rounds` Miller-Rabin rounds and optionally Lucas
+static bool search_is_prime(bigint_t c, size_t rounds, bool lucas)
+{
+    mont_ctx_t ctx = mont_new(c);
+    bool out = prime_miller_rabin(&ctx, rounds);
+    if (out && lucas)
+        out = prime_strong_lucas(&ctx);
+    mont_delete(&ctx);
+    return out;
+}
+
+// Return whether candidate c (which survived the sieve) is acceptable
+static bool search_test(const search_t *s, bigint_t c)
+{
+    size_t rounds = s->rounds ? s->rounds : prime_mr_rounds(bigint_bits(c), s->lucas);
+    if (!s->safe)
+        return search_is_prime(c, rounds, s->lucas);
+
+    // q = (c - 1) / 2: weed out composites with a single round on each
+    // half before running the full tests
+    uword_t q_val[c.size];
+    limb_shr(q_val, c.val, c.size, 1);
+    bigint_t q = bigint_from_limbs(q_val, c.size);
+
+    bool out = search_is_prime(q, 1, false)
+        && search_is_prime(c, rounds, s->lucas)
+        && search_is_prime(q, rounds, s->lucas);
+
+    bigint_delete(&q);
+    return out;
+}
+
+// Worker thread: claim and process windows until a prime is found
+static void *search_worker(void *arg)
+{
+    search_t *s = arg;
+    uint8_t *composite = malloc(s->window);
+
+    while (!atomic_load(&s->found)) {
+        size_t first = atomic_fetch_add(&s->next_window, 1) * s->window;
+
+        // Sieve: offset j is composite if start + step * (first + j) is
+        // divisible by a small prime (or is 1 mod it, for safe primes)
+        memset(composite, 0, s->window);
+        for (size_t i = 0; i < SMALL_PRIMES; i++) {
+            const uword_t p = small_primes[i];
+            const uword_t r = (s->res[i] + (udword_t)first * s->step) % p;
+            for (uword_t target = 0; target <= s->safe; target++) {
+                uword_t j = (target + p - r) % p * s->inv_step[i] % p;
+                for ( ; j < s->window; j += p)
+                    composite[j] = 1;
+            }
+        }
+
+        size_t sieved = 0;
+        for (size_t j = 0; j < s->window && !atomic_load(&s->found); j++) {
+            sieved++;
+            if (composite[j])
+                continue;
+            atomic_fetch_add(&s->tested, 1);
+
+            bigint_t offset = long_to_bigint((long)((first + j) * s->step));
+            bigint_t c = bigint_sum(s->start, offset);
+            bigint_delete(&offset);
+
+            if (search_test(s, c)) {
+                pthread_mutex_lock(&s->lock);
+                if (!atomic_load(&s->found)) {
+                    s->result = c;
+                    atomic_store(&s->found, true);
+                    c.size = 0;
+                }
+                pthread_mutex_unlock(&s->lock);
+            }
+            if (c.size)
+                bigint_delete(&c);
+        }
+        atomic_fetch_add(&s->sieved, sieved);
+    }
+
+    free(composite);
+    return NULL;
+}
+
+// Return wall-clock time in seconds
+static double search_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Return a probable prime p >= start
+bigint_t prime_search(bigint_t start, const prime_search_opts_t *opts,
+        prime_search_stats_t *stats)
+{
+    const prime_search_opts_t defaults = { 0 };
+    if (!opts)
+        opts = &defaults;
+
+    if (!is_pos(start) || bigint_bits(start) <= 11) {
+        fprintf(stderr, "prime_search: WARNING: start must exceed the sieving primes\n");
+        return bigint_zero(1);
+    }
+
+    search_t s = {
+        .step = opts->safe ? 4 : 2,
+        .window = opts->window ? opts->window : PRIME_SEARCH_DEFAULT_WINDOW,
+        .rounds = opts->rounds,
+        .lucas = opts->lucas,
+        .safe = opts->safe,
+    };
+    atomic_init(&s.next_window, 0);
+    atomic_init(&s.found, false);
+    atomic_init(&s.sieved, 0);
+    atomic_init(&s.tested, 0);
+    pthread_mutex_init(&s.lock, NULL);
+
+    // Odd candidates, or 3 mod 4 for safe primes so that q is odd
+    uword_t want = opts->safe ? 3 : 1;
+    uword_t adjust = (want - start.val[0] % s.step + s.step) % s.step;
+    bigint_t temp = long_to_bigint(adjust);
+    s.start = bigint_sum(start, temp);
+    bigint_delete(&temp);
+
+    prime_small_residues(s.start, s.res);
+    for (size_t i = 0; i < SMALL_PRIMES; i++) {
+        uword_t inv = 1;
+        while (inv * s.step % small_primes[i] != 1)
+            inv++;
+        s.inv_step[i] = inv;
+    }
+
+    size_t threads = opts->threads;
+    if (threads == 0)
+        threads = smax(sysconf(_SC_NPROCESSORS_ONLN), 1);
+
+    double begin = search_time();
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    size_t started = 0;
+    for ( ; started < threads; started++) {
+        int err = pthread_create(workers + started, NULL, search_worker, &s);
+        if (err) {
+            fprintf(stderr, "prime_search: WARNING: started %zu of %zu threads: %s\n",
+                started, threads, strerror(err));
+            break;
+        }
+    }
+    // Search on this thread if no worker could start
+    if (started == 0)
+        search_worker(&s);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+    double seconds = search_time() - begin;
+
+    if (stats) {
+        stats->sieved = atomic_load(&s.sieved);
+        stats->tested = atomic_load(&s.tested);
+        stats->seconds = seconds;
+        stats->rate = seconds > 0 ? stats->tested / seconds : 0;
+    }
+
+    pthread_mutex_destroy(&s.lock);
+    bigint_delete(&s.start);
+    return s.result;
+}
+
+// Return a random probable prime of the given size
+bigint_t prime_generate(size_t bits, const prime_search_opts_t *opts,
+        prime_search_stats_t *stats)
+{
+    if (bits <= 11) {
+        fprintf(stderr, "prime_generate: WARNING: size must exceed the sieving primes\n");
+        return bigint_zero(1);
+    }
+
+    // Leave room for a clear sign bit above the top bit
+    bigint_t rand = bigint_random_bits(bits);
+    bigint_t start = bigint_resize(rand, bits / WORD_BITS + 1);
+    bigint_delete(&rand);
+    start.val[(bits - 1) / WORD_BITS] |= (uword_t)1 << ((bits - 1) % WORD_BITS);
+    start.val[(bits - 2) / WORD_BITS] |= (uword_t)1 << ((bits - 2) % WORD_BITS);
+
+    bigint_t out = prime_search(start, opts, stats);
+    bigint_delete(&start);
+    return out;
+}
+
+// Testing
+int primegen_test(void)
+{
+    int total_errors = 0;
+    char *p1, *p2;
+
+    static const struct {
+        char *start;
+        char *prime;    // Expected result for a single thread
+        bool safe;
+    } cases[] = {
+        { "1000000000000000000000000000000", "1000000000000000000000000000057", false },
+        { "100000000000000000000", "100000000000000000763", true },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        bigint_t start = bigint_new(cases[i].start);
+        bigint_t expect = bigint_new(cases[i].prime);
+
+        // A single worker finds the next prime; more workers find some prime
+        for (size_t threads = 1; threads <= 4; threads += 3) {
+            prime_search_opts_t opts = {
+                .threads = threads,
+                .window = 256,
+                .lucas = true,
+                .safe = cases[i].safe,
+            };
+            prime_search_stats_t stats;
+            bigint_t p = prime_search(start, &opts, &stats);
+            bigint_t diff = bigint_diff(p, start);
+
+            bool test = threads == 1 ? bigint_equals(p, expect)
+                : !is_neg(diff) && bigint_is_prime(p, 0, true);
+            printf("%s: prime_search(%s, safe=%d, threads=%zu) == %s (%zu tested, %.0f/s)\n",
+                test ? "TRUE" : "FALSE",
+                p1 = bigint_print(start),
+                cases[i].safe,
+                threads,
+                p2 = bigint_print(p),
+                stats.tested,
+                stats.rate);
+            free(p1); free(p2);
+            total_errors += !test;
+
+            bigint_delete(&p);
+            bigint_delete(&diff);
+        }
+
+        bigint_delete(&start);
+        bigint_delete(&expect);
+    }
+
+    // Random primes have exactly the requested size
+    bigint_t p = prime_generate(256, NULL, NULL);
+    bool test = bigint_bits(p) == 256 && bigint_is_prime(p, 0, true);
+    printf("%s: prime_generate(256) == %s\n", test ? "TRUE" : "FALSE", p1 = bigint_print(p));
+    free(p1);
+    bigint_delete(&p);
+    total_errors += !test;
+
+    return total_errors;
+}
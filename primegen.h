@@ -0,0 +1,49 @@
+/**
+ * primegen.h: Multithreaded prime search
+ */
+
+#ifndef PRIMEGEN_H
+#define PRIMEGEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bigint.h"
+
+enum { PRIME_SEARCH_DEFAULT_WINDOW = 4096 };
+
+typedef struct {
+    size_t threads;     // Worker threads (0: one per online CPU)
+    size_t window;      // Candidates sieved per work unit (0: default)
+    size_t rounds;      // Miller-Rabin rounds (0: from the bit size)
+    bool lucas;         // Also run the strong Lucas test
+    bool safe;          // Search for safe primes p = 2q + 1 with q prime
+} prime_search_opts_t;
+
+typedef struct {
+    size_t sieved;      // Candidates covered by the sieve windows
+    size_t tested;      // Candidates that survived the sieve
+    double seconds;     // Wall-clock time of the search
+    double rate;        // Candidates tested per second
+} prime_search_stats_t;
+
+/**
+ * Return a probable prime p >= start (start > 1621). Workers claim
+ * consecutive windows of candidates, so with more than one thread the result
+ * need not be the smallest such prime. opts and stats may be NULL.
+ */
+bigint_t prime_search(bigint_t start, const prime_search_opts_t *opts,
+        prime_search_stats_t *stats);
+
+/**
+ * Return a random probable prime of the given size (bits > 11). The search
+ * starts from a random value with its top two bits set, so the product of
+ * two such primes has exactly 2 * bits bits.
+ */
+bigint_t prime_generate(size_t bits, const prime_search_opts_t *opts,
+        prime_search_stats_t *stats);
+
+// Testing methods
+int primegen_test(void);
+
+#endif // PRIMEGEN_H
@@ -0,0 +1,203 @@
+/**
+ * rng.c: Buffered ChaCha20 random number generator
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+
+#include "rng.h"
+
+enum {
+    RNG_BLOCK_BYTES = 64,
+    RNG_BUFFER_BLOCKS = 16,
+    RNG_BUFFER_BYTES = RNG_BLOCK_BYTES * RNG_BUFFER_BLOCKS,
+};
+
+typedef struct {
+    uint32_t key[8];
+    uint64_t counter;       // Block counter
+    uint64_t stream;        // Nonce
+    size_t pos;             // Bytes of buf already handed out
+    unsigned generation;    // Seed generation the key belongs to
+    bool seeded;
+    uint8_t buf[RNG_BUFFER_BYTES];
+} rng_state_t;
+
+static _Thread_local rng_state_t rng_state;
+
+// Deterministic seeding, shared by all threads
+static pthread_mutex_t rng_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t rng_fixed_seed[RNG_SEED_BYTES];
+static bool rng_fixed = false;
+static uint64_t rng_streams = 0;
+static atomic_uint rng_generation = 0;
+static pthread_once_t rng_atfork_once = PTHREAD_ONCE_INIT;
+
+static inline uint32_t rotl32(uint32_t x, int k)
+{
+    return (x << k) | (x >> (32 - k));
+}
+
+#define QUARTER_ROUND(a, b, c, d) do { \
+    a += b; d = rotl32(d ^ a, 16); \
+    c += d; b = rotl32(b ^ c, 12); \
+    a += b; d = rotl32(d ^ a, 8); \
+    c += d; b = rotl32(b ^ c, 7); \
+} while (0)
+
+// Write one ChaCha20 block (20 rounds) to out
+static void chacha20_block(const rng_state_t *st, uint64_t counter, uint8_t *out)
+{
+    uint32_t in[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        st->key[0], st->key[1], st->key[2], st->key[3],
+        st->key[4], st->key[5], st->key[6], st->key[7],
+        (uint32_t)counter, (uint32_t)(counter >> 32),
+        (uint32_t)st->stream, (uint32_t)(st->stream >> 32),
+    };
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+
+    for (int i = 0; i < 10; i++) {
+        QUARTER_ROUND(x[0], x[4], x[ 8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[ 9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[ 8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[ 9], x[14]);
+    }
+
+    for (int i = 0; i < 16; i++) {
+        uint32_t v = x[i] + in[i];
+        out[4*i + 0] = (uint8_t)v;
+        out[4*i + 1] = (uint8_t)(v >> 8);
+        out[4*i + 2] = (uint8_t)(v >> 16);
+        out[4*i + 3] = (uint8_t)(v >> 24);
+    }
+}
+
+// Load a key from 32 bytes
+static void rng_set_key(rng_state_t *st, const uint8_t *key)
+{
+    for (int i = 0; i < 8; i++) {
+        st->key[i] = (uint32_t)key[4*i] | (uint32_t)key[4*i + 1] << 8
+            | (uint32_t)key[4*i + 2] << 16 | (uint32_t)key[4*i + 3] << 24;
+    }
+}
+
+// Refill the buffer, then replace the key with the first 32 bytes of output
+// so earlier output cannot be recovered from the state
+static void rng_refill(rng_state_t *st)
+{
+    for (size_t i = 0; i < RNG_BUFFER_BLOCKS; i++)
+        chacha20_block(st, st->counter++, st->buf + i * RNG_BLOCK_BYTES);
+    rng_set_key(st, st->buf);
+    memset(st->buf, 0, RNG_SEED_BYTES);
+    st->pos = RNG_SEED_BYTES;
+}
+
+// Fork handlers: hold the lock across fork, then make every stream the child
+// inherited stale so it reseeds before drawing
+static void rng_atfork_prepare(void)
+{
+    pthread_mutex_lock(&rng_lock);
+}
+
+static void rng_atfork_parent(void)
+{
+    pthread_mutex_unlock(&rng_lock);
+}
+
+static void rng_atfork_child(void)
+{
+    atomic_fetch_add(&rng_generation, 1);
+    pthread_mutex_unlock(&rng_lock);
+}
+
+static void rng_atfork_init(void)
+{
+    pthread_atfork(rng_atfork_prepare, rng_atfork_parent, rng_atfork_child);
+}
+
+// (Re)seed the calling thread's state
+static void rng_reseed(rng_state_t *st)
+{
+    uint8_t key[RNG_SEED_BYTES];
+
+    pthread_once(&rng_atfork_once, rng_atfork_init);
+    pthread_mutex_lock(&rng_lock);
+    st->generation = atomic_load(&rng_generation);
+    if (rng_fixed) {
+        memcpy(key, rng_fixed_seed, sizeof(key));
+        st->stream = rng_streams++;
+    } else {
+        st->stream = 0;
+    }
+    bool fixed = rng_fixed;
+    pthread_mutex_unlock(&rng_lock);
+
+    if (!fixed) {
+        size_t got = 0;
+        while (got < sizeof(key)) {
+            ssize_t r = getrandom(key + got, sizeof(key) - got, 0);
+            if (r < 0 && errno != EINTR) {
+                fprintf(stderr, "rng_reseed: ERROR: getrandom failed\n");
+                abort();
+            }
+            if (r > 0)
+                got += r;
+        }
+    }
+
+    rng_set_key(st, key);
+    memset(key, 0, sizeof(key));
+    st->counter = 0;
+    st->seeded = true;
+    rng_refill(st);
+}
+
+// Fill buf with len random bytes from the calling thread's stream
+void rng_bytes(void *buf, size_t len)
+{
+    rng_state_t *st = &rng_state;
+    if (!st->seeded || st->generation != atomic_load(&rng_generation))
+        rng_reseed(st);
+
+    uint8_t *out = buf;
+    while (len > 0) {
+        if (st->pos == RNG_BUFFER_BYTES)
+            rng_refill(st);
+        size_t n = smin(len, RNG_BUFFER_BYTES - st->pos);
+        memcpy(out, st->buf + st->pos, n);
+        memset(st->buf + st->pos, 0, n);
+        st->pos += n;
+        out += n;
+        len -= n;
+    }
+}
+
+// Fill out with n random words
+void rng_words(uword_t *out, size_t n)
+{
+    rng_bytes(out, n * sizeof(uword_t));
+}
+
+// Use streams derived from seed in every thread
+void rng_seed(const uint8_t *seed)
+{
+    pthread_mutex_lock(&rng_lock);
+    rng_fixed = seed != NULL;
+    if (seed)
+        memcpy(rng_fixed_seed, seed, RNG_SEED_BYTES);
+    rng_streams = 0;
+    atomic_fetch_add(&rng_generation, 1);
+    pthread_mutex_unlock(&rng_lock);
+}
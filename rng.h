@@ -0,0 +1,31 @@
+/**
+ * rng.h: Buffered ChaCha20 random number generator
+ *
+ * Every thread draws from its own ChaCha20 stream, seeded on first use from
+ * getrandom(2). rng_seed() switches all threads to streams derived from a
+ * fixed seed so benchmarks and tests can be reproduced. A forked child
+ * reseeds before its first draw rather than repeating the parent's output.
+ */
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "int_math.h"
+
+enum { RNG_SEED_BYTES = 32 };
+
+// Fill buf with len random bytes from the calling thread's stream
+void rng_bytes(void *buf, size_t len);
+
+// Fill out with n random words
+void rng_words(uword_t *out, size_t n);
+
+// Use streams derived from seed in every thread; NULL returns to getrandom
+// seeding. Each thread's stream depends on the order in which it first
+// draws after this call.
+void rng_seed(const uint8_t *seed);
+
+#endif // RNG_H
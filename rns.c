@@ -0,0 +1,480 @@
+/**
+ * rns.c: Residue number system arithmetic
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "limb.h"
+#include "math.h"
+#include "mod_math.h"
+#include "pool.h"
+#include "rns.h"
+
+// Return a * b mod p for setup, by division
+static uword_t rns_mulmod_slow(uword_t a, uword_t b, uword_t p)
+{
+    return (uword_t)((udword_t)a * b % p);
+}
+
+// Return a^e mod p for setup
+static uword_t rns_powmod(uword_t a, uword_t e, uword_t p)
+{
+    uword_t out = 1;
+    for (a %= p; e; e >>= 1) {
+        if (e & 1)
+            out = rns_mulmod_slow(out, a, p);
+        a = rns_mulmod_slow(a, a, p);
+    }
+    return out;
+}
+
+// Return a^-1 mod p for a coprime to p, by the extended Euclidean algorithm
+static uword_t rns_invmod(uword_t a, uword_t p)
+{
+    word_t r0 = (word_t)p, r1 = (word_t)(a % p), s0 = 0, s1 = 1;
+    while (r1) {
+        word_t q = r0 / r1, t;
+        t = r0 - q * r1; r0 = r1; r1 = t;
+        t = s0 - q * s1; s0 = s1; s1 = t;
+    }
+    return s0 < 0 ? (uword_t)(s0 + (word_t)p) : (uword_t)s0;
+}
+
+// Return whether odd p > 37 is prime, by Miller-Rabin on bases that decide
+// every 64-bit input
+static bool rns_is_prime(uword_t p)
+{
+    static const uword_t bases[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+    for (size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); i++)
+        if (p % bases[i] == 0)
+            return false;
+
+    uword_t d = p - 1;
+    int s = __builtin_ctzll(d);
+    d >>= s;
+    for (size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); i++) {
+        uword_t x = rns_powmod(bases[i], d, p);
+        if (x == 1 || x == p - 1)
+            continue;
+        int r;
+        for (r = 1; r < s; r++) {
+            x = rns_mulmod_slow(x, x, p);
+            if (x == p - 1)
+                break;
+        }
+        if (r == s)
+            return false;
+    }
+    return true;
+}
+
+// Return a * b mod p for a, b < 2^62 by Barrett reduction, mu = floor(2^124 / p).
+// The quotient estimate is short by at most 2, so the remainder fits a word.
+static inline uword_t rns_mulmod(uword_t a, uword_t b, uword_t p, uword_t mu)
+{
+    udword_t x = (udword_t)a * b;
+    uword_t q = (uword_t)(((udword_t)(uword_t)(x >> (RNS_PRIME_BITS - 1)) * mu) >> (RNS_PRIME_BITS + 1));
+    uword_t r = (uword_t)x - q * p;
+    r -= r >= p ? p : 0;
+    r -= r >= p ? p : 0;
+    return r;
+}
+
+// Return a + b mod p for a, b < p
+static inline uword_t rns_addmod(uword_t a, uword_t b, uword_t p)
+{
+    uword_t s = a + b;
+    return s >= p ? s - p : s;
+}
+
+// Return a - b mod p for a, b < p
+static inline uword_t rns_submod(uword_t a, uword_t b, uword_t p)
+{
+    return a >= b ? a - b : a + p - b;
+}
+
+// Return the product of k primes
+static bigint_t rns_product(const uword_t *p, size_t k)
+{
+    uword_t buf[k + 1];
+    memset(buf, 0, sizeof(buf));
+    buf[0] = 1;
+    for (size_t i = 0; i < k; i++)
+        limb_mul_1(buf, buf, k + 1, p[i]);
+    return bigint_from_limbs(buf, k + 1);
+}
+
+// Return whether a > c * n
+static bool rns_exceeds(bigint_t a, bigint_t n, long c)
+{
+    bigint_t cl = long_to_bigint(c);
+    bigint_t bound = bigint_prod(n, cl);
+    bigint_t diff = bigint_diff(a, bound);
+    bool out = is_pos(diff);
+    bigint_delete(&cl);
+    bigint_delete(&bound);
+    bigint_delete(&diff);
+    return out;
+}
+
+// Return whether count primes are valid channels for n: distinct primes in
+// (2^61, 2^62) not dividing n, with bases large enough to keep products exact
+static bool rns_check(bigint_t n, const uword_t *p, size_t count)
+{
+    if (count < 2 || count % 2)
+        return false;
+    size_t words = limb_normalize(n.val, n.size);
+    for (size_t i = 0; i < count; i++) {
+        if (p[i] >> (RNS_PRIME_BITS - 1) != 1 || !rns_is_prime(p[i])
+                || limb_mod_1(n.val, words, p[i]) == 0)
+            return false;
+        for (size_t j = 0; j < i; j++)
+            if (p[i] == p[j])
+                return false;
+    }
+
+    const size_t k = count / 2;
+    bigint_t a = rns_product(p, k);
+    bigint_t b = rns_product(p + k, k);
+    bool out = rns_exceeds(a, n, 4 * (long)(k + 1) * (long)(k + 1))
+        && rns_exceeds(b, n, 2 * (long)(k + 1));
+    bigint_delete(&a);
+    bigint_delete(&b);
+    return out;
+}
+
+// Fill p with count primes below 2^62 that do not divide n, largest first
+static void rns_pick_primes(bigint_t n, uword_t *p, size_t count)
+{
+    size_t words = limb_normalize(n.val, n.size);
+    uword_t c = ((uword_t)1 << RNS_PRIME_BITS) - 1;
+    for (size_t i = 0; i < count; c -= 2)
+        if (rns_is_prime(c) && limb_mod_1(n.val, words, c) != 0)
+            p[i++] = c;
+}
+
+// Return context for positive n over count primes in (2^61, 2^62), half per
+// base, coprime to n, with A > 4 (k + 1)^2 n and B > 2 (k + 1) n. primes may
+// be NULL to pick the fewest primes below 2^62 that fit.
+rns_ctx_t rns_new(bigint_t n, const uword_t *primes, size_t count)
+{
+    rns_ctx_t ctx = { 0 };
+    if (!is_pos(n)) {
+        fprintf(stderr, "rns_new: WARNING: modulus is not positive\n");
+        return ctx;
+    }
+
+    uword_t *p;
+    if (primes) {
+        if (!rns_check(n, primes, count)) {
+            fprintf(stderr, "rns_new: WARNING: primes do not fit the modulus\n");
+            return ctx;
+        }
+        p = malloc(count * sizeof(uword_t));
+        memcpy(p, primes, count * sizeof(uword_t));
+    } else {
+        // Each prime adds over 61 bits; start from the bound that ignores
+        // the (k + 1)^2 factor and grow
+        for (size_t k = bigint_bits(n) / (RNS_PRIME_BITS - 1) + 1; ; k++) {
+            count = 2 * k;
+            p = malloc(count * sizeof(uword_t));
+            rns_pick_primes(n, p, count);
+            if (rns_check(n, p, count))
+                break;
+            free(p);
+        }
+    }
+
+    const size_t k = count / 2;
+    ctx.k = k;
+    ctx.n = bigint_share(bigint_copy(n));
+    ctx.p = p;
+
+    // One table for every per-channel constant
+    uword_t *t = malloc((2 * k + k + k * k + 3 * k + k * k + k + k * k) * sizeof(uword_t));
+    ctx.mu = t;         t += 2 * k;
+    ctx.q_a = t;        t += k;
+    ctx.ahat_b = t;     t += k * k;
+    ctx.n_b = t;        t += k;
+    ctx.ainv_b = t;     t += k;
+    ctx.bhat_inv = t;   t += k;
+    ctx.bhat_a = t;     t += k * k;
+    ctx.b_a = t;        t += k;
+    ctx.garner = t;
+
+    const uword_t *a = p, *b = p + k;
+    size_t words = limb_normalize(n.val, n.size);
+    for (size_t c = 0; c < 2 * k; c++) {
+        udword_t top = (udword_t)1 << (2 * RNS_PRIME_BITS);
+        ctx.mu[c] = (uword_t)(top / p[c]);
+    }
+    const uword_t *mua = ctx.mu, *mub = ctx.mu + k;
+
+    // Row r of each matrix takes the products of all but one prime of a base
+    // modulo a prime of the other, from prefix and suffix products
+    uword_t pre[k + 1], suf[k + 1];
+    for (size_t r = 0; r < k; r++) {
+        for (int base = 0; base < 2; base++) {
+            const uword_t *src = base ? b : a;
+            const uword_t pr = base ? a[r] : b[r], mu = base ? mua[r] : mub[r];
+            uword_t *row = (base ? ctx.bhat_a : ctx.ahat_b) + r * k;
+            pre[0] = suf[k] = 1;
+            for (size_t i = 0; i < k; i++)
+                pre[i + 1] = rns_mulmod(pre[i], src[i] % pr, pr, mu);
+            for (size_t i = k; i-- > 0; )
+                suf[i] = rns_mulmod(suf[i + 1], src[i] % pr, pr, mu);
+            for (size_t i = 0; i < k; i++)
+                row[i] = rns_mulmod(pre[i], suf[i + 1], pr, mu);
+            if (base)
+                ctx.b_a[r] = pre[k];
+            else
+                ctx.ainv_b[r] = rns_invmod(pre[k], pr);
+        }
+
+        // The same within a base: A / a_r mod a_r and B / b_r mod b_r
+        uword_t ahat = 1, bhat = 1;
+        for (size_t j = 0; j < k; j++) {
+            if (j == r)
+                continue;
+            ahat = rns_mulmod(ahat, a[j] % a[r], a[r], mua[r]);
+            bhat = rns_mulmod(bhat, b[j] % b[r], b[r], mub[r]);
+        }
+        uword_t n_a = limb_mod_1(n.val, words, a[r]);
+        uword_t q = rns_invmod(rns_mulmod(n_a, ahat, a[r], mua[r]), a[r]);
+        ctx.q_a[r] = q ? a[r] - q : 0;
+        ctx.bhat_inv[r] = rns_invmod(bhat, b[r]);
+        ctx.n_b[r] = limb_mod_1(n.val, words, b[r]);
+        for (size_t j = 0; j < k; j++)
+            ctx.garner[r * k + j] = j < r ? rns_invmod(a[j], a[r]) : 0;
+    }
+
+    bigint_t big_a = rns_product(a, k);
+    ctx.a_mod_n = mod(big_a, n);
+    bigint_delete(&big_a);
+    return ctx;
+}
+
+// Free context
+void rns_delete(rns_ctx_t *ctx)
+{
+    if (!ctx->p)
+        return;
+    bigint_delete(&ctx->n);
+    bigint_delete(&ctx->a_mod_n);
+    free(ctx->p);
+    free(ctx->mu);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+// Convert a (any sign or size) into an element
+void rns_to(const rns_ctx_t *ctx, uword_t *out, bigint_t a)
+{
+    bigint_t r = mod(a, ctx->n);
+    bigint_t t = mod_prod(r, ctx->a_mod_n, ctx->n);
+    size_t words = limb_normalize(t.val, t.size);
+    for (size_t c = 0; c < 2 * ctx->k; c++)
+        out[c] = limb_mod_1(t.val, words, ctx->p[c]);
+    bigint_delete(&r);
+    bigint_delete(&t);
+}
+
+// Convert an element back, reduced into [0, n)
+bigint_t rns_from(const rns_ctx_t *ctx, const uword_t *a)
+{
+    const size_t k = ctx->k;
+    uword_t one[2 * k], t[2 * k];
+    for (size_t c = 0; c < 2 * k; c++)
+        one[c] = 1;
+    rns_mul(ctx, t, a, one);
+
+    // Mixed-radix digits in base A (Garner), then Horner's rule; the value
+    // is below (k + 1) n < A, so base A alone determines it
+    uword_t v[k], buf[k + 1];
+    for (size_t i = 0; i < k; i++) {
+        const uword_t ai = ctx->p[i], mu = ctx->mu[i];
+        uword_t x = t[i];
+        for (size_t j = 0; j < i; j++)
+            x = rns_mulmod(rns_submod(x, v[j] % ai, ai), ctx->garner[i * k + j], ai, mu);
+        v[i] = x;
+    }
+    memset(buf, 0, sizeof(buf));
+    for (size_t i = k; i-- > 0; ) {
+        limb_mul_1(buf, buf, k + 1, ctx->p[i]);
+        limb_add_1(buf, buf, k + 1, v[i]);
+    }
+
+    bigint_t x = bigint_from_limbs(buf, k + 1);
+    bigint_t out = mod(x, ctx->n);
+    bigint_delete(&x);
+    return out;
+}
+
+typedef struct {
+    const uword_t *xi;      // k inputs
+    const uword_t *m;       // Matrix rows, k words each
+    const uword_t *p;       // Output primes
+    const uword_t *mu;
+    uword_t *out;
+    size_t k, lo, hi;
+} rns_dot_arg_t;
+
+// out[r] = sum_i xi[i] m[r k + i] mod p[r] for r in [lo, hi)
+static void rns_dot(void *arg)
+{
+    const rns_dot_arg_t *d = arg;
+    for (size_t r = d->lo; r < d->hi; r++) {
+        const uword_t *row = d->m + r * d->k;
+        const uword_t pr = d->p[r], mu = d->mu[r];
+        uword_t s = 0;
+        for (size_t i = 0; i < d->k; i++)
+            s = rns_addmod(s, rns_mulmod(d->xi[i], row[i], pr, mu), pr);
+        d->out[r] = s;
+    }
+}
+
+// Base extension matrix product, split across the default pool for many channels
+static void rns_extend(const uword_t *xi, const uword_t *m, const uword_t *p,
+    const uword_t *mu, uword_t *out, size_t k)
+{
+    rns_dot_arg_t whole = { xi, m, p, mu, out, k, 0, k };
+    if (k < RNS_PARALLEL_CHANNELS) {
+        rns_dot(&whole);
+        return;
+    }
+
+    pool_t *pool = pool_default();
+    size_t chunks = smin(pool_threads(pool), k);
+    rns_dot_arg_t args[chunks];
+    pool_group_t group;
+    pool_group_init(&group);
+    for (size_t c = 0; c < chunks; c++) {
+        args[c] = whole;
+        args[c].lo = k * c / chunks;
+        args[c].hi = k * (c + 1) / chunks;
+        pool_submit(pool, &group, rns_dot, &args[c]);
+    }
+    pool_wait(pool, &group);
+}
+
+// out = a * b / A, channel by channel with base extensions (out may alias a or b)
+void rns_mul(const rns_ctx_t *ctx, uword_t *out, const uword_t *a, const uword_t *b)
+{
+    const size_t k = ctx->k;
+    const uword_t *pa = ctx->p, *pb = ctx->p + k;
+    const uword_t *mua = ctx->mu, *mub = ctx->mu + k;
+    uword_t buf[5 * k];
+    memset(buf, 0, sizeof(buf));    // Quiets a false maybe-uninitialized at -O1
+    uword_t *x = buf, *xi = buf + 2 * k, *q = buf + 3 * k, *r = buf + 4 * k;
+
+    for (size_t c = 0; c < 2 * k; c++)
+        x[c] = rns_mulmod(a[c], b[c], ctx->p[c], ctx->mu[c]);
+
+    // q = -x / n mod A, as its CRT terms q_i (A / a_i)^-1, carried to base B
+    // up to a multiple below k A (Bajard)
+    for (size_t i = 0; i < k; i++)
+        xi[i] = rns_mulmod(x[i], ctx->q_a[i], pa[i], mua[i]);
+    rns_extend(xi, ctx->ahat_b, pb, mub, q, k);
+
+    // r = (x + q n) / A in base B, and its CRT terms
+    for (size_t j = 0; j < k; j++) {
+        uword_t t = rns_addmod(x[k + j], rns_mulmod(q[j], ctx->n_b[j], pb[j], mub[j]), pb[j]);
+        r[j] = rns_mulmod(t, ctx->ainv_b[j], pb[j], mub[j]);
+        xi[j] = rns_mulmod(r[j], ctx->bhat_inv[j], pb[j], mub[j]);
+    }
+
+    // Exact extension back to base A (Kawamura): sum_j xi_j / b_j = alpha + r / B
+    // with r < B / 2, so the rounding error of the sum cannot move alpha
+    double frac = 0.25;
+    for (size_t j = 0; j < k; j++)
+        frac += (double)xi[j] / (double)pb[j];
+    uword_t alpha = (uword_t)frac;
+    rns_extend(xi, ctx->bhat_a, pa, mua, out, k);
+    for (size_t i = 0; i < k; i++)
+        out[i] = rns_submod(out[i], rns_mulmod(alpha, ctx->b_a[i], pa[i], mua[i]), pa[i]);
+    memcpy(out + k, r, k * sizeof(uword_t));
+}
+
+// out = a + b, channel by channel
+void rns_add(const rns_ctx_t *ctx, uword_t *out, const uword_t *a, const uword_t *b)
+{
+    for (size_t c = 0; c < 2 * ctx->k; c++)
+        out[c] = rns_addmod(a[c], b[c], ctx->p[c]);
+}
+
+// Testing
+int rns_test(void)
+{
+    int total_errors = 0;
+    static const size_t bits[] = { 64, 521, 2048, 20000 };
+
+    for (size_t t = 0; t < sizeof(bits) / sizeof(bits[0]); t++) {
+        bigint_t n = bigint_random_bits(bits[t]);
+        n.val[0] |= 1;
+        rns_ctx_t ctx = rns_new(n, NULL, 0);
+        const size_t w = 2 * ctx.k;
+        int errors = 0;
+
+        // Round trips, then x1 x2 + x3 x4 and its product with x5, against mod_prod
+        uword_t e[5][w], acc[w], tmp[w];
+        bigint_t x[5];
+        for (int i = 0; i < 5; i++) {
+            x[i] = bigint_random_bits(bits[t] + 10);
+            if (i == 2) {
+                bigint_t neg = bigint_neg(x[i]);
+                bigint_delete(&x[i]);
+                x[i] = neg;
+            }
+            rns_to(&ctx, e[i], x[i]);
+            bigint_t got = rns_from(&ctx, e[i]);
+            bigint_t expect = mod(x[i], n);
+            errors += !bigint_equals(got, expect);
+            bigint_delete(&got);
+            bigint_delete(&expect);
+        }
+        rns_mul(&ctx, acc, e[0], e[1]);
+        rns_mul(&ctx, tmp, e[2], e[3]);
+        rns_add(&ctx, acc, acc, tmp);
+        rns_mul(&ctx, acc, acc, e[4]);
+        for (int i = 0; i < 20; i++)
+            rns_mul(&ctx, acc, acc, acc);
+
+        bigint_t p01 = mod_prod(x[0], x[1], n), p23 = mod_prod(x[2], x[3], n);
+        bigint_t s = mod_sum(p01, p23, n);
+        bigint_t expect = mod_prod(s, x[4], n);
+        for (int i = 0; i < 20; i++) {
+            bigint_t sq = mod_prod(expect, expect, n);
+            bigint_delete(&expect);
+            expect = sq;
+        }
+        bigint_t got = rns_from(&ctx, acc);
+        errors += !bigint_equals(got, expect);
+        bigint_delete(&got);
+
+        // The same primes passed explicitly give the same element, and a
+        // context made from the shared modulus of another takes its limbs
+        rns_ctx_t again = rns_new(ctx.n, ctx.p, w);
+        rns_mul(&again, tmp, e[0], e[1]);
+        rns_mul(&ctx, acc, e[0], e[1]);
+        errors += again.k != ctx.k || memcmp(tmp, acc, sizeof(acc)) != 0;
+        errors += again.n.val != ctx.n.val;
+        rns_delete(&again);
+
+        bool test = errors == 0;
+        printf("%s: rns products and sums match mod_prod for a %zu-bit modulus (%zu channels)\n",
+            test ? "TRUE" : "FALSE", bits[t], w);
+        total_errors += !test;
+
+        bigint_delete(&p01);
+        bigint_delete(&p23);
+        bigint_delete(&s);
+        bigint_delete(&expect);
+        for (int i = 0; i < 5; i++)
+            bigint_delete(&x[i]);
+        rns_delete(&ctx);
+        bigint_delete(&n);
+    }
+
+    return total_errors;
+}
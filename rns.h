@@ -0,0 +1,69 @@
+/**
+ * rns.h: Residue number system arithmetic
+ *
+ * An element is stored as its residues modulo 2k word-size primes, one word
+ * per channel: base A is the first k primes and base B the last k. Products
+ * and sums act on each channel alone, with no carries between them. Products
+ * are Montgomery products with R = A (the product of base A): the quotient
+ * is formed in base A, carried over to base B by Bajard's fast base
+ * extension, the result divided by A in base B, and extended back to base A
+ * exactly by Kawamura's method, which recovers the overflow count from
+ * floating-point sums of the channels.
+ *
+ * Elements are in Montgomery form (x * A mod n) and only partly reduced:
+ * rns_mul returns values below (k + 1) n and accepts inputs below
+ * 2 (k + 1) n, so one rns_add of two products may feed another product.
+ * Contexts are not modified after rns_new, so threads may share one.
+ */
+
+#ifndef RNS_H
+#define RNS_H
+
+#include "bigint.h"
+
+enum {
+    RNS_PRIME_BITS = 62,            // Channel primes lie in (2^61, 2^62)
+    RNS_PARALLEL_CHANNELS = 256,    // Channels per base at which base extensions
+                                    // run on the default pool
+};
+
+typedef struct {
+    size_t k;           // Channels per base; elements are 2k words
+    bigint_t n;         // Modulus, shared with contexts made from it
+    bigint_t a_mod_n;   // A mod n, for conversion into Montgomery form
+    uword_t *p;         // Primes: base A then base B
+    uword_t *mu;        // Barrett constants floor(2^124 / p)
+    uword_t *q_a;       // -n^-1 (A / a_i)^-1 mod a_i
+    uword_t *ahat_b;    // A / a_i mod b_j, row j
+    uword_t *n_b;       // n mod b_j
+    uword_t *ainv_b;    // A^-1 mod b_j
+    uword_t *bhat_inv;  // (B / b_j)^-1 mod b_j
+    uword_t *bhat_a;    // B / b_j mod a_i, row i
+    uword_t *b_a;       // B mod a_i
+    uword_t *garner;    // a_j^-1 mod a_i for j < i, row i
+} rns_ctx_t;
+
+// Return context for positive n over count primes in (2^61, 2^62), half per
+// base, coprime to n, with A > 4 (k + 1)^2 n and B > 2 (k + 1) n. primes may
+// be NULL to pick the fewest primes below 2^62 that fit.
+rns_ctx_t rns_new(bigint_t n, const uword_t *primes, size_t count);
+
+// Free context
+void rns_delete(rns_ctx_t *ctx);
+
+// Convert a (any sign or size) into an element
+void rns_to(const rns_ctx_t *ctx, uword_t *out, bigint_t a);
+
+// Convert an element back, reduced into [0, n)
+bigint_t rns_from(const rns_ctx_t *ctx, const uword_t *a);
+
+// out = a * b / A, channel by channel with base extensions (out may alias a or b)
+void rns_mul(const rns_ctx_t *ctx, uword_t *out, const uword_t *a, const uword_t *b);
+
+// out = a + b, channel by channel
+void rns_add(const rns_ctx_t *ctx, uword_t *out, const uword_t *a, const uword_t *b);
+
+// Testing methods
+int rns_test(void);
+
+#endif // RNS_H
@@ -0,0 +1,43 @@
+/**
+ * tables.h: Constant tables generated at build time
+ *
+ * tables.c is written by gen_tables (see gen_tables.c) when the library is
+ * built, so none of these values is computed when a process starts. It holds
+ * the small primes declared in prime.h, the powers of ten behind decimal
+ * conversion, and Montgomery constants that mont_new takes for standard
+ * moduli instead of dividing.
+ */
+
+#ifndef TABLES_H
+#define TABLES_H
+
+#include <stdint.h>
+
+#include "bigint.h"
+
+enum {
+    TABLES_POW10 = 8,           // Powers 10^(19 * 2^j) for j < 8
+    TABLES_POW10_DIGITS = 19,   // Zeros in the first power, which fills a word
+    TABLES_MONT = 18,           // Standard moduli with Montgomery constants
+};
+
+// Limbs of 10^(TABLES_POW10_DIGITS * 2^j), the powers decimal conversion
+// splits at, least significant first, from tables_pow10_start[j] up to
+// tables_pow10_start[j + 1]
+extern const uword_t tables_pow10[];
+extern const uint16_t tables_pow10_start[TABLES_POW10 + 1];
+
+typedef struct {
+    const char *name;
+    size_t size;            // Words in the modulus
+    uword_t n0inv;          // -n^-1 mod 2^WORD_BITS
+    const uword_t *n;       // Modulus
+    const uword_t *r2;      // R^2 mod n
+    const uword_t *one;     // R mod n
+} tables_mont_t;
+
+// NIST, Curve25519 and secp256k1 field primes, then the RFC 3526 MODP and
+// RFC 7919 FFDHE group primes
+extern const tables_mont_t tables_mont[TABLES_MONT];
+
+#endif // TABLES_H
@@ -0,0 +1,499 @@
+/**
+ * tree.c: Product and remainder trees, and batch GCD
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "math.h"
+#include "primegen.h"
+#include "tree.h"
+
+enum {
+    TREE_CHUNK_PER_THREAD = 4,  // Nodes per worker between writes of a level
+};
+
+// One level of a tree, in memory or in an unlinked temporary file
+typedef struct {
+    size_t count;       // Nodes in the level
+    size_t filled;      // Nodes stored so far
+    bigint_t *nodes;    // Nodes in memory, NULL when spilled
+    bool borrowed;      // nodes belongs to the caller
+    int fd;             // Spill file, -1 when in memory
+    off_t *offsets;     // File offset of every node, then the end
+    size_t bytes;       // Limb bytes stored
+} tree_level_t;
+
+// State of one tree computation
+typedef struct {
+    tree_opts_t opts;
+    pool_t *pool;
+    size_t in_memory;       // Limb bytes of the levels held in memory
+    size_t height;
+    tree_level_t *levels;   // Leaves first, root last
+    tree_stats_t stats;
+} tree_ctx_t;
+
+// Start a computation with the given options (NULL: defaults)
+static void tree_ctx_init(tree_ctx_t *t, const tree_opts_t *opts)
+{
+    memset(t, 0, sizeof(*t));
+    if (opts)
+        t->opts = *opts;
+    t->pool = t->opts.pool ? t->opts.pool : pool_default();
+}
+
+// Open an unlinked spill file for a level, return false on failure
+static bool tree_spill_open(tree_ctx_t *t, tree_level_t *l)
+{
+    const char *dir = t->opts.spill_dir;
+    if (!dir)
+        dir = getenv("TMPDIR");
+    if (!dir || !*dir)
+        dir = "/tmp";
+
+    size_t len = strlen(dir) + sizeof("/lcrypt-tree-XXXXXX");
+    char path[len];
+    snprintf(path, len, "%s/lcrypt-tree-XXXXXX", dir);
+    l->fd = mkstemp(path);
+    if (l->fd < 0) {
+        fprintf(stderr, "tree_spill_open: WARNING: cannot create a file in %s, "
+            "keeping the level in memory\n", dir);
+        return false;
+    }
+    unlink(path);
+    l->offsets = calloc(l->count + 1, sizeof(off_t));
+    t->stats.spilled++;
+    return true;
+}
+
+// Prepare an empty level of count nodes, expected to hold about `estimate`
+// limb bytes; it goes to disk if that would exceed the memory budget
+static void tree_level_init(tree_ctx_t *t, tree_level_t *l, size_t count, size_t estimate)
+{
+    memset(l, 0, sizeof(*l));
+    l->count = count;
+    l->fd = -1;
+    if (t->opts.memory_bytes && t->in_memory + estimate > t->opts.memory_bytes
+            && tree_spill_open(t, l))
+        return;
+    l->nodes = calloc(count, sizeof(bigint_t));
+}
+
+// Make a level of the caller's nodes, filled ones included
+static void tree_level_wrap(tree_ctx_t *t, tree_level_t *l, bigint_t *nodes, size_t count,
+        size_t filled)
+{
+    memset(l, 0, sizeof(*l));
+    l->count = count;
+    l->filled = filled;
+    l->nodes = nodes;
+    l->borrowed = true;
+    l->fd = -1;
+    for (size_t i = 0; i < filled; i++)
+        l->bytes += nodes[i].size * sizeof(uword_t);
+    t->in_memory += l->bytes;
+}
+
+// Write or read all of buf at offset, aborting on I/O errors
+static void tree_io(tree_level_t *l, void *buf, size_t len, off_t offset, bool write)
+{
+    char *p = buf;
+    while (len) {
+        ssize_t r = write ? pwrite(l->fd, p, len, offset) : pread(l->fd, p, len, offset);
+        if (r <= 0) {
+            fprintf(stderr, "tree_io: ERROR: %s of a spilled level failed\n",
+                write ? "write" : "read");
+            abort();
+        }
+        p += r;
+        len -= r;
+        offset += r;
+    }
+}
+
+// Append x to a level, taking ownership of it
+static void tree_level_put(tree_ctx_t *t, tree_level_t *l, bigint_t x)
+{
+    size_t bytes = x.size * sizeof(uword_t);
+    l->bytes += bytes;
+    if (l->nodes) {
+        l->nodes[l->filled++] = x;
+        t->in_memory += bytes;
+        return;
+    }
+
+    off_t offset = l->offsets[l->filled];
+    tree_io(l, &x.size, sizeof(x.size), offset, true);
+    tree_io(l, x.val, bytes, offset + sizeof(x.size), true);
+    l->offsets[++l->filled] = offset + sizeof(x.size) + bytes;
+    t->stats.spill_bytes += sizeof(x.size) + bytes;
+    bigint_delete(&x);
+}
+
+// Return node i of a level; pass it to tree_level_release when done.
+// Safe to call from several threads.
+static bigint_t tree_level_get(const tree_level_t *l, size_t i)
+{
+    if (l->nodes)
+        return l->nodes[i];
+
+    size_t size;
+    tree_io((tree_level_t *)l, &size, sizeof(size), l->offsets[i], false);
+    bigint_t x = bigint_zero(size);
+    tree_io((tree_level_t *)l, x.val, size * sizeof(uword_t), l->offsets[i] + sizeof(size), false);
+    return x;
+}
+
+// Release a node returned by tree_level_get
+static void tree_level_release(const tree_level_t *l, bigint_t *x)
+{
+    if (!l->nodes)
+        bigint_delete(x);
+}
+
+// Free a level and the nodes it owns
+static void tree_level_free(tree_ctx_t *t, tree_level_t *l)
+{
+    if (l->fd >= 0) {
+        close(l->fd);
+        free(l->offsets);
+    } else {
+        t->in_memory -= l->bytes;
+        for (size_t i = 0; !l->borrowed && i < l->filled; i++)
+            bigint_delete(&l->nodes[i]);
+        if (!l->borrowed)
+            free(l->nodes);
+    }
+    memset(l, 0, sizeof(*l));
+    l->fd = -1;
+}
+
+// Computation of the nodes of one level from other levels
+typedef struct {
+    bigint_t (*node)(void *arg, size_t i);
+    void *arg;
+    size_t start;
+    bigint_t *results;
+} tree_map_t;
+
+typedef struct {
+    tree_map_t *map;
+    size_t i;
+} tree_map_task_t;
+
+static void tree_map_task(void *arg)
+{
+    tree_map_task_t *task = arg;
+    tree_map_t *map = task->map;
+    map->results[task->i - map->start] = map->node(map->arg, task->i);
+}
+
+// Fill the level out with node(arg, i) for every i, computed by the pool
+// a chunk at a time so spilled levels stream through memory
+static void tree_map(tree_ctx_t *t, tree_level_t *out, bigint_t (*node)(void *, size_t),
+        void *arg)
+{
+    const size_t chunk = TREE_CHUNK_PER_THREAD * pool_threads(t->pool);
+    tree_map_t map = { .node = node, .arg = arg, .results = malloc(chunk * sizeof(bigint_t)) };
+    tree_map_task_t *tasks = malloc(chunk * sizeof(tree_map_task_t));
+
+    for (map.start = 0; map.start < out->count; map.start += chunk) {
+        size_t end = map.start + chunk < out->count ? map.start + chunk : out->count;
+        if (end - map.start == 1 || pool_threads(t->pool) < 2) {
+            for (size_t i = map.start; i < end; i++)
+                map.results[i - map.start] = node(arg, i);
+        } else {
+            pool_group_t group;
+            pool_group_init(&group);
+            for (size_t i = map.start; i < end; i++) {
+                tasks[i - map.start] = (tree_map_task_t){ .map = &map, .i = i };
+                pool_submit(t->pool, &group, tree_map_task, &tasks[i - map.start]);
+            }
+            pool_wait(t->pool, &group);
+        }
+        for (size_t i = map.start; i < end; i++)
+            tree_level_put(t, out, map.results[i - map.start]);
+    }
+
+    free(map.results);
+    free(tasks);
+}
+
+// Node i of the level above src: the product of its two children
+static bigint_t tree_prod_node(void *arg, size_t i)
+{
+    const tree_level_t *src = arg;
+    bigint_t a = tree_level_get(src, 2 * i);
+    bigint_t out;
+    if (2 * i + 1 < src->count) {
+        bigint_t b = tree_level_get(src, 2 * i + 1);
+        out = bigint_prod(a, b);
+        tree_level_release(src, &b);
+    } else {
+        out = bigint_copy(a);
+    }
+    tree_level_release(src, &a);
+    return out;
+}
+
+// Build the product tree of the k leaves x
+static void tree_build(tree_ctx_t *t, const bigint_t *x, size_t k)
+{
+    t->height = 1;
+    for (size_t count = k; count > 1; count = (count + 1) / 2)
+        t->height++;
+    t->levels = calloc(t->height, sizeof(tree_level_t));
+    t->stats.levels = t->height;
+
+    tree_level_wrap(t, &t->levels[0], (bigint_t *)x, k, k);
+    for (size_t j = 1; j < t->height; j++) {
+        tree_level_t *below = &t->levels[j - 1];
+        tree_level_init(t, &t->levels[j], (below->count + 1) / 2, below->bytes);
+        tree_map(t, &t->levels[j], tree_prod_node, below);
+    }
+}
+
+// Free the tree and its levels
+static void tree_free(tree_ctx_t *t)
+{
+    for (size_t j = 0; j < t->height; j++)
+        tree_level_free(t, &t->levels[j]);
+    free(t->levels);
+    t->levels = NULL;
+    t->height = 0;
+}
+
+typedef struct {
+    const tree_level_t *prod;   // Products of the level being reduced to
+    const tree_level_t *above;  // Remainders of the parents
+    bool squares;               // Reduce modulo the squares of the products
+} tree_rem_arg_t;
+
+// Node i of a remainder level: its parent's remainder mod the product (or
+// its square)
+static bigint_t tree_rem_node(void *arg, size_t i)
+{
+    const tree_rem_arg_t *r = arg;
+    bigint_t parent = tree_level_get(r->above, i / 2);
+    bigint_t p = tree_level_get(r->prod, i);
+    bigint_t m = r->squares ? bigint_prod(p, p) : p;
+    bigint_t rem;
+    bigint_t q = bigint_div(parent, m, &rem);
+    bigint_delete(&q);
+    if (r->squares)
+        bigint_delete(&m);
+    tree_level_release(r->prod, &p);
+    tree_level_release(r->above, &parent);
+    return rem;
+}
+
+// Reduce top down the built tree and return the leaf remainders in a level,
+// freeing the product levels above the leaves as it goes
+static tree_level_t tree_descend(tree_ctx_t *t, bigint_t top, bool squares)
+{
+    tree_level_t above;
+    tree_level_init(t, &above, 1, top.size * sizeof(uword_t));
+    tree_level_put(t, &above, top);
+
+    for (size_t j = t->height - 1; j-- > 0; ) {
+        tree_level_t level;
+        tree_level_init(t, &level, t->levels[j].count, t->levels[j].bytes << squares);
+        tree_rem_arg_t arg = { .prod = &t->levels[j], .above = &above, .squares = squares };
+        tree_map(t, &level, tree_rem_node, &arg);
+        tree_level_free(t, &above);
+        tree_level_free(t, &t->levels[j + 1]);
+        above = level;
+    }
+    return above;
+}
+
+// Return the product of the k non-negative numbers x (1 for k = 0)
+bigint_t tree_prod(const bigint_t *x, size_t k, const tree_opts_t *opts)
+{
+    if (k == 0)
+        return long_to_bigint(1);
+
+    tree_ctx_t t;
+    tree_ctx_init(&t, opts);
+    tree_build(&t, x, k);
+    bigint_t root = tree_level_get(&t.levels[t.height - 1], 0);
+    bigint_t out = bigint_copy(root);
+    tree_level_release(&t.levels[t.height - 1], &root);
+    tree_free(&t);
+    return out;
+}
+
+// Set out[i] = a mod m[i] for non-negative a and k positive moduli
+void tree_rem(bigint_t a, const bigint_t *m, size_t k, bigint_t *out,
+        const tree_opts_t *opts)
+{
+    if (k == 0)
+        return;
+
+    tree_ctx_t t;
+    tree_ctx_init(&t, opts);
+    tree_build(&t, m, k);
+
+    bigint_t root = tree_level_get(&t.levels[t.height - 1], 0);
+    bigint_t top;
+    bigint_t q = bigint_div(a, root, &top);
+    bigint_delete(&q);
+    tree_level_release(&t.levels[t.height - 1], &root);
+
+    tree_level_t rem = tree_descend(&t, top, false);
+    for (size_t i = 0; i < k; i++)
+        out[i] = rem.nodes ? rem.nodes[i] : tree_level_get(&rem, i);
+    if (rem.nodes)
+        rem.filled = 0;     // Handed over to out
+    tree_level_free(&t, &rem);
+    tree_free(&t);
+}
+
+typedef struct {
+    const tree_level_t *leaves;
+    const tree_level_t *rem;    // P mod n_i^2 for the product P of all n_i
+} tree_gcd_arg_t;
+
+// gcd(n_i, P / n_i) = gcd(n_i, (P mod n_i^2) / n_i)
+static bigint_t tree_gcd_node(void *arg, size_t i)
+{
+    const tree_gcd_arg_t *g = arg;
+    bigint_t n = tree_level_get(g->leaves, i);
+    bigint_t r = tree_level_get(g->rem, i);
+    bigint_t rem;
+    bigint_t q = bigint_div(r, n, &rem);
+    bigint_t out = bigint_gcd(q, n);
+    bigint_delete(&q);
+    bigint_delete(&rem);
+    tree_level_release(g->rem, &r);
+    tree_level_release(g->leaves, &n);
+    return out;
+}
+
+// Set out[i] = gcd(n[i], product of the other n[j]) for k integers n[i] > 1
+void tree_batch_gcd(const bigint_t *n, size_t k, bigint_t *out,
+        const tree_opts_t *opts, tree_stats_t *stats)
+{
+    tree_ctx_t t;
+    tree_ctx_init(&t, opts);
+    if (k > 0) {
+        tree_build(&t, n, k);
+        bigint_t root = tree_level_get(&t.levels[t.height - 1], 0);
+        bigint_t top = bigint_copy(root);
+        tree_level_release(&t.levels[t.height - 1], &root);
+
+        tree_level_t rem = tree_descend(&t, top, true);
+        tree_level_t result;
+        tree_level_wrap(&t, &result, out, k, 0);
+        tree_gcd_arg_t arg = { .leaves = &t.levels[0], .rem = &rem };
+        tree_map(&t, &result, tree_gcd_node, &arg);
+        tree_level_free(&t, &result);
+        tree_level_free(&t, &rem);
+        tree_free(&t);
+    }
+    if (stats)
+        *stats = t.stats;
+}
+
+// Testing
+int tree_test(void)
+{
+    int total_errors = 0;
+    bool test;
+
+    // Products and remainders of a few dozen numbers against the plain loop
+    const size_t k = 37;
+    bigint_t x[k], rem[k];
+    bigint_t expect = long_to_bigint(1);
+    for (size_t i = 0; i < k; i++) {
+        x[i] = bigint_random_bits(64 + 29 * i);
+        x[i].val[0] |= 1;
+        bigint_t tmp = bigint_prod(expect, x[i]);
+        bigint_delete(&expect);
+        expect = tmp;
+    }
+    bigint_t prod = tree_prod(x, k, NULL);
+    test = bigint_equals(prod, expect);
+    printf("%s: tree_prod of %zu numbers matches sequential products\n",
+        test ? "TRUE" : "FALSE", k);
+    total_errors += !test;
+
+    bigint_t a = bigint_random_bits(bigint_bits(prod) + 100);
+    tree_rem(a, x, k, rem, NULL);
+    int errors = 0;
+    for (size_t i = 0; i < k; i++) {
+        bigint_t r;
+        bigint_t q = bigint_div(a, x[i], &r);
+        errors += !bigint_equals(r, rem[i]);
+        bigint_delete(&q);
+        bigint_delete(&r);
+        bigint_delete(&rem[i]);
+    }
+    test = errors == 0;
+    printf("%s: tree_rem of %zu moduli matches bigint_div\n", test ? "TRUE" : "FALSE", k);
+    total_errors += !test;
+    bigint_delete(&a);
+    bigint_delete(&prod);
+    bigint_delete(&expect);
+    for (size_t i = 0; i < k; i++)
+        bigint_delete(&x[i]);
+
+    // RSA-like moduli from a pool of primes, some sharing one, one duplicated,
+    // in memory and spilled to disk on a private pool
+    enum { KEYS = 21, PRIMES = 40 };
+    bigint_t p[PRIMES], n[KEYS], g[KEYS];
+    static const size_t pick[KEYS][2] = {
+        { 0, 1 }, { 2, 3 }, { 4, 5 }, { 0, 6 }, { 7, 8 }, { 9, 10 }, { 11, 12 },
+        { 13, 14 }, { 15, 16 }, { 17, 18 }, { 19, 20 }, { 21, 22 }, { 23, 24 },
+        { 25, 26 }, { 6, 27 }, { 28, 29 }, { 30, 31 }, { 32, 33 }, { 34, 35 },
+        { 36, 37 }, { 2, 3 },
+    };
+    for (size_t i = 0; i < PRIMES; i++)
+        p[i] = prime_generate(96, &(prime_search_opts_t){ .threads = 1 }, NULL);
+    for (size_t i = 0; i < KEYS; i++)
+        n[i] = bigint_prod(p[pick[i][0]], p[pick[i][1]]);
+
+    pool_t *pool = pool_new(3);
+    const tree_opts_t opts[] = {
+        { 0 },
+        { .pool = pool, .memory_bytes = 1 },
+    };
+    for (size_t o = 0; o < sizeof(opts) / sizeof(opts[0]); o++) {
+        tree_stats_t stats;
+        tree_batch_gcd(n, KEYS, g, &opts[o], &stats);
+        errors = 0;
+        for (size_t i = 0; i < KEYS; i++) {
+            // Expected: the primes of n[i] that some other key also uses
+            bigint_t want = long_to_bigint(1);
+            for (size_t f = 0; f < 2; f++) {
+                bool shared = false;
+                for (size_t j = 0; j < KEYS; j++)
+                    shared |= j != i && (pick[j][0] == pick[i][f] || pick[j][1] == pick[i][f]);
+                if (shared) {
+                    bigint_t tmp = bigint_prod(want, p[pick[i][f]]);
+                    bigint_delete(&want);
+                    want = tmp;
+                }
+            }
+            errors += !bigint_equals(g[i], want);
+            bigint_delete(&want);
+            bigint_delete(&g[i]);
+        }
+        test = errors == 0 && stats.levels == 6 && (o == 0 ? stats.spilled == 0
+            : stats.spilled > 0 && stats.spill_bytes > 0);
+        printf("%s: tree_batch_gcd finds shared factors of %d moduli (%zu levels spilled)\n",
+            test ? "TRUE" : "FALSE", KEYS, stats.spilled);
+        total_errors += !test;
+    }
+    pool_delete(pool);
+
+    for (size_t i = 0; i < PRIMES; i++)
+        bigint_delete(&p[i]);
+    for (size_t i = 0; i < KEYS; i++)
+        bigint_delete(&n[i]);
+
+    return total_errors;
+}
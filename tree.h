@@ -0,0 +1,48 @@
+/**
+ * tree.h: Product and remainder trees, and batch GCD
+ *
+ * A product tree holds the inputs at its leaves and the product of its two
+ * children at every other node. Reducing a number down such a tree, each
+ * node modulo its own value, gives its remainders modulo every leaf for the
+ * price of a few full-size products. Bernstein's batch GCD reduces the root
+ * modulo the squares instead, which yields gcd(n_i, prod_{j != i} n_j) for
+ * every input at once. Each level of a tree is computed by the pool workers,
+ * and levels that do not fit the memory budget are streamed to disk.
+ */
+
+#ifndef TREE_H
+#define TREE_H
+
+#include "bigint.h"
+#include "pool.h"
+
+typedef struct {
+    pool_t *pool;           // Workers for the nodes of a level (NULL: default pool)
+    size_t memory_bytes;    // Limb bytes kept in memory before levels go to
+                            // disk (0: keep everything in memory)
+    const char *spill_dir;  // Directory for spilled levels (NULL: $TMPDIR or /tmp)
+} tree_opts_t;
+
+typedef struct {
+    size_t levels;          // Levels of the product tree, leaves included
+    size_t spilled;         // Levels written to disk
+    size_t spill_bytes;     // Bytes written to disk
+} tree_stats_t;
+
+// Return the product of the k non-negative numbers x (1 for k = 0)
+bigint_t tree_prod(const bigint_t *x, size_t k, const tree_opts_t *opts);
+
+// Set out[i] = a mod m[i] for non-negative a and k positive moduli
+void tree_rem(bigint_t a, const bigint_t *m, size_t k, bigint_t *out,
+        const tree_opts_t *opts);
+
+// Set out[i] = gcd(n[i], product of the other n[j]) for k integers n[i] > 1.
+// out[i] == n[i] flags a modulus whose every factor is shared, e.g. a
+// duplicate. opts and stats may be NULL.
+void tree_batch_gcd(const bigint_t *n, size_t k, bigint_t *out,
+        const tree_opts_t *opts, tree_stats_t *stats);
+
+// Testing methods
+int tree_test(void);
+
+#endif // TREE_H
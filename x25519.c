@@ -0,0 +1,475 @@
+/**
+ * x25519.c: X25519 key exchange (RFC 7748) over GF(2^255 - 19)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bigint.h"
+#include "math.h"
+#include "mod_math.h"
+#include "rng.h"
+#include "x25519.h"
+
+/**
+ * Field elements are five 51-bit digits, v[0] least significant, so the sum
+ * of a row of digit products fits in 128 bits and 2^255 folds back in as 19.
+ * Digits may exceed 51 bits between operations: mul and sqr accept digits
+ * below 2^54 and return them below 2^52, so a sum or difference of two
+ * products can go straight back in without carrying first.
+ */
+
+#define FE_MASK (((uint64_t)1 << 51) - 1)
+
+typedef struct {
+    uint64_t v[5];
+} fe_t;
+
+// 2p in the digit layout, added before subtracting to keep digits positive
+static const fe_t fe_2p = { {
+    0xfffffffffffdaull, 0xffffffffffffeull, 0xffffffffffffeull,
+    0xffffffffffffeull, 0xffffffffffffeull,
+} };
+
+// h = f + g
+static inline void fe_add(fe_t *h, const fe_t *f, const fe_t *g)
+{
+    for (int i = 0; i < 5; i++)
+        h->v[i] = f->v[i] + g->v[i];
+}
+
+// h = f - g for g with digits below 2^52
+static inline void fe_sub(fe_t *h, const fe_t *f, const fe_t *g)
+{
+    for (int i = 0; i < 5; i++)
+        h->v[i] = f->v[i] + fe_2p.v[i] - g->v[i];
+}
+
+// Carry the column sums r into h
+static inline void fe_carry(fe_t *h, udword_t r[5])
+{
+    r[1] += (uint64_t)(r[0] >> 51);
+    r[2] += (uint64_t)(r[1] >> 51);
+    r[3] += (uint64_t)(r[2] >> 51);
+    r[4] += (uint64_t)(r[3] >> 51);
+    uint64_t c = (uint64_t)(r[4] >> 51);
+    h->v[0] = ((uint64_t)r[0] & FE_MASK) + c * 19;
+    h->v[1] = ((uint64_t)r[1] & FE_MASK) + (h->v[0] >> 51);
+    h->v[0] &= FE_MASK;
+    h->v[2] = (uint64_t)r[2] & FE_MASK;
+    h->v[3] = (uint64_t)r[3] & FE_MASK;
+    h->v[4] = (uint64_t)r[4] & FE_MASK;
+}
+
+// h = f * g
+static inline void fe_mul(fe_t *h, const fe_t *f, const fe_t *g)
+{
+    uint64_t f0 = f->v[0], f1 = f->v[1], f2 = f->v[2], f3 = f->v[3], f4 = f->v[4];
+    uint64_t g0 = g->v[0], g1 = g->v[1], g2 = g->v[2], g3 = g->v[3], g4 = g->v[4];
+    uint64_t g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3, g4_19 = 19 * g4;
+
+    udword_t r[5];
+    r[0] = (udword_t)f0 * g0 + (udword_t)f1 * g4_19 + (udword_t)f2 * g3_19
+        + (udword_t)f3 * g2_19 + (udword_t)f4 * g1_19;
+    r[1] = (udword_t)f0 * g1 + (udword_t)f1 * g0 + (udword_t)f2 * g4_19
+        + (udword_t)f3 * g3_19 + (udword_t)f4 * g2_19;
+    r[2] = (udword_t)f0 * g2 + (udword_t)f1 * g1 + (udword_t)f2 * g0
+        + (udword_t)f3 * g4_19 + (udword_t)f4 * g3_19;
+    r[3] = (udword_t)f0 * g3 + (udword_t)f1 * g2 + (udword_t)f2 * g1
+        + (udword_t)f3 * g0 + (udword_t)f4 * g4_19;
+    r[4] = (udword_t)f0 * g4 + (udword_t)f1 * g3 + (udword_t)f2 * g2
+        + (udword_t)f3 * g1 + (udword_t)f4 * g0;
+    fe_carry(h, r);
+}
+
+// h = f^2
+static inline void fe_sqr(fe_t *h, const fe_t *f)
+{
+    uint64_t f0 = f->v[0], f1 = f->v[1], f2 = f->v[2], f3 = f->v[3], f4 = f->v[4];
+    uint64_t d0 = 2 * f0, d1 = 2 * f1;
+    uint64_t d2_19 = 38 * f2, d3_19 = 38 * f3, f3_19 = 19 * f3, f4_19 = 19 * f4;
+
+    udword_t r[5];
+    r[0] = (udword_t)f0 * f0 + (udword_t)d1 * f4_19 + (udword_t)d2_19 * f3;
+    r[1] = (udword_t)d0 * f1 + (udword_t)d2_19 * f4 + (udword_t)f3_19 * f3;
+    r[2] = (udword_t)d0 * f2 + (udword_t)f1 * f1 + (udword_t)d3_19 * f4;
+    r[3] = (udword_t)d0 * f3 + (udword_t)d1 * f2 + (udword_t)f4_19 * f4;
+    r[4] = (udword_t)d0 * f4 + (udword_t)d1 * f3 + (udword_t)f2 * f2;
+    fe_carry(h, r);
+}
+
+// h = f^(2^k)
+static void fe_sqr_n(fe_t *h, const fe_t *f, int k)
+{
+    fe_sqr(h, f);
+    while (--k > 0)
+        fe_sqr(h, h);
+}
+
+// h = f * k for small k
+static inline void fe_mul_small(fe_t *h, const fe_t *f, uint32_t k)
+{
+    udword_t r[5];
+    for (int i = 0; i < 5; i++)
+        r[i] = (udword_t)f->v[i] * k;
+    fe_carry(h, r);
+}
+
+// h = f^-1 = f^(p - 2), by the usual chain of 254 squarings and 11 products
+static void fe_inv(fe_t *h, const fe_t *f)
+{
+    fe_t z2, z9, z11, z_5_0, z_10_0, z_20_0, z_50_0, z_100_0, t;
+
+    fe_sqr(&z2, f);                     // 2
+    fe_sqr_n(&t, &z2, 2);               // 8
+    fe_mul(&z9, &t, f);                 // 9
+    fe_mul(&z11, &z9, &z2);             // 11
+    fe_sqr(&t, &z11);                   // 22
+    fe_mul(&z_5_0, &t, &z9);            // 2^5 - 1
+    fe_sqr_n(&t, &z_5_0, 5);
+    fe_mul(&z_10_0, &t, &z_5_0);        // 2^10 - 1
+    fe_sqr_n(&t, &z_10_0, 10);
+    fe_mul(&z_20_0, &t, &z_10_0);       // 2^20 - 1
+    fe_sqr_n(&t, &z_20_0, 20);
+    fe_mul(&t, &t, &z_20_0);            // 2^40 - 1
+    fe_sqr_n(&t, &t, 10);
+    fe_mul(&z_50_0, &t, &z_10_0);       // 2^50 - 1
+    fe_sqr_n(&t, &z_50_0, 50);
+    fe_mul(&z_100_0, &t, &z_50_0);      // 2^100 - 1
+    fe_sqr_n(&t, &z_100_0, 100);
+    fe_mul(&t, &t, &z_100_0);           // 2^200 - 1
+    fe_sqr_n(&t, &t, 50);
+    fe_mul(&t, &t, &z_50_0);            // 2^250 - 1
+    fe_sqr_n(&t, &t, 5);
+    fe_mul(h, &t, &z11);                // 2^255 - 21
+}
+
+// Swap f and g if swap is 1, without branching on it
+static inline void fe_cswap(fe_t *f, fe_t *g, uint64_t swap)
+{
+    uint64_t mask = -swap;
+    for (int i = 0; i < 5; i++) {
+        uint64_t x = mask & (f->v[i] ^ g->v[i]);
+        f->v[i] ^= x;
+        g->v[i] ^= x;
+    }
+}
+
+// Return the little-endian 64-bit word at s
+static inline uint64_t fe_load64(const uint8_t *s)
+{
+    uint64_t x = 0;
+    for (int i = 7; i >= 0; i--)
+        x = (x << 8) | s[i];
+    return x;
+}
+
+// h = s, ignoring the top bit as the RFC requires
+static void fe_from_bytes(fe_t *h, const uint8_t s[X25519_BYTES])
+{
+    h->v[0] = fe_load64(s) & FE_MASK;
+    h->v[1] = (fe_load64(s + 6) >> 3) & FE_MASK;
+    h->v[2] = (fe_load64(s + 12) >> 6) & FE_MASK;
+    h->v[3] = (fe_load64(s + 19) >> 1) & FE_MASK;
+    h->v[4] = (fe_load64(s + 24) >> 12) & FE_MASK;
+}
+
+// s = f, fully reduced mod p
+static void fe_to_bytes(uint8_t s[X25519_BYTES], const fe_t *f)
+{
+    udword_t r[5];
+    fe_t h;
+    for (int i = 0; i < 5; i++)
+        r[i] = f->v[i];
+    fe_carry(&h, r);
+
+    // h < 2^255 + 2^52 here; q = 1 iff h >= p, i.e. h + 19 carries past 2^255
+    uint64_t q = (h.v[0] + 19) >> 51;
+    q = (h.v[1] + q) >> 51;
+    q = (h.v[2] + q) >> 51;
+    q = (h.v[3] + q) >> 51;
+    q = (h.v[4] + q) >> 51;
+
+    // h - p = h + 19 - 2^255, dropping the carry out of the top digit
+    h.v[0] += 19 * q;
+    h.v[1] += h.v[0] >> 51;
+    h.v[0] &= FE_MASK;
+    h.v[2] += h.v[1] >> 51;
+    h.v[1] &= FE_MASK;
+    h.v[3] += h.v[2] >> 51;
+    h.v[2] &= FE_MASK;
+    h.v[4] += h.v[3] >> 51;
+    h.v[3] &= FE_MASK;
+    h.v[4] &= FE_MASK;
+
+    uint64_t w[4] = {
+        h.v[0] | h.v[1] << 51,
+        h.v[1] >> 13 | h.v[2] << 38,
+        h.v[2] >> 26 | h.v[3] << 25,
+        h.v[3] >> 39 | h.v[4] << 12,
+    };
+    for (int i = 0; i < X25519_BYTES; i++)
+        s[i] = (uint8_t)(w[i / 8] >> (8 * (i % 8)));
+}
+
+// Copy scalar into k, clamped as the RFC requires
+static void x25519_clamp(uint8_t k[X25519_BYTES], const uint8_t scalar[X25519_BYTES])
+{
+    memcpy(k, scalar, X25519_BYTES);
+    k[0] &= 248;
+    k[31] &= 127;
+    k[31] |= 64;
+}
+
+// out = scalar * u, with the scalar clamped as the RFC requires
+// The ladder touches the same memory and runs the same instructions for
+// every scalar: the only scalar-dependent step is the masked swap.
+void x25519(uint8_t out[X25519_BYTES], const uint8_t scalar[X25519_BYTES],
+        const uint8_t u[X25519_BYTES])
+{
+    uint8_t k[X25519_BYTES];
+    x25519_clamp(k, scalar);
+
+    fe_t x1, x2 = { { 1 } }, z2 = { { 0 } }, x3, z3 = { { 1 } };
+    fe_from_bytes(&x1, u);
+    x3 = x1;
+
+    uint64_t swap = 0;
+    for (int t = X25519_LADDER_STEPS - 1; t >= 0; t--) {
+        uint64_t bit = (k[t / 8] >> (t % 8)) & 1;
+        swap ^= bit;
+        fe_cswap(&x2, &x3, swap);
+        fe_cswap(&z2, &z3, swap);
+        swap = bit;
+
+        fe_t a, aa, b, bb, e, c, d, da, cb;
+        fe_add(&a, &x2, &z2);
+        fe_sqr(&aa, &a);
+        fe_sub(&b, &x2, &z2);
+        fe_sqr(&bb, &b);
+        fe_sub(&e, &aa, &bb);
+        fe_add(&c, &x3, &z3);
+        fe_sub(&d, &x3, &z3);
+        fe_mul(&da, &d, &a);
+        fe_mul(&cb, &c, &b);
+
+        fe_add(&x3, &da, &cb);
+        fe_sqr(&x3, &x3);
+        fe_sub(&z3, &da, &cb);
+        fe_sqr(&z3, &z3);
+        fe_mul(&z3, &z3, &x1);
+        fe_mul(&x2, &aa, &bb);
+        fe_mul_small(&z2, &e, 121665);
+        fe_add(&z2, &z2, &aa);
+        fe_mul(&z2, &z2, &e);
+    }
+    fe_cswap(&x2, &x3, swap);
+    fe_cswap(&z2, &z3, swap);
+
+    fe_inv(&z2, &z2);
+    fe_mul(&x2, &x2, &z2);
+    fe_to_bytes(out, &x2);
+}
+
+// out = scalar * 9, the public key for private key scalar
+void x25519_base(uint8_t out[X25519_BYTES], const uint8_t scalar[X25519_BYTES])
+{
+    static const uint8_t base[X25519_BYTES] = { 9 };
+    x25519(out, scalar, base);
+}
+
+// Return s as a non-negative bigint, top bit cleared if mask is set
+static bigint_t x25519_to_bigint(const uint8_t s[X25519_BYTES], bool mask)
+{
+    uword_t w[X25519_BYTES / sizeof(uword_t)];
+    for (size_t i = 0; i < X25519_BYTES / sizeof(uword_t); i++)
+        w[i] = fe_load64(s + 8 * i);
+    if (mask)
+        w[3] &= ~((uword_t)1 << 63);
+    return bigint_from_limbs(w, X25519_BYTES / sizeof(uword_t));
+}
+
+// Replace a with mod_prod(a, b, p), freeing the old value
+static void x25519_prod(bigint_t *a, bigint_t b, bigint_t p)
+{
+    bigint_t out = mod_prod(*a, b, p);
+    bigint_delete(a);
+    *a = out;
+}
+
+// x25519 computed on bigints with mod_prod and friends (not constant time)
+void x25519_generic(uint8_t out[X25519_BYTES], const uint8_t scalar[X25519_BYTES],
+        const uint8_t u[X25519_BYTES])
+{
+    uint8_t k[X25519_BYTES];
+    x25519_clamp(k, scalar);
+
+    bigint_t p = bigint_new("57896044618658097711785492504343953926634992332820282019728792003956564819949");
+    bigint_t a24 = long_to_bigint(121665);
+    bigint_t zero = long_to_bigint(0);
+    bigint_t raw = x25519_to_bigint(u, true);
+    bigint_t x1 = mod_sum(raw, zero, p);
+    bigint_delete(&raw);
+    bigint_t x2 = long_to_bigint(1), z2 = long_to_bigint(0);
+    bigint_t x3 = bigint_copy(x1), z3 = long_to_bigint(1);
+
+    for (int t = X25519_LADDER_STEPS - 1; t >= 0; t--) {
+        if ((k[t / 8] >> (t % 8)) & 1) {
+            bigint_t tmp = x2; x2 = x3; x3 = tmp;
+            tmp = z2; z2 = z3; z3 = tmp;
+        }
+
+        bigint_t a = mod_sum(x2, z2, p);
+        bigint_t aa = mod_prod(a, a, p);
+        bigint_t b = mod_diff(x2, z2, p);
+        bigint_t bb = mod_prod(b, b, p);
+        bigint_t e = mod_diff(aa, bb, p);
+        bigint_t c = mod_sum(x3, z3, p);
+        bigint_t d = mod_diff(x3, z3, p);
+        bigint_t da = mod_prod(d, a, p);
+        bigint_t cb = mod_prod(c, b, p);
+        bigint_delete(&x2);
+        bigint_delete(&z2);
+        bigint_delete(&x3);
+        bigint_delete(&z3);
+
+        x3 = mod_sum(da, cb, p);
+        x25519_prod(&x3, x3, p);
+        z3 = mod_diff(da, cb, p);
+        x25519_prod(&z3, z3, p);
+        x25519_prod(&z3, x1, p);
+        x2 = mod_prod(aa, bb, p);
+        z2 = mod_prod(a24, e, p);
+        bigint_t sum = mod_sum(z2, aa, p);
+        bigint_delete(&z2);
+        z2 = mod_prod(sum, e, p);
+        bigint_delete(&sum);
+
+        if ((k[t / 8] >> (t % 8)) & 1) {
+            bigint_t tmp = x2; x2 = x3; x3 = tmp;
+            tmp = z2; z2 = z3; z3 = tmp;
+        }
+        bigint_delete(&a);
+        bigint_delete(&aa);
+        bigint_delete(&b);
+        bigint_delete(&bb);
+        bigint_delete(&e);
+        bigint_delete(&c);
+        bigint_delete(&d);
+        bigint_delete(&da);
+        bigint_delete(&cb);
+    }
+
+    // x2 / z2 by Fermat, z2^(p - 2)
+    bigint_t two = long_to_bigint(2);
+    bigint_t exp = bigint_diff(p, two);
+    bigint_t inv = mod_exp(z2, exp, p);
+    x25519_prod(&x2, inv, p);
+
+    memset(out, 0, X25519_BYTES);
+    for (size_t i = 0; i < X25519_BYTES && i / 8 < x2.size; i++)
+        out[i] = (uint8_t)(x2.val[i / 8] >> (8 * (i % 8)));
+
+    bigint_delete(&two);
+    bigint_delete(&exp);
+    bigint_delete(&inv);
+    bigint_delete(&p);
+    bigint_delete(&a24);
+    bigint_delete(&zero);
+    bigint_delete(&x1);
+    bigint_delete(&x2);
+    bigint_delete(&z2);
+    bigint_delete(&x3);
+    bigint_delete(&z3);
+}
+
+// Parse 64 hex digits into s
+static void x25519_test_hex(uint8_t s[X25519_BYTES], const char *hex)
+{
+    for (int i = 0; i < X25519_BYTES; i++)
+        sscanf(hex + 2 * i, "%2hhx", s + i);
+}
+
+// Testing
+int x25519_test(void)
+{
+    static const char *vectors[][3] = {
+        // RFC 7748 section 5.2: scalar, u, result
+        {
+            "a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4",
+            "e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c",
+            "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552",
+        },
+        {
+            "4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d",
+            "e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493",
+            "95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957",
+        },
+        // RFC 7748 section 6.1: Alice's private and public keys
+        {
+            "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a",
+            "0900000000000000000000000000000000000000000000000000000000000000",
+            "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a",
+        },
+    };
+
+    int total_errors = 0;
+    bool test;
+    uint8_t k[X25519_BYTES], u[X25519_BYTES], expect[X25519_BYTES];
+    uint8_t out[X25519_BYTES], generic[X25519_BYTES];
+
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        x25519_test_hex(k, vectors[i][0]);
+        x25519_test_hex(u, vectors[i][1]);
+        x25519_test_hex(expect, vectors[i][2]);
+        x25519(out, k, u);
+        x25519_generic(generic, k, u);
+        test = memcmp(out, expect, X25519_BYTES) == 0
+            && memcmp(generic, expect, X25519_BYTES) == 0;
+        printf("%s: x25519 RFC 7748 vector %zu\n", test ? "TRUE" : "FALSE", i + 1);
+        total_errors += !test;
+    }
+
+    // RFC 7748 section 5.2: feed each result back in as the next scalar
+    uint8_t next[X25519_BYTES];
+    memset(k, 0, X25519_BYTES);
+    k[0] = 9;
+    memcpy(u, k, X25519_BYTES);
+    for (int i = 0; i < 1000; i++) {
+        x25519(next, k, u);
+        memcpy(u, k, X25519_BYTES);
+        memcpy(k, next, X25519_BYTES);
+    }
+    x25519_test_hex(expect, "684cf59ba83309552800ef566f2f4d3c1c3887c49360e3875f2eb94d99532c51");
+    test = memcmp(k, expect, X25519_BYTES) == 0;
+    printf("%s: x25519 RFC 7748 1000 iterations\n", test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    // Shared secrets agree, and the field matches the generic path on random
+    // points, including non-canonical u >= p
+    int errors = 0;
+    for (int iter = 0; iter < 8; iter++) {
+        uint8_t a[X25519_BYTES], b[X25519_BYTES], pa[X25519_BYTES], pb[X25519_BYTES];
+        rng_bytes(a, X25519_BYTES);
+        rng_bytes(b, X25519_BYTES);
+        x25519_base(pa, a);
+        x25519_base(pb, b);
+        x25519(out, a, pb);
+        x25519(generic, b, pa);
+        errors += memcmp(out, generic, X25519_BYTES) != 0;
+
+        rng_bytes(u, X25519_BYTES);
+        if (iter == 0)
+            memset(u, 0xff, X25519_BYTES);
+        x25519(out, a, u);
+        x25519_generic(generic, a, u);
+        errors += memcmp(out, generic, X25519_BYTES) != 0;
+    }
+    test = errors == 0;
+    printf("%s: x25519 shared secrets agree and match the generic ladder\n",
+        test ? "TRUE" : "FALSE");
+    total_errors += !test;
+
+    return total_errors;
+}
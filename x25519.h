@@ -0,0 +1,33 @@
+/**
+ * x25519.h: X25519 key exchange (RFC 7748) over GF(2^255 - 19)
+ *
+ * Keys and u-coordinates are 32-byte little-endian strings as in the RFC.
+ * x25519 runs in constant time for secret scalars; x25519_generic computes
+ * the same ladder with the general mod_* routines and is only a reference.
+ */
+
+#ifndef X25519_H
+#define X25519_H
+
+#include <stdint.h>
+
+enum {
+    X25519_BYTES = 32,
+    X25519_LADDER_STEPS = 255,  // Ladder steps per scalar multiplication
+};
+
+// out = scalar * u, with the scalar clamped as the RFC requires
+void x25519(uint8_t out[X25519_BYTES], const uint8_t scalar[X25519_BYTES],
+        const uint8_t u[X25519_BYTES]);
+
+// out = scalar * 9, the public key for private key scalar
+void x25519_base(uint8_t out[X25519_BYTES], const uint8_t scalar[X25519_BYTES]);
+
+// x25519 computed on bigints with mod_prod and friends (not constant time)
+void x25519_generic(uint8_t out[X25519_BYTES], const uint8_t scalar[X25519_BYTES],
+        const uint8_t u[X25519_BYTES]);
+
+// Testing methods
+int x25519_test(void);
+
+#endif // X25519_H